@@ -11,6 +11,9 @@
 #define KLEE_CONSTRAINTS_H
 
 #include "klee/Expr.h"
+#include "klee/Internal/ADT/ImmutableMap.h"
+#include "klee/Internal/ADT/PersistentVector.h"
+#include "klee/util/ExprHashMap.h"
 #include <llvm/Support/raw_ostream.h>
 
 // FIXME: Currently we use ConstraintManager for two things: to pass
@@ -19,32 +22,50 @@
 // (ConstraintSet?) which ConstraintManager could embed if it likes.
 namespace klee {
 
+class ConstraintIndependence;
 class ExprVisitor;
   
 class ConstraintManager {
 public:
-  typedef std::vector< ref<Expr> > constraints_ty;
-  typedef constraints_ty::iterator iterator;
+  /// Forked states share the constraints of their common path prefix
+  typedef PersistentVector< ref<Expr> > constraints_ty;
+  typedef constraints_ty::const_iterator iterator;
   typedef constraints_ty::const_iterator const_iterator;
 
-  ConstraintManager() {}
+  ConstraintManager() : equalitiesSize(0), independence(0) {}
 
   // create from constraints with no optimization
   explicit
   ConstraintManager(const std::vector< ref<Expr> > &_constraints) :
-    constraints(_constraints) {}
+    constraints(_constraints.begin(), _constraints.end()),
+    equalitiesSize(0), independence(0) {}
 
-  ConstraintManager(const ConstraintManager &cs) : constraints(cs.constraints) {}
+  ConstraintManager(const ConstraintManager &cs);
+  ConstraintManager &operator=(const ConstraintManager &cs);
+  ~ConstraintManager();
 
-  typedef std::vector< ref<Expr> >::const_iterator constraint_iterator;
+  typedef constraints_ty::const_iterator constraint_iterator;
 
   // given a constraint which is known to be valid, attempt to 
   // simplify the existing constraint set
   void simplifyForValidConstraint(ref<Expr> e);
 
+  /// Substitute the known values of the subexpressions of e. Results
+  /// are cached until the next constraint is added.
   ref<Expr> simplifyExpr(ref<Expr> e) const;
 
+  /// Release the cached simplifications, e.g. when the state stops
+  /// running and would otherwise keep them alive while idle.
+  void clearSimplifyCache() const {
+    simplifyCache.clear();
+  }
+
   void addConstraint(ref<Expr> e);
+
+  /// Collect the constraints that transitively read the same array bytes
+  /// as e. The other constraints cannot affect a query on e.
+  void getIndependentConstraints(ref<Expr> e,
+                                 std::vector< ref<Expr> > &result) const;
   
   bool empty() const {
     return constraints.empty();
@@ -74,12 +95,34 @@ public:
   }
 
 private:
-  std::vector< ref<Expr> > constraints;
+  typedef ImmutableMap< ref<Expr>, ref<Expr> > equalities_ty;
+
+  constraints_ty constraints;
+
+  /// The values implied by the first equalitiesSize constraints: the
+  /// constant of the equalities with a constant, and true for the other
+  /// constraints. Updated on lookup and shared with the copies of the
+  /// manager.
+  mutable equalities_ty equalities;
+  mutable unsigned equalitiesSize;
+
+  /// The results of simplifyExpr for the current constraints
+  mutable ExprHashMap< ref<Expr> > simplifyCache;
+
+  /// Partitions of the constraints by the array bytes they read. Built
+  /// on first use and shared with the copies of the manager until one of
+  /// them adds a constraint.
+  mutable ConstraintIndependence *independence;
+
+  void releaseIndependence();
+
+  void updateEqualities() const;
 
   // returns true iff the constraints were modified
   bool rewriteConstraints(ExprVisitor &visitor);
 
-  void addConstraintInternal(ref<Expr> e);
+  // returns true iff existing constraints were rewritten
+  bool addConstraintInternal(ref<Expr> e);
 };
 
 }
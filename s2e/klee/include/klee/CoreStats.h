@@ -27,9 +27,21 @@ namespace stats {
   extern Statistic forkTime;
   extern Statistic solverTime;
 
+  /// The number of object lookups in the address spaces, and their
+  /// total time in nanoseconds. Only updated with -profile-address-space.
+  extern Statistic addressSpaceLookups;
+  extern Statistic addressSpaceLookupTime;
+
   /// The number of process forks.
   extern Statistic forks;
 
+  /// The number of speculative states found feasible, resp. infeasible,
+  /// in the background, and of selected speculative states that had to
+  /// wait for their background resolution.
+  extern Statistic speculativeStatesResolved;
+  extern Statistic speculativeStatesInfeasible;
+  extern Statistic speculativeStateWaits;
+
   /// Number of states, this is a "fake" statistic used by istats, it
   /// isn't normally up-to-date.
   extern Statistic states;
@@ -65,6 +65,7 @@ namespace klee {
   class SpecialFunctionHandler;
   struct StackFrame;
   class StatsTracker;
+  class STPWorkerPool;
   class TimingSolver;
   class TreeStreamWriter;
   class BitfieldSimplifier;
@@ -184,10 +185,37 @@ protected:
   /// Simplifier user to simplify expressions when adding them
   BitfieldSimplifier *exprSimplifier;
 
+  /// Processes resolving speculative states in the background with
+  /// their own solver, or null. \see -speculative-workers
+  STPWorkerPool *speculativeWorkers;
+  /// The speculative states waiting for an idle background worker
+  std::set<ExecutionState*> speculativeQueue;
+  /// The speculative states being resolved in the background, with the
+  /// ticket of their query
+  std::map<ExecutionState*, uint64_t> speculativeTickets;
+
+  /// Send the queued speculative states to the idle background workers.
+  void submitSpeculativeStates();
+
+  /// Apply the background resolution of a speculative state, waiting
+  /// for it if needed. Returns false if the state must be resolved
+  /// synchronously, otherwise sets feasible.
+  bool receiveSpeculativeState(ExecutionState &state, uint64_t ticket,
+                               bool &feasible);
+
+  /// Forget the background resolution of a terminated state.
+  void dropSpeculativeState(ExecutionState &state);
+
   llvm::Function* getCalledFunction(llvm::CallSite &cs, ExecutionState &state);
 
   void executeInstruction(ExecutionState &state, KInstruction *ki);
 
+  /// Executes arithmetic, comparison and cast instructions whose operands
+  /// are all constant using native integers, without building and
+  /// simplifying expressions. Returns false if the instruction must go
+  /// through executeInstruction().
+  bool executeConcreteInstruction(ExecutionState &state, KInstruction *ki);
+
   void printFileLine(ExecutionState &state, KInstruction *ki);
 
   void run(ExecutionState &initialState);
@@ -399,6 +427,12 @@ public:
   bool resolveSpeculativeState(ExecutionState &state);
   bool checkSpeculativeState(ExecutionState &state);
 
+  /// Apply the background resolutions of speculative states that
+  /// arrived and submit the queued states. The resolved states become
+  /// non-speculative, and those found infeasible are terminated.
+  /// Returns true if states were terminated.
+  bool updateSpeculativeStates();
+
   virtual bool merge(ExecutionState &base, ExecutionState &other);
 
   // remove state from queue and delete
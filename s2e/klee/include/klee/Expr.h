@@ -11,6 +11,7 @@
 #define KLEE_EXPR_H
 
 #include "klee/util/Bits.h"
+#include "klee/util/ExprAllocator.h"
 #include "klee/util/Ref.h"
 
 #include "llvm/ADT/APInt.h"
@@ -165,14 +166,39 @@ public:
     CmpKindLast=Sge
   };
 
-  unsigned refCount;
+  // One bit of the reference count is taken by interned, so that the
+  // fields of Expr still fit in 16 bytes with the vtable pointer.
+  unsigned refCount : 31;
+
+  /// interned - Whether this expression is in the unique table of the
+  /// hash-consing expression builder. Two interned expressions are
+  /// structurally equal iff they are the same object.
+  unsigned interned : 1;
 
 protected:  
   unsigned hashValue;
   
+private:
+  /// removeInterned - Remove a dying expression from the unique table.
+  static void removeInterned(Expr *e);
+
 public:
-  Expr() : refCount(0) { Expr::count++; }
-  virtual ~Expr() { Expr::count--; } 
+  Expr() : refCount(0), interned(false) { Expr::count++; }
+  virtual ~Expr() {
+    Expr::count--;
+    if (interned)
+      removeInterned(this);
+  }
+
+  // Expressions are allocated from the slab pools of ExprAllocator. The
+  // virtual destructor ensures that delete gets the size of the actual
+  // expression class.
+  static void *operator new(size_t size) {
+    return ExprAllocator::allocate(size);
+  }
+  static void operator delete(void *p, size_t size) {
+    ExprAllocator::deallocate(p, size);
+  }
 
   virtual Kind getKind() const = 0;
   virtual Width getWidth() const = 0;
@@ -194,6 +220,17 @@ public:
   
   /// Returns 0 iff b is structuraly equivalent to *this
   int compare(const Expr &b) const;
+
+  /// Returns true iff b is structuraly equivalent to *this. Unlike
+  /// compare(), this does not walk the expressions if both are interned,
+  /// i.e., if both were built by a hash-consing expression builder.
+  bool equals(const Expr &b) const {
+    if (this == &b)
+      return true;
+    if (interned && b.interned)
+      return false;
+    return compare(b) == 0;
+  }
   virtual int compareContents(const Expr &b) const { return 0; }
 
   // Given an array of new kids return a copy of the expression
@@ -257,7 +294,7 @@ struct Expr::CreateArg {
 // Comparison operators
 
 inline bool operator==(const Expr &lhs, const Expr &rhs) {
-  return lhs.compare(rhs) == 0;
+  return lhs.equals(rhs);
 }
 
 inline bool operator<(const Expr &lhs, const Expr &rhs) {
@@ -576,6 +613,13 @@ public:
   int compare(const UpdateNode &b) const;  
   unsigned hash() const { return hashValue; }
 
+  static void *operator new(size_t size) {
+    return ExprAllocator::allocate(size);
+  }
+  static void operator delete(void *p, size_t size) {
+    ExprAllocator::deallocate(p, size);
+  }
+
 private:
   UpdateNode() : refCount(0), stpArray(0) {}
   ~UpdateNode();
@@ -622,6 +666,13 @@ public:
   }
   ~Array();
 
+  static void *operator new(size_t size) {
+    return ExprAllocator::allocate(size);
+  }
+  static void operator delete(void *p, size_t size) {
+    ExprAllocator::deallocate(p, size);
+  }
+
   bool isSymbolicArray() const { return constantValues.empty(); }
   bool isConstantArray() const { return !isSymbolicArray(); }
 
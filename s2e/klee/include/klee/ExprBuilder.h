@@ -86,6 +86,25 @@ namespace klee {
   ///
   /// Base - The base builder to use when constructing expressions.
   ExprBuilder *createSimplifyingExprBuilder(ExprBuilder *Base);
+
+  /// createHashConsingExprBuilder - Create an expression builder which
+  /// returns a single node for all the structurally identical expressions it
+  /// builds, so that they can be compared by address. The nodes are kept in a
+  /// global table shared by all such builders, and leave it when they die.
+  ///
+  /// Only the expressions built through this builder are interned, those
+  /// built with the XXXExpr::create functions (e.g., by the executor) are
+  /// not. The table is not thread-safe: all the hash-consing builders, and
+  /// the destruction of the expressions they built, must be confined to
+  /// one thread.
+  ///
+  /// Base - The base builder to use when constructing expressions.
+  ExprBuilder *createHashConsingExprBuilder(ExprBuilder *Base);
+
+  /// getHashConsingStats - Return the number of live expressions in the
+  /// table of the hash-consing builders, and the number of constructions
+  /// which returned an existing expression.
+  void getHashConsingStats(uint64_t &live, uint64_t &hits);
 }
 
 #endif
@@ -0,0 +1,274 @@
+//===-- PersistentVector.h --------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_PERSISTENTVECTOR_H
+#define KLEE_PERSISTENTVECTOR_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+namespace klee {
+
+  /// PersistentVector - An append-only vector whose copies share their
+  /// common prefix.
+  ///
+  /// Elements are stored in reference counted chunks of ChunkSize
+  /// elements, listed in a reference counted spine. Copying a vector is
+  /// O(1). A copy appends in place to the chunk and spine it shares as
+  /// long as no other copy appended past their common end, so that after
+  /// a fork the first child to grow copies nothing and the others copy
+  /// the last chunk and the spine, i.e., O(ChunkSize + size / ChunkSize)
+  /// instead of O(size). Elements are never modified once appended.
+  template<class T, unsigned ChunkBits = 6>
+  class PersistentVector {
+  public:
+    enum { ChunkSize = 1 << ChunkBits };
+
+  private:
+    struct Chunk {
+      unsigned refCount;
+      /// Number of elements appended, possibly by several vectors
+      unsigned used;
+      T items[ChunkSize];
+
+      Chunk() : refCount(0), used(0) {}
+    };
+
+    struct Spine {
+      unsigned refCount;
+      std::vector<Chunk*> chunks;
+
+      Spine() : refCount(0) {}
+
+      /// Copy the first count chunks of b
+      Spine(const Spine &b, size_t count)
+        : refCount(0), chunks(b.chunks.begin(), b.chunks.begin() + count) {
+        for (size_t i = 0; i != count; ++i)
+          ++chunks[i]->refCount;
+      }
+
+      ~Spine() {
+        for (size_t i = 0; i != chunks.size(); ++i)
+          if (--chunks[i]->refCount == 0)
+            delete chunks[i];
+      }
+    };
+
+    Spine *spine;
+    size_t count;
+
+    void release() {
+      if (spine && --spine->refCount == 0)
+        delete spine;
+      spine = 0;
+    }
+
+    size_t numChunks() const {
+      return (count + ChunkSize - 1) >> ChunkBits;
+    }
+
+    /// Make the spine private to this vector and drop the chunks that
+    /// copies destroyed since then appended to it.
+    void makeSpinePrivate() {
+      size_t chunks = numChunks();
+
+      if (spine && spine->refCount == 1) {
+        for (size_t i = chunks; i != spine->chunks.size(); ++i)
+          if (--spine->chunks[i]->refCount == 0)
+            delete spine->chunks[i];
+        spine->chunks.resize(chunks);
+        return;
+      }
+
+      Spine *copy = spine ? new Spine(*spine, chunks) : new Spine();
+      ++copy->refCount;
+      release();
+      spine = copy;
+    }
+
+  public:
+    class const_iterator {
+      friend class PersistentVector;
+
+      const PersistentVector *v;
+      size_t index;
+
+      const_iterator(const PersistentVector *_v, size_t _index)
+        : v(_v), index(_index) {}
+
+    public:
+      typedef std::random_access_iterator_tag iterator_category;
+      typedef T value_type;
+      typedef ptrdiff_t difference_type;
+      typedef const T *pointer;
+      typedef const T &reference;
+
+      const_iterator() : v(0), index(0) {}
+
+      const T &operator*() const { return (*v)[index]; }
+      const T *operator->() const { return &(*v)[index]; }
+
+      const_iterator &operator++() { ++index; return *this; }
+      const_iterator operator++(int) {
+        const_iterator it(*this);
+        ++index;
+        return it;
+      }
+      const_iterator &operator--() { --index; return *this; }
+      const_iterator operator--(int) {
+        const_iterator it(*this);
+        --index;
+        return it;
+      }
+
+      const_iterator &operator+=(difference_type n) {
+        index += n;
+        return *this;
+      }
+      const_iterator operator+(difference_type n) const {
+        return const_iterator(v, index + n);
+      }
+      const_iterator operator-(difference_type n) const {
+        return const_iterator(v, index - n);
+      }
+      difference_type operator-(const const_iterator &b) const {
+        return (difference_type) index - (difference_type) b.index;
+      }
+      const T &operator[](difference_type n) const {
+        return (*v)[index + n];
+      }
+
+      bool operator==(const const_iterator &b) const {
+        return index == b.index;
+      }
+      bool operator!=(const const_iterator &b) const {
+        return index != b.index;
+      }
+      bool operator<(const const_iterator &b) const {
+        return index < b.index;
+      }
+    };
+
+    PersistentVector() : spine(0), count(0) {}
+
+    PersistentVector(const PersistentVector &b)
+      : spine(b.spine), count(b.count) {
+      if (spine)
+        ++spine->refCount;
+    }
+
+    template<class InputIterator>
+    PersistentVector(InputIterator first, InputIterator last)
+      : spine(0), count(0) {
+      for (; first != last; ++first)
+        push_back(*first);
+    }
+
+    ~PersistentVector() { release(); }
+
+    PersistentVector &operator=(const PersistentVector &b) {
+      Spine *s = b.spine;
+      size_t n = b.count;
+      if (s)
+        ++s->refCount;
+      release();
+      spine = s;
+      count = n;
+      return *this;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const T &operator[](size_t index) const {
+      assert(index < count && "index out of bounds");
+      return spine->chunks[index >> ChunkBits]->items[index & (ChunkSize - 1)];
+    }
+
+    const T &back() const { return (*this)[count - 1]; }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+
+    void push_back(const T &value) {
+      size_t index = count & (ChunkSize - 1);
+      size_t chunks = numChunks();
+      Chunk *chunk;
+
+      if (index == 0) {
+        // Other copies may have added chunks past the end of this one
+        if (!spine || spine->chunks.size() != chunks)
+          makeSpinePrivate();
+        chunk = new Chunk();
+        ++chunk->refCount;
+        spine->chunks.push_back(chunk);
+      } else {
+        chunk = spine->chunks[chunks - 1];
+        if (chunk->used != index) {
+          // Another copy appended to the last chunk
+          makeSpinePrivate();
+          if (chunk->refCount == 1) {
+            chunk->used = index;
+          } else {
+            Chunk *copy = new Chunk();
+            for (size_t i = 0; i != index; ++i)
+              copy->items[i] = chunk->items[i];
+            copy->used = index;
+
+            --chunk->refCount;
+            chunk = copy;
+            ++chunk->refCount;
+            spine->chunks[chunks - 1] = chunk;
+          }
+        }
+      }
+
+      chunk->items[index] = value;
+      ++chunk->used;
+      ++count;
+    }
+
+    /// Keep the first n elements. The dropped elements stay in the chunks
+    /// shared with other copies until the next append overwrites them.
+    void truncate(size_t n) {
+      assert(n <= count && "cannot grow by truncation");
+      count = n;
+      if (!count)
+        release();
+    }
+
+    void clear() {
+      release();
+      count = 0;
+    }
+
+    void swap(PersistentVector &b) {
+      std::swap(spine, b.spine);
+      std::swap(count, b.count);
+    }
+
+    bool operator==(const PersistentVector &b) const {
+      if (count != b.count)
+        return false;
+      if (spine == b.spine)
+        return true;
+      for (size_t i = 0; i != count; ++i)
+        if (!((*this)[i] == b[i]))
+          return false;
+      return true;
+    }
+    bool operator!=(const PersistentVector &b) const { return !(*this == b); }
+  };
+
+}
+
+#endif
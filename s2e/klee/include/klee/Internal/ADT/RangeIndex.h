@@ -0,0 +1,141 @@
+//===-- RangeIndex.h --------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_RANGEINDEX_H
+#define KLEE_RANGEINDEX_H
+
+#include <stdint.h>
+#include <vector>
+
+namespace klee {
+
+  /// RangeIndex - A set of addresses stored as a sorted array of disjoint,
+  /// non-adjacent, half-open ranges, for membership queries on hot paths.
+  ///
+  /// Queries first consult a fixed-size filter holding one bit per hashed
+  /// page, so that accesses to pages without any range are rejected with
+  /// a single load. The others check the range found by the previous query
+  /// before falling back to a binary search.
+  ///
+  /// Updates rebuild the filter and are expected to be rare.
+  class RangeIndex {
+  public:
+    struct Range {
+      uint64_t start, end;
+    };
+
+    typedef std::vector<Range>::const_iterator iterator;
+
+    enum {
+      PageBits = 12,
+      FilterBits = 13,
+      FilterSize = 1 << FilterBits
+    };
+
+  private:
+    std::vector<Range> ranges;
+    uint64_t filter[FilterSize / 64];
+    /// Index of the range that satisfied the last query
+    mutable unsigned lastHit;
+
+    static unsigned hashPage(uint64_t page) {
+      return (unsigned) (page ^ (page >> FilterBits)) & (FilterSize - 1);
+    }
+
+    static uint64_t getEnd(uint64_t start, uint64_t size) {
+      uint64_t end = start + size;
+      return end < start ? ~0ULL : end;
+    }
+
+    void rebuildFilter();
+
+    /// Return true if the filter rules out [start, end).
+    bool isFiltered(uint64_t start, uint64_t end) const {
+      uint64_t first = start >> PageBits, last = (end - 1) >> PageBits;
+      if (last - first >= FilterSize)
+        return false;
+      for (uint64_t page = first; page <= last; ++page) {
+        unsigned bit = hashPage(page);
+        if (filter[bit / 64] & (1ULL << (bit % 64)))
+          return false;
+      }
+      return true;
+    }
+
+    /// Return the index of the first range ending after address.
+    unsigned findFirstAfter(uint64_t address) const;
+
+  public:
+    RangeIndex();
+
+    /// Add [start, start + size) to the set.
+    void add(uint64_t start, uint64_t size);
+
+    /// Remove [start, start + size) from the set.
+    void remove(uint64_t start, uint64_t size);
+
+    void clear();
+
+    /// Return true if any byte of [start, start + size) is in the set.
+    bool intersects(uint64_t start, uint64_t size) const {
+      if (!size || ranges.empty())
+        return false;
+
+      uint64_t end = getEnd(start, size);
+      if (isFiltered(start, end))
+        return false;
+
+      const Range &last = ranges[lastHit];
+      if (last.start < end && start < last.end)
+        return true;
+
+      unsigned i = findFirstAfter(start);
+      if (i == ranges.size() || ranges[i].start >= end)
+        return false;
+      lastHit = i;
+      return true;
+    }
+
+    /// Return true if all the bytes of [start, start + size) are in the set.
+    bool contains(uint64_t start, uint64_t size) const {
+      if (!size)
+        return true;
+      if (ranges.empty())
+        return false;
+
+      uint64_t end = getEnd(start, size);
+      if (isFiltered(start, end))
+        return false;
+
+      // Ranges are not adjacent, so a single one must hold the bytes
+      const Range &last = ranges[lastHit];
+      if (last.start <= start && end <= last.end)
+        return true;
+
+      unsigned i = findFirstAfter(start);
+      if (i == ranges.size() || ranges[i].start > start || ranges[i].end < end)
+        return false;
+      lastHit = i;
+      return true;
+    }
+
+    bool contains(uint64_t address) const {
+      return contains(address, 1);
+    }
+
+    bool empty() const { return ranges.empty(); }
+    unsigned size() const { return ranges.size(); }
+
+    iterator begin() const { return ranges.begin(); }
+    iterator end() const { return ranges.end(); }
+  };
+
+}
+
+#endif
@@ -36,6 +36,7 @@ namespace klee {
   template<class T> class ref;
 
   struct KModulePrivate;
+  struct FunctionOptimizerPrivate;
 
   struct KFunction {
     llvm::Function *function;
@@ -79,6 +80,24 @@ namespace klee {
   };
 
 
+  /// Runs the optimization and cleanup passes that KModule applies to
+  /// functions added after prepare(). Instances can also be created for
+  /// other modules, e.g., to prepare functions in another LLVMContext
+  /// and thread.
+  class FunctionOptimizer {
+    FunctionOptimizerPrivate *p;
+
+  private:
+    FunctionOptimizer(const FunctionOptimizer&);
+    FunctionOptimizer &operator=(const FunctionOptimizer&);
+
+  public:
+    explicit FunctionOptimizer(llvm::Module *module);
+    ~FunctionOptimizer();
+
+    void run(llvm::Function *f);
+  };
+
   class KModule {
   public:
     llvm::Module *module;
@@ -119,8 +138,11 @@ namespace klee {
     /// Return an id for the given constant, creating a new one if necessary.
     unsigned getConstantID(llvm::Constant *c, KInstruction* ki);
 
-    /// Update shadow structures for newly added function
-    KFunction* updateModuleWithFunction(llvm::Function *f);
+    /// Update shadow structures for newly added function. Functions
+    /// which are already optimized (e.g., reused from a previous run)
+    /// skip the optimization and cleanup passes.
+    KFunction* updateModuleWithFunction(llvm::Function *f,
+                                        bool optimize = true);
 
     /// Remove function from KModule and call removeFromParend on it
     void removeFunction(llvm::Function *f, bool keepDeclaration = false);
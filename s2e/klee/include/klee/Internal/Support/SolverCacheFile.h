@@ -0,0 +1,105 @@
+//===-- SolverCacheFile.h ---------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_SOLVERCACHEFILE_H
+#define KLEE_SOLVERCACHEFILE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <tr1/unordered_map>
+
+namespace klee {
+
+  /// SolverCacheFile - An append-only file of solver results, keyed by the
+  /// textual form of the queries.
+  ///
+  /// The records present when the file is opened are memory-mapped. All the
+  /// records, including the ones appended afterwards, are indexed by the
+  /// hash of their key and their offset in the file, so that keys and values
+  /// stay on disk. Appended records are read back with pread. When the same
+  /// key is stored several times, the last record wins. A truncated record
+  /// at the end of the file (e.g., after a crash) is discarded.
+  class SolverCacheFile {
+  public:
+    enum RecordKind {
+      Validity = 1,
+      InitialValues = 2
+    };
+
+    struct Record {
+      RecordKind kind;
+      const char *key;
+      unsigned keySize;
+      const char *value;
+      unsigned valueSize;
+    };
+
+  private:
+    /// Hash of the kind and key of a record to its offset
+    typedef std::tr1::unordered_multimap<uint64_t, uint64_t> index_ty;
+
+    int fd;
+    bool readOnly;
+    const char *mapping;
+    uint64_t mappingSize;
+    /// Size of the valid records of the mapping, including the header
+    uint64_t validSize;
+
+    index_ty index;
+
+    static uint64_t hashKey(RecordKind kind, const char *key, unsigned size);
+
+    bool readRecord(uint64_t offset, Record &record, uint64_t &next) const;
+
+    /// Return true if the record at the given offset has the given kind and
+    /// key, and read its value if value is not null.
+    bool matchRecord(uint64_t offset, RecordKind kind, const char *key,
+                     unsigned keySize, std::string *value) const;
+
+    /// Index the record at the given offset, replacing the record of the
+    /// same key, if any.
+    void indexRecord(uint64_t offset, RecordKind kind, const char *key,
+                     unsigned keySize);
+
+    void indexRecords();
+
+  public:
+    SolverCacheFile();
+    ~SolverCacheFile();
+
+    /// open - Open (or create, unless readOnly is set) the given file.
+    /// Returns false and sets error on failure.
+    bool open(const std::string &path, bool readOnly, std::string &error);
+    void close();
+
+    bool lookup(RecordKind kind, const std::string &key,
+                std::string &value) const;
+
+    bool append(RecordKind kind, const std::string &key,
+                const std::string &value);
+
+    /// getRecords - Return the records of the mapped part of the file, in
+    /// file order. The pointers are valid until the file is closed.
+    void getRecords(std::vector<Record> &records) const;
+
+    /// mergeFrom - Append the records of input whose key is not in this
+    /// file yet, visiting them from the newest to the oldest so that only
+    /// the latest record of each key is kept. Returns false if a record
+    /// cannot be written.
+    bool mergeFrom(const SolverCacheFile &input, unsigned &written);
+
+    /// getNumIndexedRecords - Return the number of distinct keys.
+    unsigned getNumIndexedRecords() const;
+  };
+
+}
+
+#endif
@@ -154,9 +154,34 @@ public:
 
 class ObjectState {
 private:
+  /// The symbolic part of an object state. All-concrete objects (the
+  /// common case, e.g. for most of the guest RAM) do not have one and
+  /// only hold their bytes; it is created on the first symbolic write or
+  /// read at a symbolic offset.
+  struct Symbolic {
+    // XXX(s2e) for now we keep this first to access from C code
+    // (yes, we do need to access if really fast)
+    BitArray concreteMask;
+
+    // XXX cleanup name of flushMask (its backwards or something)
+    BitArray *flushMask;
+
+    ref<Expr> *knownSymbolics;
+
+    UpdateList updates;
+
+    Symbolic(unsigned size);
+    Symbolic(const Symbolic &b, unsigned size);
+    ~Symbolic();
+
+    /// Memory taken by the symbolic part of an object of the given size
+    uint64_t getFootprint(unsigned size) const;
+  };
+
   // XXX(s2e) for now we keep this first to access from C code
   // (yes, we do need to access if really fast)
-  BitArray *concreteMask;
+  // mutable because may need flushed during read of const
+  mutable Symbolic *symbolic;
 
   friend class AddressSpace;
   unsigned copyOnWriteOwner; // exclusively for AddressSpace
@@ -169,21 +194,30 @@ private:
   //XXX: made it public for fast access
   uint8_t *concreteStore;
 
-  // XXX cleanup name of flushMask (its backwards or something)
-  // mutable because may need flushed during read of const
-  mutable BitArray *flushMask;
-
-  ref<Expr> *knownSymbolics;
-
-  // mutable because we may need flush during read of const
-  mutable UpdateList updates;
-
 public:
   unsigned size;
 
   bool readOnly;
 
+  /// Memory used by the live object states, for statistics
+  struct Stats {
+    uint64_t objects;
+    uint64_t bytes;
+    /// Objects with a symbolic part, and the memory it takes
+    uint64_t symbolicObjects;
+    uint64_t symbolicBytes;
+  };
+
+private:
+  static Stats stats;
+
 public:
+  /// The contents of an object state are stored right after it: object
+  /// states must be allocated with new (mo->size) ObjectState(...).
+  static void *operator new(size_t objectSize, unsigned storeSize);
+  static void operator delete(void *p, unsigned storeSize);
+  static void operator delete(void *p);
+
   /// Create a new object state for the given memory object with concrete
   /// contents. The initial contents are undefined, it is the callers
   /// responsibility to initialize the object contents appropriately.
@@ -198,6 +232,8 @@ public:
 
   inline const MemoryObject *getObject() const { return object; }
 
+  static const Stats &getStats() { return stats; }
+
   void setReadOnly(bool ro) { readOnly = ro; }
 
   // make contents all concrete and zero
@@ -232,7 +268,7 @@ public:
   bool isAllConcrete() const;
 
   inline bool isConcrete(unsigned offset, Expr::Width width) const {
-    if (!concreteMask)
+    if (!symbolic)
         return true;
 
     unsigned size = Expr::getMinBytesForWidth(width);
@@ -247,6 +283,9 @@ public:
   uint8_t *getConcreteStore(bool allowSymolic = false);
 
 private:
+  /// Return the symbolic part, creating it if needed.
+  Symbolic &getSymbolic() const;
+
   const UpdateList &getUpdates() const;
 
   void makeConcrete();
@@ -263,20 +302,22 @@ private:
   void flushRangeForWrite(unsigned rangeBase, unsigned rangeSize);
 
   inline bool isByteConcrete(unsigned offset) const {
-    return !concreteMask || concreteMask->get(offset);
+    return !symbolic || symbolic->concreteMask.get(offset);
   }
 
   inline bool isByteFlushed(unsigned offset) const {
-      return flushMask && !flushMask->get(offset);
+      return symbolic && symbolic->flushMask &&
+             !symbolic->flushMask->get(offset);
   }
 
   inline bool isByteKnownSymbolic(unsigned offset) const {
-      return knownSymbolics && knownSymbolics[offset].get();
+      return symbolic && symbolic->knownSymbolics &&
+             symbolic->knownSymbolics[offset].get();
   }
 
   inline void markByteConcrete(unsigned offset) {
-      if (concreteMask)
-        concreteMask->set(offset);
+      if (symbolic)
+        symbolic->concreteMask.set(offset);
   }
 
   void markByteSymbolic(unsigned offset);
@@ -284,8 +325,8 @@ private:
   void markByteFlushed(unsigned offset);
 
   void markByteUnflushed(unsigned offset) {
-      if (flushMask)
-        flushMask->set(offset);
+      if (symbolic && symbolic->flushMask)
+        symbolic->flushMask->set(offset);
   }
 
   void setKnownSymbolic(unsigned offset, Expr *value);
@@ -12,12 +12,14 @@
 
 #include "klee/Expr.h"
 
+#include <string>
 #include <vector>
 
 namespace klee {
   class ConstraintManager;
   class Expr;
   class SolverImpl;
+  class Statistic;
 
   struct Query {
   public:
@@ -157,7 +159,14 @@ namespace klee {
     ///
     /// \param useForkedSTP - Whether STP should be run in a separate process
     /// (required for using timeouts).
-    STPSolver(bool useForkedSTP);
+    /// \param incremental - Whether the constraints shared by successive
+    /// queries should be kept asserted in STP instead of being asserted again
+    /// for every query. Forked queries then fork the calling process for each
+    /// query instead of using the worker pool.
+    /// \param optimizeDivides - Whether divisions by constants should be
+    /// rewritten into multiplications and shifts when building STP queries.
+    STPSolver(bool useForkedSTP, bool incremental = false,
+              bool optimizeDivides = true);
 
     
     
@@ -170,6 +179,29 @@ namespace klee {
     void setTimeout(double timeout);
   };
 
+  /// PortfolioSolver - A complete solver which runs several solvers on each
+  /// query, each in its own long-lived worker process, and returns the first
+  /// answer. The workers of the other solvers are killed and respawned for
+  /// the next query.
+  ///
+  /// A solver failing (e.g., an incomplete solver which cannot answer) does
+  /// not end the race, the query only fails if all the solvers fail or if
+  /// the timeout expires.
+  class PortfolioSolver : public Solver {
+  public:
+    PortfolioSolver();
+
+    /// addSolver - Add a solver to the portfolio, which takes its ownership.
+    ///
+    /// \param wins - The statistic counting the queries answered first by
+    /// this solver, or null.
+    void addSolver(Solver *solver, Statistic *wins);
+
+    /// setTimeout - Set the time given to the solvers to answer a query; 0 is
+    /// off.
+    void setTimeout(double timeout);
+  };
+
   /* *** */
 
   /// createValidatingSolver - Create a solver which will validate all query
@@ -187,6 +219,26 @@ namespace klee {
   /// \param s - The underlying solver to use.
   Solver *createCachingSolver(Solver *s);
 
+  /// createSharedCachingSolver - Create a solver which will cache the queries
+  /// and their counterexamples in fixed-size tables shared with all processes
+  /// forked after the first call to this function. Queries are identified by
+  /// a 64-bit fingerprint.
+  ///
+  /// \param s - The underlying solver to use.
+  /// \param entries - The number of entries of the shared validity table.
+  /// \param counterexamples - The number of counterexamples of the shared
+  /// counterexample table, 0 to not share counterexamples.
+  Solver *createSharedCachingSolver(Solver *s, unsigned entries,
+                                    unsigned counterexamples = 0);
+
+  /// createPersistentCachingSolver - Create a solver which will cache validity
+  /// results and counterexamples in the given append-only file, reusing the
+  /// results stored there by previous runs.
+  ///
+  /// \param s - The underlying solver to use.
+  /// \param path - The cache file, created if it does not exist.
+  Solver *createPersistentCachingSolver(Solver *s, const std::string &path);
+
   /// createCexCachingSolver - Create a counterexample caching solver. This is a
   /// more sophisticated cache which records counterexamples for a constraint
   /// set and uses subset/superset relations among constraints to try and
@@ -216,6 +268,13 @@ namespace klee {
   /// createDummySolver - Create a dummy solver implementation which always
   /// fails.
   Solver *createDummySolver();
+
+  /// createSMTLIBSolver - Create a complete solver which sends the queries in
+  /// SMT-LIBv2 format to an external solver, started for every query.
+  ///
+  /// \param command - The shell command starting the solver, which must read
+  /// the script on its standard input (e.g., "z3 -smt2 -in").
+  Solver *createSMTLIBSolver(const std::string &command);
 }
 
 #endif
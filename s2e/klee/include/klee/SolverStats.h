@@ -25,6 +25,19 @@ namespace stats {
   extern Statistic queryConstructs;
   extern Statistic queryCounterexamples;
   extern Statistic queryTime;
+  extern Statistic sharedQueryCacheHits;
+  extern Statistic sharedQueryCacheMisses;
+  extern Statistic sharedQueryCacheEvictions;
+  extern Statistic sharedCexCacheHits;
+  extern Statistic sharedCexCacheMisses;
+  extern Statistic persistentQueryCacheHits;
+  extern Statistic persistentQueryCacheMisses;
+  extern Statistic portfolioQueries;
+  extern Statistic portfolioFailures;
+  extern Statistic portfolioWinsSTP;
+  extern Statistic portfolioWinsSTPSimple;
+  extern Statistic portfolioWinsFastCex;
+  extern Statistic portfolioWinsSMTLIB;
 
 }
 }
@@ -0,0 +1,58 @@
+//===-- ExprAllocator.h -----------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_UTIL_EXPRALLOCATOR_H
+#define KLEE_UTIL_EXPRALLOCATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace klee {
+
+  /// ExprAllocator - Size-class slab pools for the nodes of the expression
+  /// graph (Expr, UpdateNode and Array objects).
+  ///
+  /// Objects are carved out of large slabs, one set of slabs per size class,
+  /// and freed objects go back to the free list of their class. This avoids
+  /// fragmenting the heap with many small, short-lived objects and keeps the
+  /// nodes of a process densely packed, which also limits the number of
+  /// pages copied after a fork. Slabs are never returned to the system.
+  ///
+  /// The free lists are protected by a spinlock per class, so that nodes may
+  /// be allocated and freed from several threads.
+  class ExprAllocator {
+  public:
+    enum {
+      /// Sizes are rounded up to a multiple of Granularity.
+      Granularity = 8,
+      /// Objects larger than MaxSize are allocated with malloc.
+      MaxSize = 256,
+      NumClasses = MaxSize / Granularity,
+      SlabSize = 64 * 1024
+    };
+
+    struct Stats {
+      /// Objects currently allocated, and their size
+      uint64_t liveObjects;
+      uint64_t liveBytes;
+      /// Allocations since the start of the process
+      uint64_t allocations;
+      /// Memory taken from the system for the slabs, used or not
+      uint64_t slabBytes;
+    };
+
+    static void *allocate(size_t size);
+    static void deallocate(void *p, size_t size);
+
+    static void getStats(Stats &stats);
+  };
+
+}
+
+#endif
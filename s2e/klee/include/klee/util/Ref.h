@@ -104,8 +104,11 @@ public:
 
   // assumes non-null arguments
   bool operator<(const ref &rhs) const { return compare(rhs)<0; }
-  bool operator==(const ref &rhs) const { return compare(rhs)==0; }
-  bool operator!=(const ref &rhs) const { return compare(rhs)!=0; }
+  bool operator==(const ref &rhs) const {
+    assert(!isNull() && !rhs.isNull() && "Invalid call to operator==()");
+    return get()->equals(*rhs.get());
+  }
+  bool operator!=(const ref &rhs) const { return !(*this == rhs); }
 };
 
 template<class T>
@@ -17,10 +17,52 @@
 #include "klee/ExecutionState.h"
 #include "klee/Executor.h"
 
+#include "llvm/Support/CommandLine.h"
+
+#include <time.h>
+
+using namespace llvm;
 using namespace klee;
 
+namespace {
+  cl::opt<bool>
+  ProfileAddressSpace("profile-address-space",
+                      cl::desc("Measure the latency of the lookups of "
+                               "objects in the address space (default=off)"),
+                      cl::init(false));
+
+  /// Account the lifetime of the object to the address space lookups.
+  /// Lookups are too short for the microsecond resolution of WallTimer.
+  class LookupTimer {
+    struct timespec start;
+
+  public:
+    LookupTimer() {
+      if (ProfileAddressSpace)
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+
+    ~LookupTimer() {
+      if (!ProfileAddressSpace)
+        return;
+
+      struct timespec end;
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      ++stats::addressSpaceLookups;
+      stats::addressSpaceLookupTime +=
+          (end.tv_sec - start.tv_sec) * 1000000000LL +
+          (end.tv_nsec - start.tv_nsec);
+    }
+  };
+}
+
 ///
 
+void AddressSpace::addFixedRange(uint64_t address, uint64_t size,
+                                 unsigned objectBits) {
+  fixedObjects.addRange(address, size, objectBits);
+}
+
 void AddressSpace::bindObject(const MemoryObject *mo, ObjectState *os) {
   assert(state);
   const ObjectState *oldOS = findObject(mo);
@@ -29,7 +71,10 @@ void AddressSpace::bindObject(const MemoryObject *mo, ObjectState *os) {
 
   assert(os->copyOnWriteOwner==0 && "object already has owner");
   os->copyOnWriteOwner = cowKey;
-  objects = objects.replace(std::make_pair(mo, os));
+  if (fixedObjects.covers(mo))
+    fixedObjects.insert(mo, os);
+  else
+    objects = objects.replace(std::make_pair(mo, os));
 }
 
 void AddressSpace::unbindObject(const MemoryObject *mo) {
@@ -37,16 +82,33 @@ void AddressSpace::unbindObject(const MemoryObject *mo) {
   const ObjectState *os = findObject(mo);
   if(os) state->addressSpaceChange(mo, os, NULL);
 
-  objects = objects.remove(mo);
+  if (fixedObjects.covers(mo))
+    fixedObjects.remove(mo);
+  else
+    objects = objects.remove(mo);
 }
 
 const ObjectState *AddressSpace::findObject(const MemoryObject *mo) const {
+  LookupTimer timer;
+
+  if (fixedObjects.covers(mo)) {
+    const FixedObjectTable::value_type *res =
+        fixedObjects.lookup(mo->address);
+    return res ? res->second : 0;
+  }
+
   const MemoryMap::value_type *res = objects.lookup(mo);
   
   return res ? res->second : 0;
 }
 
 ObjectPair AddressSpace::findObject(uint64_t address) const {
+  LookupTimer timer;
+
+  const FixedObjectTable::value_type *fixed = fixedObjects.lookup(address);
+  if (fixed && fixed->first->address == address)
+    return ObjectPair(*fixed);
+
   MemoryObject hack(address);
   const MemoryMap::value_type *res = objects.lookup(&hack);
   return res ? ObjectPair(*res) : ObjectPair(NULL, NULL);
@@ -59,13 +121,16 @@ ObjectState *AddressSpace::getWriteable(const MemoryObject *mo,
   if (cowKey==os->copyOnWriteOwner) {
     return const_cast<ObjectState*>(os);
   } else {
-    ObjectState *n = new ObjectState(*os);
+    ObjectState *n = new (os->size) ObjectState(*os);
     n->copyOnWriteOwner = cowKey;
 
     assert(state);
     state->addressSpaceChange(mo, os, n);
 
-    objects = objects.replace(std::make_pair(mo, n));
+    if (fixedObjects.covers(mo))
+      fixedObjects.insert(mo, n);
+    else
+      objects = objects.replace(std::make_pair(mo, n));
     return n;    
   }
 }
@@ -75,11 +140,35 @@ bool AddressSpace::isOwnedByUs(const ObjectState *os) const
     return cowKey==os->copyOnWriteOwner;
 }
 
+void AddressSpace::getPrivateConcreteObjects(ResolutionList &result) const {
+  for (MemoryMap::iterator it = objects.begin(),
+            ie = objects.end(); it != ie; ++it) {
+    const ObjectState *os = it->second;
+    if (os->copyOnWriteOwner == cowKey && !os->symbolic)
+      result.push_back(ObjectPair(it->first, os));
+  }
+
+  for (FixedObjectTable::iterator it = fixedObjects.begin(),
+            ie = fixedObjects.end(); it != ie; ++it) {
+    const ObjectState *os = it->second;
+    if (os->copyOnWriteOwner == cowKey && !os->symbolic)
+      result.push_back(ObjectPair(it->first, os));
+  }
+}
+
 /// 
 
 bool AddressSpace::resolveOne(const ref<ConstantExpr> &addr, 
                               ObjectPair &result) {
+  LookupTimer timer;
   uint64_t address = addr->getZExtValue();
+
+  if (const FixedObjectTable::value_type *res =
+          fixedObjects.lookup(address)) {
+    result = *res;
+    return true;
+  }
+
   MemoryObject hack(address);
 
   if (const MemoryMap::value_type *res = objects.lookup_previous(&hack)) {
@@ -111,6 +200,15 @@ bool AddressSpace::resolveOne(ExecutionState &state,
     if (!solver->getValue(state, address, cex))
       return false;
     uint64_t example = cex->getZExtValue();
+
+    // Fixed objects tile their ranges, so the example is always inbounds
+    if (const FixedObjectTable::value_type *res =
+            fixedObjects.lookup(example)) {
+      result = *res;
+      success = true;
+      return true;
+    }
+
     MemoryObject hack(example);
     const MemoryMap::value_type *res = objects.lookup_previous(&hack);
     
@@ -218,6 +316,11 @@ bool AddressSpace::resolve(ExecutionState &state,
     if (!solver->getValue(state, p, cex))
       return true;
     uint64_t example = cex->getZExtValue();
+
+    if (fixedObjects.lookup(example))
+      return resolveFixed(state, solver, p, example, rl, maxResolutions,
+                          timeout_us, timer);
+
     MemoryObject hack(example);
     
     MemoryMap::iterator oi = objects.upper_bound(&hack);
@@ -309,49 +412,179 @@ bool AddressSpace::resolve(ExecutionState &state,
   return false;
 }
 
+bool AddressSpace::resolveFixed(ExecutionState &state,
+                                TimingSolver *solver,
+                                ref<Expr> p,
+                                uint64_t example,
+                                ResolutionList &rl,
+                                unsigned maxResolutions,
+                                uint64_t timeout_us,
+                                TimerStatIncrementer &timer) {
+  // Same search as in resolve, stepping from the object that contains
+  // the example to its neighbours in the fixed range.
+  const FixedObjectTable::value_type *start = fixedObjects.lookup(example);
+
+  // search backwards, starting with the object containing the example
+  for (const FixedObjectTable::value_type *res = start; res; ) {
+    const MemoryObject *mo = res->first;
+    if (timeout_us && timeout_us < timer.check())
+      return true;
+
+    ref<Expr> inBounds = mo->getBoundsCheckPointer(p);
+    bool mayBeTrue;
+    if (!solver->mayBeTrue(state, inBounds, mayBeTrue))
+      return true;
+    if (mayBeTrue) {
+      rl.push_back(*res);
+
+      // fast path check
+      unsigned size = rl.size();
+      if (size==1) {
+        bool mustBeTrue;
+        if (!solver->mustBeTrue(state, inBounds, mustBeTrue))
+          return true;
+        if (mustBeTrue)
+          return false;
+      } else if (size==maxResolutions) {
+        return true;
+      }
+    }
+
+    bool mustBeTrue;
+    if (!solver->mustBeTrue(state,
+                            UgeExpr::create(p, mo->getBaseExpr()),
+                            mustBeTrue))
+      return true;
+    if (mustBeTrue || mo->address < mo->size)
+      break;
+    res = fixedObjects.lookup(mo->address - mo->size);
+  }
+
+  // search forwards
+  for (const FixedObjectTable::value_type *res =
+           fixedObjects.lookup(start->first->address + start->first->size);
+       res; res = fixedObjects.lookup(res->first->address + res->first->size)) {
+    const MemoryObject *mo = res->first;
+    if (timeout_us && timeout_us < timer.check())
+      return true;
+
+    bool mustBeTrue;
+    if (!solver->mustBeTrue(state,
+                            UltExpr::create(p, mo->getBaseExpr()),
+                            mustBeTrue))
+      return true;
+    if (mustBeTrue)
+      break;
+
+    ref<Expr> inBounds = mo->getBoundsCheckPointer(p);
+    bool mayBeTrue;
+    if (!solver->mayBeTrue(state, inBounds, mayBeTrue))
+      return true;
+    if (mayBeTrue) {
+      rl.push_back(*res);
+
+      // fast path check
+      unsigned size = rl.size();
+      if (size==1) {
+        bool mustBeTrue;
+        if (!solver->mustBeTrue(state, inBounds, mustBeTrue))
+          return true;
+        if (mustBeTrue)
+          return false;
+      } else if (size==maxResolutions) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
 // These two are pretty big hack so we can sort of pass memory back
 // and forth to externals. They work by abusing the concrete cache
 // store inside of the object states, which allows them to
 // transparently avoid screwing up symbolics (if the byte is symbolic
 // then its concrete cache byte isn't being used) but is just a hack.
 
+void AddressSpace::copyOutConcrete(const MemoryObject *mo,
+                                   const ObjectState *os) const {
+  if(mo->isUserSpecified)
+      return;
+
+  uint8_t *address = (uint8_t*) (uintptr_t) mo->address;
+
+  if (!os->readOnly)
+    memcpy(address, os->concreteStore, mo->size);
+}
+
 void AddressSpace::copyOutConcretes() {
   for (MemoryMap::iterator it = objects.begin(),
-            ie = objects.end(); it != ie; ++it) {
-    const MemoryObject *mo = it->first;
-    if(mo->isUserSpecified)
-        continue;
+            ie = objects.end(); it != ie; ++it)
+    copyOutConcrete(it->first, it->second);
 
-    const ObjectState *os = it->second;
-    uint8_t *address = (uint8_t*) (uintptr_t) mo->address;
+  for (FixedObjectTable::iterator it = fixedObjects.begin(),
+            ie = fixedObjects.end(); it != ie; ++it)
+    copyOutConcrete(it->first, it->second);
+}
 
-    if (!os->readOnly)
-      memcpy(address, os->concreteStore, mo->size);
+bool AddressSpace::copyInConcrete(const MemoryObject *mo,
+                                  const ObjectState *os) {
+  if(mo->isUserSpecified)
+      return true;
+
+  uint8_t *address = (uint8_t*) (uintptr_t) mo->address;
+
+  if (os->readOnly) {
+    if (memcmp(address, os->concreteStore, mo->size)!=0)
+      return false;
+  } else {
+    ObjectState *wos = getWriteable(mo, os);
+    memcpy(wos->concreteStore, address, mo->size);
   }
+
+  return true;
 }
 
 bool AddressSpace::copyInConcretes() {
   for (MemoryMap::iterator it = objects.begin(),
             ie = objects.end(); it != ie; ++it) {
-    const MemoryObject *mo = it->first;
-    if(mo->isUserSpecified)
-        continue;
-
-    const ObjectState *os = it->second;
-    uint8_t *address = (uint8_t*) (uintptr_t) mo->address;
+    if (!copyInConcrete(it->first, it->second))
+      return false;
+  }
 
-    if (os->readOnly) {
-      if (memcmp(address, os->concreteStore, mo->size)!=0)
-        return false;
-    } else {
-      ObjectState *wos = getWriteable(mo, os);
-      memcpy(wos->concreteStore, address, mo->size);
-    }
+  // getWriteable updates the table in place, iterate over a snapshot
+  FixedObjectTable snapshot(fixedObjects);
+  for (FixedObjectTable::iterator it = snapshot.begin(),
+            ie = snapshot.end(); it != ie; ++it) {
+    if (!copyInConcrete(it->first, it->second))
+      return false;
   }
 
   return true;
 }
 
+int AddressSpace::concretizeObject(Executor *e, ObjectState *os) {
+    unsigned int object_offset;
+    int j = 0;
+    for (object_offset = 0; object_offset < os->size; object_offset++) {
+        ref<klee::Expr> oldexpr;
+        if (os->symbolic && os->symbolic->knownSymbolics != NULL) {
+            oldexpr = os->symbolic->knownSymbolics[object_offset];
+        } else {
+            continue;
+        }
+
+        if (oldexpr.get() == NULL) {
+            continue;
+        }
+
+        ref<klee::ConstantExpr> expr = e->toConstantSilent(*state, oldexpr);
+        os->setKnownSymbolic (object_offset, expr.get());
+        j++;
+    }
+    return j;
+}
+
 //
 // The purpose of this function is to concretize all symbolic
 // data in the current "address space."  The idea is to collapse all
@@ -359,29 +592,17 @@ bool AddressSpace::copyInConcretes() {
 // need this but sometimes constraints get out of hand.
 //
 void AddressSpace::concretizeAll(Executor *e) {
-    unsigned int object_offset;
     int i, j;
     i = 0;
     j = 0;
     for (MemoryMap::iterator it = objects.begin(),
              ie = objects.end(); it != ie; ++it) {
-        ObjectState *os = it->second;
-        for (object_offset = 0; object_offset < os->size; object_offset++) {
-            ref<klee::Expr> oldexpr;
-            if (os->knownSymbolics != NULL) {
-                oldexpr = os->knownSymbolics[object_offset];
-            } else {
-                continue;
-            }
-
-            if (oldexpr.get() == NULL) {
-                continue;
-            }
-
-            ref<klee::ConstantExpr> expr = e->toConstantSilent(*state, oldexpr);
-            os->setKnownSymbolic (object_offset, expr.get());
-            j++;
-        }
+        j += concretizeObject(e, it->second);
+        i++;
+    }
+    for (FixedObjectTable::iterator it = fixedObjects.begin(),
+             ie = fixedObjects.end(); it != ie; ++it) {
+        j += concretizeObject(e, it->second);
         i++;
     }
     // std::cerr << "AddressSpace: " << i << ", " << j << std::endl;
@@ -10,6 +10,7 @@
 #ifndef KLEE_ADDRESSSPACE_H
 #define KLEE_ADDRESSSPACE_H
 
+#include "FixedObjectTable.h"
 #include "ObjectHolder.h"
 
 #include "klee/Expr.h"
@@ -21,6 +22,7 @@ namespace klee {
   class MemoryObject;
   class ObjectState;
   class TimingSolver;
+  class TimerStatIncrementer;
 
   template<class T> class ref;
 
@@ -41,6 +43,21 @@ namespace klee {
 
     /// Unsupported, use copy constructor
     AddressSpace &operator=(const AddressSpace&); 
+
+    /// Continue resolve in the fixed range containing \a example.
+    bool resolveFixed(ExecutionState &state,
+                      TimingSolver *solver,
+                      ref<Expr> p,
+                      uint64_t example,
+                      ResolutionList &rl,
+                      unsigned maxResolutions,
+                      uint64_t timeout_us,
+                      TimerStatIncrementer &timer);
+
+    void copyOutConcrete(const MemoryObject *mo, const ObjectState *os) const;
+    bool copyInConcrete(const MemoryObject *mo, const ObjectState *os);
+
+    int concretizeObject(Executor *e, ObjectState *os);
     
   public:
     /// The MemoryObject -> ObjectState map that constitutes the
@@ -52,13 +69,18 @@ namespace klee {
     /// \invariant forall o in objects, o->copyOnWriteOwner <= cowKey
     MemoryMap objects;
 
+    /// The bindings of the objects tiling the fixed ranges registered
+    /// with addFixedRange. These objects are not in \a objects.
+    FixedObjectTable fixedObjects;
+
     /// ExecutionState that owns this AddressSpace
     ExecutionState *state;
 
   public:
     AddressSpace(ExecutionState* _state) : cowKey(1), state(_state) {}
     AddressSpace(const AddressSpace &b) :
-            cowKey(++b.cowKey), objects(b.objects), state(NULL) { }
+            cowKey(++b.cowKey), objects(b.objects),
+            fixedObjects(b.fixedObjects), state(NULL) { }
     ~AddressSpace() {}
 
     /// Resolve address to an ObjectPair in result.
@@ -96,6 +118,12 @@ namespace klee {
 
     /***/
 
+    /// Register a fixed range of host memory that will be tiled by
+    /// objects of 2^objectBits bytes. The bindings of these objects are
+    /// kept in a radix table instead of the map of dynamic objects.
+    /// Ranges must be registered before binding their objects.
+    void addFixedRange(uint64_t address, uint64_t size, unsigned objectBits);
+
     /// Add a binding to the address space.
     void bindObject(const MemoryObject *mo, ObjectState *os);
 
@@ -122,6 +150,13 @@ namespace klee {
 
     bool isOwnedByUs(const ObjectState *os) const;
 
+    /// Collect the objects that are owned by this address space, and
+    /// thus not shared with its copies, and hold only concrete bytes.
+    /// Such an object is entirely described by its contents and can be
+    /// unbound and later rebound to a new ObjectState with the same
+    /// contents, e.g., to swap it out of memory.
+    void getPrivateConcreteObjects(ResolutionList &result) const;
+
     /// Copy the concrete values of all managed ObjectStates into the
     /// actual system memory location they were allocated at.
     void copyOutConcretes();
@@ -11,6 +11,8 @@
 
 using namespace klee;
 
+Statistic stats::addressSpaceLookups("AddressSpaceLookups", "ASlookups");
+Statistic stats::addressSpaceLookupTime("AddressSpaceLookupTime", "AStime");
 Statistic stats::allocations("Allocations", "Alloc");
 Statistic stats::coveredInstructions("CoveredInstructions", "Icov");
 Statistic stats::falseBranches("FalseBranches", "Bf");
@@ -24,6 +26,11 @@ Statistic stats::minDistToUncovered("MinDistToUncovered", "UCdist");
 Statistic stats::reachableUncovered("ReachableUncovered", "IuncovReach");
 Statistic stats::resolveTime("ResolveTime", "Rtime");
 Statistic stats::solverTime("SolverTime", "Stime");
+Statistic stats::speculativeStateWaits("SpeculativeStateWaits", "SpecWaits");
+Statistic stats::speculativeStatesInfeasible("SpeculativeStatesInfeasible",
+                                             "SpecInfeasible");
+Statistic stats::speculativeStatesResolved("SpeculativeStatesResolved",
+                                           "SpecResolved");
 Statistic stats::states("States", "States");
 Statistic stats::trueBranches("TrueBranches", "Bt");
 Statistic stats::uncoveredInstructions("UncoveredInstructions", "Iuncov");
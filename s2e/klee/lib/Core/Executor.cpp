@@ -26,6 +26,7 @@
 #include "klee/UserSearcher.h"
 #include "klee/SolverStats.h"
 #include "../Expr/BitfieldSimplifier.h"
+#include "../Solver/STPWorkerPool.h"
 
 #include "klee/ExecutionState.h"
 #include "klee/Expr.h"
@@ -177,6 +178,26 @@ namespace {
            cl::init(true),
 	   cl::desc("Use validity caching"));
 
+  cl::opt<bool>
+  UseSharedCache("use-shared-cache",
+           cl::init(false),
+	   cl::desc("Share validity results between all S2E processes"));
+
+  cl::opt<unsigned>
+  SharedCacheEntries("shared-cache-entries",
+           cl::init(1 << 22),
+	   cl::desc("Number of entries of the shared validity cache"));
+
+  cl::opt<unsigned>
+  SharedCacheCounterexamples("shared-cache-counterexamples",
+           cl::init(1 << 16),
+	   cl::desc("Number of counterexamples kept in the shared cache (0 to not share them)"));
+
+  cl::opt<std::string>
+  PersistentCacheFile("persistent-cache-file",
+           cl::init(""),
+	   cl::desc("Store solver results in the given file and reuse them across runs"));
+
   cl::opt<bool>
   OnlyReplaySeeds("only-replay-seeds", 
                   cl::desc("Discard states that do not have a seed."));
@@ -253,6 +274,31 @@ namespace {
   UseForkedSTP("use-forked-stp", 
                  cl::desc("Run STP in forked process"),  cl::init(false));
 
+  cl::opt<bool>
+  UseIncrementalSTP("use-incremental-stp",
+                 cl::desc("Keep the constraints shared by successive queries asserted in STP"),
+                 cl::init(false));
+
+  enum PortfolioBackend {
+    PortfolioSTPSimple,
+    PortfolioFastCex,
+    PortfolioSMTLIB
+  };
+
+  cl::list<PortfolioBackend>
+  SolverPortfolio("solver-portfolio",
+                  cl::desc("Race STP against the given solvers on each query, in separate processes"),
+                  cl::CommaSeparated,
+                  cl::values(clEnumValN(PortfolioSTPSimple, "stp-simple", "STP without rewriting divisions by constants"),
+                             clEnumValN(PortfolioFastCex, "fast-cex", "the fast counterexample solver"),
+                             clEnumValN(PortfolioSMTLIB, "smtlib", "an external SMT-LIBv2 solver"),
+                             clEnumValEnd));
+
+  cl::opt<std::string>
+  SMTLIBSolverCommand("smtlib-solver-command",
+                      cl::desc("Command running the SMT-LIBv2 solver of the portfolio, reading the script on its standard input"),
+                      cl::init("z3 -smt2 -in"));
+
   /*
   cl::opt<bool>
   IgnoreAlwaysConcrete("ignore-always-concrete",
@@ -269,6 +315,12 @@ namespace {
   EnableSpeculativeForking("enable-speculative-forking",
             cl::desc("Enable speculative forking for concolic execution"),
             cl::init(true));
+
+  cl::opt<unsigned>
+  SpeculativeWorkers("speculative-workers",
+            cl::desc("Number of processes resolving speculative states in "
+                     "the background (0 = resolve them when selected)"),
+            cl::init(0));
 }
 
 //S2E: we want these to be accessible in S2E executor
@@ -277,6 +329,12 @@ UseExprSimplifier("use-expr-simplifier",
           cl::desc("Apply expression simplifier for new expressions"),
           cl::init(true));
 
+cl::opt<bool>
+ConcreteFastPath("concrete-fast-path",
+          cl::desc("Execute LLVM instructions whose operands are all concrete "
+                   "with native arithmetic"),
+          cl::init(true));
+
 
 
 unsigned Executor::getMaxMemory() { return MaxMemory; }
@@ -289,12 +347,39 @@ namespace klee {
   RNG theRNG;
 }
 
-Solver *constructSolverChain(STPSolver *stpSolver,
+/// Each solver of the portfolio runs in its own worker process, STP is
+/// thus run in-process there.
+PortfolioSolver *constructPortfolio() {
+  PortfolioSolver *portfolio = new PortfolioSolver();
+  portfolio->addSolver(new STPSolver(false), &stats::portfolioWinsSTP);
+
+  for (unsigned i = 0; i < SolverPortfolio.size(); ++i) {
+    switch (SolverPortfolio[i]) {
+    case PortfolioSTPSimple:
+      portfolio->addSolver(new STPSolver(false, false, false),
+                           &stats::portfolioWinsSTPSimple);
+      break;
+    case PortfolioFastCex:
+      portfolio->addSolver(createFastCexSolver(createDummySolver()),
+                           &stats::portfolioWinsFastCex);
+      break;
+    case PortfolioSMTLIB:
+      portfolio->addSolver(createSMTLIBSolver(SMTLIBSolverCommand),
+                           &stats::portfolioWinsSMTLIB);
+      break;
+    }
+  }
+
+  return portfolio;
+}
+
+Solver *constructSolverChain(Solver *coreSolver,
+                             STPSolver *stpSolver,
                              std::string queryLogPath,
                              std::string stpQueryLogPath,
                              std::string queryPCLogPath,
                              std::string stpQueryPCLogPath) {
-  Solver *solver = stpSolver;
+  Solver *solver = coreSolver;
 
   if (UseSTPQueryPCLog)
     solver = createPCLoggingSolver(solver, 
@@ -303,9 +388,16 @@ Solver *constructSolverChain(STPSolver *stpSolver,
   if (UseFastCexSolver)
     solver = createFastCexSolver(solver);
 
+  if (!PersistentCacheFile.empty())
+    solver = createPersistentCachingSolver(solver, PersistentCacheFile);
+
   if (UseCexCache)
     solver = createCexCachingSolver(solver);
 
+  if (UseSharedCache)
+    solver = createSharedCachingSolver(solver, SharedCacheEntries,
+                                       SharedCacheCounterexamples);
+
   if (UseCache)
     solver = createCachingSolver(solver);
 
@@ -328,15 +420,25 @@ void Executor::initializeSolver()
         delete this->solver;
     }
 
-    STPSolver *stpSolver = new STPSolver(UseForkedSTP);
+    // The portfolio workers parse each query anew, they cannot keep
+    // constraints asserted across queries
+    if (UseIncrementalSTP && !SolverPortfolio.empty())
+      klee_error("--use-incremental-stp cannot be used with --solver-portfolio");
+
+    STPSolver *stpSolver = new STPSolver(UseForkedSTP, UseIncrementalSTP);
+    PortfolioSolver *portfolioSolver =
+      SolverPortfolio.empty() ? 0 : constructPortfolio();
+
     Solver *solver =
-      constructSolverChain(stpSolver,
+      constructSolverChain(portfolioSolver ? (Solver*) portfolioSolver :
+                                             (Solver*) stpSolver,
+                           stpSolver,
                            interpreterHandler->getOutputFilename("queries.qlog"),
                            interpreterHandler->getOutputFilename("stp-queries.qlog"),
                            interpreterHandler->getOutputFilename("queries.pc"),
                            interpreterHandler->getOutputFilename("stp-queries.pc"));
 
-    this->solver = new TimingSolver(solver, stpSolver);
+    this->solver = new TimingSolver(solver, stpSolver, true, portfolioSolver);
 }
 
 Executor::Executor(const InterpreterOptions &opts,
@@ -357,7 +459,8 @@ Executor::Executor(const InterpreterOptions &opts,
     atMemoryLimit(false),
     inhibitForking(false),
     haltExecution(false),
-    ivcEnabled(false) {
+    ivcEnabled(false),
+    speculativeWorkers(0) {
 
   if(MaxSTPTime == 0) {
       stpTimeout = MaxInstructionTime;
@@ -376,6 +479,11 @@ Executor::Executor(const InterpreterOptions &opts,
       exprSimplifier = new BitfieldSimplifier;
   else
       exprSimplifier = NULL;
+
+#ifndef __MINGW32__
+  if (SpeculativeWorkers && EnableSpeculativeForking)
+      speculativeWorkers = new STPWorkerPool(SpeculativeWorkers);
+#endif
 }
 
 
@@ -418,6 +526,7 @@ Executor::~Executor() {
   if (statsTracker)
     delete statsTracker;
   delete solver;
+  delete speculativeWorkers;
   delete kmodule;
 }
 
@@ -850,6 +959,10 @@ Executor::concolicFork(ExecutionState &current, ref<Expr> condition, bool isInte
     branchedState->speculative = true;
     branchedState->concolics.clear();
 
+    if (speculativeWorkers) {
+        speculativeQueue.insert(branchedState);
+    }
+
     //We don't know if the branched state could be valid
     //or not, so we mark it speculative and defer the
     //actual determination of the speculative status to later.
@@ -873,6 +986,12 @@ Executor::concolicFork(ExecutionState &current, ref<Expr> condition, bool isInte
     falseState->ptreeNode = res.first;
     trueState->ptreeNode = res.second;
 
+    //Let the workers check the speculative state while the current
+    //state keeps running
+    if (speculativeWorkers) {
+        submitSpeculativeStates();
+    }
+
     return StatePair(trueState, falseState);
 }
 
@@ -893,6 +1012,22 @@ bool Executor::resolveSpeculativeState(ExecutionState &state)
 {
     assert(state.isSpeculative());
 
+    if (speculativeWorkers) {
+        std::map<ExecutionState*, uint64_t>::iterator it =
+                speculativeTickets.find(&state);
+        if (it != speculativeTickets.end()) {
+            uint64_t ticket = it->second;
+            speculativeTickets.erase(it);
+            ++stats::speculativeStateWaits;
+
+            bool feasible;
+            if (receiveSpeculativeState(state, ticket, feasible)) {
+                return feasible;
+            }
+        }
+        speculativeQueue.erase(&state);
+    }
+
     //The speculative condition must satisfy the current path constraints
     if (!checkSpeculativeState(state)) {
         return false;
@@ -923,6 +1058,166 @@ bool Executor::resolveSpeculativeState(ExecutionState &state)
 }
 
 
+static void getSymbolicArrays(const ExecutionState &state,
+                              std::vector<const Array*> &arrays)
+{
+    for (unsigned i=0; i<state.symbolics.size(); ++i) {
+        arrays.push_back(state.symbolics[i].second);
+    }
+}
+
+/* The worker only needs the constraints that share array bytes with the
+   speculative condition, and only computes the arrays they read: the
+   concolic values of the other arrays already satisfy the remaining
+   constraints. All the constraints and arrays are sent if the state has
+   no such values. */
+static void getSpeculativeQuery(const ExecutionState &state,
+                                std::vector< ref<Expr> > &constraints,
+                                std::vector<const Array*> &arrays)
+{
+    state.constraints.getIndependentConstraints(state.speculativeCondition,
+                                                constraints);
+
+    std::vector< ref<Expr> > exprs(constraints);
+    exprs.push_back(state.speculativeCondition);
+    findSymbolicObjects(exprs.begin(), exprs.end(), arrays);
+
+    std::set<const Array*> required(arrays.begin(), arrays.end());
+    for (unsigned i=0; i<state.symbolics.size(); ++i) {
+        const Array *array = state.symbolics[i].second;
+        if (!required.count(array) &&
+            !state.concolics.bindings.count(array)) {
+            constraints.clear();
+            for (ConstraintManager::const_iterator it =
+                 state.constraints.begin();
+                 it != state.constraints.end(); ++it) {
+                constraints.push_back(*it);
+            }
+            arrays.clear();
+            getSymbolicArrays(state, arrays);
+            return;
+        }
+    }
+}
+
+void Executor::submitSpeculativeStates()
+{
+    while (!speculativeQueue.empty()) {
+        ExecutionState *state = *speculativeQueue.begin();
+
+        //The worker looks for values satisfying the path constraints
+        //and the speculative condition, which resolves the state at once
+        std::vector< ref<Expr> > constraints;
+        std::vector<const Array*> symbObjects;
+        getSpeculativeQuery(*state, constraints, symbObjects);
+        ConstraintManager manager(constraints);
+        Query query(manager,
+                    Expr::createIsZero(state->speculativeCondition));
+
+        uint64_t ticket = speculativeWorkers->submitInitialValues(
+                query, symbObjects, stpTimeout);
+        if (!ticket) {
+            //All the workers are busy
+            break;
+        }
+
+        speculativeQueue.erase(speculativeQueue.begin());
+        speculativeTickets[state] = ticket;
+    }
+}
+
+bool Executor::receiveSpeculativeState(ExecutionState &state, uint64_t ticket,
+                                       bool &feasible)
+{
+    std::vector< ref<Expr> > constraints;
+    std::vector<const Array*> symbObjects;
+    std::vector<std::vector<unsigned char> > concreteObjects;
+    bool hasSolution;
+
+    //The state did not run since its query was submitted
+    getSpeculativeQuery(state, constraints, symbObjects);
+
+    STPWorkerPool::Result result = speculativeWorkers->receiveInitialValues(
+            ticket, symbObjects, concreteObjects, hasSolution);
+    if (result != STPWorkerPool::Success) {
+        return false;
+    }
+
+    if (!hasSolution) {
+        ++stats::speculativeStatesInfeasible;
+        feasible = false;
+        return true;
+    }
+
+    //Same as resolveSpeculativeState, without querying the solver.
+    //The values of the other arrays are kept.
+    state.addConstraint(state.speculativeCondition);
+    for (unsigned i=0; i<symbObjects.size(); ++i) {
+        state.concolics.bindings[symbObjects[i]] = concreteObjects[i];
+    }
+    state.speculative = false;
+
+    ++stats::speculativeStatesResolved;
+    feasible = true;
+    return true;
+}
+
+bool Executor::updateSpeculativeStates()
+{
+    if (!speculativeWorkers) {
+        return false;
+    }
+
+    std::vector<ExecutionState*> answered;
+    std::map<ExecutionState*, uint64_t>::iterator it;
+    for (it = speculativeTickets.begin(); it != speculativeTickets.end(); ++it) {
+        if (speculativeWorkers->isAnswered(it->second)) {
+            answered.push_back(it->first);
+        }
+    }
+
+    bool terminated = false;
+    std::set<ExecutionState*> empty;
+
+    for (unsigned i=0; i<answered.size(); ++i) {
+        ExecutionState *state = answered[i];
+        it = speculativeTickets.find(state);
+        uint64_t ticket = it->second;
+        speculativeTickets.erase(it);
+
+        bool feasible;
+        if (!receiveSpeculativeState(*state, ticket, feasible)) {
+            //The state is resolved synchronously when selected
+            continue;
+        }
+
+        if (!feasible) {
+            terminateState(*state);
+            terminated = true;
+        } else if (!addedStates.count(state)) {
+            //Let the searcher know that the state is not speculative anymore
+            searcher->update(state, empty, empty);
+        }
+    }
+
+    submitSpeculativeStates();
+
+    return terminated;
+}
+
+void Executor::dropSpeculativeState(ExecutionState &state)
+{
+    speculativeQueue.erase(&state);
+
+    std::map<ExecutionState*, uint64_t>::iterator it =
+            speculativeTickets.find(&state);
+    if (it != speculativeTickets.end()) {
+        speculativeWorkers->cancel(it->second);
+        speculativeTickets.erase(it);
+    }
+}
+
+
 Executor::StatePair 
 Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
   condition = simplifyExpr(current, condition);
@@ -1599,6 +1894,162 @@ static bool isDebugIntrinsic(const Function *f, KModule *KM) {
 #endif
 }
 
+/// Returns the operand as a native integer if it is a constant of at
+/// most 64 bits.
+static inline bool getConcreteOperand(const Cell &cell, uint64_t &value,
+                                      Expr::Width &width) {
+  ConstantExpr *ce = dyn_cast_or_null<ConstantExpr>(cell.value.get());
+  if (!ce || ce->getWidth() > Expr::Int64)
+    return false;
+  value = ce->getZExtValue();
+  width = ce->getWidth();
+  return true;
+}
+
+static inline int64_t signExtend(uint64_t value, Expr::Width width) {
+  unsigned shift = Expr::Int64 - width;
+  return ((int64_t) (value << shift)) >> shift;
+}
+
+bool Executor::executeConcreteInstruction(ExecutionState &state,
+                                          KInstruction *ki) {
+  Instruction *i = ki->inst;
+  unsigned opcode = i->getOpcode();
+  uint64_t left, right = 0, result;
+  Expr::Width width, rightWidth;
+
+  // Only the operands of the handled instructions are bound: branches,
+  // calls to inline assembly, etc. have operands without a cell.
+  switch (opcode) {
+  case Instruction::Select: {
+    uint64_t cond;
+    if (!getConcreteOperand(eval(ki, 0, state), cond, width))
+      return false;
+    // The selected value is already simplified
+    getDestCell(state, ki).value = eval(ki, cond ? 1 : 2, state).value;
+    return true;
+  }
+
+  case Instruction::BitCast:
+    getDestCell(state, ki).value = eval(ki, 0, state).value;
+    return true;
+
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::Mul:
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor:
+  case Instruction::UDiv:
+  case Instruction::URem:
+  case Instruction::Shl:
+  case Instruction::LShr:
+  case Instruction::AShr:
+  case Instruction::ICmp:
+    if (!getConcreteOperand(eval(ki, 0, state), left, width) ||
+        !getConcreteOperand(eval(ki, 1, state), right, rightWidth))
+      return false;
+    break;
+
+  case Instruction::Trunc:
+  case Instruction::ZExt:
+  case Instruction::SExt:
+  case Instruction::IntToPtr:
+  case Instruction::PtrToInt:
+    if (!getConcreteOperand(eval(ki, 0, state), left, width))
+      return false;
+    break;
+
+  default:
+    return false;
+  }
+
+  switch (opcode) {
+  case Instruction::Add: result = left + right; break;
+  case Instruction::Sub: result = left - right; break;
+  case Instruction::Mul: result = left * right; break;
+  case Instruction::And: result = left & right; break;
+  case Instruction::Or:  result = left | right; break;
+  case Instruction::Xor: result = left ^ right; break;
+
+  case Instruction::UDiv:
+    if (!right)
+      return false;
+    result = left / right;
+    break;
+
+  case Instruction::URem:
+    if (!right)
+      return false;
+    result = left % right;
+    break;
+
+  case Instruction::Shl:
+    if (right >= width)
+      return false;
+    result = left << right;
+    break;
+
+  case Instruction::LShr:
+    if (right >= width)
+      return false;
+    result = left >> right;
+    break;
+
+  case Instruction::AShr:
+    if (right >= width)
+      return false;
+    result = signExtend(left, width) >> right;
+    break;
+
+  case Instruction::ICmp: {
+    int64_t sleft = signExtend(left, width);
+    int64_t sright = signExtend(right, width);
+
+    switch (cast<ICmpInst>(i)->getPredicate()) {
+    case ICmpInst::ICMP_EQ:  result = left == right; break;
+    case ICmpInst::ICMP_NE:  result = left != right; break;
+    case ICmpInst::ICMP_UGT: result = left > right; break;
+    case ICmpInst::ICMP_UGE: result = left >= right; break;
+    case ICmpInst::ICMP_ULT: result = left < right; break;
+    case ICmpInst::ICMP_ULE: result = left <= right; break;
+    case ICmpInst::ICMP_SGT: result = sleft > sright; break;
+    case ICmpInst::ICMP_SGE: result = sleft >= sright; break;
+    case ICmpInst::ICMP_SLT: result = sleft < sright; break;
+    case ICmpInst::ICMP_SLE: result = sleft <= sright; break;
+    default:
+      return false;
+    }
+    getDestCell(state, ki).value = ConstantExpr::create(result, Expr::Bool);
+    return true;
+  }
+
+  case Instruction::Trunc:
+  case Instruction::ZExt:
+  case Instruction::IntToPtr:
+  case Instruction::PtrToInt:
+    result = left;
+    width = getWidthForLLVMType(i->getType());
+    break;
+
+  case Instruction::SExt:
+    result = signExtend(left, width);
+    width = getWidthForLLVMType(i->getType());
+    break;
+
+  default:
+    assert(0 && "unhandled opcode");
+    return false;
+  }
+
+  if (width > Expr::Int64)
+    return false;
+
+  getDestCell(state, ki).value =
+      ConstantExpr::create(bits64::truncateToNBits(result, width), width);
+  return true;
+}
+
 void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
   Instruction *i = ki->inst;
   switch (i->getOpcode()) {
@@ -2654,7 +3105,8 @@ void Executor::run(ExecutionState &initialState) {
       KInstruction *ki = state.pc;
       stepInstruction(state);
 
-      executeInstruction(state, ki);
+      if (!ConcreteFastPath || !executeConcreteInstruction(state, ki))
+        executeInstruction(state, ki);
       processTimers(&state, MaxInstructionTime * numSeeds);
       updateStates(&state);
 
@@ -2704,7 +3156,8 @@ void Executor::run(ExecutionState &initialState) {
     KInstruction *ki = state.pc;
     stepInstruction(state);
 
-    executeInstruction(state, ki);
+    if (!ConcreteFastPath || !executeConcreteInstruction(state, ki))
+      executeInstruction(state, ki);
     processTimers(&state, MaxInstructionTime);
 
     if (MaxMemory) {
@@ -2829,6 +3282,9 @@ void Executor::terminateState(ExecutionState &state) {
 
   interpreterHandler->incPathsExplored();
 
+  if (speculativeWorkers)
+    dropSpeculativeState(state);
+
   std::set<ExecutionState*>::iterator it = addedStates.find(&state);
   if (it==addedStates.end()) {
     // XXX: the following line makes delayed state termination impossible
@@ -3060,7 +3516,8 @@ ObjectState *Executor::bindObjectInState(ExecutionState &state,
                                          const MemoryObject *mo,
                                          bool isLocal,
                                          const Array *array) {
-  ObjectState *os = array ? new ObjectState(mo, array) : new ObjectState(mo);
+  ObjectState *os = array ? new (mo->size) ObjectState(mo, array)
+                          : new (mo->size) ObjectState(mo);
   state.addressSpace.bindObject(mo, os);
 
   // Its possible that multiple bindings of the same mo in the state
@@ -0,0 +1,259 @@
+//===-- FixedObjectTable.cpp ----------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "FixedObjectTable.h"
+
+#include "klee/Memory.h"
+
+#include <cassert>
+#include <cstring>
+
+using namespace klee;
+
+FixedObjectTable::Interior::Interior() {
+  memset(children, 0, sizeof(children));
+}
+
+FixedObjectTable::Interior::Interior(const Interior &b) : Node() {
+  for (unsigned i = 0; i < NodeSize; ++i) {
+    children[i] = b.children[i];
+    if (children[i])
+      ++children[i]->refCount;
+  }
+}
+
+FixedObjectTable::FixedObjectTable(const FixedObjectTable &b)
+  : objectBits(b.objectBits), levels(b.levels), ranges(b.ranges),
+    root(b.root), count(b.count) {
+  if (root)
+    ++root->refCount;
+}
+
+FixedObjectTable::~FixedObjectTable() {
+  if (root)
+    release(root, levels);
+}
+
+void FixedObjectTable::release(Node *n, unsigned level) {
+  if (--n->refCount)
+    return;
+
+  if (level == 0) {
+    delete static_cast<Leaf*>(n);
+    return;
+  }
+
+  Interior *node = static_cast<Interior*>(n);
+  for (unsigned i = 0; i < NodeSize; ++i) {
+    if (node->children[i])
+      release(node->children[i], level - 1);
+  }
+  delete node;
+}
+
+void FixedObjectTable::addRange(uint64_t start, uint64_t size,
+                                unsigned _objectBits) {
+  assert(_objectBits < AddressBits - LeafBits);
+  assert(start + size <= (1ULL << AddressBits) &&
+         "range is out of the address space of the table");
+  assert(((start | size) & ((1ULL << _objectBits) - 1)) == 0 &&
+         "range is not aligned on the size of the objects");
+
+  if (ranges.empty()) {
+    assert(!root);
+    objectBits = _objectBits;
+    levels = (AddressBits - objectBits - LeafBits + NodeBits - 1) / NodeBits;
+  }
+  assert(objectBits == _objectBits && "ranges use different object sizes");
+
+  Range r;
+  r.start = start;
+  r.end = start + size;
+  ranges.push_back(r);
+}
+
+bool FixedObjectTable::covers(const MemoryObject *mo) const {
+  if (mo->size != (1U << objectBits) || ranges.empty())
+    return false;
+
+  for (unsigned i = 0; i < ranges.size(); ++i) {
+    if (mo->address >= ranges[i].start && mo->address < ranges[i].end)
+      return (mo->address & (mo->size - 1)) == 0;
+  }
+  return false;
+}
+
+FixedObjectTable::value_type &
+FixedObjectTable::getWriteableEntry(uint64_t key) {
+  Node **slot = &root;
+
+  for (unsigned l = levels + 1; l > 0; --l) {
+    Node *n = *slot;
+    unsigned level = l - 1;
+
+    if (!n) {
+      n = level ? static_cast<Node*>(new Interior())
+                : static_cast<Node*>(new Leaf());
+      n->refCount = 1;
+      *slot = n;
+    } else if (n->refCount > 1) {
+      // Shared with another table: copy the node, whose children become
+      // shared in turn.
+      Node *copy = level ?
+          static_cast<Node*>(new Interior(*static_cast<Interior*>(n))) :
+          static_cast<Node*>(new Leaf(*static_cast<Leaf*>(n)));
+      copy->refCount = 1;
+      --n->refCount;
+      n = copy;
+      *slot = n;
+    }
+
+    if (level == 0)
+      return static_cast<Leaf*>(n)->entries[key & (LeafSize - 1)];
+
+    unsigned index = (key >> ((level - 1) * NodeBits + LeafBits)) &
+                     (NodeSize - 1);
+    slot = &static_cast<Interior*>(n)->children[index];
+  }
+
+  assert(0 && "unreachable");
+  return static_cast<Leaf*>(root)->entries[0];
+}
+
+void FixedObjectTable::insert(const MemoryObject *mo, ObjectState *os) {
+  assert(covers(mo));
+
+  value_type &entry = getWriteableEntry(mo->address >> objectBits);
+  if (!entry.first)
+    ++count;
+  entry.first = mo;
+  entry.second = os;
+}
+
+void FixedObjectTable::remove(const MemoryObject *mo) {
+  assert(covers(mo));
+
+  if (!lookup(mo->address))
+    return;
+
+  value_type &entry = getWriteableEntry(mo->address >> objectBits);
+  entry.first = NULL;
+  entry.second = ObjectHolder();
+  --count;
+}
+
+bool FixedObjectTable::isEmpty(const Node *n, unsigned level) {
+  if (!n)
+    return true;
+
+  if (level == 0) {
+    const Leaf *leaf = static_cast<const Leaf*>(n);
+    for (unsigned i = 0; i < LeafSize; ++i) {
+      if (leaf->entries[i].first)
+        return false;
+    }
+    return true;
+  }
+
+  const Interior *node = static_cast<const Interior*>(n);
+  for (unsigned i = 0; i < NodeSize; ++i) {
+    if (!isEmpty(node->children[i], level - 1))
+      return false;
+  }
+  return true;
+}
+
+bool FixedObjectTable::diff(const Node *a, const Node *b, unsigned level,
+                            std::vector<const MemoryObject*> &mutated) {
+  if (a == b)
+    return true;
+  if (!a || !b)
+    return isEmpty(a ? a : b, level);
+
+  if (level == 0) {
+    const Leaf *la = static_cast<const Leaf*>(a);
+    const Leaf *lb = static_cast<const Leaf*>(b);
+    for (unsigned i = 0; i < LeafSize; ++i) {
+      const value_type &ea = la->entries[i], &eb = lb->entries[i];
+      if (ea.first != eb.first)
+        return false;
+      if (ea.first && ea.second != eb.second)
+        mutated.push_back(ea.first);
+    }
+    return true;
+  }
+
+  const Interior *na = static_cast<const Interior*>(a);
+  const Interior *nb = static_cast<const Interior*>(b);
+  for (unsigned i = 0; i < NodeSize; ++i) {
+    if (!diff(na->children[i], nb->children[i], level - 1, mutated))
+      return false;
+  }
+  return true;
+}
+
+bool FixedObjectTable::diff(const FixedObjectTable &b,
+                            std::vector<const MemoryObject*> &mutated) const {
+  if (count != b.count)
+    return false;
+  if (!root || !b.root)
+    return root == b.root;
+  if (objectBits != b.objectBits || levels != b.levels)
+    return false;
+  return diff(root, b.root, levels, mutated);
+}
+
+/***/
+
+FixedObjectTable::iterator::iterator(const FixedObjectTable *_table)
+  : table(_table) {
+  if (table->root) {
+    stack.reserve(table->levels + 1);
+    stack.push_back(std::make_pair((const Node*) table->root, 0U));
+    settle();
+  }
+}
+
+void FixedObjectTable::iterator::settle() {
+  while (!stack.empty()) {
+    unsigned level = table->levels + 1 - stack.size();
+    const Node *n = stack.back().first;
+    unsigned index = stack.back().second;
+
+    if (level == 0) {
+      const Leaf *leaf = static_cast<const Leaf*>(n);
+      while (index < LeafSize && !leaf->entries[index].first)
+        ++index;
+      stack.back().second = index;
+      if (index < LeafSize)
+        return;
+    } else {
+      const Interior *node = static_cast<const Interior*>(n);
+      while (index < NodeSize && !node->children[index])
+        ++index;
+      stack.back().second = index;
+      if (index < NodeSize) {
+        stack.push_back(std::make_pair((const Node*) node->children[index],
+                                       0U));
+        continue;
+      }
+    }
+
+    stack.pop_back();
+    if (!stack.empty())
+      ++stack.back().second;
+  }
+}
+
+FixedObjectTable::iterator &FixedObjectTable::iterator::operator++() {
+  assert(!stack.empty() && "incrementing end iterator");
+  ++stack.back().second;
+  settle();
+  return *this;
+}
@@ -0,0 +1,171 @@
+//===-- FixedObjectTable.h --------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_FIXEDOBJECTTABLE_H
+#define KLEE_FIXEDOBJECTTABLE_H
+
+#include "ObjectHolder.h"
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace klee {
+  class MemoryObject;
+  class ObjectState;
+
+  /// FixedObjectTable - A persistent radix table holding the bindings of
+  /// the objects that tile fixed ranges of host memory (e.g., guest RAM).
+  ///
+  /// The ranges are split into objects of 2^objectBits bytes, and the key
+  /// of an object is its address shifted by objectBits. Leaves hold the
+  /// bindings of LeafSize consecutive objects and interior nodes hold
+  /// NodeSize children, so that a lookup is a fixed number of indexings
+  /// instead of the search of a balanced tree.
+  ///
+  /// Nodes are reference counted and shared between the copies of a table.
+  /// Copying a table is O(1), and the first update of a leaf shared with
+  /// another table copies the path from the root to that leaf.
+  class FixedObjectTable {
+  public:
+    typedef std::pair<const MemoryObject*, ObjectHolder> value_type;
+
+    enum {
+      /// Only addresses below 2^AddressBits can be stored in the table
+      AddressBits = 48,
+      LeafBits = 5,
+      LeafSize = 1 << LeafBits,
+      NodeBits = 9,
+      NodeSize = 1 << NodeBits
+    };
+
+  private:
+    struct Node {
+      unsigned refCount;
+      Node() : refCount(0) {}
+    };
+
+    struct Interior : public Node {
+      Node *children[NodeSize];
+      Interior();
+      Interior(const Interior &b);
+    };
+
+    struct Leaf : public Node {
+      value_type entries[LeafSize];
+    };
+
+    struct Range {
+      uint64_t start, end;
+    };
+
+    unsigned objectBits;
+    /// Number of interior levels above the leaves
+    unsigned levels;
+    std::vector<Range> ranges;
+    Node *root;
+    uint64_t count;
+
+    static void release(Node *n, unsigned level);
+    static bool isEmpty(const Node *n, unsigned level);
+    static bool diff(const Node *a, const Node *b, unsigned level,
+                     std::vector<const MemoryObject*> &mutated);
+
+    /// Return the entry of the given key, copying the nodes on its path
+    /// that are shared with other tables.
+    value_type &getWriteableEntry(uint64_t key);
+
+    /// Unsupported, use copy constructor
+    FixedObjectTable &operator=(const FixedObjectTable&);
+
+  public:
+    class iterator {
+      friend class FixedObjectTable;
+
+      /// The nodes from the root to the current leaf, and the index of
+      /// the current child in each of them.
+      const FixedObjectTable *table;
+      std::vector< std::pair<const Node*, unsigned> > stack;
+
+      iterator(const FixedObjectTable *_table);
+      void settle();
+
+    public:
+      iterator() : table(0) {}
+
+      const value_type &operator*() const {
+        return static_cast<const Leaf*>(stack.back().first)
+            ->entries[stack.back().second];
+      }
+      const value_type *operator->() const { return &**this; }
+
+      iterator &operator++();
+
+      bool operator==(const iterator &b) const {
+        if (stack.empty() || b.stack.empty())
+          return stack.empty() == b.stack.empty();
+        return stack.back() == b.stack.back();
+      }
+      bool operator!=(const iterator &b) const { return !(*this == b); }
+    };
+
+    FixedObjectTable() : objectBits(0), levels(0), root(0), count(0) {}
+    FixedObjectTable(const FixedObjectTable &b);
+    ~FixedObjectTable();
+
+    /// Register a range whose objects of 2^objectBits bytes must be
+    /// stored in the table. All the ranges must use the same object size.
+    void addRange(uint64_t start, uint64_t size, unsigned objectBits);
+
+    /// Return true if the given object belongs to the table.
+    bool covers(const MemoryObject *mo) const;
+
+    /// Lookup the binding of the object containing the given address.
+    const value_type *lookup(uint64_t address) const {
+      if (!root)
+        return 0;
+
+      uint64_t key = address >> objectBits;
+      if (key >> (levels * NodeBits + LeafBits))
+        return 0;
+
+      const Node *n = root;
+      for (unsigned l = levels; l > 0; --l) {
+        unsigned index = (key >> ((l - 1) * NodeBits + LeafBits)) &
+                         (NodeSize - 1);
+        n = static_cast<const Interior*>(n)->children[index];
+        if (!n)
+          return 0;
+      }
+
+      const value_type &v =
+          static_cast<const Leaf*>(n)->entries[key & (LeafSize - 1)];
+      return v.first ? &v : 0;
+    }
+
+    /// Bind (or rebind) an object covered by the table.
+    void insert(const MemoryObject *mo, ObjectState *os);
+
+    /// Remove the binding of an object covered by the table.
+    void remove(const MemoryObject *mo);
+
+    /// Collect the objects bound to different ObjectStates in this table
+    /// and in \a b, skipping the subtrees the two tables share.
+    /// \return false if the two tables do not bind the same objects.
+    bool diff(const FixedObjectTable &b,
+              std::vector<const MemoryObject*> &mutated) const;
+
+    uint64_t size() const { return count; }
+
+    iterator begin() const { return iterator(this); }
+    iterator end() const { return iterator(); }
+  };
+}
+
+#endif
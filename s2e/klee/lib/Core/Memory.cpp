@@ -89,75 +89,138 @@ void MemoryObject::getAllocInfo(std::string &result) const {
 
 /***/
 
+ObjectState::Symbolic::Symbolic(unsigned size)
+  : concreteMask(size, true),
+    flushMask(0),
+    knownSymbolics(0),
+    updates(0, 0) {
+}
+
+ObjectState::Symbolic::Symbolic(const Symbolic &b, unsigned size)
+  : concreteMask(b.concreteMask, size),
+    flushMask(b.flushMask ? new BitArray(*b.flushMask, size) : 0),
+    knownSymbolics(0),
+    updates(b.updates) {
+  if (b.knownSymbolics) {
+    knownSymbolics = new ref<Expr>[size];
+    for (unsigned i=0; i<size; i++)
+      knownSymbolics[i] = b.knownSymbolics[i];
+  }
+}
+
+ObjectState::Symbolic::~Symbolic() {
+  if (flushMask) delete flushMask;
+  if (knownSymbolics) delete[] knownSymbolics;
+}
+
+uint64_t ObjectState::Symbolic::getFootprint(unsigned size) const {
+  uint64_t bytes = sizeof(*this) + ((size + 31) / 32) * sizeof(uint32_t);
+  if (flushMask)
+    bytes += sizeof(*flushMask) + ((size + 31) / 32) * sizeof(uint32_t);
+  if (knownSymbolics)
+    bytes += size * sizeof(ref<Expr>);
+  return bytes;
+}
+
+ObjectState::Stats ObjectState::stats;
+
+void *ObjectState::operator new(size_t objectSize, unsigned storeSize) {
+  return ::operator new(objectSize + storeSize);
+}
+
+void ObjectState::operator delete(void *p, unsigned storeSize) {
+  ::operator delete(p);
+}
+
+void ObjectState::operator delete(void *p) {
+  ::operator delete(p);
+}
+
 ObjectState::ObjectState(const MemoryObject *mo)
-  : concreteMask(0),
+  : symbolic(0),
     copyOnWriteOwner(0),
     refCount(0),
     object(mo),
-    concreteStore(new uint8_t[mo->size]),
-    flushMask(0),
-    knownSymbolics(0),
-    updates(0, 0),
+    concreteStore(reinterpret_cast<uint8_t*>(this + 1)),
     size(mo->size),
     readOnly(false)
      {
+  ++stats.objects;
+  stats.bytes += sizeof(ObjectState) + size;
+
   if (!UseConstantArrays) {
     // FIXME: Leaked.
     static unsigned id = 0;
     const Array *array = new Array("tmp_arr" + llvm::utostr(++id), size);
-    updates = UpdateList(array, 0);
+    getSymbolic().updates = UpdateList(array, 0);
   }
 }
 
 
 ObjectState::ObjectState(const MemoryObject *mo, const Array *array)
-  : concreteMask(0),
+  : symbolic(0),
     copyOnWriteOwner(0),
     refCount(0),
     object(mo),
-    concreteStore(new uint8_t[mo->size]),
-    flushMask(0),
-    knownSymbolics(0),
-    updates(array, 0),
+    concreteStore(reinterpret_cast<uint8_t*>(this + 1)),
     size(mo->size),
     readOnly(false)
  {
+  ++stats.objects;
+  stats.bytes += sizeof(ObjectState) + size;
+
+  getSymbolic().updates = UpdateList(array, 0);
   makeSymbolic();
 }
 
 ObjectState::ObjectState(const ObjectState &os) 
-  : concreteMask(os.concreteMask ? new BitArray(*os.concreteMask, os.size) : 0),
+  : symbolic(0),
     copyOnWriteOwner(0),
     refCount(0),
     object(os.object),
-    concreteStore(new uint8_t[os.size]),
-    flushMask(os.flushMask ? new BitArray(*os.flushMask, os.size) : 0),
-    knownSymbolics(0),
-    updates(os.updates),
+    concreteStore(reinterpret_cast<uint8_t*>(this + 1)),
     size(os.size),
     readOnly(false)
      {
   assert(!os.readOnly && "no need to copy read only object?");
 
-  if (os.knownSymbolics) {
-    knownSymbolics = new ref<Expr>[size];
-    for (unsigned i=0; i<size; i++)
-      knownSymbolics[i] = os.knownSymbolics[i];
+  ++stats.objects;
+  stats.bytes += sizeof(ObjectState) + size;
+
+  if (os.symbolic) {
+    symbolic = new Symbolic(*os.symbolic, size);
+    ++stats.symbolicObjects;
+    stats.symbolicBytes += symbolic->getFootprint(size);
   }
 
   memcpy(concreteStore, os.concreteStore, size*sizeof(*concreteStore));
 }
 
 ObjectState::~ObjectState() {
-  if (concreteMask) delete concreteMask;
-  if (flushMask) delete flushMask;
-  if (knownSymbolics) delete[] knownSymbolics;
-  delete[] concreteStore;
+  if (symbolic) {
+    --stats.symbolicObjects;
+    stats.symbolicBytes -= symbolic->getFootprint(size);
+    delete symbolic;
+  }
+
+  --stats.objects;
+  stats.bytes -= sizeof(ObjectState) + size;
 }
 
 /***/
 
+ObjectState::Symbolic &ObjectState::getSymbolic() const {
+  if (!symbolic) {
+    symbolic = new Symbolic(size);
+    ++stats.symbolicObjects;
+    stats.symbolicBytes += symbolic->getFootprint(size);
+  }
+  return *symbolic;
+}
+
 const UpdateList &ObjectState::getUpdates() const {
+  UpdateList &updates = getSymbolic().updates;
+
   // Constant arrays are created lazily.
   if (!updates.root) {
     // Collect the list of writes, with the oldest writes first.
@@ -214,16 +277,30 @@ const UpdateList &ObjectState::getUpdates() const {
 }
 
 void ObjectState::makeConcrete() {
-  if (concreteMask) delete concreteMask;
-  if (flushMask) delete flushMask;
-  if (knownSymbolics) delete[] knownSymbolics;
-  concreteMask = 0;
-  flushMask = 0;
-  knownSymbolics = 0;
+  if (!symbolic)
+    return;
+
+  stats.symbolicBytes -= symbolic->getFootprint(size);
+
+  // The update list is still needed if it has a root or writes, otherwise
+  // go back to the compact representation.
+  if (symbolic->updates.root || symbolic->updates.head) {
+    if (symbolic->flushMask) delete symbolic->flushMask;
+    if (symbolic->knownSymbolics) delete[] symbolic->knownSymbolics;
+    symbolic->flushMask = 0;
+    symbolic->knownSymbolics = 0;
+    for (unsigned i=0; i<size; i++)
+      symbolic->concreteMask.set(i);
+    stats.symbolicBytes += symbolic->getFootprint(size);
+  } else {
+    --stats.symbolicObjects;
+    delete symbolic;
+    symbolic = 0;
+  }
 }
 
 void ObjectState::makeSymbolic() {
-  assert(!updates.head &&
+  assert(!getSymbolic().updates.head &&
          "XXX makeSymbolic of objects with symbolic values is unsupported");
 
   // XXX simplify this, can just delete various arrays I guess
@@ -264,42 +341,54 @@ void ObjectState::fastRangeCheckOffset(ref<Expr> offset,
 
 void ObjectState::flushRangeForRead(unsigned rangeBase, 
                                     unsigned rangeSize) const {
-  if (!flushMask) flushMask = new BitArray(size, true);
+  Symbolic &sym = getSymbolic();
+  if (!sym.flushMask) {
+    stats.symbolicBytes -= sym.getFootprint(size);
+    sym.flushMask = new BitArray(size, true);
+    stats.symbolicBytes += sym.getFootprint(size);
+  }
  
   for (unsigned offset=rangeBase; offset<rangeBase+rangeSize; offset++) {
     if (!isByteFlushed(offset)) {
       if (isByteConcrete(offset)) {
-        updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       ConstantExpr::create(concreteStore[offset], Expr::Int8));
+        sym.updates.extend(ConstantExpr::create(offset, Expr::Int32),
+                           ConstantExpr::create(concreteStore[offset],
+                                                Expr::Int8));
       } else {
         assert(isByteKnownSymbolic(offset) && "invalid bit set in flushMask");
-        updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       knownSymbolics[offset]);
+        sym.updates.extend(ConstantExpr::create(offset, Expr::Int32),
+                           sym.knownSymbolics[offset]);
       }
 
-      flushMask->unset(offset);
+      sym.flushMask->unset(offset);
     }
   } 
 }
 
 void ObjectState::flushRangeForWrite(unsigned rangeBase, 
                                      unsigned rangeSize) {
-  if (!flushMask) flushMask = new BitArray(size, true);
+  Symbolic &sym = getSymbolic();
+  if (!sym.flushMask) {
+    stats.symbolicBytes -= sym.getFootprint(size);
+    sym.flushMask = new BitArray(size, true);
+    stats.symbolicBytes += sym.getFootprint(size);
+  }
 
   for (unsigned offset=rangeBase; offset<rangeBase+rangeSize; offset++) {
     if (!isByteFlushed(offset)) {
       if (isByteConcrete(offset)) {
-        updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       ConstantExpr::create(concreteStore[offset], Expr::Int8));
+        sym.updates.extend(ConstantExpr::create(offset, Expr::Int32),
+                           ConstantExpr::create(concreteStore[offset],
+                                                Expr::Int8));
         markByteSymbolic(offset);
       } else {
         assert(isByteKnownSymbolic(offset) && "invalid bit set in flushMask");
-        updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       knownSymbolics[offset]);
+        sym.updates.extend(ConstantExpr::create(offset, Expr::Int32),
+                           sym.knownSymbolics[offset]);
         setKnownSymbolic(offset, 0);
       }
 
-      flushMask->unset(offset);
+      sym.flushMask->unset(offset);
     } else {
       // flushed bytes that are written over still need
       // to be marked out
@@ -313,7 +402,7 @@ void ObjectState::flushRangeForWrite(unsigned rangeBase,
 }
 
 bool ObjectState::isAllConcrete() const {
-  return !concreteMask || concreteMask->isAllOnes(size);
+  return !symbolic || symbolic->concreteMask.isAllOnes(size);
 }
 
 
@@ -336,28 +425,32 @@ uint8_t *ObjectState::getConcreteStore(bool allowSymbolic)
 
 
 void ObjectState::markByteSymbolic(unsigned offset) {
-  if (!concreteMask)
-    concreteMask = new BitArray(size, true);
-  concreteMask->unset(offset);
+  getSymbolic().concreteMask.unset(offset);
 }
 
 
 void ObjectState::markByteFlushed(unsigned offset) {
-  if (!flushMask) {
-    flushMask = new BitArray(size, false);
+  Symbolic &sym = getSymbolic();
+  if (!sym.flushMask) {
+    stats.symbolicBytes -= sym.getFootprint(size);
+    sym.flushMask = new BitArray(size, false);
+    stats.symbolicBytes += sym.getFootprint(size);
   } else {
-    flushMask->unset(offset);
+    sym.flushMask->unset(offset);
   }
 }
 
 inline void ObjectState::setKnownSymbolic(unsigned offset,
                                    Expr *value /* can be null */) {
-  if (knownSymbolics) {
-    knownSymbolics[offset] = value;
+  if (symbolic && symbolic->knownSymbolics) {
+    symbolic->knownSymbolics[offset] = value;
   } else {
     if (value) {
-      knownSymbolics = new ref<Expr>[size];
-      knownSymbolics[offset] = value;
+      Symbolic &sym = getSymbolic();
+      stats.symbolicBytes -= sym.getFootprint(size);
+      sym.knownSymbolics = new ref<Expr>[size];
+      stats.symbolicBytes += sym.getFootprint(size);
+      sym.knownSymbolics[offset] = value;
     }
   }
 }
@@ -369,7 +462,7 @@ ref<Expr> ObjectState::read8(unsigned offset) const {
     if (isByteConcrete(offset)) {
       return ConstantExpr::create(concreteStore[offset], Expr::Int8);
     } else if (isByteKnownSymbolic(offset)) {
-      return knownSymbolics[offset];
+      return symbolic->knownSymbolics[offset];
     } else {
       assert(isByteFlushed(offset) && "unflushed byte without cache value");
     
@@ -443,7 +536,7 @@ void ObjectState::write8(ref<Expr> offset, ref<Expr> value) {
                       allocInfo.c_str());
   }
   
-  updates.extend(ZExtExpr::create(offset, Expr::Int32), value);
+  getSymbolic().updates.extend(ZExtExpr::create(offset, Expr::Int32), value);
 }
 
 /***/
@@ -580,7 +673,8 @@ void ObjectState::write64(unsigned offset, uint64_t value) {
 void ObjectState::print() {
   std::cerr << "-- ObjectState --\n";
   std::cerr << "\tMemoryObject ID: " << object->id << "\n";
-  std::cerr << "\tRoot Object: " << updates.root << "\n";
+  std::cerr << "\tRoot Object: " << (symbolic ? symbolic->updates.root : 0)
+            << "\n";
   std::cerr << "\tSize: " << size << "\n";
 
   std::cerr << "\tBytes:\n";
@@ -594,7 +688,9 @@ void ObjectState::print() {
   }
 
   std::cerr << "\tUpdates:\n";
-  for (const UpdateNode *un=updates.head; un; un=un->next) {
+  if (!symbolic)
+    return;
+  for (const UpdateNode *un=symbolic->updates.head; un; un=un->next) {
     std::cerr << "\t\t[" << un->index << "] = " << un->value << "\n";
   }
 }
@@ -17,6 +17,7 @@
 
 namespace klee {
   class ExecutionState;
+  class PortfolioSolver;
   class Solver;
   class STPSolver;
 
@@ -26,6 +27,7 @@ namespace klee {
   public:
     Solver *solver;
     STPSolver *stpSolver;
+    PortfolioSolver *portfolioSolver;
     bool simplifyExprs;
 
   public:
@@ -34,15 +36,24 @@ namespace klee {
     /// \param _simplifyExprs - Whether expressions should be
     /// simplified (via the constraint manager interface) prior to
     /// querying.
+    /// \param _portfolioSolver - The portfolio at the bottom of the solver
+    /// chain, if any, which enforces the timeouts. The STP solver is then
+    /// not part of the chain, and the timing solver owns it.
     TimingSolver(Solver *_solver, STPSolver *_stpSolver, 
-                 bool _simplifyExprs = true) 
-      : solver(_solver), stpSolver(_stpSolver), simplifyExprs(_simplifyExprs) {}
+                 bool _simplifyExprs = true,
+                 PortfolioSolver *_portfolioSolver = 0) 
+      : solver(_solver), stpSolver(_stpSolver),
+        portfolioSolver(_portfolioSolver), simplifyExprs(_simplifyExprs) {}
     ~TimingSolver() {
       delete solver;
+      if (portfolioSolver)
+        delete stpSolver;
     }
 
     void setTimeout(double t) {
       stpSolver->setTimeout(t);
+      if (portfolioSolver)
+        portfolioSolver->setTimeout(t);
     }
 
     bool evaluate(const ExecutionState&, ref<Expr>, Solver::Validity &result);
@@ -0,0 +1,133 @@
+//===-- ConstraintIndependence.cpp ----------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ConstraintIndependence.h"
+
+#include "klee/util/ExprUtil.h"
+
+#include <algorithm>
+
+using namespace klee;
+
+/// Collect the reads of e that may alias with other reads.
+static void findAliasingReads(ref<Expr> e,
+                              std::vector< ref<ReadExpr> > &reads) {
+  std::vector< ref<ReadExpr> > allReads;
+  findReads(e, /* visitUpdates= */ true, allReads);
+
+  for (unsigned i = 0; i != allReads.size(); ++i) {
+    ReadExpr *re = allReads[i].get();
+
+    // Reads of a constant array don't alias.
+    if (re->updates.root->isConstantArray() && !re->updates.head)
+      continue;
+
+    reads.push_back(allReads[i]);
+  }
+}
+
+ConstraintIndependence::ConstraintIndependence(
+    const ConstraintIndependence &b)
+  : refCount(0),
+    count(b.count),
+    parents(b.parents),
+    sizes(b.sizes),
+    successors(b.successors),
+    wholeReaders(b.wholeReaders),
+    byteReaders(b.byteReaders) {
+}
+
+void ConstraintIndependence::unite(unsigned a, unsigned b) {
+  a = find(a);
+  b = find(b);
+  if (a == b)
+    return;
+
+  // Union by size keeps the trees logarithmic without path compression,
+  // so that lookups do not modify the forest.
+  unsigned sizeA = get(sizes, a, 1), sizeB = get(sizes, b, 1);
+  if (sizeA < sizeB)
+    std::swap(a, b);
+
+  parents = parents.insert(std::make_pair(b, a));
+  sizes = sizes.remove(b).replace(std::make_pair(a, sizeA + sizeB));
+
+  // Exchanging the successors of a and b splices their cycles
+  unsigned nextA = get(successors, a, a), nextB = get(successors, b, b);
+  successors = successors.replace(std::make_pair(a, nextB))
+                         .replace(std::make_pair(b, nextA));
+}
+
+void ConstraintIndependence::add(ref<Expr> constraint) {
+  unsigned node = count++;
+
+  std::vector< ref<ReadExpr> > reads;
+  findAliasingReads(constraint, reads);
+
+  for (unsigned i = 0; i != reads.size(); ++i) {
+    ReadExpr *re = reads[i].get();
+    const Array *array = re->updates.root;
+
+    if (const arrays_ty::value_type *whole = wholeReaders.lookup(array)) {
+      unite(node, whole->second);
+    } else if (ConstantExpr *CE = dyn_cast<ConstantExpr>(re->index)) {
+      Byte byte(array, (unsigned) CE->getZExtValue(32));
+      if (const bytes_ty::value_type *reader = byteReaders.lookup(byte))
+        unite(node, reader->second);
+      else
+        byteReaders = byteReaders.insert(std::make_pair(byte, node));
+    } else {
+      // The constraint may read any byte of the array
+      wholeReaders = wholeReaders.insert(std::make_pair(array, node));
+      for (bytes_ty::iterator it = byteReaders.lower_bound(Byte(array, 0)),
+             ie = byteReaders.end(); it != ie && it->first.first == array;
+           ++it)
+        unite(node, it->second);
+    }
+  }
+}
+
+void ConstraintIndependence::addRoots(const Array *array, ref<Expr> index,
+                                      std::vector<unsigned> &roots) const {
+  if (const arrays_ty::value_type *whole = wholeReaders.lookup(array)) {
+    roots.push_back(find(whole->second));
+  } else if (ConstantExpr *CE = dyn_cast<ConstantExpr>(index)) {
+    const bytes_ty::value_type *reader =
+        byteReaders.lookup(Byte(array, (unsigned) CE->getZExtValue(32)));
+    if (reader)
+      roots.push_back(find(reader->second));
+  } else {
+    for (bytes_ty::iterator it = byteReaders.lower_bound(Byte(array, 0)),
+           ie = byteReaders.end(); it != ie && it->first.first == array; ++it)
+      roots.push_back(find(it->second));
+  }
+}
+
+void ConstraintIndependence::getDependentConstraints(
+    ref<Expr> e, std::vector<unsigned> &positions) const {
+  std::vector< ref<ReadExpr> > reads;
+  findAliasingReads(e, reads);
+
+  std::vector<unsigned> roots;
+  for (unsigned i = 0; i != reads.size(); ++i)
+    addRoots(reads[i]->updates.root, reads[i]->index, roots);
+
+  std::sort(roots.begin(), roots.end());
+  roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+
+  for (unsigned i = 0; i != roots.size(); ++i) {
+    unsigned node = roots[i];
+    do {
+      positions.push_back(node);
+      node = get(successors, node, node);
+    } while (node != roots[i]);
+  }
+
+  std::sort(positions.begin(), positions.end());
+}
@@ -0,0 +1,101 @@
+//===-- ConstraintIndependence.h --------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_CONSTRAINTINDEPENDENCE_H
+#define KLEE_CONSTRAINTINDEPENDENCE_H
+
+#include "klee/Expr.h"
+#include "klee/Internal/ADT/ImmutableMap.h"
+
+#include <utility>
+#include <vector>
+
+namespace klee {
+
+  /// ConstraintIndependence - Partitions the constraints of a
+  /// ConstraintManager into sets that read disjoint array bytes.
+  ///
+  /// A constraint reads the bytes at the constant indices of its reads,
+  /// and the whole array for reads at symbolic indices. The partitions are
+  /// kept in a union-find forest over the positions of the constraints,
+  /// which is updated once per added constraint, so that the constraints
+  /// relevant to a query are found without scanning the others.
+  ///
+  /// All the tables are immutable maps, so that copying the partitions of
+  /// a forked state is O(1) and adding a constraint only copies the paths
+  /// to the entries it updates.
+  class ConstraintIndependence {
+  public:
+    unsigned refCount;
+
+  private:
+    typedef std::pair<const Array*, unsigned> Byte;
+
+    typedef ImmutableMap<unsigned, unsigned> links_ty;
+    typedef ImmutableMap<const Array*, unsigned> arrays_ty;
+    typedef ImmutableMap<Byte, unsigned> bytes_ty;
+
+    /// Number of constraints in the partitions
+    unsigned count;
+
+    /// Parents of the constraints that are not the root of their tree
+    links_ty parents;
+    /// Sizes of the partitions of more than one constraint, by root
+    links_ty sizes;
+    /// The constraints of a partition form a cycle of successors, which
+    /// lets unite() merge them in O(log n). Constraints that are alone in
+    /// their partition are their own successor and are not listed.
+    links_ty successors;
+
+    /// A constraint reading the array at a symbolic index
+    arrays_ty wholeReaders;
+    /// The first reader of each byte read at a constant index. The bytes of
+    /// an array are only looked up until the whole array is read.
+    bytes_ty byteReaders;
+
+    static unsigned get(const links_ty &links, unsigned node,
+                        unsigned defaultValue) {
+      const links_ty::value_type *res = links.lookup(node);
+      return res ? res->second : defaultValue;
+    }
+
+    unsigned find(unsigned node) const {
+      while (const links_ty::value_type *parent = parents.lookup(node))
+        node = parent->second;
+      return node;
+    }
+
+    void unite(unsigned a, unsigned b);
+
+    /// Collect the roots of the partitions reading the given array bytes.
+    void addRoots(const Array *array, ref<Expr> index,
+                  std::vector<unsigned> &roots) const;
+
+    /// Unsupported, use copy constructor
+    ConstraintIndependence &operator=(const ConstraintIndependence&);
+
+  public:
+    ConstraintIndependence() : refCount(0), count(0) {}
+    ConstraintIndependence(const ConstraintIndependence &b);
+
+    /// Number of constraints in the partitions
+    unsigned size() const { return count; }
+
+    /// Add the constraint at the next position.
+    void add(ref<Expr> constraint);
+
+    /// Collect the positions of the constraints that transitively read
+    /// the same array bytes as e, in increasing order.
+    void getDependentConstraints(ref<Expr> e,
+                                 std::vector<unsigned> &positions) const;
+  };
+
+}
+
+#endif
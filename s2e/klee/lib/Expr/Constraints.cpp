@@ -9,11 +9,12 @@
 
 #include "klee/Constraints.h"
 
+#include "ConstraintIndependence.h"
+
 #include "klee/util/ExprPPrinter.h"
 #include "klee/util/ExprVisitor.h"
 
 #include <iostream>
-#include <map>
 
 using namespace klee;
 
@@ -43,75 +44,137 @@ public:
 
 class ExprReplaceVisitor2 : public ExprVisitor {
 private:
-  const std::map< ref<Expr>, ref<Expr> > &replacements;
+  typedef ImmutableMap< ref<Expr>, ref<Expr> > replacements_ty;
+  const replacements_ty &replacements;
 
 public:
-  ExprReplaceVisitor2(const std::map< ref<Expr>, ref<Expr> > &_replacements) 
+  ExprReplaceVisitor2(const replacements_ty &_replacements) 
     : ExprVisitor(true),
       replacements(_replacements) {}
 
   Action visitExprPost(const Expr &e) {
-    std::map< ref<Expr>, ref<Expr> >::const_iterator it =
-      replacements.find(ref<Expr>(const_cast<Expr*>(&e)));
-    if (it!=replacements.end()) {
-      return Action::changeTo(it->second);
+    const replacements_ty::value_type *res =
+      replacements.lookup(ref<Expr>(const_cast<Expr*>(&e)));
+    if (res) {
+      return Action::changeTo(res->second);
     } else {
       return Action::doChildren();
     }
   }
 };
 
+/// Bound on the number of cached simplifications of a ConstraintManager.
+/// Every state has its own cache, keep it small: the hits come from the
+/// few expressions that are simplified repeatedly between two forks.
+static const unsigned MaxSimplifyCacheSize = 256;
+
+ConstraintManager::ConstraintManager(const ConstraintManager &cs)
+  : constraints(cs.constraints),
+    equalities(cs.equalities), equalitiesSize(cs.equalitiesSize),
+    independence(cs.independence) {
+  if (independence)
+    ++independence->refCount;
+}
+
+ConstraintManager &ConstraintManager::operator=(const ConstraintManager &cs) {
+  ConstraintIndependence *ci = cs.independence;
+  if (ci)
+    ++ci->refCount;
+  releaseIndependence();
+  constraints = cs.constraints;
+  equalities = cs.equalities;
+  equalitiesSize = cs.equalitiesSize;
+  simplifyCache.clear();
+  independence = ci;
+  return *this;
+}
+
+ConstraintManager::~ConstraintManager() {
+  releaseIndependence();
+}
+
+void ConstraintManager::releaseIndependence() {
+  if (independence && --independence->refCount == 0)
+    delete independence;
+  independence = 0;
+}
+
 bool ConstraintManager::rewriteConstraints(ExprVisitor &visitor) {
-  ConstraintManager::constraints_ty old;
-  bool changed = false;
+  // Keep the unchanged prefix, which is shared with the other states
+  // forked from this one, and rebuild the constraints after it.
+  unsigned first = 0;
+  ref<Expr> e;
+  for (; first != constraints.size(); ++first) {
+    e = visitor.visit(constraints[first]);
+    if (e != constraints[first])
+      break;
+  }
+
+  if (first == constraints.size())
+    return false;
+
+  ConstraintManager::constraints_ty old(constraints);
+  constraints.truncate(first);
+  if (equalitiesSize > first) {
+    equalities = equalities_ty();
+    equalitiesSize = 0;
+  }
+  addConstraintInternal(e); // enable further reductions
 
-  constraints.swap(old);
-  for (ConstraintManager::constraints_ty::iterator 
-         it = old.begin(), ie = old.end(); it != ie; ++it) {
-    ref<Expr> &ce = *it;
-    ref<Expr> e = visitor.visit(ce);
+  for (ConstraintManager::constraints_ty::const_iterator
+         it = old.begin() + first + 1, ie = old.end(); it != ie; ++it) {
+    const ref<Expr> &ce = *it;
+    e = visitor.visit(ce);
 
     if (e!=ce) {
       addConstraintInternal(e); // enable further reductions
-      changed = true;
     } else {
       constraints.push_back(ce);
     }
   }
 
-  return changed;
+  return true;
 }
 
 void ConstraintManager::simplifyForValidConstraint(ref<Expr> e) {
   // XXX 
 }
 
-ref<Expr> ConstraintManager::simplifyExpr(ref<Expr> e) const {
-  if (isa<ConstantExpr>(e))
-    return e;
+void ConstraintManager::updateEqualities() const {
+  for (; equalitiesSize != constraints.size(); ++equalitiesSize) {
+    const ref<Expr> &c = constraints[equalitiesSize];
+    const EqExpr *ee = dyn_cast<EqExpr>(c);
 
-  std::map< ref<Expr>, ref<Expr> > equalities;
-  
-  for (ConstraintManager::constraints_ty::const_iterator 
-         it = constraints.begin(), ie = constraints.end(); it != ie; ++it) {
-    if (const EqExpr *ee = dyn_cast<EqExpr>(*it)) {
-      if (isa<ConstantExpr>(ee->left)) {
-        equalities.insert(std::make_pair(ee->right,
-                                         ee->left));
-      } else {
-        equalities.insert(std::make_pair(*it,
-                                         ConstantExpr::alloc(1, Expr::Bool)));
-      }
+    // The first constraint on an expression wins
+    if (ee && isa<ConstantExpr>(ee->left)) {
+      equalities = equalities.insert(std::make_pair(ee->right,
+                                                    ee->left));
     } else {
-      equalities.insert(std::make_pair(*it,
-                                       ConstantExpr::alloc(1, Expr::Bool)));
+      equalities = equalities.insert(std::make_pair(c,
+                                     ConstantExpr::alloc(1, Expr::Bool)));
     }
   }
+}
 
-  return ExprReplaceVisitor2(equalities).visit(e);
+ref<Expr> ConstraintManager::simplifyExpr(ref<Expr> e) const {
+  if (isa<ConstantExpr>(e))
+    return e;
+
+  ExprHashMap< ref<Expr> >::iterator it = simplifyCache.find(e);
+  if (it != simplifyCache.end())
+    return it->second;
+
+  updateEqualities();
+  ref<Expr> result = ExprReplaceVisitor2(equalities).visit(e);
+
+  if (simplifyCache.size() >= MaxSimplifyCacheSize)
+    simplifyCache.clear();
+  simplifyCache.insert(std::make_pair(e, result));
+
+  return result;
 }
 
-void ConstraintManager::addConstraintInternal(ref<Expr> e) {
+bool ConstraintManager::addConstraintInternal(ref<Expr> e) {
   // rewrite any known equalities 
 
   // XXX should profile the effects of this and the overhead.
@@ -124,33 +187,70 @@ void ConstraintManager::addConstraintInternal(ref<Expr> e) {
   case Expr::Constant:
     assert(cast<ConstantExpr>(e)->isTrue() && 
            "attempt to add invalid (false) constraint");
-    break;
+    return false;
     
     // split to enable finer grained independence and other optimizations
   case Expr::And: {
     BinaryExpr *be = cast<BinaryExpr>(e);
-    addConstraintInternal(be->left);
-    addConstraintInternal(be->right);
-    break;
+    bool rewritten = addConstraintInternal(be->left);
+    return addConstraintInternal(be->right) || rewritten;
   }
 
   case Expr::Eq: {
     BinaryExpr *be = cast<BinaryExpr>(e);
+    bool rewritten = false;
     if (isa<ConstantExpr>(be->left)) {
       ExprReplaceVisitor visitor(be->right, be->left);
-      rewriteConstraints(visitor);
+      rewritten = rewriteConstraints(visitor);
     }
     constraints.push_back(e);
-    break;
+    return rewritten;
   }
     
   default:
     constraints.push_back(e);
-    break;
+    return false;
   }
 }
 
 void ConstraintManager::addConstraint(ref<Expr> e) {
   e = simplifyExpr(e);
-  addConstraintInternal(e);
+  if (!simplifyCache.empty())
+    simplifyCache.clear();
+
+  if (addConstraintInternal(e)) {
+    // The rewritten constraints moved and may read fewer bytes, so the
+    // partitions are rebuilt on the next lookup.
+    releaseIndependence();
+    return;
+  }
+
+  if (!independence || independence->size() == constraints.size())
+    return;
+
+  if (independence->refCount > 1) {
+    --independence->refCount;
+    independence = new ConstraintIndependence(*independence);
+    ++independence->refCount;
+  }
+
+  for (unsigned i = independence->size(); i != constraints.size(); ++i)
+    independence->add(constraints[i]);
+}
+
+void ConstraintManager::getIndependentConstraints(
+    ref<Expr> e, std::vector< ref<Expr> > &result) const {
+  if (!independence) {
+    independence = new ConstraintIndependence();
+    ++independence->refCount;
+    for (unsigned i = 0; i != constraints.size(); ++i)
+      independence->add(constraints[i]);
+  }
+  assert(independence->size() == constraints.size());
+
+  std::vector<unsigned> positions;
+  independence->getDependentConstraints(e, positions);
+
+  for (unsigned i = 0; i != positions.size(); ++i)
+    result.push_back(constraints[positions[i]]);
 }
@@ -0,0 +1,156 @@
+//===-- ExprAllocator.cpp -------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/util/ExprAllocator.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+using namespace klee;
+
+namespace {
+  struct FreeObject {
+    FreeObject *next;
+  };
+
+  /// The pools are plain data, zero-initialized before any static
+  /// constructor may allocate an expression.
+  struct SizeClass {
+    volatile int lock;
+    FreeObject *freeList;
+    uint64_t live;
+    uint64_t allocations;
+  };
+
+  SizeClass sizeClasses[ExprAllocator::NumClasses];
+
+  volatile int largeLock;
+  uint64_t largeLive, largeLiveBytes, largeAllocations;
+  uint64_t slabBytes;
+
+  class SpinLock {
+    volatile int &lock;
+
+  public:
+    SpinLock(volatile int &_lock) : lock(_lock) {
+      while (__sync_lock_test_and_set(&lock, 1))
+        while (lock)
+          ;
+    }
+
+    ~SpinLock() {
+      __sync_lock_release(&lock);
+    }
+  };
+
+  inline unsigned getClass(size_t size) {
+    return (size + ExprAllocator::Granularity - 1) /
+           ExprAllocator::Granularity - 1;
+  }
+
+  /// Carve a new slab into free objects of the given class. Called with
+  /// the lock of the class held.
+  void refill(SizeClass &sc, unsigned index) {
+    size_t objectSize = (index + 1) * ExprAllocator::Granularity;
+    char *slab = static_cast<char*>(malloc(ExprAllocator::SlabSize));
+    if (!slab)
+      throw std::bad_alloc();
+
+    __sync_fetch_and_add(&slabBytes, (uint64_t) ExprAllocator::SlabSize);
+
+    unsigned count = ExprAllocator::SlabSize / objectSize;
+    for (unsigned i = count; i > 0; --i) {
+      FreeObject *obj = reinterpret_cast<FreeObject*>(slab +
+                                                      (i - 1) * objectSize);
+      obj->next = sc.freeList;
+      sc.freeList = obj;
+    }
+  }
+}
+
+void *ExprAllocator::allocate(size_t size) {
+  if (size == 0)
+    size = 1;
+
+  if (size > MaxSize) {
+    void *p = malloc(size);
+    if (!p)
+      throw std::bad_alloc();
+
+    SpinLock guard(largeLock);
+    ++largeLive;
+    largeLiveBytes += size;
+    ++largeAllocations;
+    return p;
+  }
+
+  unsigned index = getClass(size);
+  SizeClass &sc = sizeClasses[index];
+  SpinLock guard(sc.lock);
+
+  if (!sc.freeList)
+    refill(sc, index);
+
+  FreeObject *obj = sc.freeList;
+  sc.freeList = obj->next;
+  ++sc.live;
+  ++sc.allocations;
+  return obj;
+}
+
+void ExprAllocator::deallocate(void *p, size_t size) {
+  if (!p)
+    return;
+
+  if (size == 0)
+    size = 1;
+
+  if (size > MaxSize) {
+    free(p);
+
+    SpinLock guard(largeLock);
+    assert(largeLive && "freeing more objects than allocated");
+    --largeLive;
+    largeLiveBytes -= size;
+    return;
+  }
+
+  SizeClass &sc = sizeClasses[getClass(size)];
+  SpinLock guard(sc.lock);
+
+  assert(sc.live && "freeing more objects than allocated");
+  FreeObject *obj = static_cast<FreeObject*>(p);
+  obj->next = sc.freeList;
+  sc.freeList = obj;
+  --sc.live;
+}
+
+void ExprAllocator::getStats(Stats &stats) {
+  stats.liveObjects = 0;
+  stats.liveBytes = 0;
+  stats.allocations = 0;
+
+  for (unsigned i = 0; i < NumClasses; ++i) {
+    SizeClass &sc = sizeClasses[i];
+    SpinLock guard(sc.lock);
+    stats.liveObjects += sc.live;
+    stats.liveBytes += sc.live * (i + 1) * Granularity;
+    stats.allocations += sc.allocations;
+  }
+
+  {
+    SpinLock guard(largeLock);
+    stats.liveObjects += largeLive;
+    stats.liveBytes += largeLiveBytes;
+    stats.allocations += largeAllocations;
+  }
+
+  stats.slabBytes = __sync_fetch_and_add(&slabBytes, (uint64_t) 0);
+}
@@ -9,6 +9,9 @@
 
 #include "klee/ExprBuilder.h"
 
+#include <cassert>
+#include <tr1/unordered_map>
+
 using namespace klee;
 
 ExprBuilder::ExprBuilder() {
@@ -1052,6 +1055,228 @@ namespace {
 
   typedef ConstantSpecializedExprBuilder<SimplifyingBuilder>
     SimplifyingExprBuilder;
+
+  /// The unique table of the hash-consing builders, indexed by hash. It
+  /// only holds weak references: expressions remove themselves from it when
+  /// they die. It is never destroyed, since interned expressions may be
+  /// destroyed after static destructors have run. Neither the table nor
+  /// uniqueTableHits are protected against concurrent accesses.
+  typedef std::tr1::unordered_multimap<unsigned, Expr*> UniqueTable;
+
+  UniqueTable &getUniqueTable() {
+    static UniqueTable *table = new UniqueTable();
+    return *table;
+  }
+
+  uint64_t uniqueTableHits = 0;
+
+  /// Structural equality of expressions whose kids are interned.
+  bool shallowEquals(const Expr *a, const Expr *b) {
+    if (a->getKind() != b->getKind() || a->getWidth() != b->getWidth())
+      return false;
+    if (a->compareContents(*b))
+      return false;
+    for (unsigned i = 0, e = a->getNumKids(); i != e; ++i)
+      if (a->getKid(i).get() != b->getKid(i).get())
+        return false;
+    return true;
+  }
+
+  /// intern - Return the unique node structurally equal to the given
+  /// expression, adding it (and its kids) to the unique table if needed.
+  ref<Expr> intern(const ref<Expr> &e) {
+    if (e->interned)
+      return e;
+
+    unsigned numKids = e->getNumKids();
+    ref<Expr> kids[3];
+    bool rebuild = false;
+    assert(numKids <= 3 && "unexpected number of kids");
+    for (unsigned i = 0; i != numKids; ++i) {
+      ref<Expr> kid = e->getKid(i);
+      kids[i] = intern(kid);
+      rebuild |= kids[i].get() != kid.get();
+    }
+
+    if (rebuild)
+      return intern(e->rebuild(kids));
+
+    UniqueTable &table = getUniqueTable();
+    std::pair<UniqueTable::iterator, UniqueTable::iterator> range =
+      table.equal_range(e->hash());
+    for (UniqueTable::iterator it = range.first; it != range.second; ++it) {
+      if (shallowEquals(it->second, e.get())) {
+        ++uniqueTableHits;
+        return it->second;
+      }
+    }
+
+    table.insert(std::make_pair(e->hash(), e.get()));
+    e->interned = true;
+    return e;
+  }
+
+  /// HashConsingExprBuilder - Intern the kids and the results of the base
+  /// builder, so that structurally identical expressions share one node.
+  /// Nodes are still allocated by the base builder, a new node which already
+  /// has an interned twin dies as soon as it is replaced.
+  class HashConsingExprBuilder : public ExprBuilder {
+    ExprBuilder *Base;
+
+  public:
+    HashConsingExprBuilder(ExprBuilder *_Base) : Base(_Base) {}
+    ~HashConsingExprBuilder() { delete Base; }
+
+    virtual ref<Expr> Constant(const llvm::APInt &Value) {
+      return intern(Base->Constant(Value));
+    }
+
+    virtual ref<Expr> NotOptimized(const ref<Expr> &Index) {
+      return intern(Base->NotOptimized(intern(Index)));
+    }
+
+    virtual ref<Expr> Read(const UpdateList &Updates,
+                           const ref<Expr> &Index) {
+      return intern(Base->Read(Updates, intern(Index)));
+    }
+
+    virtual ref<Expr> Select(const ref<Expr> &Cond,
+                             const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Select(intern(Cond), intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Concat(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Concat(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Extract(const ref<Expr> &LHS,
+                              unsigned Offset, Expr::Width W) {
+      return intern(Base->Extract(intern(LHS), Offset, W));
+    }
+
+    virtual ref<Expr> ZExt(const ref<Expr> &LHS, Expr::Width W) {
+      return intern(Base->ZExt(intern(LHS), W));
+    }
+
+    virtual ref<Expr> SExt(const ref<Expr> &LHS, Expr::Width W) {
+      return intern(Base->SExt(intern(LHS), W));
+    }
+
+    virtual ref<Expr> Not(const ref<Expr> &LHS) {
+      return intern(Base->Not(intern(LHS)));
+    }
+
+    virtual ref<Expr> Add(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Add(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Sub(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Sub(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Mul(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Mul(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> UDiv(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->UDiv(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> SDiv(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->SDiv(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> URem(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->URem(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> SRem(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->SRem(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> And(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->And(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Or(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Or(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Xor(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Xor(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Shl(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Shl(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> LShr(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->LShr(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> AShr(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->AShr(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Eq(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Eq(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Ne(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Ne(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Ult(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Ult(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Ule(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Ule(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Ugt(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Ugt(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Uge(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Uge(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Slt(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Slt(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Sle(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Sle(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Sgt(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Sgt(intern(LHS), intern(RHS)));
+    }
+
+    virtual ref<Expr> Sge(const ref<Expr> &LHS, const ref<Expr> &RHS) {
+      return intern(Base->Sge(intern(LHS), intern(RHS)));
+    }
+  };
+}
+
+void Expr::removeInterned(Expr *e) {
+  // Called from ~Expr, only the base class fields can be used
+  UniqueTable &table = getUniqueTable();
+  std::pair<UniqueTable::iterator, UniqueTable::iterator> range =
+    table.equal_range(e->hashValue);
+  for (UniqueTable::iterator it = range.first; it != range.second; ++it) {
+    if (it->second == e) {
+      table.erase(it);
+      return;
+    }
+  }
+  assert(0 && "interned expression missing from the unique table");
+}
+
+void klee::getHashConsingStats(uint64_t &live, uint64_t &hits) {
+  live = getUniqueTable().size();
+  hits = uniqueTableHits;
 }
 
 ExprBuilder *klee::createDefaultExprBuilder() {
@@ -1065,3 +1290,7 @@ ExprBuilder *klee::createConstantFoldingExprBuilder(ExprBuilder *Base) {
 ExprBuilder *klee::createSimplifyingExprBuilder(ExprBuilder *Base) {
   return new SimplifyingExprBuilder(Base);
 }
+
+ExprBuilder *klee::createHashConsingExprBuilder(ExprBuilder *Base) {
+  return new HashConsingExprBuilder(Base);
+}
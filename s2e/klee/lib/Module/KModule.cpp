@@ -93,46 +93,56 @@ extern void CreateOptimizePasses(PassManagerBase&, Module*);
 
 namespace klee {
 
-struct KModulePrivate {
-  llvm::PassManager pmOptimize, pm3, pm4;
+struct FunctionOptimizerPrivate {
+  llvm::TargetData targetData;
   llvm::FunctionPassManager fpmOptimize, fpm3, fpm4;
 
-  KModulePrivate(llvm::Module *module,
-                 llvm::TargetData *targetData)
-          :
+  FunctionOptimizerPrivate(llvm::Module *module)
+          : targetData(module),
             fpmOptimize(module),
             fpm3(module),
             fpm4(module) {
 
-    pm3.add(createCFGSimplificationPass());
     fpm3.add(createCFGSimplificationPass());
+    if (SwitchType == eSwitchTypeSimple)
+      fpm3.add(new LowerSwitchPass());
+    fpm3.add(new IntrinsicFunctionCleanerPass());
+
+    fpm4.add(new IntrinsicCleanerPass(targetData));
+    fpm4.add(new PhiCleanerPass());
+
+    CreateOptimizePasses(fpmOptimize, module);
+    fpmOptimize.doInitialization();
+  }
+};
+
+struct KModulePrivate {
+  llvm::PassManager pmOptimize, pm3, pm4;
+  FunctionOptimizer functionOptimizer;
+
+  KModulePrivate(llvm::Module *module,
+                 llvm::TargetData *targetData)
+          : functionOptimizer(module) {
+
+    pm3.add(createCFGSimplificationPass());
 
     switch(SwitchType) {
     case eSwitchTypeInternal: break;
     case eSwitchTypeSimple:
       pm3.add(new LowerSwitchPass());
-      fpm3.add(new LowerSwitchPass());
       break;
     case eSwitchTypeLLVM:
       pm3.add(createLowerSwitchPass()); break;
-      fpm3.add(createLowerSwitchPass()); break;
     default: klee_error("invalid --switch-type");
     }
     pm3.add(new IntrinsicCleanerPass(*targetData));
-    fpm3.add(new IntrinsicFunctionCleanerPass());
 
     //pm3.add(new PhiCleanerPass());
 
     pm4.add(new PhiCleanerPass());
     pm4.add(new IntrinsicCleanerPass(*targetData));
 
-    fpm4.add(new IntrinsicCleanerPass(*targetData));
-    fpm4.add(new PhiCleanerPass());
-
     CreateOptimizePasses(pmOptimize, module);
-
-    CreateOptimizePasses(fpmOptimize, module);
-    fpmOptimize.doInitialization();
   }
 
   ~KModulePrivate() {
@@ -140,6 +150,21 @@ struct KModulePrivate {
   }
 };
 
+FunctionOptimizer::FunctionOptimizer(llvm::Module *module)
+  : p(new FunctionOptimizerPrivate(module)) {
+}
+
+FunctionOptimizer::~FunctionOptimizer() {
+  delete p;
+}
+
+void FunctionOptimizer::run(llvm::Function *f) {
+  p->fpmOptimize.run(*f);
+
+  p->fpm3.run(*f);
+  p->fpm4.run(*f);
+}
+
 } // namespace klee
 
 KModule::KModule(Module *_module) 
@@ -543,7 +568,8 @@ void KModule::prepare(const Interpreter::ModuleOptions &opts,
   }
 }
 
-KFunction* KModule::updateModuleWithFunction(llvm::Function *f)
+KFunction* KModule::updateModuleWithFunction(llvm::Function *f,
+                                             bool optimize)
 {
     assert(functionMap.find(f) == functionMap.end());
 
@@ -552,10 +578,9 @@ KFunction* KModule::updateModuleWithFunction(llvm::Function *f)
     //IntrinsicCleanerPass ip(*targetData, false);
     //ip.runOnFunction(*f);
 
-    p->fpmOptimize.run(*f);
-
-    p->fpm3.run(*f);
-    p->fpm4.run(*f);
+    if (optimize) {
+        p->functionOptimizer.run(f);
+    }
 
     KFunction *kf = new KFunction(f, this);
 
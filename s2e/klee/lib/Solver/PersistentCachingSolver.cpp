@@ -0,0 +1,286 @@
+//===-- PersistentCachingSolver.cpp - On-disk query cache -----------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/IncompleteSolver.h"
+#include "klee/SolverImpl.h"
+#include "klee/SolverStats.h"
+#include "klee/util/ExprPPrinter.h"
+#include "klee/Internal/Support/SolverCacheFile.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <string.h>
+
+using namespace klee;
+
+/// Caches validity results and counterexamples in a SolverCacheFile, so that
+/// they survive across runs. Queries are identified by their textual form as
+/// printed by ExprPPrinter::printQuery.
+class PersistentCachingSolver : public SolverImpl {
+private:
+  Solver *solver;
+  SolverCacheFile file;
+
+  ref<Expr> canonicalizeQuery(ref<Expr> originalQuery,
+                              bool &negationUsed);
+
+  std::string getKey(const Query &query,
+                     const std::vector<const Array*> *objects);
+
+  bool cacheLookup(const Query& query,
+                   IncompleteSolver::PartialValidity &result);
+  void cacheInsert(const Query& query,
+                   IncompleteSolver::PartialValidity result);
+
+public:
+  PersistentCachingSolver(Solver *s, const std::string &path);
+  ~PersistentCachingSolver() { delete solver; }
+
+  bool computeValidity(const Query&, Solver::Validity &result);
+  bool computeTruth(const Query&, bool &isValid);
+  bool computeValue(const Query& query, ref<Expr> &result) {
+    return solver->impl->computeValue(query, result);
+  }
+  bool computeInitialValues(const Query& query,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution);
+};
+
+PersistentCachingSolver::PersistentCachingSolver(Solver *s,
+                                                 const std::string &path)
+  : solver(s) {
+  std::string error;
+  if (!file.open(path, false, error)) {
+    llvm::errs() << "KLEE: WARNING: persistent solver cache disabled, "
+                 << error << "\n";
+  }
+}
+
+ref<Expr> PersistentCachingSolver::canonicalizeQuery(ref<Expr> originalQuery,
+                                                     bool &negationUsed) {
+  ref<Expr> negatedQuery = Expr::createIsZero(originalQuery);
+
+  if (originalQuery.compare(negatedQuery) < 0) {
+    negationUsed = false;
+    return originalQuery;
+  } else {
+    negationUsed = true;
+    return negatedQuery;
+  }
+}
+
+std::string
+PersistentCachingSolver::getKey(const Query &query,
+                                const std::vector<const Array*> *objects) {
+  std::string key;
+  llvm::raw_string_ostream os(key);
+
+  if (objects && !objects->empty()) {
+    ExprPPrinter::printQuery(os, query.constraints, query.expr, 0, 0,
+                             &(*objects)[0],
+                             &(*objects)[0] + objects->size());
+  } else {
+    ExprPPrinter::printQuery(os, query.constraints, query.expr);
+  }
+
+  os.flush();
+  return key;
+}
+
+bool PersistentCachingSolver::cacheLookup(const Query& query,
+                                          IncompleteSolver::PartialValidity &result) {
+  bool negationUsed;
+  ref<Expr> canonicalQuery = canonicalizeQuery(query.expr, negationUsed);
+
+  std::string value;
+  if (!file.lookup(SolverCacheFile::Validity,
+                   getKey(query.withExpr(canonicalQuery), 0), value) ||
+      value.size() != 1)
+    return false;
+
+  IncompleteSolver::PartialValidity cached =
+    (IncompleteSolver::PartialValidity) (int8_t) value[0];
+  result = (negationUsed ?
+            IncompleteSolver::negatePartialValidity(cached) : cached);
+  return true;
+}
+
+void PersistentCachingSolver::cacheInsert(const Query& query,
+                                          IncompleteSolver::PartialValidity result) {
+  bool negationUsed;
+  ref<Expr> canonicalQuery = canonicalizeQuery(query.expr, negationUsed);
+  IncompleteSolver::PartialValidity cachedResult =
+    (negationUsed ? IncompleteSolver::negatePartialValidity(result) : result);
+
+  file.append(SolverCacheFile::Validity,
+              getKey(query.withExpr(canonicalQuery), 0),
+              std::string(1, (char) (int8_t) cachedResult));
+}
+
+bool PersistentCachingSolver::computeValidity(const Query& query,
+                                              Solver::Validity &result) {
+  IncompleteSolver::PartialValidity cachedResult;
+  bool tmp, cacheHit = cacheLookup(query, cachedResult);
+
+  if (cacheHit) {
+    ++stats::persistentQueryCacheHits;
+
+    switch(cachedResult) {
+    case IncompleteSolver::MustBeTrue:
+      result = Solver::True;
+      return true;
+    case IncompleteSolver::MustBeFalse:
+      result = Solver::False;
+      return true;
+    case IncompleteSolver::TrueOrFalse:
+      result = Solver::Unknown;
+      return true;
+    case IncompleteSolver::MayBeTrue: {
+      if (!solver->impl->computeTruth(query, tmp))
+        return false;
+      cachedResult = tmp ? IncompleteSolver::MustBeTrue :
+                           IncompleteSolver::TrueOrFalse;
+      cacheInsert(query, cachedResult);
+      result = tmp ? Solver::True : Solver::Unknown;
+      return true;
+    }
+    case IncompleteSolver::MayBeFalse: {
+      if (!solver->impl->computeTruth(query.negateExpr(), tmp))
+        return false;
+      cachedResult = tmp ? IncompleteSolver::MustBeFalse :
+                           IncompleteSolver::TrueOrFalse;
+      cacheInsert(query, cachedResult);
+      result = tmp ? Solver::False : Solver::Unknown;
+      return true;
+    }
+    default:
+      // Unknown value, e.g., from a corrupted file
+      break;
+    }
+  }
+
+  ++stats::persistentQueryCacheMisses;
+
+  if (!solver->impl->computeValidity(query, result))
+    return false;
+
+  switch (result) {
+  case Solver::True:
+    cachedResult = IncompleteSolver::MustBeTrue; break;
+  case Solver::False:
+    cachedResult = IncompleteSolver::MustBeFalse; break;
+  default:
+    cachedResult = IncompleteSolver::TrueOrFalse; break;
+  }
+
+  cacheInsert(query, cachedResult);
+  return true;
+}
+
+bool PersistentCachingSolver::computeTruth(const Query& query,
+                                           bool &isValid) {
+  IncompleteSolver::PartialValidity cachedResult;
+  bool cacheHit = cacheLookup(query, cachedResult);
+
+  if (cacheHit) {
+    switch (cachedResult) {
+    case IncompleteSolver::MustBeTrue:
+    case IncompleteSolver::MustBeFalse:
+    case IncompleteSolver::MayBeFalse:
+    case IncompleteSolver::TrueOrFalse:
+      ++stats::persistentQueryCacheHits;
+      isValid = (cachedResult == IncompleteSolver::MustBeTrue);
+      return true;
+    default:
+      break;
+    }
+  }
+
+  ++stats::persistentQueryCacheMisses;
+
+  if (!solver->impl->computeTruth(query, isValid))
+    return false;
+
+  if (isValid) {
+    cachedResult = IncompleteSolver::MustBeTrue;
+  } else if (cacheHit && cachedResult == IncompleteSolver::MayBeTrue) {
+    cachedResult = IncompleteSolver::TrueOrFalse;
+  } else {
+    cachedResult = IncompleteSolver::MayBeFalse;
+  }
+
+  cacheInsert(query, cachedResult);
+  return true;
+}
+
+/// Counterexamples are stored as a solution flag followed by the size
+/// (32 bits) and the bytes of each object.
+bool PersistentCachingSolver::computeInitialValues(const Query& query,
+                                                   const std::vector<const Array*> &objects,
+                                                   std::vector< std::vector<unsigned char> > &values,
+                                                   bool &hasSolution) {
+  std::string key = getKey(query, &objects);
+  std::string value;
+
+  if (file.lookup(SolverCacheFile::InitialValues, key, value) &&
+      !value.empty()) {
+    std::vector< std::vector<unsigned char> > cachedValues;
+    const char *p = value.data() + 1, *end = value.data() + value.size();
+    bool valid = true;
+
+    if (value[0]) {
+      for (unsigned i = 0; i < objects.size(); ++i) {
+        uint32_t size;
+        if (p + sizeof(size) > end) { valid = false; break; }
+        memcpy(&size, p, sizeof(size));
+        p += sizeof(size);
+        if (size != objects[i]->size || p + size > end) { valid = false; break; }
+        cachedValues.push_back(std::vector<unsigned char>(p, p + size));
+        p += size;
+      }
+    }
+
+    if (valid) {
+      ++stats::persistentQueryCacheHits;
+      hasSolution = value[0] != 0;
+      values.swap(cachedValues);
+      return true;
+    }
+  }
+
+  ++stats::persistentQueryCacheMisses;
+
+  if (!solver->impl->computeInitialValues(query, objects, values, hasSolution))
+    return false;
+
+  value.assign(1, hasSolution ? 1 : 0);
+  if (hasSolution) {
+    for (unsigned i = 0; i < values.size(); ++i) {
+      uint32_t size = values[i].size();
+      value.append((const char*) &size, sizeof(size));
+      if (size)
+        value.append((const char*) &values[i][0], size);
+    }
+  }
+
+  file.append(SolverCacheFile::InitialValues, key, value);
+  return true;
+}
+
+///
+
+Solver *klee::createPersistentCachingSolver(Solver *_solver,
+                                            const std::string &path) {
+  return new Solver(new PersistentCachingSolver(_solver, path));
+}
@@ -0,0 +1,471 @@
+//===-- PortfolioSolver.cpp -----------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+
+#include "STPWorkerPool.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/SolverImpl.h"
+#include "klee/SolverStats.h"
+#include "klee/Statistic.h"
+#include "klee/util/Assignment.h"
+#include "klee/util/ExprUtil.h"
+#include "klee/Internal/System/Time.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <cassert>
+#include <cstdio>
+#include <exception>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace klee;
+
+extern llvm::raw_ostream *g_solverLog;
+
+/*
+ * Each solver of the portfolio runs in its own long-lived worker process.
+ * Queries that the workers cannot parse back are raced in child processes
+ * forked for them, which write their answer to a pipe: a status byte,
+ * followed by the contents of the requested arrays if a solution was found.
+ */
+
+namespace {
+  enum RunnerStatus {
+    StatusSolution = 0,
+    StatusNoSolution = 1,
+    StatusFailure = 2
+  };
+
+  struct Runner {
+    pid_t pid;
+    int fd;
+  };
+
+  bool readFully(int fd, void *buffer, size_t size) {
+    uint8_t *p = static_cast<uint8_t*>(buffer);
+    while (size) {
+      ssize_t ret = read(fd, p, size);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return false;
+      p += ret;
+      size -= ret;
+    }
+    return true;
+  }
+
+  bool writeFully(int fd, const void *buffer, size_t size) {
+    const uint8_t *p = static_cast<const uint8_t*>(buffer);
+    while (size) {
+      ssize_t ret = write(fd, p, size);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return false;
+      p += ret;
+      size -= ret;
+    }
+    return true;
+  }
+}
+
+class PortfolioSolverImpl : public SolverImpl {
+private:
+  struct Backend {
+    Solver *solver;
+    Statistic *wins;
+    /// The worker running the solver
+    STPWorkerPool *pool;
+  };
+
+  std::vector<Backend> backends;
+  double timeout;
+
+  static void runBackend(Solver *solver, int fd, const Query &query,
+                         const std::vector<const Array*> &objects);
+
+  bool spawn(Solver *solver, Runner &runner, const Query &query,
+             const std::vector<const Array*> &objects);
+
+  /// race - Send the query to the workers of the backends and wait for
+  /// the first answer. The workers of the other backends are killed and
+  /// respawned for the next query. Returns the index of the winning
+  /// backend, or -1. unsupported is set if a worker could not parse the
+  /// query back.
+  int race(const Query &query,
+           const std::vector<const Array*> &objects,
+           std::vector< std::vector<unsigned char> > &values,
+           bool &hasSolution, bool &unsupported);
+
+  /// raceForked - Like race, but runs each backend in a process forked
+  /// for the query.
+  int raceForked(const Query &query,
+                 const std::vector<const Array*> &objects,
+                 std::vector< std::vector<unsigned char> > &values,
+                 bool &hasSolution);
+
+public:
+  PortfolioSolverImpl() : timeout(0.0) {}
+  ~PortfolioSolverImpl();
+
+  void addSolver(Solver *solver, Statistic *wins) {
+    Backend backend;
+    backend.solver = solver;
+    backend.wins = wins;
+    backend.pool = new STPWorkerPool(1, solver);
+    backends.push_back(backend);
+  }
+
+  void setTimeout(double _timeout) { timeout = _timeout; }
+
+  bool computeTruth(const Query&, bool &isValid);
+  bool computeValue(const Query&, ref<Expr> &result);
+  bool computeInitialValues(const Query&,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution);
+};
+
+PortfolioSolverImpl::~PortfolioSolverImpl() {
+  for (unsigned i = 0; i < backends.size(); ++i) {
+    delete backends[i].pool;
+    delete backends[i].solver;
+  }
+}
+
+void PortfolioSolverImpl::runBackend(Solver *solver, int fd,
+                                     const Query &query,
+                                     const std::vector<const Array*> &objects) {
+  // The log belongs to the parent process
+  g_solverLog = NULL;
+
+  std::vector< std::vector<unsigned char> > values;
+  bool hasSolution = false;
+  uint8_t status = StatusFailure;
+
+  try {
+    if (solver->impl->computeInitialValues(query, objects, values,
+                                           hasSolution))
+      status = hasSolution ? StatusSolution : StatusNoSolution;
+  } catch (std::exception &) {
+    status = StatusFailure;
+  }
+
+  if (writeFully(fd, &status, sizeof(status)) && status == StatusSolution) {
+    for (unsigned i = 0; i < values.size(); ++i) {
+      assert(values[i].size() == objects[i]->size);
+      if (!values[i].empty() &&
+          !writeFully(fd, &values[i][0], values[i].size()))
+        break;
+    }
+  }
+
+  _exit(0);
+}
+
+bool PortfolioSolverImpl::spawn(Solver *solver, Runner &runner,
+                                const Query &query,
+                                const std::vector<const Array*> &objects) {
+  int fds[2];
+  if (pipe(fds) < 0) {
+    perror("pipe() for portfolio solver");
+    return false;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork() for portfolio solver");
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+
+  if (pid == 0) {
+    close(fds[0]);
+    runBackend(solver, fds[1], query, objects);
+  }
+
+  close(fds[1]);
+  runner.pid = pid;
+  runner.fd = fds[0];
+  return true;
+}
+
+int PortfolioSolverImpl::race(const Query &query,
+                              const std::vector<const Array*> &objects,
+                              std::vector< std::vector<unsigned char> > &values,
+                              bool &hasSolution, bool &unsupported) {
+  std::vector<uint64_t> tickets(backends.size());
+  unsigned numRunning = 0;
+
+  for (unsigned i = 0; i < backends.size(); ++i) {
+    tickets[i] = backends[i].pool->submitInitialValues(query, objects,
+                                                       timeout);
+    if (tickets[i])
+      ++numRunning;
+  }
+
+  double deadline = util::getWallTime() + timeout;
+  int winner = -1;
+
+  while (winner < 0 && numRunning) {
+    int ms = -1;
+    if (timeout) {
+      double remaining = deadline - util::getWallTime();
+      if (remaining <= 0)
+        break;
+      ms = (int) (remaining * 1000) + 1;
+    }
+
+    std::vector<struct pollfd> pfds;
+    std::vector<unsigned> indices;
+    for (unsigned i = 0; i < backends.size(); ++i) {
+      if (!tickets[i])
+        continue;
+      struct pollfd pfd;
+      pfd.fd = backends[i].pool->getAnswerDescriptor(tickets[i]);
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      pfds.push_back(pfd);
+      indices.push_back(i);
+    }
+
+    int ret = poll(&pfds[0], pfds.size(), ms);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0) {
+      perror("poll() for portfolio solver");
+      break;
+    }
+
+    for (unsigned j = 0; winner < 0 && j < pfds.size(); ++j) {
+      if (!pfds[j].revents)
+        continue;
+
+      unsigned i = indices[j];
+      uint64_t ticket = tickets[i];
+      tickets[i] = 0;
+      --numRunning;
+
+      // A worker that died without answering counts as a failure
+      std::vector< std::vector<unsigned char> > result;
+      bool solution;
+      STPWorkerPool::Result res =
+        backends[i].pool->receiveInitialValues(ticket, objects, result,
+                                               solution);
+      if (res == STPWorkerPool::Unsupported) {
+        unsupported = true;
+      } else if (res == STPWorkerPool::Success) {
+        winner = i;
+        hasSolution = solution;
+        values.swap(result);
+      }
+    }
+  }
+
+  // Losing workers could keep solving forever, replace them
+  for (unsigned i = 0; i < backends.size(); ++i) {
+    if (tickets[i])
+      backends[i].pool->cancel(tickets[i]);
+  }
+
+  return winner;
+}
+
+int PortfolioSolverImpl::raceForked(const Query &query,
+                                    const std::vector<const Array*> &objects,
+                                    std::vector< std::vector<unsigned char> > &values,
+                                    bool &hasSolution) {
+  std::vector<Runner> runners(backends.size());
+  std::vector<bool> running(backends.size());
+  unsigned numRunning = 0;
+
+  for (unsigned i = 0; i < backends.size(); ++i) {
+    runners[i].pid = -1;
+    runners[i].fd = -1;
+    running[i] = spawn(backends[i].solver, runners[i], query, objects);
+    if (running[i])
+      ++numRunning;
+  }
+
+  double deadline = util::getWallTime() + timeout;
+  int winner = -1;
+
+  while (winner < 0 && numRunning) {
+    int ms = -1;
+    if (timeout) {
+      double remaining = deadline - util::getWallTime();
+      if (remaining <= 0)
+        break;
+      ms = (int) (remaining * 1000) + 1;
+    }
+
+    std::vector<struct pollfd> pfds;
+    std::vector<unsigned> indices;
+    for (unsigned i = 0; i < runners.size(); ++i) {
+      if (!running[i])
+        continue;
+      struct pollfd pfd;
+      pfd.fd = runners[i].fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      pfds.push_back(pfd);
+      indices.push_back(i);
+    }
+
+    int ret = poll(&pfds[0], pfds.size(), ms);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0) {
+      perror("poll() for portfolio solver");
+      break;
+    }
+
+    for (unsigned j = 0; winner < 0 && j < pfds.size(); ++j) {
+      if (!pfds[j].revents)
+        continue;
+
+      unsigned i = indices[j];
+      running[i] = false;
+      --numRunning;
+
+      // A runner that died without answering counts as a failure
+      uint8_t status;
+      if (!readFully(runners[i].fd, &status, sizeof(status)) ||
+          status == StatusFailure)
+        continue;
+
+      std::vector< std::vector<unsigned char> > result;
+      bool complete = true;
+      if (status == StatusSolution) {
+        result.resize(objects.size());
+        for (unsigned k = 0; complete && k < objects.size(); ++k) {
+          result[k].resize(objects[k]->size);
+          complete = !objects[k]->size ||
+                     readFully(runners[i].fd, &result[k][0], objects[k]->size);
+        }
+      }
+
+      if (complete) {
+        winner = i;
+        hasSolution = status == StatusSolution;
+        values.swap(result);
+      }
+    }
+  }
+
+  // Cancel the solvers that are still running
+  for (unsigned i = 0; i < runners.size(); ++i) {
+    if (running[i])
+      ::kill(runners[i].pid, SIGKILL);
+  }
+
+  for (unsigned i = 0; i < runners.size(); ++i) {
+    if (runners[i].pid <= 0)
+      continue;
+    close(runners[i].fd);
+    int status;
+    while (waitpid(runners[i].pid, &status, 0) < 0 && errno == EINTR)
+      ;
+  }
+
+  return winner;
+}
+
+bool PortfolioSolverImpl::computeTruth(const Query& query,
+                                       bool &isValid) {
+  std::vector<const Array*> objects;
+  std::vector< std::vector<unsigned char> > values;
+  bool hasSolution;
+
+  if (!computeInitialValues(query, objects, values, hasSolution))
+    return false;
+
+  isValid = !hasSolution;
+  return true;
+}
+
+bool PortfolioSolverImpl::computeValue(const Query& query,
+                                       ref<Expr> &result) {
+  std::vector<const Array*> objects;
+  std::vector< std::vector<unsigned char> > values;
+  bool hasSolution;
+
+  // Find the object used in the expression, and compute an assignment
+  // for them.
+  findSymbolicObjects(query.expr, objects);
+  if (!computeInitialValues(query.withFalse(), objects, values, hasSolution))
+    return false;
+  assert(hasSolution && "state has invalid constraint set");
+
+  // Evaluate the expression with the computed assignment.
+  Assignment a(objects, values);
+  result = a.evaluate(query.expr);
+
+  return true;
+}
+
+bool
+PortfolioSolverImpl::computeInitialValues(const Query& query,
+                                          const std::vector<const Array*>
+                                            &objects,
+                                          std::vector< std::vector<unsigned char> >
+                                            &values,
+                                          bool &hasSolution) {
+  ++stats::portfolioQueries;
+
+  bool unsupported = false;
+  int winner = race(query, objects, values, hasSolution, unsupported);
+  if (winner < 0 && unsupported)
+    winner = raceForked(query, objects, values, hasSolution);
+
+  if (winner < 0) {
+    ++stats::portfolioFailures;
+    return false;
+  }
+
+  if (backends[winner].wins)
+    ++*backends[winner].wins;
+
+  ++stats::queries;
+  ++stats::queryCounterexamples;
+  if (hasSolution)
+    ++stats::queriesInvalid;
+  else
+    ++stats::queriesValid;
+
+  return true;
+}
+
+/***/
+
+PortfolioSolver::PortfolioSolver()
+  : Solver(new PortfolioSolverImpl()) {
+}
+
+void PortfolioSolver::addSolver(Solver *solver, Statistic *wins) {
+  static_cast<PortfolioSolverImpl*>(impl)->addSolver(solver, wins);
+}
+
+void PortfolioSolver::setTimeout(double timeout) {
+  static_cast<PortfolioSolverImpl*>(impl)->setTimeout(timeout);
+}
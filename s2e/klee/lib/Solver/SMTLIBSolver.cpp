@@ -0,0 +1,718 @@
+//===-- SMTLIBSolver.cpp --------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/SolverImpl.h"
+#include "klee/SolverStats.h"
+#include "klee/util/Assignment.h"
+#include "klee/util/ExprUtil.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+using namespace klee;
+
+namespace {
+
+  /// SMTLIBPrinter - Print a query as an SMT-LIBv2 script in the QF_ABV
+  /// logic. All expressions are bitvectors, booleans being bitvectors of
+  /// width 1. Expressions and update nodes used more than once are bound
+  /// with define-fun, so that the script stays linear in the size of the
+  /// expression DAG.
+  class SMTLIBPrinter {
+    llvm::raw_ostream &os;
+
+    std::map<const Expr*, unsigned> uses;
+    std::map<const Expr*, std::string> exprNames;
+    std::map<const UpdateNode*, std::string> updateNames;
+    std::map<const Array*, std::string> arrayNames;
+    std::vector<const Array*> arrays;
+    unsigned numUpdates;
+
+    void scan(const ref<Expr> &e);
+    void scanUpdates(const UpdateList &updates);
+
+    void define(const ref<Expr> &e);
+    void defineUpdates(const UpdateList &updates);
+
+    void printConstant(const ConstantExpr *ce);
+    void printExpr(const ref<Expr> &e);
+    void printTerm(const ref<Expr> &e);
+    void printUpdates(const UpdateList &updates);
+    void printCompare(const char *op, const ref<Expr> &e);
+
+    const std::string &getArrayName(const Array *array);
+
+  public:
+    SMTLIBPrinter(llvm::raw_ostream &_os) : os(_os), numUpdates(0) {}
+
+    /// printQuery - Print the script checking whether the constraints of the
+    /// query are satisfiable together with the negation of its expression,
+    /// and requesting the values of the given objects.
+    void printQuery(const Query &query,
+                    const std::vector<const Array*> &objects);
+  };
+
+  /// SExpr - A parsed S-expression of the solver output.
+  struct SExpr {
+    bool isList;
+    std::string atom;
+    std::vector<SExpr> list;
+
+    SExpr() : isList(false) {}
+  };
+
+  bool parseSExpr(const std::string &s, size_t &pos, SExpr &out);
+  bool parseValue(const SExpr &value, unsigned char &result);
+
+  bool runSolver(const std::string &command, const std::string &script,
+                 std::string &output);
+}
+
+const std::string &SMTLIBPrinter::getArrayName(const Array *array) {
+  std::map<const Array*, std::string>::iterator it = arrayNames.find(array);
+  if (it != arrayNames.end())
+    return it->second;
+
+  // Array names are not guaranteed to be unique, nor to be valid symbols
+  std::string name;
+  llvm::raw_string_ostream ss(name);
+  ss << "|" << arrays.size() << "_";
+  for (unsigned i = 0; i < array->name.size(); ++i) {
+    char c = array->name[i];
+    ss << ((c == '|' || c == '\\') ? '_' : c);
+  }
+  ss << "|";
+  ss.flush();
+
+  arrays.push_back(array);
+  return arrayNames[array] = name;
+}
+
+void SMTLIBPrinter::scanUpdates(const UpdateList &updates) {
+  getArrayName(updates.root);
+  for (const UpdateNode *un = updates.head; un; un = un->next) {
+    if (updateNames.count(un))
+      break;
+    updateNames[un] = "";
+    scan(un->index);
+    scan(un->value);
+  }
+}
+
+void SMTLIBPrinter::scan(const ref<Expr> &e) {
+  if (isa<ConstantExpr>(e))
+    return;
+
+  if (uses[e.get()]++)
+    return;
+
+  if (const ReadExpr *re = dyn_cast<ReadExpr>(e))
+    scanUpdates(re->updates);
+
+  for (unsigned i = 0; i < e->getNumKids(); ++i)
+    scan(e->getKid(i));
+}
+
+void SMTLIBPrinter::defineUpdates(const UpdateList &updates) {
+  // Define the oldest updates first
+  std::vector<const UpdateNode*> pending;
+  for (const UpdateNode *un = updates.head; un; un = un->next) {
+    std::string &name = updateNames[un];
+    if (!name.empty())
+      break;
+    pending.push_back(un);
+  }
+
+  for (unsigned i = pending.size(); i > 0; --i) {
+    const UpdateNode *un = pending[i - 1];
+    define(un->index);
+    define(un->value);
+
+    std::string name;
+    llvm::raw_string_ostream ss(name);
+    ss << "u" << numUpdates++;
+    ss.flush();
+
+    os << "(define-fun " << name
+       << " () (Array (_ BitVec 32) (_ BitVec 8)) (store ";
+    if (un->next)
+      os << updateNames[un->next];
+    else
+      os << getArrayName(updates.root);
+    os << " ";
+    printTerm(un->index);
+    os << " ";
+    printTerm(un->value);
+    os << "))\n";
+
+    updateNames[un] = name;
+  }
+}
+
+void SMTLIBPrinter::define(const ref<Expr> &e) {
+  if (isa<ConstantExpr>(e) || exprNames.count(e.get()))
+    return;
+
+  if (const ReadExpr *re = dyn_cast<ReadExpr>(e))
+    defineUpdates(re->updates);
+
+  for (unsigned i = 0; i < e->getNumKids(); ++i)
+    define(e->getKid(i));
+
+  if (uses[e.get()] > 1) {
+    std::string name;
+    llvm::raw_string_ostream ss(name);
+    ss << "e" << exprNames.size();
+    ss.flush();
+
+    os << "(define-fun " << name << " () (_ BitVec " << e->getWidth()
+       << ") ";
+    printExpr(e);
+    os << ")\n";
+
+    exprNames[e.get()] = name;
+  } else {
+    // Mark as visited, printed inline
+    exprNames[e.get()] = "";
+  }
+}
+
+void SMTLIBPrinter::printConstant(const ConstantExpr *ce) {
+  std::string value;
+  ce->toString(value);
+  os << "(_ bv" << value << " " << ce->getWidth() << ")";
+}
+
+void SMTLIBPrinter::printTerm(const ref<Expr> &e) {
+  if (const ConstantExpr *ce = dyn_cast<ConstantExpr>(e)) {
+    printConstant(ce);
+    return;
+  }
+
+  std::map<const Expr*, std::string>::iterator it = exprNames.find(e.get());
+  if (it != exprNames.end() && !it->second.empty()) {
+    os << it->second;
+    return;
+  }
+
+  printExpr(e);
+}
+
+void SMTLIBPrinter::printUpdates(const UpdateList &updates) {
+  if (updates.head)
+    os << updateNames[updates.head];
+  else
+    os << getArrayName(updates.root);
+}
+
+void SMTLIBPrinter::printCompare(const char *op, const ref<Expr> &e) {
+  os << "(ite (" << op << " ";
+  printTerm(e->getKid(0));
+  os << " ";
+  printTerm(e->getKid(1));
+  os << ") #b1 #b0)";
+}
+
+void SMTLIBPrinter::printExpr(const ref<Expr> &e) {
+  const char *op = 0;
+
+  switch (e->getKind()) {
+  case Expr::Constant:
+    printConstant(cast<ConstantExpr>(e));
+    return;
+
+  case Expr::NotOptimized:
+    printTerm(e->getKid(0));
+    return;
+
+  case Expr::Read: {
+    const ReadExpr *re = cast<ReadExpr>(e);
+    os << "(select ";
+    printUpdates(re->updates);
+    os << " ";
+    printTerm(re->index);
+    os << ")";
+    return;
+  }
+
+  case Expr::Select:
+    os << "(ite (= ";
+    printTerm(e->getKid(0));
+    os << " #b1) ";
+    printTerm(e->getKid(1));
+    os << " ";
+    printTerm(e->getKid(2));
+    os << ")";
+    return;
+
+  case Expr::Extract: {
+    const ExtractExpr *ee = cast<ExtractExpr>(e);
+    os << "((_ extract " << (ee->offset + ee->width - 1) << " "
+       << ee->offset << ") ";
+    printTerm(ee->expr);
+    os << ")";
+    return;
+  }
+
+  case Expr::ZExt:
+  case Expr::SExt: {
+    ref<Expr> src = e->getKid(0);
+    unsigned extra = e->getWidth() - src->getWidth();
+    if (!extra) {
+      printTerm(src);
+      return;
+    }
+    os << "((_ " << (e->getKind() == Expr::ZExt ? "zero" : "sign")
+       << "_extend " << extra << ") ";
+    printTerm(src);
+    os << ")";
+    return;
+  }
+
+  case Expr::Not:
+    os << "(bvnot ";
+    printTerm(e->getKid(0));
+    os << ")";
+    return;
+
+  case Expr::Eq:  printCompare("=", e); return;
+  case Expr::Ne:  printCompare("distinct", e); return;
+  case Expr::Ult: printCompare("bvult", e); return;
+  case Expr::Ule: printCompare("bvule", e); return;
+  case Expr::Ugt: printCompare("bvugt", e); return;
+  case Expr::Uge: printCompare("bvuge", e); return;
+  case Expr::Slt: printCompare("bvslt", e); return;
+  case Expr::Sle: printCompare("bvsle", e); return;
+  case Expr::Sgt: printCompare("bvsgt", e); return;
+  case Expr::Sge: printCompare("bvsge", e); return;
+
+  case Expr::Concat: op = "concat"; break;
+  case Expr::Add:  op = "bvadd"; break;
+  case Expr::Sub:  op = "bvsub"; break;
+  case Expr::Mul:  op = "bvmul"; break;
+  case Expr::UDiv: op = "bvudiv"; break;
+  case Expr::SDiv: op = "bvsdiv"; break;
+  case Expr::URem: op = "bvurem"; break;
+  case Expr::SRem: op = "bvsrem"; break;
+  case Expr::And:  op = "bvand"; break;
+  case Expr::Or:   op = "bvor"; break;
+  case Expr::Xor:  op = "bvxor"; break;
+  case Expr::Shl:  op = "bvshl"; break;
+  case Expr::LShr: op = "bvlshr"; break;
+  case Expr::AShr: op = "bvashr"; break;
+
+  default:
+    assert(0 && "unhandled Expr type");
+    return;
+  }
+
+  os << "(" << op;
+  for (unsigned i = 0; i < e->getNumKids(); ++i) {
+    os << " ";
+    printTerm(e->getKid(i));
+  }
+  os << ")";
+}
+
+void SMTLIBPrinter::printQuery(const Query &query,
+                               const std::vector<const Array*> &objects) {
+  for (unsigned i = 0; i < objects.size(); ++i)
+    getArrayName(objects[i]);
+  for (ConstraintManager::constraint_iterator it = query.constraints.begin(),
+         ie = query.constraints.end(); it != ie; ++it)
+    scan(*it);
+  scan(query.expr);
+
+  os << "(set-option :produce-models true)\n";
+  os << "(set-logic QF_ABV)\n";
+
+  for (unsigned i = 0; i < arrays.size(); ++i)
+    os << "(declare-fun " << arrayNames[arrays[i]]
+       << " () (Array (_ BitVec 32) (_ BitVec 8)))\n";
+
+  // Constant arrays are declared like symbolic ones and constrained to
+  // their initial values
+  for (unsigned i = 0; i < arrays.size(); ++i) {
+    const Array *array = arrays[i];
+    for (unsigned j = 0; j < array->constantValues.size(); ++j) {
+      os << "(assert (= (select " << arrayNames[array]
+         << " (_ bv" << j << " 32)) ";
+      printConstant(array->constantValues[j].get());
+      os << "))\n";
+    }
+  }
+
+  for (ConstraintManager::constraint_iterator it = query.constraints.begin(),
+         ie = query.constraints.end(); it != ie; ++it) {
+    define(*it);
+    os << "(assert (= ";
+    printTerm(*it);
+    os << " #b1))\n";
+  }
+
+  define(query.expr);
+  os << "(assert (= ";
+  printTerm(query.expr);
+  os << " #b0))\n";
+
+  os << "(check-sat)\n";
+
+  // A single command, so that the solver only starts writing the values
+  // once the whole script has been sent
+  bool first = true;
+  for (unsigned i = 0; i < objects.size(); ++i) {
+    for (unsigned j = 0; j < objects[i]->size; ++j) {
+      os << (first ? "(get-value (" : " ")
+         << "(select " << arrayNames[objects[i]] << " (_ bv" << j << " 32))";
+      first = false;
+    }
+  }
+  if (!first)
+    os << "))\n";
+
+  os << "(exit)\n";
+}
+
+namespace {
+
+bool parseSExpr(const std::string &s, size_t &pos, SExpr &out) {
+  // Skip blanks and comments
+  for (;;) {
+    while (pos < s.size() && isspace((unsigned char) s[pos]))
+      ++pos;
+    if (pos < s.size() && s[pos] == ';') {
+      while (pos < s.size() && s[pos] != '\n')
+        ++pos;
+      continue;
+    }
+    break;
+  }
+
+  if (pos >= s.size() || s[pos] == ')')
+    return false;
+
+  if (s[pos] == '(') {
+    ++pos;
+    out.isList = true;
+    for (;;) {
+      SExpr child;
+      if (!parseSExpr(s, pos, child))
+        break;
+      out.list.push_back(child);
+    }
+    if (pos >= s.size() || s[pos] != ')')
+      return false;
+    ++pos;
+    return true;
+  }
+
+  size_t start = pos;
+  if (s[pos] == '|' || s[pos] == '"') {
+    char quote = s[pos++];
+    while (pos < s.size() && s[pos] != quote)
+      ++pos;
+    if (pos >= s.size())
+      return false;
+    ++pos;
+  } else {
+    while (pos < s.size() && !isspace((unsigned char) s[pos]) &&
+           s[pos] != '(' && s[pos] != ')')
+      ++pos;
+  }
+
+  out.isList = false;
+  out.atom = s.substr(start, pos - start);
+  return true;
+}
+
+bool parseValue(const SExpr &value, unsigned char &result) {
+  std::string digits;
+  int base;
+
+  if (!value.isList && value.atom.size() > 2 && value.atom[0] == '#') {
+    digits = value.atom.substr(2);
+    base = value.atom[1] == 'x' ? 16 : 2;
+  } else if (value.isList && value.list.size() == 3 &&
+             value.list[0].atom == "_" &&
+             value.list[1].atom.compare(0, 2, "bv") == 0) {
+    // (_ bvN 8)
+    digits = value.list[1].atom.substr(2);
+    base = 10;
+  } else {
+    return false;
+  }
+
+  char *end;
+  unsigned long v = strtoul(digits.c_str(), &end, base);
+  if (*end || v > 0xff)
+    return false;
+  result = (unsigned char) v;
+  return true;
+}
+
+bool runSolver(const std::string &command, const std::string &script,
+               std::string &output) {
+  int in[2], out[2];
+  if (pipe(in) < 0) {
+    perror("pipe() for SMT-LIB solver");
+    return false;
+  }
+  if (pipe(out) < 0) {
+    perror("pipe() for SMT-LIB solver");
+    close(in[0]);
+    close(in[1]);
+    return false;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork() for SMT-LIB solver");
+    close(in[0]); close(in[1]);
+    close(out[0]); close(out[1]);
+    return false;
+  }
+
+  if (pid == 0) {
+#ifdef __linux__
+    // Do not outlive a portfolio worker killed by its parent
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+    // Portfolio workers block all signals
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    dup2(in[0], 0);
+    dup2(out[1], 1);
+    close(in[0]); close(in[1]);
+    close(out[0]); close(out[1]);
+    std::string cmd = "exec " + command;
+    execl("/bin/sh", "sh", "-c", cmd.c_str(), (char*) NULL);
+    _exit(127);
+  }
+
+  close(in[0]);
+  close(out[1]);
+
+  // The solver may exit before reading the whole script
+  struct sigaction ignore, old;
+  ignore.sa_handler = SIG_IGN;
+  sigemptyset(&ignore.sa_mask);
+  ignore.sa_flags = 0;
+  sigaction(SIGPIPE, &ignore, &old);
+
+  // Write the script while reading the output: the solver may answer
+  // the first check-sat before reading the rest of the script, and
+  // block once the output pipe is full
+  fcntl(in[1], F_SETFL, fcntl(in[1], F_GETFL) | O_NONBLOCK);
+
+  const char *p = script.data();
+  size_t left = script.size();
+  bool writing = true, reading = true;
+  if (!left) {
+    close(in[1]);
+    writing = false;
+  }
+
+  char buffer[4096];
+  while (reading) {
+    struct pollfd pfds[2];
+    unsigned n = 0;
+    pfds[n].fd = out[0];
+    pfds[n].events = POLLIN;
+    pfds[n++].revents = 0;
+    if (writing) {
+      pfds[n].fd = in[1];
+      pfds[n].events = POLLOUT;
+      pfds[n++].revents = 0;
+    }
+
+    int ret = poll(pfds, n, -1);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0)
+      break;
+
+    if (writing && pfds[1].revents) {
+      ssize_t written = write(in[1], p, left);
+      if (written > 0) {
+        p += written;
+        left -= written;
+      }
+      if (!left || (written < 0 && errno != EINTR && errno != EAGAIN)) {
+        close(in[1]);
+        writing = false;
+      }
+    }
+
+    if (pfds[0].revents) {
+      ssize_t count = read(out[0], buffer, sizeof(buffer));
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        reading = false;
+      else
+        output.append(buffer, count);
+    }
+  }
+
+  if (writing)
+    close(in[1]);
+  close(out[0]);
+
+  sigaction(SIGPIPE, &old, NULL);
+
+  int status;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+    fprintf(stderr, "error: cannot run SMT-LIB solver '%s'\n",
+            command.c_str());
+    return false;
+  }
+
+  return left == 0;
+}
+}
+
+/***/
+
+class SMTLIBSolverImpl : public SolverImpl {
+private:
+  std::string command;
+
+public:
+  SMTLIBSolverImpl(const std::string &_command) : command(_command) {}
+
+  bool computeTruth(const Query&, bool &isValid);
+  bool computeValue(const Query&, ref<Expr> &result);
+  bool computeInitialValues(const Query&,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution);
+};
+
+bool SMTLIBSolverImpl::computeTruth(const Query& query,
+                                    bool &isValid) {
+  std::vector<const Array*> objects;
+  std::vector< std::vector<unsigned char> > values;
+  bool hasSolution;
+
+  if (!computeInitialValues(query, objects, values, hasSolution))
+    return false;
+
+  isValid = !hasSolution;
+  return true;
+}
+
+bool SMTLIBSolverImpl::computeValue(const Query& query,
+                                    ref<Expr> &result) {
+  std::vector<const Array*> objects;
+  std::vector< std::vector<unsigned char> > values;
+  bool hasSolution;
+
+  // Find the object used in the expression, and compute an assignment
+  // for them.
+  findSymbolicObjects(query.expr, objects);
+  if (!computeInitialValues(query.withFalse(), objects, values, hasSolution))
+    return false;
+  assert(hasSolution && "state has invalid constraint set");
+
+  // Evaluate the expression with the computed assignment.
+  Assignment a(objects, values);
+  result = a.evaluate(query.expr);
+
+  return true;
+}
+
+bool
+SMTLIBSolverImpl::computeInitialValues(const Query& query,
+                                       const std::vector<const Array*>
+                                         &objects,
+                                       std::vector< std::vector<unsigned char> >
+                                         &values,
+                                       bool &hasSolution) {
+  ++stats::queries;
+  ++stats::queryCounterexamples;
+
+  std::string script;
+  llvm::raw_string_ostream os(script);
+  SMTLIBPrinter(os).printQuery(query, objects);
+  os.flush();
+
+  std::string output;
+  if (!runSolver(command, script, output))
+    return false;
+
+  size_t pos = 0;
+  SExpr result;
+  if (!parseSExpr(output, pos, result) || result.isList)
+    return false;
+
+  if (result.atom == "unsat") {
+    hasSolution = false;
+    ++stats::queriesValid;
+    return true;
+  }
+
+  if (result.atom != "sat")
+    return false;
+
+  std::vector< std::vector<unsigned char> > cex(objects.size());
+  SExpr model;
+  if (!objects.empty() && !parseSExpr(output, pos, model))
+    return false;
+
+  // The model lists (term value) pairs in the requested order
+  unsigned k = 0;
+  for (unsigned i = 0; i < objects.size(); ++i) {
+    cex[i].resize(objects[i]->size);
+    for (unsigned j = 0; j < objects[i]->size; ++j, ++k) {
+      if (k >= model.list.size() || model.list[k].list.size() != 2 ||
+          !parseValue(model.list[k].list[1], cex[i][j]))
+        return false;
+    }
+  }
+
+  hasSolution = true;
+  values.swap(cex);
+  ++stats::queriesInvalid;
+  return true;
+}
+
+/***/
+
+Solver *klee::createSMTLIBSolver(const std::string &command) {
+  return new Solver(new SMTLIBSolverImpl(command));
+}
@@ -0,0 +1,468 @@
+//===-- STPWorkerPool.cpp -------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "STPWorkerPool.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/ExprBuilder.h"
+#include "klee/Solver.h"
+#include "klee/SolverImpl.h"
+#include "klee/util/ExprPPrinter.h"
+#include "klee/Internal/System/Time.h"
+#include "expr/Parser.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cassert>
+#include <cstdio>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+using namespace klee;
+using namespace klee::expr;
+
+extern llvm::raw_ostream *g_solverLog;
+
+/*
+ * Protocol, over a UNIX socket pair:
+ *   request:  uint32_t length, query text
+ *   response: uint32_t status, uint32_t size, concatenated array contents
+ */
+
+namespace {
+  enum WorkerStatus {
+    StatusSolution = 0,
+    StatusNoSolution = 1,
+    StatusUnsupported = 2,
+    StatusFailure = 3
+  };
+
+  bool readFully(int fd, void *buffer, size_t size) {
+    uint8_t *p = static_cast<uint8_t*>(buffer);
+    while (size) {
+      ssize_t ret = recv(fd, p, size, 0);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return false;
+      p += ret;
+      size -= ret;
+    }
+    return true;
+  }
+
+  // MSG_NOSIGNAL avoids SIGPIPE when the other side died
+  bool writeFully(int fd, const void *buffer, size_t size) {
+    const uint8_t *p = static_cast<const uint8_t*>(buffer);
+    while (size) {
+      ssize_t ret = send(fd, p, size, MSG_NOSIGNAL);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret <= 0)
+        return false;
+      p += ret;
+      size -= ret;
+    }
+    return true;
+  }
+
+  /// Wait until fd is readable or the deadline passes (0 = no deadline).
+  /// A deadline that already passed polls fd once.
+  bool waitReadable(int fd, double deadline) {
+    for (;;) {
+      int ms = -1;
+      if (deadline) {
+        double remaining = deadline - util::getWallTime();
+        ms = remaining > 0 ? (int) (remaining * 1000) + 1 : 0;
+      }
+
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      int ret = poll(&pfd, 1, ms);
+      if (ret < 0 && errno == EINTR)
+        continue;
+      return ret > 0;
+    }
+  }
+
+  /// Number of queries after which a worker recreates its STP solver, or is
+  /// restarted if it runs the caller's solver. The builder caches the STP
+  /// expressions of every query it has seen, and the arrays parsed from the
+  /// queries have to outlive it.
+  const unsigned WorkerSolverQueries = 64;
+}
+
+STPWorkerPool::STPWorkerPool(unsigned size, Solver *_solver)
+  : workers(size), solver(_solver), nextWorker(0), nextTicket(1),
+    owner(getpid()) {
+  assert(size > 0);
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    workers[i].pid = -1;
+    workers[i].fd = -1;
+    workers[i].ticket = 0;
+    workers[i].deadline = 0;
+    workers[i].queries = 0;
+  }
+}
+
+STPWorkerPool::~STPWorkerPool() {
+  // Workers inherited from the process that forked us belong to it
+  bool owned = getpid() == owner;
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    if (owned) {
+      kill(workers[i]);
+    } else if (workers[i].fd >= 0) {
+      close(workers[i].fd);
+    }
+  }
+}
+
+void STPWorkerPool::workerMain(int fd, Solver *callerSolver) {
+  // The log belongs to the parent process
+  g_solverLog = NULL;
+
+  // The caller's solver and the arrays it has seen are freed along
+  // with the worker, when the pool restarts it
+  Solver *solver = callerSolver;
+  unsigned solverQueries = 0;
+  std::vector<const Array*> arrays;
+  ExprBuilder *builder = createDefaultExprBuilder();
+  std::string text;
+
+  for (;;) {
+    if (!callerSolver && solverQueries == WorkerSolverQueries) {
+      delete solver;
+      solver = 0;
+      solverQueries = 0;
+
+      for (unsigned i = 0; i < arrays.size(); ++i)
+        delete arrays[i];
+      arrays.clear();
+    }
+
+    uint32_t length;
+    if (!readFully(fd, &length, sizeof(length)))
+      break;
+
+    text.resize(length);
+    if (length && !readFully(fd, &text[0], length))
+      break;
+
+    uint32_t status = StatusUnsupported;
+    std::string cex;
+
+    llvm::MemoryBuffer *MB =
+      llvm::MemoryBuffer::getMemBuffer(llvm::StringRef(text.c_str(),
+                                                       text.size()));
+    Parser *P = Parser::Create("query", MB, builder);
+    P->SetMaxErrors(1);
+
+    ++solverQueries;
+
+    std::vector<Decl*> decls;
+    QueryCommand *QC = 0;
+    while (Decl *D = P->ParseTopLevelDecl()) {
+      decls.push_back(D);
+      if (ArrayDecl *AD = dyn_cast<ArrayDecl>(D))
+        arrays.push_back(AD->Root);
+      if (QueryCommand *qc = dyn_cast<QueryCommand>(D))
+        QC = qc;
+    }
+
+    if (QC && !P->GetNumErrors()) {
+      ConstraintManager constraints(QC->Constraints);
+      std::vector< std::vector<unsigned char> > values;
+      bool hasSolution;
+
+      if (!solver)
+        solver = new STPSolver(false);
+
+      if (solver->impl->computeInitialValues(Query(constraints, QC->Query),
+                                             QC->Objects, values,
+                                             hasSolution)) {
+        status = hasSolution ? StatusSolution : StatusNoSolution;
+        for (unsigned i = 0; hasSolution && i < values.size(); ++i)
+          cex.append(values[i].begin(), values[i].end());
+      } else {
+        status = StatusFailure;
+      }
+    }
+
+    for (unsigned i = 0; i < decls.size(); ++i)
+      delete decls[i];
+    delete P;
+    delete MB;
+
+    uint32_t size = cex.size();
+    if (!writeFully(fd, &status, sizeof(status)) ||
+        !writeFully(fd, &size, sizeof(size)) ||
+        !writeFully(fd, cex.data(), size))
+      break;
+  }
+
+  _exit(0);
+}
+
+bool STPWorkerPool::spawn(Worker &worker) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    perror("socketpair() for STP worker");
+    return false;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  sigset_t sig_mask, sig_mask_old;
+  sigfillset(&sig_mask);
+  sigemptyset(&sig_mask_old);
+  sigprocmask(SIG_SETMASK, &sig_mask, &sig_mask_old);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    // The worker keeps all signals blocked: it only terminates
+    // when the parent closes the socket or kills it.
+    close(fds[0]);
+    for (unsigned i = 0; i < workers.size(); ++i) {
+      if (workers[i].fd >= 0)
+        close(workers[i].fd);
+    }
+    workerMain(fds[1], solver);
+  }
+
+  sigprocmask(SIG_SETMASK, &sig_mask_old, NULL);
+  close(fds[1]);
+
+  if (pid < 0) {
+    fprintf(stderr, "error: fork failed (for STP worker)\n");
+    close(fds[0]);
+    return false;
+  }
+
+  worker.pid = pid;
+  worker.fd = fds[0];
+  worker.queries = 0;
+  return true;
+}
+
+void STPWorkerPool::kill(Worker &worker) {
+  if (worker.pid > 0) {
+    ::kill(worker.pid, SIGKILL);
+
+    pid_t res;
+    do {
+      res = waitpid(worker.pid, NULL, 0);
+    } while (res < 0 && errno == EINTR);
+  }
+
+  if (worker.fd >= 0)
+    close(worker.fd);
+
+  worker.pid = -1;
+  worker.fd = -1;
+  worker.ticket = 0;
+  worker.queries = 0;
+}
+
+void STPWorkerPool::checkOwner() {
+  // After a fork, the inherited workers still serve the parent process
+  if (getpid() == owner)
+    return;
+
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    if (workers[i].fd >= 0)
+      close(workers[i].fd);
+    workers[i].pid = -1;
+    workers[i].fd = -1;
+    workers[i].ticket = 0;
+    workers[i].queries = 0;
+  }
+  owner = getpid();
+}
+
+bool STPWorkerPool::send(Worker &worker, const Query &query,
+                         const std::vector<const Array*> &objects) {
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  if (objects.empty()) {
+    ExprPPrinter::printQuery(os, query.constraints, query.expr);
+  } else {
+    ExprPPrinter::printQuery(os, query.constraints, query.expr, 0, 0,
+                             &objects[0], &objects[0] + objects.size());
+  }
+  os.flush();
+
+  // Workers running the caller's solver cannot recreate it
+  if (solver && worker.queries == WorkerSolverQueries)
+    kill(worker);
+
+  // Dead or killed workers are replaced on their next use
+  if (worker.pid <= 0 && !spawn(worker))
+    return false;
+  ++worker.queries;
+
+  uint32_t length = text.size();
+  if (!writeFully(worker.fd, &length, sizeof(length)) ||
+      !writeFully(worker.fd, text.data(), length)) {
+    kill(worker);
+    return false;
+  }
+
+  return true;
+}
+
+STPWorkerPool::Result
+STPWorkerPool::receive(Worker &worker,
+                       const std::vector<const Array*> &objects,
+                       std::vector< std::vector<unsigned char> > &values,
+                       bool &hasSolution,
+                       double deadline) {
+  worker.ticket = 0;
+
+  if (!waitReadable(worker.fd, deadline)) {
+    fprintf(stderr, "error: STP timed out\n");
+    kill(worker);
+    return Failure;
+  }
+
+  uint32_t status, size;
+  if (!readFully(worker.fd, &status, sizeof(status)) ||
+      !readFully(worker.fd, &size, sizeof(size))) {
+    fprintf(stderr, "error: STP worker did not return successfully\n");
+    kill(worker);
+    return Failure;
+  }
+
+  // The buffer is sized by the worker's reply, there is no fixed limit
+  std::vector<unsigned char> cex(size);
+  if (size && !readFully(worker.fd, &cex[0], size)) {
+    fprintf(stderr, "error: STP worker did not return successfully\n");
+    kill(worker);
+    return Failure;
+  }
+
+  switch (status) {
+  case StatusSolution:
+    break;
+  case StatusNoSolution:
+    hasSolution = false;
+    return Success;
+  case StatusUnsupported:
+    return Unsupported;
+  default:
+    return Failure;
+  }
+
+  uint64_t expected = 0;
+  for (unsigned i = 0; i < objects.size(); ++i)
+    expected += objects[i]->size;
+  if (expected != size) {
+    fprintf(stderr, "error: STP worker returned an invalid counterexample\n");
+    return Failure;
+  }
+
+  hasSolution = true;
+  values = std::vector< std::vector<unsigned char> >(objects.size());
+  const unsigned char *pos = size ? &cex[0] : 0;
+  for (unsigned i = 0; i < objects.size(); ++i) {
+    values[i].assign(pos, pos + objects[i]->size);
+    pos += objects[i]->size;
+  }
+
+  return Success;
+}
+
+STPWorkerPool::Result
+STPWorkerPool::computeInitialValues(const Query &query,
+                                    const std::vector<const Array*> &objects,
+                                    std::vector< std::vector<unsigned char> > &values,
+                                    bool &hasSolution,
+                                    double timeout) {
+  checkOwner();
+
+  Worker &worker = workers[nextWorker];
+  nextWorker = (nextWorker + 1) % workers.size();
+  assert(!worker.ticket && "pool is also used for submitted queries");
+
+  if (!send(worker, query, objects))
+    return Unsupported;
+
+  double deadline = timeout ? util::getWallTime() + timeout : 0;
+  return receive(worker, objects, values, hasSolution, deadline);
+}
+
+STPWorkerPool::Worker *STPWorkerPool::findWorker(uint64_t ticket) {
+  checkOwner();
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    if (workers[i].ticket == ticket)
+      return &workers[i];
+  }
+  return NULL;
+}
+
+uint64_t
+STPWorkerPool::submitInitialValues(const Query &query,
+                                   const std::vector<const Array*> &objects,
+                                   double timeout) {
+  checkOwner();
+
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    Worker &worker = workers[i];
+    if (worker.ticket)
+      continue;
+
+    if (!send(worker, query, objects))
+      return 0;
+
+    worker.ticket = nextTicket++;
+    worker.deadline = timeout ? util::getWallTime() + timeout : 0;
+    return worker.ticket;
+  }
+
+  return 0;
+}
+
+bool STPWorkerPool::isAnswered(uint64_t ticket) {
+  Worker *worker = findWorker(ticket);
+  return !worker || waitReadable(worker->fd, util::getWallTime());
+}
+
+int STPWorkerPool::getAnswerDescriptor(uint64_t ticket) {
+  Worker *worker = findWorker(ticket);
+  return worker ? worker->fd : -1;
+}
+
+STPWorkerPool::Result
+STPWorkerPool::receiveInitialValues(uint64_t ticket,
+                                    const std::vector<const Array*> &objects,
+                                    std::vector< std::vector<unsigned char> > &values,
+                                    bool &hasSolution) {
+  Worker *worker = findWorker(ticket);
+  if (!worker)
+    return Unsupported;
+  return receive(*worker, objects, values, hasSolution, worker->deadline);
+}
+
+void STPWorkerPool::cancel(uint64_t ticket) {
+  // Without a timeout, the worker could keep solving forever
+  if (Worker *worker = findWorker(ticket))
+    kill(*worker);
+}
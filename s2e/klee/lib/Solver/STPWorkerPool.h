@@ -0,0 +1,132 @@
+//===-- STPWorkerPool.h -----------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __UTIL_STPWORKERPOOL_H__
+#define __UTIL_STPWORKERPOOL_H__
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace klee {
+  class Array;
+  class Solver;
+  struct Query;
+
+  /// STPWorkerPool - A set of long-lived processes that solve queries with
+  /// their own STP instance. Queries are sent to the workers in the textual
+  /// format of ExprPPrinter and parsed back by the workers, so that solving
+  /// does not require forking the (possibly large) calling process for each
+  /// query. A worker that crashes or exceeds the timeout is killed and
+  /// replaced by a new one. Workers periodically recreate their STP
+  /// instance and free the arrays of the queries it solved, so that their
+  /// memory use does not grow with the number of queries.
+  ///
+  /// The workers can also run a solver given by the caller instead of STP.
+  /// Since they cannot recreate it, they are restarted just as often.
+  ///
+  /// Queries are either solved synchronously with computeInitialValues,
+  /// or submitted to an idle worker and received later, so that the
+  /// caller can keep running while they are solved. A pool should only
+  /// be used in one of the two ways.
+  class STPWorkerPool {
+  public:
+    enum Result {
+      Success,
+      Failure,
+      /// The worker could not handle the query, e.g., because it
+      /// could not parse it back. The caller should solve it in
+      /// some other way.
+      Unsupported
+    };
+
+  private:
+    struct Worker {
+      pid_t pid;
+      int fd;
+      /// The ticket of the submitted query being solved, or 0
+      uint64_t ticket;
+      /// Wall time after which the submitted query times out, or 0
+      double deadline;
+      /// Queries sent since the worker was spawned
+      unsigned queries;
+    };
+
+    std::vector<Worker> workers;
+    /// The solver run by the workers, or null for STP
+    Solver *solver;
+    unsigned nextWorker;
+    uint64_t nextTicket;
+    /// The process that spawned the workers. Processes forked
+    /// from it must not use or kill them.
+    pid_t owner;
+
+    bool spawn(Worker &worker);
+    void kill(Worker &worker);
+
+    /// Forget the workers inherited from the process that forked us,
+    /// along with the queries submitted to them.
+    void checkOwner();
+
+    Worker *findWorker(uint64_t ticket);
+
+    bool send(Worker &worker, const Query &query,
+              const std::vector<const Array*> &objects);
+    Result receive(Worker &worker,
+                   const std::vector<const Array*> &objects,
+                   std::vector< std::vector<unsigned char> > &values,
+                   bool &hasSolution,
+                   double deadline);
+
+    static void workerMain(int fd, Solver *solver);
+
+  public:
+    /// \param solver - The solver run by the workers, or null for STP. The
+    /// pool does not take its ownership.
+    STPWorkerPool(unsigned size, Solver *solver = 0);
+    ~STPWorkerPool();
+
+    Result computeInitialValues(const Query &query,
+                                const std::vector<const Array*> &objects,
+                                std::vector< std::vector<unsigned char> > &values,
+                                bool &hasSolution,
+                                double timeout);
+
+    /// Send the query to an idle worker without waiting for its answer.
+    /// Returns a ticket identifying the query, or 0 if all the workers
+    /// are busy or the query could not be sent.
+    uint64_t submitInitialValues(const Query &query,
+                                 const std::vector<const Array*> &objects,
+                                 double timeout);
+
+    /// Check, without blocking, whether the answer to the submitted
+    /// query arrived. Queries lost by a fork are reported as answered.
+    bool isAnswered(uint64_t ticket);
+
+    /// Return the descriptor that becomes readable when the answer to the
+    /// submitted query arrives, to wait on several pools at once, or -1 if
+    /// the query is unknown.
+    int getAnswerDescriptor(uint64_t ticket);
+
+    /// Receive the answer to the submitted query, waiting for it until
+    /// its timeout expires. The objects must be those of the query.
+    Result receiveInitialValues(uint64_t ticket,
+                                const std::vector<const Array*> &objects,
+                                std::vector< std::vector<unsigned char> > &values,
+                                bool &hasSolution);
+
+    /// Drop the submitted query. Its worker is killed and replaced on its
+    /// next use.
+    void cancel(uint64_t ticket);
+  };
+}
+
+#endif
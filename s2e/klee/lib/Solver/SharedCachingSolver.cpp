@@ -0,0 +1,671 @@
+//===-- SharedCachingSolver.cpp - Cross-process query cache ---------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/IncompleteSolver.h"
+#include "klee/SolverImpl.h"
+
+#include "klee/SolverStats.h"
+#include "klee/util/Assignment.h"
+
+#include "llvm/ADT/APInt.h"
+
+#include <tr1/unordered_map>
+#include <vector>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+using namespace klee;
+
+/// The cache lives in anonymous shared mappings. They are created by the
+/// first solver instance, i.e., before S2E forks its worker processes, so
+/// that all processes of the same run inherit and share them.
+///
+/// Queries are identified by a 128-bit structural digest that covers every
+/// field of the expressions, unlike the 32-bit Expr::hash(), so a lookup
+/// checks the whole digest of the query and does not rely on a fingerprint.
+///
+/// Validity entries and counterexamples are kept in slots guarded by a
+/// version counter that is odd while the slot is written. Writers give up
+/// if the slot is being written, and a reader retries nothing: it treats a
+/// slot whose version changed while copying it as a miss. This keeps the
+/// tables lock-free.
+namespace {
+
+  const unsigned Associativity = 4;
+
+  struct ValiditySlot {
+    uint32_t version;
+    /// The encoded partial validity, 0 if the slot is empty
+    uint32_t result;
+    uint64_t key[2];
+  };
+
+  ValiditySlot *sharedTable = 0;
+  uint64_t sharedTableSets = 0;
+
+  const unsigned CexSlotSize = 512;
+
+  struct CexSlot {
+    uint32_t version;
+    /// Total size of the values of the counterexample
+    uint32_t size;
+    uint64_t key;
+    unsigned char values[CexSlotSize - 16];
+  };
+
+  CexSlot *sharedCexTable = 0;
+  uint64_t sharedCexSlots = 0;
+
+  uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  uint64_t rotl(uint64_t v, unsigned bits) {
+    return (v << bits) | (v >> (64 - bits));
+  }
+
+  /// 128-bit hash of a sequence of words
+  struct Digest {
+    uint64_t h1, h2;
+
+    Digest(uint64_t seed = 0) : h1(mix(seed)), h2(mix(~seed)) {}
+
+    void add(uint64_t v) {
+      h1 = rotl(h1 ^ mix(v), 31) * 0x9e3779b97f4a7c15ULL;
+      h2 = rotl(h2 + mix(v ^ 0x5bd1e9955bd1e995ULL), 27)
+             * 0x87c37b91114253d5ULL;
+    }
+
+    void add(const Digest &d) {
+      add(d.h1);
+      add(d.h2);
+    }
+
+    Digest finish() const {
+      Digest d;
+      d.h1 = mix(h1 ^ h2);
+      d.h2 = mix(h2 + d.h1);
+      return d;
+    }
+  };
+
+  /// Computes the structural digests of the queries of a process. Arrays
+  /// are identified by their name, size and constant values: the executor
+  /// gives distinct names to the arrays of a state. The digests of the
+  /// expressions are remembered, the queries of a path share most of their
+  /// constraints.
+  class QueryDigester {
+    struct CachedDigest {
+      ref<Expr> expr;
+      Digest digest;
+    };
+
+    typedef std::tr1::unordered_map<const Expr*, CachedDigest> ExprDigests;
+    typedef std::tr1::unordered_map<const UpdateNode*, Digest> NodeDigests;
+    typedef std::tr1::unordered_map<const Array*, Digest> ArrayDigests;
+
+    /// Bound on the number of remembered expressions
+    static const unsigned MaxExprDigests = 1 << 16;
+
+    ExprDigests exprDigests;
+
+    /// Update nodes and arrays are not reference counted, they are only
+    /// remembered during a single query
+    NodeDigests nodeDigests;
+    ArrayDigests arrayDigests;
+
+    Digest digestArray(const Array *array);
+    Digest digestUpdates(const UpdateList &updates);
+
+  public:
+    /// Must be called before digesting the expressions of a query
+    void beginQuery() {
+      nodeDigests.clear();
+      arrayDigests.clear();
+      if (exprDigests.size() > MaxExprDigests)
+        exprDigests.clear();
+    }
+
+    Digest digestExpr(const ref<Expr> &e);
+
+    /// The digest of a constraint set does not depend on the order of the
+    /// constraints. The halves are summed, which does not cancel out
+    /// duplicates, unlike a xor.
+    Digest digestConstraints(const ConstraintManager &constraints) {
+      Digest sum;
+      sum.h1 = sum.h2 = 0;
+      for (ConstraintManager::constraint_iterator it = constraints.begin();
+           it != constraints.end(); ++it) {
+        Digest d = digestExpr(*it);
+        sum.h1 += d.h1;
+        sum.h2 += d.h2;
+      }
+
+      Digest result(constraints.size());
+      result.add(sum);
+      return result.finish();
+    }
+  };
+
+  Digest QueryDigester::digestArray(const Array *array) {
+    ArrayDigests::iterator it = arrayDigests.find(array);
+    if (it != arrayDigests.end())
+      return it->second;
+
+    Digest d(array->size);
+    d.add(array->name.size());
+    for (unsigned i = 0; i < array->name.size(); ++i)
+      d.add((unsigned char) array->name[i]);
+    d.add(array->constantValues.size());
+    for (unsigned i = 0; i < array->constantValues.size(); ++i)
+      d.add(digestExpr(array->constantValues[i]));
+
+    Digest result = d.finish();
+    arrayDigests[array] = result;
+    return result;
+  }
+
+  Digest QueryDigester::digestUpdates(const UpdateList &updates) {
+    // Lists share their tails, only digest the nodes not seen yet.
+    // This also avoids recursing on long lists.
+    std::vector<const UpdateNode*> pending;
+    const UpdateNode *un = updates.head;
+    while (un && !nodeDigests.count(un)) {
+      pending.push_back(un);
+      un = un->next;
+    }
+
+    Digest next = un ? nodeDigests[un] : Digest();
+    for (unsigned i = pending.size(); i > 0; --i) {
+      const UpdateNode *node = pending[i - 1];
+      Digest d(node->getSize());
+      d.add(next);
+      d.add(digestExpr(node->index));
+      d.add(digestExpr(node->value));
+      next = d.finish();
+      nodeDigests[node] = next;
+    }
+
+    Digest d(updates.getSize());
+    d.add(digestArray(updates.root));
+    d.add(next);
+    return d.finish();
+  }
+
+  Digest QueryDigester::digestExpr(const ref<Expr> &e) {
+    ExprDigests::iterator it = exprDigests.find(e.get());
+    if (it != exprDigests.end())
+      return it->second.digest;
+
+    Digest d(e->getKind());
+    d.add(e->getWidth());
+    d.add(e->getNumKids());
+
+    if (ConstantExpr *ce = dyn_cast<ConstantExpr>(e)) {
+      const llvm::APInt &value = ce->getAPValue();
+      for (unsigned i = 0; i < value.getNumWords(); ++i)
+        d.add(value.getRawData()[i]);
+    } else if (ReadExpr *re = dyn_cast<ReadExpr>(e)) {
+      d.add(digestUpdates(re->updates));
+    } else if (ExtractExpr *ee = dyn_cast<ExtractExpr>(e)) {
+      d.add(ee->offset);
+    }
+
+    for (unsigned i = 0; i < e->getNumKids(); ++i)
+      d.add(digestExpr(e->getKid(i)));
+
+    Digest result = d.finish();
+    CachedDigest &cached = exprDigests[e.get()];
+    cached.expr = e;
+    cached.digest = result;
+    return result;
+  }
+
+  void *allocateShared(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANON, -1, 0);
+    if (p == MAP_FAILED) {
+      perror("Could not allocate the shared query cache");
+      exit(-1);
+    }
+
+    // Anonymous mappings are zero-filled, i.e., all entries are empty
+    return p;
+  }
+
+}
+
+class SharedCachingSolver : public SolverImpl {
+private:
+  Solver *solver;
+  QueryDigester digester;
+
+  struct CacheKey {
+    uint64_t digest[2];
+    bool negationUsed;
+  };
+
+  ref<Expr> canonicalizeQuery(ref<Expr> originalQuery,
+                              bool &negationUsed);
+
+  CacheKey getKey(const Query &query);
+
+  void cacheInsert(const CacheKey &key,
+                   IncompleteSolver::PartialValidity result);
+
+  bool cacheLookup(const CacheKey &key,
+                   IncompleteSolver::PartialValidity &result);
+
+  uint64_t getCexKey(const Query &query,
+                     const std::vector<const Array*> &objects);
+
+  bool cexLookup(const Query &query,
+                 const std::vector<const Array*> &objects,
+                 std::vector< std::vector<unsigned char> > &values);
+
+  void cexInsert(const Query &query,
+                 const std::vector<const Array*> &objects,
+                 const std::vector< std::vector<unsigned char> > &values);
+
+public:
+  SharedCachingSolver(Solver *s) : solver(s) {}
+  ~SharedCachingSolver() { delete solver; }
+
+  bool computeValidity(const Query&, Solver::Validity &result);
+  bool computeTruth(const Query&, bool &isValid);
+  bool computeValue(const Query& query, ref<Expr> &result) {
+    return solver->impl->computeValue(query, result);
+  }
+  bool computeInitialValues(const Query& query,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution);
+};
+
+/** @returns the canonical version of the given query.  The reference
+    negationUsed is set to true if the original query was negated in
+    the canonicalization process. */
+ref<Expr> SharedCachingSolver::canonicalizeQuery(ref<Expr> originalQuery,
+                                                 bool &negationUsed) {
+  ref<Expr> negatedQuery = Expr::createIsZero(originalQuery);
+
+  if (originalQuery.compare(negatedQuery) < 0) {
+    negationUsed = false;
+    return originalQuery;
+  } else {
+    negationUsed = true;
+    return negatedQuery;
+  }
+}
+
+SharedCachingSolver::CacheKey
+SharedCachingSolver::getKey(const Query &query) {
+  CacheKey key;
+  ref<Expr> canonicalQuery = canonicalizeQuery(query.expr, key.negationUsed);
+
+  digester.beginQuery();
+  Digest d;
+  d.add(digester.digestExpr(canonicalQuery));
+  d.add(digester.digestConstraints(query.constraints));
+  d = d.finish();
+
+  key.digest[0] = d.h1;
+  key.digest[1] = d.h2;
+  return key;
+}
+
+/// Partial validities are stored with an offset of 3 so that 0 means empty.
+static uint32_t encodeResult(IncompleteSolver::PartialValidity pv) {
+  return (uint32_t) (pv + 3);
+}
+
+static IncompleteSolver::PartialValidity decodeResult(uint32_t entry) {
+  return (IncompleteSolver::PartialValidity) ((int) entry - 3);
+}
+
+/** @returns true on a cache hit, false of a cache miss.  Reference
+    value result only valid on a cache hit. */
+bool SharedCachingSolver::cacheLookup(const CacheKey &key,
+                                      IncompleteSolver::PartialValidity &result) {
+  ValiditySlot *set = &sharedTable[(key.digest[0] % sharedTableSets) *
+                                   Associativity];
+
+  for (unsigned i = 0; i < Associativity; ++i) {
+    ValiditySlot *slot = &set[i];
+    uint32_t version = *(volatile uint32_t*) &slot->version;
+    if (version & 1)
+      continue;
+    __sync_synchronize();
+
+    uint32_t entry = slot->result;
+    bool match = slot->key[0] == key.digest[0] &&
+                 slot->key[1] == key.digest[1];
+
+    __sync_synchronize();
+    if (*(volatile uint32_t*) &slot->version != version)
+      continue;
+
+    if (entry && match) {
+      IncompleteSolver::PartialValidity cached = decodeResult(entry);
+      result = (key.negationUsed ?
+                IncompleteSolver::negatePartialValidity(cached) : cached);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/// Inserts the given query, result pair into the cache.
+void SharedCachingSolver::cacheInsert(const CacheKey &key,
+                                      IncompleteSolver::PartialValidity result) {
+  IncompleteSolver::PartialValidity cachedResult =
+    (key.negationUsed ? IncompleteSolver::negatePartialValidity(result) : result);
+
+  ValiditySlot *set = &sharedTable[(key.digest[0] % sharedTableSets) *
+                                   Associativity];
+
+  // Update an existing entry or fill an empty one. Otherwise the set is
+  // full, evict an entry picked by the key.
+  ValiditySlot *slot = &set[key.digest[1] % Associativity];
+  bool evicted = true;
+  for (unsigned i = 0; i < Associativity; ++i) {
+    if (!set[i].result ||
+        (set[i].key[0] == key.digest[0] && set[i].key[1] == key.digest[1])) {
+      slot = &set[i];
+      evicted = false;
+      break;
+    }
+  }
+
+  // Give up if another process is writing the slot
+  uint32_t version = *(volatile uint32_t*) &slot->version;
+  if ((version & 1) ||
+      !__sync_bool_compare_and_swap(&slot->version, version, version + 1))
+    return;
+
+  slot->key[0] = key.digest[0];
+  slot->key[1] = key.digest[1];
+  slot->result = encodeResult(cachedResult);
+
+  __sync_synchronize();
+  *(volatile uint32_t*) &slot->version = version + 2;
+
+  if (evicted)
+    ++stats::sharedQueryCacheEvictions;
+}
+
+bool SharedCachingSolver::computeValidity(const Query& query,
+                                          Solver::Validity &result) {
+  CacheKey key = getKey(query);
+  IncompleteSolver::PartialValidity cachedResult;
+  bool tmp, cacheHit = cacheLookup(key, cachedResult);
+
+  if (cacheHit) {
+    ++stats::sharedQueryCacheHits;
+
+    switch(cachedResult) {
+    case IncompleteSolver::MustBeTrue:
+      result = Solver::True;
+      return true;
+    case IncompleteSolver::MustBeFalse:
+      result = Solver::False;
+      return true;
+    case IncompleteSolver::TrueOrFalse:
+      result = Solver::Unknown;
+      return true;
+    case IncompleteSolver::MayBeTrue: {
+      if (!solver->impl->computeTruth(query, tmp))
+        return false;
+      if (tmp) {
+        cacheInsert(key, IncompleteSolver::MustBeTrue);
+        result = Solver::True;
+        return true;
+      } else {
+        cacheInsert(key, IncompleteSolver::TrueOrFalse);
+        result = Solver::Unknown;
+        return true;
+      }
+    }
+    case IncompleteSolver::MayBeFalse: {
+      if (!solver->impl->computeTruth(query.negateExpr(), tmp))
+        return false;
+      if (tmp) {
+        cacheInsert(key, IncompleteSolver::MustBeFalse);
+        result = Solver::False;
+        return true;
+      } else {
+        cacheInsert(key, IncompleteSolver::TrueOrFalse);
+        result = Solver::Unknown;
+        return true;
+      }
+    }
+    default: assert(0 && "unreachable");
+    }
+  }
+
+  ++stats::sharedQueryCacheMisses;
+
+  if (!solver->impl->computeValidity(query, result))
+    return false;
+
+  switch (result) {
+  case Solver::True:
+    cachedResult = IncompleteSolver::MustBeTrue; break;
+  case Solver::False:
+    cachedResult = IncompleteSolver::MustBeFalse; break;
+  default:
+    cachedResult = IncompleteSolver::TrueOrFalse; break;
+  }
+
+  cacheInsert(key, cachedResult);
+  return true;
+}
+
+bool SharedCachingSolver::computeTruth(const Query& query,
+                                       bool &isValid) {
+  CacheKey key = getKey(query);
+  IncompleteSolver::PartialValidity cachedResult;
+  bool cacheHit = cacheLookup(key, cachedResult);
+
+  // a cached result of MayBeTrue forces us to check whether
+  // a False assignment exists.
+  if (cacheHit && cachedResult != IncompleteSolver::MayBeTrue) {
+    ++stats::sharedQueryCacheHits;
+    isValid = (cachedResult == IncompleteSolver::MustBeTrue);
+    return true;
+  }
+
+  ++stats::sharedQueryCacheMisses;
+
+  // cache miss: query solver
+  if (!solver->impl->computeTruth(query, isValid))
+    return false;
+
+  if (isValid) {
+    cachedResult = IncompleteSolver::MustBeTrue;
+  } else if (cacheHit) {
+    // We know a true assignment exists, and query isn't valid, so
+    // must be TrueOrFalse.
+    assert(cachedResult == IncompleteSolver::MayBeTrue);
+    cachedResult = IncompleteSolver::TrueOrFalse;
+  } else {
+    cachedResult = IncompleteSolver::MayBeFalse;
+  }
+
+  cacheInsert(key, cachedResult);
+  return true;
+}
+
+/// Counterexamples are looked up by the query itself, not by its canonical
+/// form, and by the names and sizes of the requested arrays.
+uint64_t
+SharedCachingSolver::getCexKey(const Query &query,
+                               const std::vector<const Array*> &objects) {
+  digester.beginQuery();
+  Digest d;
+  d.add(digester.digestExpr(query.expr));
+  d.add(digester.digestConstraints(query.constraints));
+
+  for (unsigned i = 0; i < objects.size(); ++i) {
+    uint64_t name = objects[i]->size;
+    for (unsigned j = 0; j < objects[i]->name.size(); ++j)
+      name = name * Expr::MAGIC_HASH_CONSTANT + objects[i]->name[j];
+    d.add(name);
+  }
+
+  return d.finish().h1;
+}
+
+/// A counterexample found in the table is only returned if it satisfies the
+/// constraints and falsifies the query, so key collisions and torn
+/// slots cannot produce a wrong answer.
+bool SharedCachingSolver::cexLookup(const Query &query,
+                                    const std::vector<const Array*> &objects,
+                                    std::vector< std::vector<unsigned char> >
+                                      &values) {
+  uint64_t size = 0;
+  for (unsigned i = 0; i < objects.size(); ++i)
+    size += objects[i]->size;
+  if (size > sizeof(((CexSlot*) 0)->values))
+    return false;
+
+  uint64_t key = getCexKey(query, objects);
+  CexSlot *slot = &sharedCexTable[key % sharedCexSlots];
+
+  uint32_t version = *(volatile uint32_t*) &slot->version;
+  if (version & 1)
+    return false;
+  __sync_synchronize();
+
+  if (slot->key != key || slot->size != size)
+    return false;
+
+  std::vector< std::vector<unsigned char> > result(objects.size());
+  const unsigned char *p = slot->values;
+  for (unsigned i = 0; i < objects.size(); ++i) {
+    result[i].assign(p, p + objects[i]->size);
+    p += objects[i]->size;
+  }
+
+  __sync_synchronize();
+  if (*(volatile uint32_t*) &slot->version != version)
+    return false;
+
+  Assignment assignment;
+  for (unsigned i = 0; i < objects.size(); ++i)
+    assignment.add(objects[i], result[i]);
+
+  for (ConstraintManager::constraint_iterator it = query.constraints.begin();
+       it != query.constraints.end(); ++it)
+    if (!assignment.evaluate(*it)->isTrue())
+      return false;
+  if (!assignment.evaluate(query.expr)->isFalse())
+    return false;
+
+  values.swap(result);
+  return true;
+}
+
+void SharedCachingSolver::cexInsert(const Query &query,
+                                    const std::vector<const Array*> &objects,
+                                    const std::vector< std::vector<unsigned char> >
+                                      &values) {
+  uint64_t size = 0;
+  for (unsigned i = 0; i < objects.size(); ++i)
+    size += objects[i]->size;
+  if (size > sizeof(((CexSlot*) 0)->values))
+    return;
+
+  uint64_t key = getCexKey(query, objects);
+  CexSlot *slot = &sharedCexTable[key % sharedCexSlots];
+
+  // Give up if another process is writing the slot
+  uint32_t version = *(volatile uint32_t*) &slot->version;
+  if ((version & 1) ||
+      !__sync_bool_compare_and_swap(&slot->version, version, version + 1))
+    return;
+
+  slot->key = key;
+  slot->size = size;
+  unsigned char *p = slot->values;
+  for (unsigned i = 0; i < values.size(); ++i) {
+    if (!values[i].empty())
+      memcpy(p, &values[i][0], values[i].size());
+    p += values[i].size();
+  }
+
+  __sync_synchronize();
+  *(volatile uint32_t*) &slot->version = version + 2;
+}
+
+bool
+SharedCachingSolver::computeInitialValues(const Query& query,
+                                          const std::vector<const Array*>
+                                            &objects,
+                                          std::vector< std::vector<unsigned char> >
+                                            &values,
+                                          bool &hasSolution) {
+  if (!sharedCexTable)
+    return solver->impl->computeInitialValues(query, objects, values,
+                                              hasSolution);
+
+  if (cexLookup(query, objects, values)) {
+    ++stats::sharedCexCacheHits;
+    hasSolution = true;
+    return true;
+  }
+
+  ++stats::sharedCexCacheMisses;
+
+  if (!solver->impl->computeInitialValues(query, objects, values,
+                                          hasSolution))
+    return false;
+
+  if (hasSolution)
+    cexInsert(query, objects, values);
+  return true;
+}
+
+///
+
+Solver *klee::createSharedCachingSolver(Solver *_solver, unsigned entries,
+                                        unsigned counterexamples) {
+  if (!sharedTable) {
+    sharedTableSets = (entries + Associativity - 1) / Associativity;
+    if (!sharedTableSets)
+      sharedTableSets = 1;
+
+    sharedTable = static_cast<ValiditySlot*>(
+        allocateShared(sharedTableSets * Associativity *
+                       sizeof(ValiditySlot)));
+  }
+
+  if (!sharedCexTable && counterexamples) {
+    sharedCexSlots = counterexamples;
+    sharedCexTable = static_cast<CexSlot*>(
+        allocateShared(sharedCexSlots * sizeof(CexSlot)));
+  }
+
+  return new Solver(new SharedCachingSolver(_solver));
+}
@@ -35,8 +35,8 @@
 
 #ifndef __MINGW32__
 #include <sys/wait.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <sys/mman.h>
+#include "STPWorkerPool.h"
 #endif
 
 using namespace klee;
@@ -45,6 +45,12 @@ namespace {
   llvm::cl::opt<bool>
   ReinstantiateSolver("reinstantiate-solver",
                       llvm::cl::init(false));
+
+  llvm::cl::opt<unsigned>
+  STPWorkers("stp-workers",
+             llvm::cl::desc("Number of long-lived processes solving the queries "
+                            "of the forked STP solver (0 = fork for each query)"),
+             llvm::cl::init(1));
 }
 
 /***/
@@ -501,21 +507,43 @@ Solver *klee::createDummySolver() {
 /***/
 
 class STPSolverImpl : public SolverImpl {
-private:
+protected:
   /// The solver we are part of, for access to public information.
   STPSolver *solver;
   VC vc;
   STPBuilder *builder;
   double timeout;
   bool useForkedSTP;
+  bool optimizeDivides;
+#ifndef __MINGW32__
+  STPWorkerPool *workerPool;
+#endif
 
   void reinstantiate();
 
-public:
-  STPSolverImpl(STPSolver *_solver, bool _useForkedSTP);
-  ~STPSolverImpl();
+  /// solveWithWorkers - Solve the query in the worker pool, if there is
+  /// one. Returns false if the query has to be solved in this process.
+  bool solveWithWorkers(const Query&,
+                        const std::vector<const Array*> &objects,
+                        std::vector< std::vector<unsigned char> > &values,
+                        bool &hasSolution, bool &success);
+
+  /// runQuery - Check query.expr against the constraints currently
+  /// asserted in the validity checker.
+  bool runQuery(const Query&,
+                const std::vector<const Array*> &objects,
+                std::vector< std::vector<unsigned char> > &values,
+                bool &hasSolution);
 
-  char *getConstraintLog(const Query&);
+public:
+  /// \param _useWorkers - Whether forked queries may be solved in the
+  /// worker pool, which does not see the constraints asserted in this
+  /// process.
+  STPSolverImpl(STPSolver *_solver, bool _useForkedSTP,
+                bool _optimizeDivides = true, bool _useWorkers = true);
+  virtual ~STPSolverImpl();
+
+  virtual char *getConstraintLog(const Query&);
   void setTimeout(double _timeout) { timeout = _timeout; }
 
   bool computeTruth(const Query&, bool &isValid);
@@ -526,21 +554,53 @@ public:
                             bool &hasSolution);
 };
 
-static unsigned char *shared_memory_ptr;
-static const unsigned shared_memory_size = 1<<20;
-static int shared_memory_id;
+/// IncrementalSTPSolverImpl - Keeps the constraints of the previous query
+/// asserted in the validity checker, one push level per constraint. The
+/// next query only pops the constraints that are not a prefix of its own
+/// constraint set and asserts the remaining suffix. Successive queries of
+/// the same state, or of a state and its children, share most constraints.
+///
+/// Forked queries are run in a process forked for them, which inherits
+/// the asserted constraints, rather than in the worker pool.
+class IncrementalSTPSolverImpl : public STPSolverImpl {
+private:
+  std::vector< ref<Expr> > assertedConstraints;
+
+  void popConstraints(unsigned count);
+
+public:
+  IncrementalSTPSolverImpl(STPSolver *_solver, bool _useForkedSTP,
+                           bool _optimizeDivides)
+    : STPSolverImpl(_solver, _useForkedSTP, _optimizeDivides, false) {}
+  ~IncrementalSTPSolverImpl() { popConstraints(assertedConstraints.size()); }
+
+  char *getConstraintLog(const Query &query) {
+    popConstraints(assertedConstraints.size());
+    return STPSolverImpl::getConstraintLog(query);
+  }
+
+  bool computeInitialValues(const Query&,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution);
+};
+
+static unsigned char *shared_memory_ptr = 0;
+static size_t shared_memory_size = 0;
 
 static void stp_error_handler(const char* err_msg) {
   fprintf(stderr, "error: STP Error: %s\n", err_msg);
   exit(-1);
 }
 
-STPSolverImpl::STPSolverImpl(STPSolver *_solver, bool _useForkedSTP)
+STPSolverImpl::STPSolverImpl(STPSolver *_solver, bool _useForkedSTP,
+                             bool _optimizeDivides, bool _useWorkers)
   : solver(_solver),
     vc(vc_createValidityChecker()),
-    builder(new STPBuilder(vc)),
+    builder(new STPBuilder(vc, _optimizeDivides)),
     timeout(0.0),
-    useForkedSTP(_useForkedSTP)
+    useForkedSTP(_useForkedSTP),
+    optimizeDivides(_optimizeDivides)
 {
   assert(vc && "unable to create validity checker");
   assert(builder && "unable to create STPBuilder");
@@ -551,20 +611,24 @@ STPSolverImpl::STPSolverImpl(STPSolver *_solver, bool _useForkedSTP)
 
   vc_registerErrorHandler(::stp_error_handler);
 
+#ifndef __MINGW32__
+  workerPool = 0;
+#endif
+
   if (useForkedSTP) {
 #ifdef __MINGW32__
     assert(false && "Cannot use forked stp solver on Windows");
 #else
-    shared_memory_id = shmget(IPC_PRIVATE, shared_memory_size, IPC_CREAT | 0700);
-    assert(shared_memory_id>=0 && "shmget failed");
-    shared_memory_ptr = (unsigned char*) shmat(shared_memory_id, NULL, 0);
-    assert(shared_memory_ptr!=(void*)-1 && "shmat failed");
-    shmctl(shared_memory_id, IPC_RMID, NULL);
+    if (STPWorkers && _useWorkers)
+      workerPool = new STPWorkerPool(STPWorkers);
 #endif
   }
 }
 
 STPSolverImpl::~STPSolverImpl() {
+#ifndef __MINGW32__
+  delete workerPool;
+#endif
   delete builder;
 
   vc_Destroy(vc);
@@ -578,7 +642,7 @@ void STPSolverImpl::reinstantiate()
         delete builder;
         vc_Destroy(vc);
         vc = vc_createValidityChecker();
-        builder = new STPBuilder(vc);
+        builder = new STPBuilder(vc, optimizeDivides);
 
         #ifdef HAVE_EXT_STP
         vc_setInterfaceFlags(vc, EXPRDELETE, 0);
@@ -590,8 +654,11 @@ void STPSolverImpl::reinstantiate()
 
 /***/
 
-STPSolver::STPSolver(bool useForkedSTP)
-  : Solver(new STPSolverImpl(this, useForkedSTP))
+STPSolver::STPSolver(bool useForkedSTP, bool incremental,
+                     bool optimizeDivides)
+  : Solver(incremental ?
+           new IncrementalSTPSolverImpl(this, useForkedSTP, optimizeDivides) :
+           new STPSolverImpl(this, useForkedSTP, optimizeDivides))
 {
 }
 
@@ -607,7 +674,7 @@ void STPSolver::setTimeout(double timeout) {
 
 char *STPSolverImpl::getConstraintLog(const Query &query) {
   vc_push(vc);
-  for (std::vector< ref<Expr> >::const_iterator it = query.constraints.begin(),
+  for (ConstraintManager::const_iterator it = query.constraints.begin(),
          ie = query.constraints.end(); it != ie; ++it)
     vc_assertFormula(vc, builder->construct(*it));
   assert(query.expr == ConstantExpr::alloc(0, Expr::Bool) &&
@@ -709,6 +776,31 @@ static void stpTimeoutHandler(int x) {
   _exit(52);
 }
 
+#ifndef __MINGW32__
+/// Grows the buffer through which forked STP processes return
+/// counterexamples, so that it can hold at least size bytes.
+static bool reserveSharedMemory(size_t size) {
+  if (shared_memory_ptr && size <= shared_memory_size)
+    return true;
+
+  size_t newSize = shared_memory_size ? shared_memory_size : 1<<20;
+  while (newSize < size)
+    newSize *= 2;
+
+  void *ptr = mmap(NULL, newSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANON, -1, 0);
+  if (ptr == MAP_FAILED)
+    return false;
+
+  if (shared_memory_ptr)
+    munmap(shared_memory_ptr, shared_memory_size);
+
+  shared_memory_ptr = static_cast<unsigned char*>(ptr);
+  shared_memory_size = newSize;
+  return true;
+}
+#endif
+
 static bool runAndGetCexForked(::VC vc,
                                STPBuilder *builder,
                                ::VCExpr q,
@@ -722,12 +814,16 @@ static bool runAndGetCexForked(::VC vc,
   return false;
 #else
 
-  unsigned char *pos = shared_memory_ptr;
-  unsigned sum = 0;
+  size_t sum = 0;
   for (std::vector<const Array*>::const_iterator
          it = objects.begin(), ie = objects.end(); it != ie; ++it)
     sum += (*it)->size;
-  assert(sum<shared_memory_size && "not enough shared memory for counterexample");
+  if (!reserveSharedMemory(sum)) {
+    fprintf(stderr, "error: not enough shared memory for counterexample\n");
+    return false;
+  }
+
+  unsigned char *pos = shared_memory_ptr;
 
   fflush(stdout);
   fflush(stderr);
@@ -828,6 +924,10 @@ STPSolverImpl::computeInitialValues(const Query &query,
                                     bool &hasSolution) {
   TimerStatIncrementer t(stats::queryTime);
 
+  bool success;
+  if (solveWithWorkers(query, objects, values, hasSolution, success))
+    return success;
+
   reinstantiate();
 
   vc_push(vc);
@@ -836,6 +936,50 @@ STPSolverImpl::computeInitialValues(const Query &query,
          ie = query.constraints.end(); it != ie; ++it)
     vc_assertFormula(vc, builder->construct(*it));
 
+  success = runQuery(query, objects, values, hasSolution);
+
+  vc_pop(vc);
+
+  return success;
+}
+
+bool
+STPSolverImpl::solveWithWorkers(const Query &query,
+                                const std::vector<const Array*> &objects,
+                                std::vector< std::vector<unsigned char> >
+                                  &values,
+                                bool &hasSolution, bool &success) {
+#ifdef __MINGW32__
+  return false;
+#else
+  if (!workerPool)
+    return false;
+
+  STPWorkerPool::Result result =
+    workerPool->computeInitialValues(query, objects, values, hasSolution,
+                                     timeout);
+  if (result == STPWorkerPool::Unsupported)
+    return false;
+
+  ++stats::queries;
+  ++stats::queryCounterexamples;
+
+  success = result == STPWorkerPool::Success;
+  if (success) {
+    if (hasSolution)
+      ++stats::queriesInvalid;
+    else
+      ++stats::queriesValid;
+  }
+  return true;
+#endif
+}
+
+bool
+STPSolverImpl::runQuery(const Query &query,
+                        const std::vector<const Array*> &objects,
+                        std::vector< std::vector<unsigned char> > &values,
+                        bool &hasSolution) {
   ++stats::queries;
   ++stats::queryCounterexamples;
 
@@ -865,10 +1009,6 @@ STPSolverImpl::computeInitialValues(const Query &query,
     } catch(std::exception &) {
         klee::klee_warning("STP solver threw an exception");
         exit(-1);
-        vc_pop(vc);
-        reinstantiate();
-        success = false;
-        return success;
     }
   }
 
@@ -879,8 +1019,50 @@ STPSolverImpl::computeInitialValues(const Query &query,
       ++stats::queriesValid;
   }
 
-  vc_pop(vc);
+  return success;
+}
+
+void IncrementalSTPSolverImpl::popConstraints(unsigned count) {
+  assert(count <= assertedConstraints.size());
+  for (unsigned i = 0; i < count; ++i) {
+    vc_pop(vc);
+    assertedConstraints.pop_back();
+  }
+}
+
+bool
+IncrementalSTPSolverImpl::computeInitialValues(const Query &query,
+                                               const std::vector<const Array*>
+                                                 &objects,
+                                               std::vector< std::vector<unsigned char> >
+                                                 &values,
+                                               bool &hasSolution) {
+  TimerStatIncrementer t(stats::queryTime);
+
+  // Find the longest prefix of the query constraints that is still asserted
+  unsigned common = 0;
+  ConstraintManager::const_iterator it = query.constraints.begin(),
+    ie = query.constraints.end();
+  for (; it != ie && common < assertedConstraints.size(); ++it, ++common) {
+    if (assertedConstraints[common].get() != (*it).get())
+      break;
+  }
+
+  popConstraints(assertedConstraints.size() - common);
+
+  // The validity checker can only be recreated when nothing is asserted
+  if (assertedConstraints.empty())
+    reinstantiate();
 
+  for (; it != ie; ++it) {
+    vc_push(vc);
+    vc_assertFormula(vc, builder->construct(*it));
+    assertedConstraints.push_back(*it);
+  }
+
+  vc_push(vc);
+  bool success = runQuery(query, objects, values, hasSolution);
+  vc_pop(vc);
 
   return success;
 }
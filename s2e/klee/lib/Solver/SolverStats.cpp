@@ -21,3 +21,16 @@ Statistic stats::queryConstructTime("QueryConstructTime", "QBtime") ;
 Statistic stats::queryConstructs("QueriesConstructs", "QB");
 Statistic stats::queryCounterexamples("QueriesCEX", "Qcex");
 Statistic stats::queryTime("QueryTime", "Qtime");
+Statistic stats::sharedQueryCacheHits("SharedQueryCacheHits", "SQChits");
+Statistic stats::sharedQueryCacheMisses("SharedQueryCacheMisses", "SQCmisses");
+Statistic stats::sharedQueryCacheEvictions("SharedQueryCacheEvictions", "SQCevict");
+Statistic stats::sharedCexCacheHits("SharedCexCacheHits", "SCChits");
+Statistic stats::sharedCexCacheMisses("SharedCexCacheMisses", "SCCmisses");
+Statistic stats::persistentQueryCacheHits("PersistentQueryCacheHits", "PQChits");
+Statistic stats::persistentQueryCacheMisses("PersistentQueryCacheMisses", "PQCmisses");
+Statistic stats::portfolioQueries("PortfolioQueries", "PFQ");
+Statistic stats::portfolioFailures("PortfolioFailures", "PFfail");
+Statistic stats::portfolioWinsSTP("PortfolioWinsSTP", "PFstp");
+Statistic stats::portfolioWinsSTPSimple("PortfolioWinsSTPSimple", "PFstps");
+Statistic stats::portfolioWinsFastCex("PortfolioWinsFastCex", "PFfcex");
+Statistic stats::portfolioWinsSMTLIB("PortfolioWinsSMTLIB", "PFsmt");
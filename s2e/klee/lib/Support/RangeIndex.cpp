@@ -0,0 +1,106 @@
+//===-- RangeIndex.cpp ----------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Internal/ADT/RangeIndex.h"
+
+#include <cstring>
+
+using namespace klee;
+
+RangeIndex::RangeIndex() : lastHit(0) {
+  memset(filter, 0, sizeof(filter));
+}
+
+void RangeIndex::clear() {
+  ranges.clear();
+  lastHit = 0;
+  memset(filter, 0, sizeof(filter));
+}
+
+unsigned RangeIndex::findFirstAfter(uint64_t address) const {
+  unsigned lo = 0, hi = ranges.size();
+  while (lo < hi) {
+    unsigned mid = lo + (hi - lo) / 2;
+    if (ranges[mid].end <= address)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void RangeIndex::rebuildFilter() {
+  memset(filter, 0, sizeof(filter));
+  lastHit = 0;
+
+  for (unsigned i = 0; i < ranges.size(); ++i) {
+    uint64_t first = ranges[i].start >> PageBits;
+    uint64_t last = (ranges[i].end - 1) >> PageBits;
+    if (last - first >= FilterSize) {
+      memset(filter, 0xff, sizeof(filter));
+      return;
+    }
+    for (uint64_t page = first; page <= last; ++page) {
+      unsigned bit = hashPage(page);
+      filter[bit / 64] |= 1ULL << (bit % 64);
+    }
+  }
+}
+
+void RangeIndex::add(uint64_t start, uint64_t size) {
+  if (!size)
+    return;
+
+  Range r;
+  r.start = start;
+  r.end = getEnd(start, size);
+
+  // Merge with the ranges overlapping or adjacent to the new one
+  unsigned i = findFirstAfter(start ? start - 1 : 0);
+  unsigned j = i;
+  while (j < ranges.size() && ranges[j].start <= r.end) {
+    if (ranges[j].start < r.start)
+      r.start = ranges[j].start;
+    if (ranges[j].end > r.end)
+      r.end = ranges[j].end;
+    ++j;
+  }
+
+  ranges.erase(ranges.begin() + i, ranges.begin() + j);
+  ranges.insert(ranges.begin() + i, r);
+  rebuildFilter();
+}
+
+void RangeIndex::remove(uint64_t start, uint64_t size) {
+  if (!size)
+    return;
+
+  uint64_t end = getEnd(start, size);
+  unsigned i = findFirstAfter(start);
+  if (i == ranges.size() || ranges[i].start >= end)
+    return;
+
+  std::vector<Range> pieces;
+  unsigned j = i;
+  while (j < ranges.size() && ranges[j].start < end) {
+    if (ranges[j].start < start) {
+      Range r = { ranges[j].start, start };
+      pieces.push_back(r);
+    }
+    if (ranges[j].end > end) {
+      Range r = { end, ranges[j].end };
+      pieces.push_back(r);
+    }
+    ++j;
+  }
+
+  ranges.erase(ranges.begin() + i, ranges.begin() + j);
+  ranges.insert(ranges.begin() + i, pieces.begin(), pieces.end());
+  rebuildFilter();
+}
@@ -0,0 +1,318 @@
+//===-- SolverCacheFile.cpp -----------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Internal/Support/SolverCacheFile.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace klee;
+
+/*
+ * File layout:
+ *   FileHeader
+ *   RecordHeader key value
+ *   RecordHeader key value
+ *   ...
+ */
+
+namespace {
+  const char FileMagic[8] = { 'K', 'L', 'E', 'E', 'S', 'C', '0', '1' };
+
+  struct RecordHeader {
+    uint32_t kind;
+    uint32_t keySize;
+    uint32_t valueSize;
+    /// Detects records that were only partially written
+    uint32_t checksum;
+  };
+
+  uint32_t computeChecksum(const char *key, unsigned keySize,
+                           const char *value, unsigned valueSize) {
+    uint32_t h = 2166136261u;
+    for (unsigned i = 0; i < keySize; ++i)
+      h = (h ^ (uint8_t) key[i]) * 16777619u;
+    for (unsigned i = 0; i < valueSize; ++i)
+      h = (h ^ (uint8_t) value[i]) * 16777619u;
+    return h;
+  }
+}
+
+SolverCacheFile::SolverCacheFile()
+  : fd(-1), readOnly(true), mapping(0), mappingSize(0), validSize(0) {
+}
+
+SolverCacheFile::~SolverCacheFile() {
+  close();
+}
+
+uint64_t SolverCacheFile::hashKey(RecordKind kind, const char *key,
+                                  unsigned size) {
+  uint64_t h = 14695981039346656037ULL ^ kind;
+  for (unsigned i = 0; i < size; ++i)
+    h = (h ^ (uint8_t) key[i]) * 1099511628211ULL;
+  return h;
+}
+
+bool SolverCacheFile::open(const std::string &path, bool _readOnly,
+                           std::string &error) {
+  close();
+  readOnly = _readOnly;
+
+  fd = ::open(path.c_str(), readOnly ? O_RDONLY : (O_RDWR | O_CREAT | O_APPEND),
+              0644);
+  if (fd < 0) {
+    error = "cannot open " + path + ": " + strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    error = "cannot stat " + path + ": " + strerror(errno);
+    close();
+    return false;
+  }
+
+  if (st.st_size == 0) {
+    if (!readOnly &&
+        write(fd, FileMagic, sizeof(FileMagic)) != (ssize_t) sizeof(FileMagic)) {
+      error = "cannot write " + path + ": " + strerror(errno);
+      close();
+      return false;
+    }
+    validSize = sizeof(FileMagic);
+    return true;
+  }
+
+  mappingSize = st.st_size;
+  void *addr = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    error = "cannot map " + path + ": " + strerror(errno);
+    mappingSize = 0;
+    close();
+    return false;
+  }
+  mapping = static_cast<const char*>(addr);
+
+  if (mappingSize < sizeof(FileMagic) ||
+      memcmp(mapping, FileMagic, sizeof(FileMagic))) {
+    error = path + " is not a solver cache file";
+    close();
+    return false;
+  }
+
+  indexRecords();
+
+  // Drop the partially written record, if any, before appending new ones
+  if (!readOnly && validSize < mappingSize) {
+    if (ftruncate(fd, validSize) < 0) {
+      error = "cannot truncate " + path + ": " + strerror(errno);
+      close();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void SolverCacheFile::close() {
+  if (mapping)
+    munmap(const_cast<char*>(mapping), mappingSize);
+  if (fd >= 0)
+    ::close(fd);
+
+  fd = -1;
+  mapping = 0;
+  mappingSize = 0;
+  validSize = 0;
+  index.clear();
+}
+
+bool SolverCacheFile::readRecord(uint64_t offset, Record &record,
+                                 uint64_t &next) const {
+  if (offset + sizeof(RecordHeader) > mappingSize)
+    return false;
+
+  RecordHeader hdr;
+  memcpy(&hdr, mapping + offset, sizeof(hdr));
+
+  uint64_t end = offset + sizeof(RecordHeader) +
+                 (uint64_t) hdr.keySize + hdr.valueSize;
+  if (end > mappingSize)
+    return false;
+
+  record.kind = (RecordKind) hdr.kind;
+  record.key = mapping + offset + sizeof(RecordHeader);
+  record.keySize = hdr.keySize;
+  record.value = record.key + hdr.keySize;
+  record.valueSize = hdr.valueSize;
+
+  if (computeChecksum(record.key, record.keySize,
+                      record.value, record.valueSize) != hdr.checksum)
+    return false;
+
+  next = end;
+  return true;
+}
+
+bool SolverCacheFile::matchRecord(uint64_t offset, RecordKind kind,
+                                  const char *key, unsigned keySize,
+                                  std::string *value) const {
+  // Records of the mapping are checked when the file is opened
+  if (offset < validSize) {
+    Record record;
+    uint64_t next;
+    if (!readRecord(offset, record, next) || record.kind != kind ||
+        record.keySize != keySize || memcmp(record.key, key, keySize))
+      return false;
+    if (value)
+      value->assign(record.value, record.valueSize);
+    return true;
+  }
+
+  RecordHeader hdr;
+  if (pread(fd, &hdr, sizeof(hdr), offset) != (ssize_t) sizeof(hdr) ||
+      hdr.kind != (uint32_t) kind || hdr.keySize != keySize)
+    return false;
+
+  std::string buffer(hdr.keySize + hdr.valueSize, '\0');
+  if (!buffer.empty() &&
+      pread(fd, &buffer[0], buffer.size(), offset + sizeof(hdr)) !=
+        (ssize_t) buffer.size())
+    return false;
+
+  if (buffer.compare(0, keySize, key, keySize) ||
+      computeChecksum(buffer.data(), hdr.keySize,
+                      buffer.data() + hdr.keySize,
+                      hdr.valueSize) != hdr.checksum)
+    return false;
+
+  if (value)
+    value->assign(buffer, keySize, std::string::npos);
+  return true;
+}
+
+void SolverCacheFile::indexRecord(uint64_t offset, RecordKind kind,
+                                  const char *key, unsigned keySize) {
+  uint64_t hash = hashKey(kind, key, keySize);
+
+  // Later records replace earlier ones with the same key
+  std::pair<index_ty::iterator, index_ty::iterator> range =
+    index.equal_range(hash);
+  for (index_ty::iterator it = range.first; it != range.second; ++it) {
+    if (matchRecord(it->second, kind, key, keySize, 0)) {
+      it->second = offset;
+      return;
+    }
+  }
+
+  index.insert(std::make_pair(hash, offset));
+}
+
+void SolverCacheFile::indexRecords() {
+  uint64_t offset = sizeof(FileMagic), next;
+  Record record;
+
+  // Records are only matched against the mapping up to validSize
+  validSize = mappingSize;
+
+  while (readRecord(offset, record, next)) {
+    indexRecord(offset, record.kind, record.key, record.keySize);
+    offset = next;
+  }
+
+  validSize = offset;
+}
+
+bool SolverCacheFile::lookup(RecordKind kind, const std::string &key,
+                             std::string &value) const {
+  std::pair<index_ty::const_iterator, index_ty::const_iterator> range =
+    index.equal_range(hashKey(kind, key.data(), key.size()));
+
+  for (index_ty::const_iterator it = range.first; it != range.second; ++it) {
+    if (matchRecord(it->second, kind, key.data(), key.size(), &value))
+      return true;
+  }
+
+  return false;
+}
+
+bool SolverCacheFile::append(RecordKind kind, const std::string &key,
+                             const std::string &value) {
+  if (fd < 0 || readOnly)
+    return false;
+
+  RecordHeader hdr;
+  hdr.kind = kind;
+  hdr.keySize = key.size();
+  hdr.valueSize = value.size();
+  hdr.checksum = computeChecksum(key.data(), key.size(),
+                                 value.data(), value.size());
+
+  // Write the record at once, so that processes sharing the
+  // file do not interleave their records
+  std::string buffer;
+  buffer.reserve(sizeof(hdr) + key.size() + value.size());
+  buffer.append((const char*) &hdr, sizeof(hdr));
+  buffer.append(key);
+  buffer.append(value);
+
+  if (write(fd, buffer.data(), buffer.size()) != (ssize_t) buffer.size())
+    return false;
+
+  // Forked processes share the file offset, so another process may have
+  // appended a record since our write. The record is then left unindexed
+  // until the file is opened again.
+  off_t end = lseek(fd, 0, SEEK_CUR);
+  if (end >= (off_t) buffer.size()) {
+    uint64_t offset = end - buffer.size();
+    if (matchRecord(offset, kind, key.data(), key.size(), 0))
+      indexRecord(offset, kind, key.data(), key.size());
+  }
+
+  return true;
+}
+
+void SolverCacheFile::getRecords(std::vector<Record> &records) const {
+  uint64_t offset = sizeof(FileMagic), next;
+  Record record;
+
+  while (offset < validSize && readRecord(offset, record, next)) {
+    records.push_back(record);
+    offset = next;
+  }
+}
+
+bool SolverCacheFile::mergeFrom(const SolverCacheFile &input,
+                                unsigned &written) {
+  std::vector<Record> records;
+  input.getRecords(records);
+
+  for (unsigned i = records.size(); i > 0; --i) {
+    const Record &r = records[i - 1];
+    std::string key(r.key, r.keySize), value;
+    if (lookup(r.kind, key, value))
+      continue;
+
+    if (!append(r.kind, key, std::string(r.value, r.valueSize)))
+      return false;
+    ++written;
+  }
+
+  return true;
+}
+
+unsigned SolverCacheFile::getNumIndexedRecords() const {
+  return index.size();
+}
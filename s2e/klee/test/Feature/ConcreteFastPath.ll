@@ -0,0 +1,63 @@
+; RUN: llvm-as -f %s -o - | %klee --concrete-fast-path --exit-on-error 2> %t1.log
+; RUN: not test -f klee-last/test000001.abort.err
+
+; Unconditional branches and switches, including one without cases,
+; are interleaved with instructions handled by the concrete fast path.
+
+declare void @klee_abort()
+
+define i32 @classify(i32 %x) {
+entry:
+  %low = and i32 %x, 3
+  br label %dispatch
+
+dispatch:
+  switch i32 %low, label %other [
+    i32 0, label %zero
+    i32 1, label %one
+  ]
+
+zero:
+  br label %join
+
+one:
+  %neg = sub i32 0, %x
+  br label %join
+
+other:
+  %big = icmp ugt i32 %x, 4
+  %sel = select i1 %big, i32 100, i32 10
+  br label %join
+
+join:
+  %v = phi i32 [ 0, %zero ], [ %neg, %one ], [ %sel, %other ]
+  switch i32 %v, label %exit [ ]
+
+exit:
+  ret i32 %v
+}
+
+define i32 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  %sum = phi i32 [ 0, %entry ], [ %newsum, %loop ]
+  %r = call i32 @classify(i32 %i)
+  %newsum = add i32 %sum, %r
+  %next = add i32 %i, 1
+  %done = icmp eq i32 %next, 8
+  br i1 %done, label %check, label %loop
+
+check:
+  %ok = icmp eq i32 %newsum, 214
+  br i1 %ok, label %exit, label %error
+
+error:
+  call void @klee_abort()
+  unreachable
+
+exit:
+  ret i32 0
+}
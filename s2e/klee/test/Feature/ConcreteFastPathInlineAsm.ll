@@ -0,0 +1,12 @@
+; RUN: llvm-as -f %s -o - | %klee --concrete-fast-path 2> %t1.log
+; RUN: test -f klee-last/test000001.exec.err
+
+; Inline assembly is reported as unsupported by the interpreter, the
+; concrete fast path must not evaluate the operands of the call.
+
+define i32 @main() {
+entry:
+  %a = add i32 1, 2
+  call void asm sideeffect "nop", ""()
+  ret i32 %a
+}
@@ -8,8 +8,10 @@
 #include "klee/ExprBuilder.h"
 #include "klee/Solver.h"
 #include "klee/Statistics.h"
+#include "klee/util/ExprHashMap.h"
 #include "klee/util/ExprPPrinter.h"
 #include "klee/util/ExprVisitor.h"
+#include "klee/Internal/System/Time.h"
 
 #include "llvm/ADT/OwningPtr.h"
 #include "llvm/ADT/StringExtras.h"
@@ -20,6 +22,10 @@
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/system_error.h"
 
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 using namespace llvm;
 using namespace klee;
 using namespace klee::expr;
@@ -32,7 +38,10 @@ namespace {
   enum ToolActions {
     PrintTokens,
     PrintAST,
-    Evaluate
+    Evaluate,
+    BenchmarkExprs,
+    BenchmarkIndependence,
+    BenchmarkIncremental
   };
 
   static llvm::cl::opt<ToolActions> 
@@ -45,6 +54,12 @@ namespace {
                         "Print parsed AST nodes from the input file."),
              clEnumValN(Evaluate, "evaluate",
                         "Print parsed AST nodes from the input file."),
+             clEnumValN(BenchmarkExprs, "benchmark-exprs",
+                        "Report the memory used by the expressions of the input file and the time to compare them."),
+             clEnumValN(BenchmarkIndependence, "benchmark-independence",
+                        "Report the time to find the constraints relevant to each query of the input file."),
+             clEnumValN(BenchmarkIncremental, "benchmark-incremental",
+                        "Report the time to solve the queries of the input file with and without incremental STP."),
              clEnumValEnd));
 
   enum BuilderKinds {
@@ -66,6 +81,11 @@ namespace {
                          "Fold constants and simplify expressions."),
               clEnumValEnd));
 
+  cl::opt<bool>
+  HashCons("hash-cons",
+           cl::desc("Share the nodes of structurally identical expressions"),
+           cl::init(false));
+
   cl::opt<bool>
   UseDummySolver("use-dummy-solver",
 		   cl::init(false));
@@ -263,6 +283,221 @@ static bool EvaluateInputAST(const char *Filename,
   return success;
 }
 
+/// Measures the expression memory of a query log, and the time spent
+/// comparing its expressions the way the solver caches do: hashing all
+/// of them, and comparing the constraints of successive queries.
+static bool BenchmarkInputAST(const char *Filename,
+                              const MemoryBuffer *MB,
+                              ExprBuilder *Builder) {
+  std::vector<Decl*> Decls;
+  unsigned InitialExprs = Expr::count;
+  double Start = util::getWallTime();
+
+  Parser *P = Parser::Create(Filename, MB, Builder);
+  P->SetMaxErrors(20);
+  while (Decl *D = P->ParseTopLevelDecl()) {
+    Decls.push_back(D);
+  }
+
+  double ParseTime = util::getWallTime() - Start;
+
+  bool success = true;
+  if (unsigned N = P->GetNumErrors()) {
+    std::cerr << Filename << ": parse failure: "
+               << N << " errors.\n";
+    success = false;
+  }
+
+  if (success) {
+    std::vector<QueryCommand*> Queries;
+    for (std::vector<Decl*>::iterator it = Decls.begin(),
+           ie = Decls.end(); it != ie; ++it)
+      if (QueryCommand *QC = dyn_cast<QueryCommand>(*it))
+        Queries.push_back(QC);
+
+    Start = util::getWallTime();
+
+    ExprHashSet Distinct;
+    unsigned NumExprs = 0, NumShared = 0;
+    for (unsigned i = 0; i != Queries.size(); ++i) {
+      const std::vector< ref<Expr> > &Constraints = Queries[i]->Constraints;
+      for (unsigned j = 0; j != Constraints.size(); ++j, ++NumExprs)
+        Distinct.insert(Constraints[j]);
+      Distinct.insert(Queries[i]->Query);
+      ++NumExprs;
+
+      if (i) {
+        const std::vector< ref<Expr> > &Previous = Queries[i-1]->Constraints;
+        for (unsigned j = 0; j != Constraints.size() &&
+               j != Previous.size(); ++j)
+          if (Constraints[j] == Previous[j])
+            ++NumShared;
+      }
+    }
+
+    double CompareTime = util::getWallTime() - Start;
+
+    std::cout << "queries = " << Queries.size() << "\n"
+              << "parse time = " << ParseTime << "s\n"
+              << "live expressions = " << Expr::count - InitialExprs << "\n";
+    if (HashCons) {
+      uint64_t Live, Hits;
+      getHashConsingStats(Live, Hits);
+      std::cout << "interned expressions = " << Live << "\n"
+                << "hash-consing hits = " << Hits << "\n";
+    }
+#ifdef __GLIBC__
+    std::cout << "heap in use = " << (mallinfo().uordblks >> 10) << "KB\n";
+#endif
+    std::cout << "distinct expressions = " << Distinct.size()
+              << " of " << NumExprs << "\n"
+              << "constraints shared with the previous query = "
+              << NumShared << "\n"
+              << "comparison time = " << CompareTime << "s\n";
+  }
+
+  for (std::vector<Decl*>::iterator it = Decls.begin(),
+         ie = Decls.end(); it != ie; ++it)
+    delete *it;
+  delete P;
+
+  return success;
+}
+
+static bool BenchmarkIndependenceAST(const char *Filename,
+                                     const MemoryBuffer *MB,
+                                     ExprBuilder *Builder) {
+  std::vector<Decl*> Decls;
+  Parser *P = Parser::Create(Filename, MB, Builder);
+  P->SetMaxErrors(20);
+  while (Decl *D = P->ParseTopLevelDecl()) {
+    Decls.push_back(D);
+  }
+
+  bool success = true;
+  if (unsigned N = P->GetNumErrors()) {
+    std::cerr << Filename << ": parse failure: "
+               << N << " errors.\n";
+    success = false;
+  }
+
+  if (success) {
+    unsigned NumQueries = 0;
+    uint64_t NumConstraints = 0, NumRequired = 0;
+    double BuildTime = 0, LookupTime = 0;
+
+    for (std::vector<Decl*>::iterator it = Decls.begin(),
+           ie = Decls.end(); it != ie; ++it) {
+      QueryCommand *QC = dyn_cast<QueryCommand>(*it);
+      if (!QC)
+        continue;
+
+      ConstraintManager Constraints(QC->Constraints);
+      std::vector< ref<Expr> > Required;
+
+      // The first lookup partitions all the constraints, as done for
+      // every query before the partitions were kept across queries.
+      double Start = util::getWallTime();
+      Constraints.getIndependentConstraints(QC->Query, Required);
+      BuildTime += util::getWallTime() - Start;
+
+      Required.clear();
+      Start = util::getWallTime();
+      Constraints.getIndependentConstraints(QC->Query, Required);
+      LookupTime += util::getWallTime() - Start;
+
+      ++NumQueries;
+      NumConstraints += QC->Constraints.size();
+      NumRequired += Required.size();
+    }
+
+    std::cout << "queries = " << NumQueries << "\n"
+              << "constraints = " << NumConstraints << "\n"
+              << "required constraints = " << NumRequired << "\n"
+              << "partitioning time = " << BuildTime << "s\n"
+              << "lookup time = " << LookupTime << "s\n";
+  }
+
+  for (std::vector<Decl*>::iterator it = Decls.begin(),
+         ie = Decls.end(); it != ie; ++it)
+    delete *it;
+  delete P;
+
+  return success;
+}
+
+/// Solves the queries of a query log in order, with and without keeping
+/// the constraints shared by successive queries asserted in STP.
+static bool BenchmarkIncrementalAST(const char *Filename,
+                                    const MemoryBuffer *MB,
+                                    ExprBuilder *Builder) {
+  std::vector<Decl*> Decls;
+  Parser *P = Parser::Create(Filename, MB, Builder);
+  P->SetMaxErrors(20);
+  while (Decl *D = P->ParseTopLevelDecl()) {
+    Decls.push_back(D);
+  }
+
+  bool success = true;
+  if (unsigned N = P->GetNumErrors()) {
+    std::cerr << Filename << ": parse failure: "
+               << N << " errors.\n";
+    success = false;
+  }
+
+  if (success) {
+    // The executor shares the constraints of a state with its children,
+    // give equal constraints of different queries the same node
+    ExprHashSet Shared;
+    std::vector<ConstraintManager> Constraints;
+    std::vector<QueryCommand*> Queries;
+    for (std::vector<Decl*>::iterator it = Decls.begin(),
+           ie = Decls.end(); it != ie; ++it) {
+      QueryCommand *QC = dyn_cast<QueryCommand>(*it);
+      if (!QC)
+        continue;
+
+      std::vector< ref<Expr> > CS;
+      for (unsigned i = 0; i != QC->Constraints.size(); ++i)
+        CS.push_back(*Shared.insert(QC->Constraints[i]).first);
+      Constraints.push_back(ConstraintManager(CS));
+      Queries.push_back(QC);
+    }
+
+    double Times[2];
+    std::vector<bool> Results[2];
+    for (unsigned Incremental = 0; Incremental != 2; ++Incremental) {
+      STPSolver S(false, Incremental);
+      double Start = util::getWallTime();
+      for (unsigned i = 0; i != Queries.size(); ++i) {
+        bool Result;
+        if (!S.mayBeTrue(Query(Constraints[i], Queries[i]->Query), Result)) {
+          std::cerr << Filename << ": query " << i << " failed\n";
+          success = false;
+        }
+        Results[Incremental].push_back(Result);
+      }
+      Times[Incremental] = util::getWallTime() - Start;
+    }
+
+    if (Results[0] != Results[1]) {
+      std::cerr << Filename << ": incremental results differ\n";
+      success = false;
+    }
+
+    std::cout << "queries = " << Queries.size() << "\n"
+              << "solving time = " << Times[0] << "s\n"
+              << "incremental solving time = " << Times[1] << "s\n";
+  }
+
+  for (std::vector<Decl*>::iterator it = Decls.begin(),
+         ie = Decls.end(); it != ie; ++it)
+    delete *it;
+  delete P;
+
+  return success;
+}
+
 int main(int argc, char **argv) {
   bool success = true;
 
@@ -292,6 +527,9 @@ int main(int argc, char **argv) {
     break;
   }
 
+  if (HashCons)
+    Builder = createHashConsingExprBuilder(Builder);
+
   switch (ToolAction) {
   case PrintTokens:
     PrintInputTokens(MB.get());
@@ -304,6 +542,18 @@ int main(int argc, char **argv) {
     success = EvaluateInputAST(InputFile=="-" ? "<stdin>" : InputFile.c_str(),
                                MB.get(), Builder);
     break;
+  case BenchmarkExprs:
+    success = BenchmarkInputAST(InputFile=="-" ? "<stdin>" : InputFile.c_str(),
+                                MB.get(), Builder);
+    break;
+  case BenchmarkIndependence:
+    success = BenchmarkIndependenceAST(InputFile=="-" ? "<stdin>" : InputFile.c_str(),
+                                       MB.get(), Builder);
+    break;
+  case BenchmarkIncremental:
+    success = BenchmarkIncrementalAST(InputFile=="-" ? "<stdin>" : InputFile.c_str(),
+                                      MB.get(), Builder);
+    break;
   default:
     std::cerr << argv[0] << ": error: Unknown program action!\n";
   }
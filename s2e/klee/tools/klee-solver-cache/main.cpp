@@ -0,0 +1,135 @@
+//===-- main.cpp ----------------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Inspects, compacts and merges the solver cache files written with
+// --persistent-cache-file.
+
+#include "klee/Internal/Support/SolverCacheFile.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/Signals.h"
+
+#include <stdio.h>
+
+using namespace llvm;
+using namespace klee;
+
+namespace {
+  enum ToolActions {
+    PrintStats,
+    Merge
+  };
+
+  cl::opt<ToolActions>
+  ToolAction(cl::desc("Tool actions:"),
+             cl::init(PrintStats),
+             cl::values(
+             clEnumValN(PrintStats, "stats",
+                        "Print the number of records of the input files."),
+             clEnumValN(Merge, "merge",
+                        "Write the latest record of each query of the input "
+                        "files to the output file. With a single input, this "
+                        "compacts the file."),
+             clEnumValEnd));
+
+  cl::list<std::string>
+  InputFiles(cl::desc("<input cache files>"), cl::Positional, cl::OneOrMore);
+
+  cl::opt<std::string>
+  OutputFile("o", cl::desc("Output cache file for merge"),
+             cl::value_desc("filename"));
+}
+
+static int printStats() {
+  for (unsigned i = 0; i < InputFiles.size(); ++i) {
+    SolverCacheFile file;
+    std::string error;
+    if (!file.open(InputFiles[i], true, error)) {
+      errs() << "klee-solver-cache: " << error << "\n";
+      return 1;
+    }
+
+    std::vector<SolverCacheFile::Record> records;
+    file.getRecords(records);
+
+    unsigned validity = 0, cex = 0;
+    uint64_t bytes = 0;
+    for (unsigned j = 0; j < records.size(); ++j) {
+      if (records[j].kind == SolverCacheFile::Validity)
+        ++validity;
+      else if (records[j].kind == SolverCacheFile::InitialValues)
+        ++cex;
+      bytes += records[j].keySize + records[j].valueSize;
+    }
+
+    outs() << InputFiles[i] << ": "
+           << records.size() << " records ("
+           << validity << " validity, " << cex << " counterexamples), "
+           << file.getNumIndexedRecords() << " distinct queries, "
+           << bytes << " bytes\n";
+  }
+  return 0;
+}
+
+static int merge() {
+  if (OutputFile.empty()) {
+    errs() << "klee-solver-cache: merge requires an output file (-o)\n";
+    return 1;
+  }
+
+  std::string tmpFile = OutputFile + ".tmp";
+  remove(tmpFile.c_str());
+
+  SolverCacheFile output;
+  std::string error;
+  if (!output.open(tmpFile, false, error)) {
+    errs() << "klee-solver-cache: " << error << "\n";
+    return 1;
+  }
+
+  // Visit the records from the newest to the oldest, so that
+  // only the latest result of each query is kept
+  unsigned written = 0;
+  for (unsigned i = InputFiles.size(); i > 0; --i) {
+    SolverCacheFile input;
+    if (!input.open(InputFiles[i - 1], true, error)) {
+      errs() << "klee-solver-cache: " << error << "\n";
+      return 1;
+    }
+
+    if (!output.mergeFrom(input, written)) {
+      errs() << "klee-solver-cache: cannot write " << tmpFile << "\n";
+      return 1;
+    }
+  }
+
+  output.close();
+  if (rename(tmpFile.c_str(), OutputFile.c_str()) < 0) {
+    errs() << "klee-solver-cache: cannot rename " << tmpFile << "\n";
+    return 1;
+  }
+
+  outs() << "Wrote " << written << " records to " << OutputFile << "\n";
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  llvm::sys::PrintStackTraceOnErrorSignal();
+  llvm::cl::ParseCommandLineOptions(argc, argv);
+
+  switch (ToolAction) {
+  case PrintStats:
+    return printStats();
+  case Merge:
+    return merge();
+  }
+
+  return 1;
+}
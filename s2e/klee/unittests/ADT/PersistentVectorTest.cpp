@@ -0,0 +1,113 @@
+//===-- PersistentVectorTest.cpp ------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include "klee/Internal/ADT/PersistentVector.h"
+
+#include <vector>
+
+using namespace klee;
+
+namespace {
+
+typedef PersistentVector<unsigned, 2> SmallVector;
+
+template<class V>
+void expectEqual(const std::vector<unsigned> &expected, const V &v) {
+  ASSERT_EQ(expected.size(), v.size());
+  for (unsigned i = 0; i < expected.size(); ++i)
+    EXPECT_EQ(expected[i], v[i]);
+  EXPECT_EQ(expected, std::vector<unsigned>(v.begin(), v.end()));
+}
+
+TEST(PersistentVectorTest, Append) {
+  SmallVector v;
+  std::vector<unsigned> expected;
+  EXPECT_TRUE(v.empty());
+
+  for (unsigned i = 0; i < 13; ++i) {
+    v.push_back(i);
+    expected.push_back(i);
+  }
+  expectEqual(expected, v);
+  EXPECT_EQ(12U, v.back());
+
+  v.clear();
+  EXPECT_TRUE(v.empty());
+  EXPECT_TRUE(v.begin() == v.end());
+}
+
+TEST(PersistentVectorTest, Forks) {
+  SmallVector parent;
+  std::vector<unsigned> expected;
+  for (unsigned i = 0; i < 6; ++i) {
+    parent.push_back(i);
+    expected.push_back(i);
+  }
+
+  // Both children append to the chunk they share with the parent
+  SmallVector a(parent), b(parent);
+  std::vector<unsigned> expectedA(expected), expectedB(expected);
+  for (unsigned i = 0; i < 5; ++i) {
+    a.push_back(100 + i);
+    expectedA.push_back(100 + i);
+    b.push_back(200 + i);
+    expectedB.push_back(200 + i);
+  }
+
+  expectEqual(expected, parent);
+  expectEqual(expectedA, a);
+  expectEqual(expectedB, b);
+  EXPECT_TRUE(a != b);
+
+  parent.push_back(300);
+  expected.push_back(300);
+  expectEqual(expected, parent);
+  expectEqual(expectedA, a);
+
+  SmallVector c;
+  c = a;
+  EXPECT_TRUE(c == a);
+  c.push_back(400);
+  expectEqual(expectedA, a);
+  EXPECT_EQ(400U, c.back());
+}
+
+TEST(PersistentVectorTest, Truncate) {
+  SmallVector v;
+  for (unsigned i = 0; i < 10; ++i)
+    v.push_back(i);
+
+  SmallVector copy(v);
+  v.truncate(5);
+  v.push_back(50);
+  v.push_back(60);
+
+  std::vector<unsigned> expected;
+  for (unsigned i = 0; i < 10; ++i)
+    expected.push_back(i);
+  expectEqual(expected, copy);
+
+  expected.resize(5);
+  expected.push_back(50);
+  expected.push_back(60);
+  expectEqual(expected, v);
+
+  // Appends reuse the chunks dropped by destroyed copies
+  {
+    SmallVector tmp(v);
+    tmp.push_back(70);
+  }
+  v.push_back(80);
+  expected.push_back(80);
+  expectEqual(expected, v);
+}
+
+}
@@ -0,0 +1,125 @@
+//===-- RangeIndexTest.cpp ------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include <iostream>
+#include "gtest/gtest.h"
+
+#include "klee/Internal/ADT/RangeIndex.h"
+#include "klee/Internal/System/Time.h"
+
+using namespace klee;
+
+namespace {
+
+struct Bar {
+  uint64_t start, size;
+};
+
+// MMIO BARs of a typical PCI layout: a NIC, a SATA controller, a sound
+// card and a USB controller below 4GB, plus two DMA buffers in RAM.
+const Bar RealisticLayout[] = {
+  { 0xfebc0000, 0x20000 },
+  { 0xfebe0000, 0x4000 },
+  { 0xfebf0000, 0x1000 },
+  { 0xfebf1000, 0x400 },
+  { 0xfebf2000, 0x100 },
+  { 0xfeb00000, 0x80000 },
+  { 0x01234000, 0x2000 },
+  { 0x07ff0000, 0x600 },
+};
+
+TEST(RangeIndexTest, AddMerge) {
+  RangeIndex index;
+  index.add(0x1000, 0x100);
+  index.add(0x1100, 0x100);
+  EXPECT_EQ(1U, index.size());
+  EXPECT_TRUE(index.contains(0x1000, 0x200));
+
+  index.add(0x3000, 0x100);
+  index.add(0x2000, 0x100);
+  EXPECT_EQ(3U, index.size());
+
+  index.add(0x1080, 0x2000);
+  EXPECT_EQ(1U, index.size());
+  EXPECT_EQ(0x1000U, index.begin()->start);
+  EXPECT_EQ(0x3100U, index.begin()->end);
+}
+
+TEST(RangeIndexTest, Remove) {
+  RangeIndex index;
+  index.add(0x1000, 0x3000);
+  index.remove(0x2000, 0x100);
+  EXPECT_EQ(2U, index.size());
+  EXPECT_TRUE(index.contains(0x1fff));
+  EXPECT_FALSE(index.contains(0x2000));
+  EXPECT_FALSE(index.contains(0x20ff));
+  EXPECT_TRUE(index.contains(0x2100));
+  EXPECT_FALSE(index.contains(0x1f00, 0x200));
+  EXPECT_TRUE(index.intersects(0x1f00, 0x200));
+
+  index.remove(0, 0x10000);
+  EXPECT_TRUE(index.empty());
+  EXPECT_FALSE(index.intersects(0, 0x10000));
+}
+
+TEST(RangeIndexTest, Queries) {
+  RangeIndex index;
+  for (unsigned i = 0; i < sizeof(RealisticLayout) / sizeof(Bar); ++i)
+    index.add(RealisticLayout[i].start, RealisticLayout[i].size);
+
+  EXPECT_TRUE(index.contains(0xfebc0000, 4));
+  EXPECT_TRUE(index.contains(0xfebdfffc, 4));
+  EXPECT_TRUE(index.intersects(0xfebdfffe, 4));
+  EXPECT_FALSE(index.contains(0xfebf1400, 4));
+  EXPECT_FALSE(index.intersects(0xfebf1400, 4));
+  EXPECT_TRUE(index.intersects(0xfebf13fe, 4));
+  EXPECT_FALSE(index.contains(0xfebf13fe, 4));
+  EXPECT_FALSE(index.contains(0x01233fff));
+  EXPECT_TRUE(index.contains(0x01234000));
+
+  // Bulk queries spanning several pages, e.g. DMA transfers
+  EXPECT_TRUE(index.intersects(0x01000000, 0x01000000));
+  EXPECT_FALSE(index.intersects(0x02000000, 0x01000000));
+  EXPECT_TRUE(index.contains(0x01234000, 0x2000));
+  EXPECT_FALSE(index.contains(0x01234000, 0x2001));
+
+  // Accesses wrapping around the address space
+  EXPECT_FALSE(index.intersects(~0ULL - 1, 4));
+}
+
+/// Microbenchmark, run with --gtest_also_run_disabled_tests from an
+/// optimized build
+TEST(RangeIndexTest, DISABLED_LookupThroughput) {
+  RangeIndex index;
+  for (unsigned i = 0; i < sizeof(RealisticLayout) / sizeof(Bar); ++i)
+    index.add(RealisticLayout[i].start, RealisticLayout[i].size);
+
+  // Mostly RAM accesses, with one device register access out of eight
+  const unsigned Lookups = 1 << 26;
+  uint64_t seed = 1, hits = 0;
+  double start = util::getWallTime();
+  for (unsigned i = 0; i < Lookups; ++i) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint64_t address;
+    if ((i & 7) == 0) {
+      const Bar &bar = RealisticLayout[(seed >> 33) % 6];
+      address = bar.start + ((seed >> 13) % bar.size & ~3ULL);
+    } else {
+      address = (seed >> 16) & 0x7ffffffc;
+    }
+    hits += index.intersects(address, 4);
+  }
+  double elapsed = util::getWallTime() - start;
+
+  EXPECT_LE(Lookups / 8, hits);
+  std::cout << "RangeIndex: " << (uint64_t) (Lookups / elapsed)
+            << " lookups per second (" << hits << " hits)\n";
+}
+
+}
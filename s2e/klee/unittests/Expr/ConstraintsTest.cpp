@@ -0,0 +1,222 @@
+//===-- ConstraintsTest.cpp -----------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+
+#include <algorithm>
+
+using namespace klee;
+
+namespace {
+
+ref<Expr> readByte(const Array *array, ref<Expr> index) {
+  return ReadExpr::create(UpdateList(array, 0), index);
+}
+
+ref<Expr> readByte(const Array *array, unsigned index) {
+  return readByte(array, ConstantExpr::alloc(index, Expr::Int32));
+}
+
+ref<Expr> lessThan(ref<Expr> e, unsigned value) {
+  return UltExpr::create(e, ConstantExpr::alloc(value, e->getWidth()));
+}
+
+bool contains(const std::vector< ref<Expr> > &constraints, ref<Expr> e) {
+  return std::find(constraints.begin(), constraints.end(), e) !=
+         constraints.end();
+}
+
+TEST(ConstraintsTest, IndependentConstraints) {
+  Array *a = new Array("a", 4), *b = new Array("b", 4), *c = new Array("c", 4);
+
+  ref<Expr> c1 = lessThan(AddExpr::create(readByte(a, 0), readByte(b, 0)), 10);
+  ref<Expr> c2 = lessThan(readByte(b, 0), 5);
+  ref<Expr> c3 = lessThan(readByte(c, 0), 5);
+  ref<Expr> c4 = lessThan(readByte(a, 1), 5);
+
+  ConstraintManager cm;
+  cm.addConstraint(c1);
+  cm.addConstraint(c2);
+  cm.addConstraint(c3);
+
+  std::vector< ref<Expr> > result;
+  cm.getIndependentConstraints(lessThan(readByte(a, 0), 3), result);
+  ASSERT_EQ(2U, result.size());
+  EXPECT_EQ(c1, result[0]);
+  EXPECT_EQ(c2, result[1]);
+
+  // The partitions are updated as constraints are added
+  cm.addConstraint(c4);
+  result.clear();
+  cm.getIndependentConstraints(lessThan(readByte(a, 1), 3), result);
+  ASSERT_EQ(1U, result.size());
+  EXPECT_EQ(c4, result[0]);
+
+  // A query reading several partitions needs all of them
+  result.clear();
+  cm.getIndependentConstraints(
+      lessThan(AddExpr::create(readByte(c, 0), readByte(a, 1)), 3), result);
+  ASSERT_EQ(2U, result.size());
+  EXPECT_TRUE(contains(result, c3));
+  EXPECT_TRUE(contains(result, c4));
+
+  result.clear();
+  cm.getIndependentConstraints(lessThan(readByte(c, 1), 3), result);
+  EXPECT_TRUE(result.empty());
+}
+
+TEST(ConstraintsTest, SymbolicIndex) {
+  Array *a = new Array("a", 4), *i = new Array("i", 4);
+
+  ref<Expr> c1 = lessThan(readByte(a, 0), 5);
+  ref<Expr> c2 = lessThan(readByte(a, 1), 5);
+  ref<Expr> c3 = lessThan(readByte(a, ZExtExpr::create(readByte(i, 0),
+                                                       Expr::Int32)), 5);
+
+  ConstraintManager cm;
+  cm.addConstraint(c1);
+  cm.addConstraint(c2);
+
+  std::vector< ref<Expr> > result;
+  cm.getIndependentConstraints(lessThan(readByte(a, 1), 3), result);
+  ASSERT_EQ(1U, result.size());
+  EXPECT_EQ(c2, result[0]);
+
+  // A read at a symbolic index may alias with every byte of the array
+  cm.addConstraint(c3);
+  result.clear();
+  cm.getIndependentConstraints(lessThan(readByte(a, 1), 3), result);
+  EXPECT_EQ(3U, result.size());
+
+  result.clear();
+  cm.getIndependentConstraints(lessThan(readByte(i, 0), 3), result);
+  EXPECT_EQ(3U, result.size());
+}
+
+TEST(ConstraintsTest, CopyOnWrite) {
+  Array *a = new Array("a", 4), *b = new Array("b", 4);
+
+  ref<Expr> c1 = lessThan(readByte(a, 0), 5);
+  ref<Expr> c2 = lessThan(AddExpr::create(readByte(a, 0), readByte(b, 0)), 10);
+
+  ConstraintManager parent;
+  parent.addConstraint(c1);
+
+  std::vector< ref<Expr> > result;
+  parent.getIndependentConstraints(lessThan(readByte(b, 0), 3), result);
+  EXPECT_TRUE(result.empty());
+
+  ConstraintManager child(parent);
+  child.addConstraint(c2);
+
+  result.clear();
+  child.getIndependentConstraints(lessThan(readByte(b, 0), 3), result);
+  EXPECT_EQ(2U, result.size());
+
+  result.clear();
+  parent.getIndependentConstraints(lessThan(readByte(b, 0), 3), result);
+  EXPECT_TRUE(result.empty());
+}
+
+TEST(ConstraintsTest, SiblingPartitions) {
+  Array *a = new Array("a", 4), *b = new Array("b", 4), *c = new Array("c", 4);
+
+  ConstraintManager parent;
+  parent.addConstraint(lessThan(readByte(a, 0), 5));
+  parent.addConstraint(lessThan(readByte(b, 0), 5));
+  parent.addConstraint(lessThan(readByte(c, 0), 5));
+
+  // Each sibling merges a different pair of the parent's partitions
+  ConstraintManager left(parent), right(parent);
+  left.addConstraint(lessThan(AddExpr::create(readByte(a, 0),
+                                              readByte(b, 0)), 10));
+  right.addConstraint(lessThan(AddExpr::create(readByte(b, 0),
+                                               readByte(c, 0)), 10));
+
+  std::vector< ref<Expr> > result;
+  left.getIndependentConstraints(lessThan(readByte(c, 0), 3), result);
+  EXPECT_EQ(1U, result.size());
+  result.clear();
+  left.getIndependentConstraints(lessThan(readByte(a, 0), 3), result);
+  EXPECT_EQ(3U, result.size());
+
+  result.clear();
+  right.getIndependentConstraints(lessThan(readByte(a, 0), 3), result);
+  EXPECT_EQ(1U, result.size());
+  result.clear();
+  right.getIndependentConstraints(lessThan(readByte(c, 0), 3), result);
+  EXPECT_EQ(3U, result.size());
+
+  // A whole-array read of b joins everything in the sibling that merged it
+  ConstraintManager grandchild(left);
+  grandchild.addConstraint(lessThan(readByte(b, readByte(c, 0)), 5));
+  result.clear();
+  grandchild.getIndependentConstraints(lessThan(readByte(a, 0), 3), result);
+  EXPECT_EQ(5U, result.size());
+  result.clear();
+  parent.getIndependentConstraints(lessThan(readByte(a, 0), 3), result);
+  EXPECT_EQ(1U, result.size());
+}
+
+TEST(ConstraintsTest, SimplifyExpr) {
+  Array *a = new Array("a", 4), *b = new Array("b", 4);
+
+  ref<Expr> c1 = lessThan(readByte(b, 0), 5);
+  ref<Expr> sum = AddExpr::create(readByte(a, 0), readByte(b, 1));
+
+  ConstraintManager cm;
+  cm.addConstraint(c1);
+  EXPECT_EQ(ref<Expr>(ConstantExpr::alloc(1, Expr::Bool)), cm.simplifyExpr(c1));
+  EXPECT_EQ(sum, cm.simplifyExpr(sum));
+
+  // Cached simplifications are dropped when constraints are added
+  ConstraintManager child(cm);
+  child.addConstraint(EqExpr::create(ConstantExpr::alloc(3, Expr::Int8),
+                                     readByte(a, 0)));
+  EXPECT_EQ(AddExpr::create(ConstantExpr::alloc(3, Expr::Int8),
+                            readByte(b, 1)),
+            child.simplifyExpr(sum));
+  EXPECT_EQ(ref<Expr>(ConstantExpr::alloc(1, Expr::Bool)), child.simplifyExpr(c1));
+
+  // The parent does not see the equalities of its copies
+  EXPECT_EQ(sum, cm.simplifyExpr(sum));
+}
+
+TEST(ConstraintsTest, RewrittenConstraints) {
+  Array *a = new Array("a", 4), *b = new Array("b", 4);
+
+  ref<Expr> c1 = lessThan(AddExpr::create(readByte(a, 0), readByte(b, 0)), 10);
+
+  ConstraintManager cm;
+  cm.addConstraint(c1);
+
+  std::vector< ref<Expr> > result;
+  cm.getIndependentConstraints(lessThan(readByte(b, 0), 3), result);
+  EXPECT_EQ(1U, result.size());
+
+  // Substituting a[0] leaves c1 reading only b[0]
+  cm.addConstraint(EqExpr::create(ConstantExpr::alloc(1, Expr::Int8),
+                                  readByte(a, 0)));
+
+  result.clear();
+  cm.getIndependentConstraints(lessThan(readByte(b, 0), 3), result);
+  ASSERT_EQ(1U, result.size());
+  EXPECT_EQ(lessThan(AddExpr::create(ConstantExpr::alloc(1, Expr::Int8),
+                                     readByte(b, 0)), 10),
+            result[0]);
+
+  result.clear();
+  cm.getIndependentConstraints(lessThan(readByte(a, 0), 3), result);
+  EXPECT_EQ(1U, result.size());
+}
+
+}
@@ -11,6 +11,8 @@
 #include "gtest/gtest.h"
 
 #include "klee/Expr.h"
+#include "klee/ExprBuilder.h"
+#include "klee/util/ExprAllocator.h"
 
 using namespace klee;
 
@@ -110,4 +112,67 @@ TEST(ExprTest, ExtractConcat) {
   EXPECT_EQ(Expr::Extract, concat2->getKid(1)->getKind());
 }
 
+TEST(ExprTest, HashConsing) {
+  ExprBuilder *Builder =
+    createHashConsingExprBuilder(createDefaultExprBuilder());
+  Array *array = new Array("arr2", 256);
+  uint64_t initialLive, live, hits;
+  getHashConsingStats(initialLive, hits);
+
+  {
+    ref<Expr> read1 = Builder->Read(UpdateList(array, 0),
+                                    Builder->Constant(3, Expr::Int32));
+    ref<Expr> read2 = Builder->Read(UpdateList(array, 0),
+                                    Builder->Constant(3, Expr::Int32));
+    EXPECT_EQ(read1.get(), read2.get());
+
+    ref<Expr> add1 = Builder->Add(Builder->Constant(1, Expr::Int8), read1);
+    ref<Expr> add2 = Builder->Add(Builder->Constant(2, Expr::Int8), read1);
+    EXPECT_NE(add1.get(), add2.get());
+    EXPECT_NE(add1, add2);
+
+    // Kids built without the builder are interned when used
+    ref<Expr> outside =
+      AddExpr::alloc(ConstantExpr::alloc(1, Expr::Int8),
+                     ReadExpr::alloc(UpdateList(array, 0),
+                                     ConstantExpr::alloc(3, Expr::Int32)));
+    EXPECT_EQ(add1, outside);
+    EXPECT_EQ(Builder->Eq(add1, read1).get(),
+              Builder->Eq(outside, read1).get());
+  }
+
+  // Dead expressions leave the table
+  getHashConsingStats(live, hits);
+  EXPECT_EQ(initialLive, live);
+
+  delete Builder;
+}
+
+TEST(ExprTest, SlabAllocation) {
+  ExprAllocator::Stats before, during, after;
+  ExprAllocator::getStats(before);
+
+  {
+    Array *array = new Array("arr3", 16);
+    UpdateList ul(array, 0);
+    ul.extend(getConstant(1, Expr::Int32), getConstant(2, Expr::Int8));
+    ref<Expr> read = ReadExpr::create(ul, getConstant(0, Expr::Int32));
+    ref<Expr> sum = AddExpr::create(read, read);
+
+    ExprAllocator::getStats(during);
+    // At least the array, the update node and the read
+    EXPECT_LE(before.liveObjects + 3, during.liveObjects);
+    EXPECT_LT(before.liveBytes, during.liveBytes);
+
+    sum = ref<Expr>();
+    read = ref<Expr>();
+    ul = UpdateList(array, 0);
+    delete array;
+  }
+
+  ExprAllocator::getStats(after);
+  EXPECT_EQ(before.liveObjects, after.liveObjects);
+  EXPECT_EQ(before.liveBytes, after.liveBytes);
+  EXPECT_LT(before.allocations, after.allocations);
+}
 }
@@ -13,8 +13,13 @@
 #include "klee/Constraints.h"
 #include "klee/Expr.h"
 #include "klee/Solver.h"
+#include "klee/SolverImpl.h"
+#include "klee/SolverStats.h"
 #include "llvm/ADT/StringExtras.h"
 
+#include <sys/wait.h>
+#include <unistd.h>
+
 using namespace klee;
 
 namespace {
@@ -163,4 +168,247 @@ TEST(SolverTest, Evaluation) {
   delete solver;
 }
 
+TEST(SolverTest, SharedCacheEvaluation) {
+  STPSolver *stpSolver = new STPSolver(true);
+  Solver *solver = stpSolver;
+
+  solver = createSharedCachingSolver(solver, 1024, 64);
+  solver = createIndependentSolver(solver);
+
+  // Each round uses fresh arrays, whose queries must not be confused
+  // with the ones cached during the previous round
+  for (unsigned i = 0; i < 2; ++i) {
+    testOpcode<SelectExpr>(*solver);
+    testOpcode<AddExpr>(*solver);
+    testOpcode<AndExpr>(*solver);
+    testOpcode<EqExpr>(*solver);
+    testOpcode<UltExpr>(*solver);
+  }
+
+  delete solver;
+}
+
+/// Counts the queries reaching the underlying solver
+class CountingSolverImpl : public SolverImpl {
+  Solver *solver;
+  unsigned &count;
+
+public:
+  CountingSolverImpl(Solver *_solver, unsigned &_count)
+    : solver(_solver), count(_count) {}
+  ~CountingSolverImpl() { delete solver; }
+
+  bool computeValidity(const Query &query, Solver::Validity &result) {
+    ++count;
+    return solver->impl->computeValidity(query, result);
+  }
+  bool computeTruth(const Query &query, bool &isValid) {
+    ++count;
+    return solver->impl->computeTruth(query, isValid);
+  }
+  bool computeValue(const Query &query, ref<Expr> &result) {
+    ++count;
+    return solver->impl->computeValue(query, result);
+  }
+  bool computeInitialValues(const Query &query,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution) {
+    ++count;
+    return solver->impl->computeInitialValues(query, objects, values,
+                                              hasSolution);
+  }
+};
+
+TEST(SolverTest, SharedCacheAcrossProcesses) {
+  unsigned queries = 0;
+  Solver *solver = new Solver(new CountingSolverImpl(new STPSolver(true),
+                                                     queries));
+  solver = createSharedCachingSolver(solver, 1024, 64);
+
+  Array *array = new Array("shared", 1);
+  ref<Expr> byte = Expr::createTempRead(array, Expr::Int8);
+  ConstraintManager constraints;
+  constraints.addConstraint(UltExpr::create(byte,
+                                            ConstantExpr::alloc(10, Expr::Int8)));
+
+  Query validQuery(constraints,
+                   UltExpr::create(byte, ConstantExpr::alloc(20, Expr::Int8)));
+  Query cexQuery(constraints,
+                 EqExpr::create(byte, ConstantExpr::alloc(3, Expr::Int8)));
+  std::vector<const Array*> objects(1, array);
+
+  // The child process fills the cache
+  pid_t pid = fork();
+  ASSERT_LE(0, pid);
+  if (pid == 0) {
+    bool res = false;
+    std::vector< std::vector<unsigned char> > values;
+    bool success = solver->mustBeTrue(validQuery, res) && res &&
+                   solver->getInitialValues(cexQuery, objects, values);
+    _exit(success ? 0 : 1);
+  }
+
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(0, WEXITSTATUS(status));
+
+  // The parent gets the answers of the child without solving anything
+  uint64_t hits = stats::sharedQueryCacheHits;
+  uint64_t cexHits = stats::sharedCexCacheHits;
+
+  bool res = false;
+  EXPECT_TRUE(solver->mustBeTrue(validQuery, res));
+  EXPECT_TRUE(res);
+
+  std::vector< std::vector<unsigned char> > values;
+  EXPECT_TRUE(solver->getInitialValues(cexQuery, objects, values));
+  ASSERT_EQ(1U, values.size());
+  ASSERT_EQ(1U, values[0].size());
+  EXPECT_GT(10, values[0][0]);
+  EXPECT_NE(3, values[0][0]);
+
+  EXPECT_EQ(0U, queries);
+  EXPECT_EQ(hits + 1, (uint64_t) stats::sharedQueryCacheHits);
+  EXPECT_EQ(cexHits + 1, (uint64_t) stats::sharedCexCacheHits);
+
+  delete solver;
+}
+
+TEST(SolverTest, SharedCacheHashCollision) {
+  Solver *solver = createSharedCachingSolver(new STPSolver(true), 1024, 64);
+
+  // Swapping two writes to the same index changes the value read back,
+  // but not Expr::hash()
+  Array *indexArray = new Array("index", 4), *readArray = new Array("read", 4);
+  ref<Expr> index = Expr::createTempRead(indexArray, Expr::Int32);
+  ref<Expr> read = Expr::createTempRead(readArray, Expr::Int32);
+  ref<Expr> one = ConstantExpr::alloc(1, Expr::Int8);
+  ref<Expr> two = ConstantExpr::alloc(2, Expr::Int8);
+
+  Array *array = new Array("collision", 4);
+  UpdateList first(array, 0), second(array, 0);
+  first.extend(index, one);
+  first.extend(index, two);
+  second.extend(index, two);
+  second.extend(index, one);
+
+  ref<Expr> readsTwo = EqExpr::create(two, ReadExpr::create(first, read));
+  ref<Expr> readsOne = EqExpr::create(two, ReadExpr::create(second, read));
+  ASSERT_EQ(readsTwo->hash(), readsOne->hash());
+
+  ConstraintManager constraints;
+  constraints.addConstraint(EqExpr::create(index, read));
+
+  bool res = false;
+  EXPECT_TRUE(solver->mustBeTrue(Query(constraints, readsTwo), res));
+  EXPECT_TRUE(res);
+  EXPECT_TRUE(solver->mustBeTrue(Query(constraints, readsOne), res));
+  EXPECT_FALSE(res);
+
+  delete solver;
+}
+
+TEST(SolverTest, PortfolioEvaluation) {
+  PortfolioSolver *portfolio = new PortfolioSolver();
+  portfolio->addSolver(new STPSolver(false), 0);
+  portfolio->addSolver(new STPSolver(false, false, false), 0);
+  // Cannot answer alone, must not make the race fail
+  portfolio->addSolver(createFastCexSolver(createDummySolver()), 0);
+
+  Solver *solver = createIndependentSolver(portfolio);
+
+  testOpcode<SelectExpr>(*solver);
+  testOpcode<AddExpr>(*solver);
+  testOpcode<UDivExpr>(*solver, false, false, 8);
+  testOpcode<EqExpr>(*solver);
+  testOpcode<UltExpr>(*solver);
+
+  delete solver;
+}
+
+/// Runs one query per constraint of a deep path, the way the executor does
+/// while extending a state.
+void runDeepPath(Solver &solver, const Array *array, unsigned depth,
+                 std::vector<bool> &results) {
+  ConstraintManager constraints;
+
+  for (unsigned i = 0; i < depth; ++i) {
+    ref<Expr> byte = ReadExpr::create(UpdateList(array, 0),
+                                      ConstantExpr::alloc(i % array->size,
+                                                          Expr::Int32));
+    constraints.addConstraint(UleExpr::create(ConstantExpr::alloc(i % 16,
+                                                                  Expr::Int8),
+                                              byte));
+
+    ref<Expr> query = UltExpr::create(byte, ConstantExpr::alloc(200 - i % 64,
+                                                                Expr::Int8));
+    bool res;
+    bool success = solver.mayBeTrue(Query(constraints, query), res);
+    EXPECT_EQ(true, success) << "Constraint solving failed";
+    results.push_back(res);
+  }
+}
+
+TEST(SolverTest, IncrementalDeepPath) {
+  const unsigned depth = 100;
+  Array *array = new Array("deep", 64);
+
+  STPSolver solver(false);
+  STPSolver incrementalSolver(false, true);
+
+  std::vector<bool> results, incrementalResults;
+  runDeepPath(solver, array, depth, results);
+  runDeepPath(incrementalSolver, array, depth, incrementalResults);
+
+  EXPECT_EQ(std::vector<bool>(depth, true), results);
+  EXPECT_EQ(results, incrementalResults);
+}
+
+/// Switches between sibling paths, which requires popping some or all of
+/// the constraints asserted for the previous query.
+TEST(SolverTest, IncrementalSiblingPaths) {
+  Array *array = new Array("siblings", 2);
+  ref<Expr> x = Expr::createTempRead(array, Expr::Int8);
+  ref<Expr> y = ReadExpr::create(UpdateList(array, 0),
+                                 ConstantExpr::alloc(1, Expr::Int32));
+  ref<Expr> c7 = ConstantExpr::alloc(7, Expr::Int8);
+  ref<Expr> c8 = ConstantExpr::alloc(8, Expr::Int8);
+
+  STPSolver solver(false, true);
+  bool res;
+
+  ConstraintManager parent;
+  parent.addConstraint(UltExpr::create(ConstantExpr::alloc(100, Expr::Int8),
+                                       x));
+  EXPECT_TRUE(solver.mayBeTrue(Query(parent, UltExpr::create(x, c8)), res));
+  EXPECT_FALSE(res);
+
+  ConstraintManager left(parent);
+  left.addConstraint(EqExpr::create(y, c7));
+  EXPECT_TRUE(solver.mayBeTrue(Query(left, EqExpr::create(y, c8)), res));
+  EXPECT_FALSE(res);
+
+  // Shares the first constraint with the left path
+  ConstraintManager right(parent);
+  right.addConstraint(Expr::createIsZero(EqExpr::create(y, c7)));
+  EXPECT_TRUE(solver.mayBeTrue(Query(right, EqExpr::create(y, c8)), res));
+  EXPECT_TRUE(res);
+  EXPECT_TRUE(solver.mayBeTrue(Query(right, EqExpr::create(y, c7)), res));
+  EXPECT_FALSE(res);
+
+  // Shares no constraint
+  ConstraintManager empty;
+  EXPECT_TRUE(solver.mayBeTrue(Query(empty, UltExpr::create(x, c8)), res));
+  EXPECT_TRUE(res);
+
+  // Extends the left path again
+  left.addConstraint(EqExpr::create(x, ConstantExpr::alloc(200, Expr::Int8)));
+  EXPECT_TRUE(solver.mustBeTrue(Query(left, EqExpr::create(y, c7)), res));
+  EXPECT_TRUE(res);
+  EXPECT_TRUE(solver.mayBeTrue(Query(left, UltExpr::create(x, c8)), res));
+  EXPECT_FALSE(res);
+}
+
 }
@@ -0,0 +1,189 @@
+//===-- SolverCacheFileTest.cpp -------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include "klee/Internal/Support/SolverCacheFile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace klee;
+
+namespace {
+
+class SolverCacheFileTest : public ::testing::Test {
+protected:
+  std::string path;
+
+  virtual void SetUp() {
+    char name[] = "/tmp/klee-solver-cache-XXXXXX";
+    int fd = mkstemp(name);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    unlink(name);
+    path = name;
+  }
+
+  virtual void TearDown() {
+    unlink(path.c_str());
+  }
+
+  void openFile(SolverCacheFile &file, bool readOnly,
+                const std::string &p = std::string()) {
+    std::string error;
+    ASSERT_TRUE(file.open(p.empty() ? path : p, readOnly, error)) << error;
+  }
+
+  static std::string get(const SolverCacheFile &file, const std::string &key,
+                         SolverCacheFile::RecordKind kind =
+                           SolverCacheFile::Validity) {
+    std::string value;
+    if (!file.lookup(kind, key, value))
+      return "<none>";
+    return value;
+  }
+};
+
+TEST_F(SolverCacheFileTest, Reopen) {
+  {
+    SolverCacheFile file;
+    openFile(file, false);
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "a", "1"));
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "b", "2"));
+    EXPECT_EQ("1", get(file, "a"));
+    EXPECT_EQ("2", get(file, "b"));
+  }
+
+  SolverCacheFile file;
+  openFile(file, true);
+  EXPECT_EQ(2U, file.getNumIndexedRecords());
+  EXPECT_EQ("1", get(file, "a"));
+  EXPECT_EQ("2", get(file, "b"));
+  EXPECT_EQ("<none>", get(file, "c"));
+  EXPECT_FALSE(file.append(SolverCacheFile::Validity, "c", "3"));
+}
+
+TEST_F(SolverCacheFileTest, KindsAreDistinct) {
+  SolverCacheFile file;
+  openFile(file, false);
+  EXPECT_TRUE(file.append(SolverCacheFile::Validity, "a", "1"));
+  EXPECT_EQ("<none>", get(file, "a", SolverCacheFile::InitialValues));
+}
+
+TEST_F(SolverCacheFileTest, LastWriteWins) {
+  {
+    SolverCacheFile file;
+    openFile(file, false);
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "a", "1"));
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "a", "2"));
+    EXPECT_EQ("2", get(file, "a"));
+    EXPECT_EQ(1U, file.getNumIndexedRecords());
+  }
+
+  {
+    SolverCacheFile file;
+    openFile(file, false);
+    EXPECT_EQ("2", get(file, "a"));
+    // Replace a record of the mapping with an appended one
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "a", "3"));
+    EXPECT_EQ("3", get(file, "a"));
+    EXPECT_EQ(1U, file.getNumIndexedRecords());
+  }
+
+  SolverCacheFile file;
+  openFile(file, true);
+  EXPECT_EQ("3", get(file, "a"));
+}
+
+TEST_F(SolverCacheFileTest, TruncatedRecord) {
+  {
+    SolverCacheFile file;
+    openFile(file, false);
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "a", "1"));
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "b", "2"));
+  }
+
+  // Simulate a crash in the middle of the last record
+  struct stat st;
+  ASSERT_EQ(0, stat(path.c_str(), &st));
+  ASSERT_EQ(0, truncate(path.c_str(), st.st_size - 1));
+
+  {
+    SolverCacheFile file;
+    openFile(file, true);
+    EXPECT_EQ(1U, file.getNumIndexedRecords());
+    EXPECT_EQ("1", get(file, "a"));
+    EXPECT_EQ("<none>", get(file, "b"));
+  }
+
+  {
+    SolverCacheFile file;
+    openFile(file, false);
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "c", "3"));
+    EXPECT_EQ("1", get(file, "a"));
+    EXPECT_EQ("3", get(file, "c"));
+  }
+
+  SolverCacheFile file;
+  openFile(file, true);
+  EXPECT_EQ(2U, file.getNumIndexedRecords());
+  EXPECT_EQ("1", get(file, "a"));
+  EXPECT_EQ("<none>", get(file, "b"));
+  EXPECT_EQ("3", get(file, "c"));
+}
+
+TEST_F(SolverCacheFileTest, Merge) {
+  std::string other = path + ".other";
+  std::string merged = path + ".merged";
+
+  {
+    SolverCacheFile file;
+    openFile(file, false);
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "a", "1"));
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "b", "1"));
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "a", "2"));
+  }
+
+  {
+    SolverCacheFile file;
+    openFile(file, false, other);
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "b", "3"));
+    EXPECT_TRUE(file.append(SolverCacheFile::Validity, "c", "3"));
+  }
+
+  {
+    SolverCacheFile output, first, second;
+    openFile(output, false, merged);
+    openFile(first, true);
+    openFile(second, true, other);
+
+    // Newer files first, as klee-solver-cache does
+    unsigned written = 0;
+    EXPECT_TRUE(output.mergeFrom(second, written));
+    EXPECT_TRUE(output.mergeFrom(first, written));
+    EXPECT_EQ(3U, written);
+  }
+
+  SolverCacheFile file;
+  openFile(file, true, merged);
+  std::vector<SolverCacheFile::Record> records;
+  file.getRecords(records);
+  EXPECT_EQ(3U, records.size());
+  EXPECT_EQ("2", get(file, "a"));
+  EXPECT_EQ("3", get(file, "b"));
+  EXPECT_EQ("3", get(file, "c"));
+
+  unlink(other.c_str());
+  unlink(merged.c_str());
+}
+
+}
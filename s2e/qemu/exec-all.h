@@ -96,6 +96,7 @@ void restore_state_to_opc(CPUArchState *env, struct TranslationBlock *tb,
 
 #ifdef CONFIG_S2E
 int cpu_gen_llvm(CPUArchState *env, TranslationBlock *tb);
+int cpu_gen_llvm_background(CPUArchState *env, TranslationBlock *tb);
 #endif
 
 
@@ -416,6 +417,9 @@ static inline tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong
 }
 #else
 tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr);
+#ifdef CONFIG_S2E
+int tb_code_in_tlb(CPUArchState *env1, TranslationBlock *tb);
+#endif
 #endif
 
 typedef void (CPUDebugExcpHandler)(CPUArchState *env);
@@ -1784,6 +1784,18 @@ static void cpu_unlink_tb(CPUArchState *env)
     TranslationBlock *tb;
     static spinlock_t interrupt_lock = SPIN_LOCK_UNLOCKED;
 
+#ifdef CONFIG_S2E
+    /* Do not touch the chains while S2E is following them. This is
+       usually called from a signal handler, so S2E cannot lock us out
+       without blocking the signals. */
+    s2e_tb_unlink_pending = 1;
+    __sync_synchronize();
+    if (s2e_tb_chain_busy) {
+        return;
+    }
+    s2e_tb_unlink_pending = 0;
+#endif
+
     spin_lock(&interrupt_lock);
     tb = env->current_tb;
     /* if the cpu is currently executing code, we must unlink it and
@@ -1795,6 +1807,16 @@ static void cpu_unlink_tb(CPUArchState *env)
     spin_unlock(&interrupt_lock);
 }
 
+#ifdef CONFIG_S2E
+volatile int s2e_tb_chain_busy;
+volatile int s2e_tb_unlink_pending;
+
+void s2e_tb_run_pending_unlink(CPUArchState *env)
+{
+    cpu_unlink_tb(env);
+}
+#endif
+
 #ifndef CONFIG_USER_ONLY
 /* mask must never be zero, except for A20 change call */
 static void tcg_handle_interrupt(CPUArchState *env, int mask)
@@ -2316,6 +2338,15 @@ uintptr_t s2e_get_host_address(target_phys_addr_t paddr)
             + section_addr(section, paddr);
 }
 
+/* Clear the state switch dirty flag of the given RAM range and update
+   the TLB so that the next write to each page of the range sets it again.
+   S2E uses this to find out which pages the active state modified. */
+void s2e_reset_switch_dirty(uint64_t ram_addr, uint64_t size)
+{
+    cpu_physical_memory_reset_dirty(ram_addr, ram_addr + size,
+                                    S2E_SWITCH_DIRTY_FLAG);
+}
+
 #endif
 
 /* Add a new TLB entry. At most one entry for a given virtual address
@@ -4879,6 +4910,45 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     return qemu_ram_addr_from_host_nofail(p);
 }
 
+#ifdef CONFIG_S2E
+/* Returns non-zero if the code of the TB can be fetched in the current
+   CPU mode without TLB miss, i.e., translating it again cannot fault */
+int tb_code_in_tlb(CPUArchState *env1, TranslationBlock *tb)
+{
+    target_ulong pc, cs_base, addr;
+    int flags, mmu_idx, page_index, n;
+    ram_addr_t ram_addr;
+    void *p;
+
+    cpu_get_tb_cpu_state(env1, &pc, &cs_base, &flags);
+    if (tb->cs_base != cs_base || tb->flags != flags) {
+        return 0;
+    }
+
+    mmu_idx = cpu_mmu_index(env1);
+    addr = tb->pc & TARGET_PAGE_MASK;
+    for (n = 0; n < 2; n++) {
+        page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+        if (env1->tlb_table[mmu_idx][page_index].addr_code != addr) {
+            return 0;
+        }
+
+        p = (void *)((uintptr_t)addr + env1->tlb_table[mmu_idx][page_index].addend);
+        if (qemu_ram_addr_from_host(p, &ram_addr) ||
+            (ram_addr & TARGET_PAGE_MASK) != tb->page_addr[n]) {
+            return 0;
+        }
+
+        if (((tb->pc + tb->size - 1) & TARGET_PAGE_MASK) == addr) {
+            break;
+        }
+        addr += TARGET_PAGE_SIZE;
+    }
+
+    return 1;
+}
+#endif
+
 #ifdef CONFIG_S2E
 uint64_t symbhw_read(void *opaque, target_phys_addr_t addr, unsigned size);
 void symbhw_write(void *opaque, target_phys_addr_t addr, uint64_t data, unsigned size);
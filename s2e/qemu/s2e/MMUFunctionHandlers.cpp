@@ -66,20 +66,6 @@ namespace s2e {
 //XXX: Fix this
 #define CPU_MMU_INDEX 0
 
-#define MJR_TRACE(ADDRESS, VALUE, WIDTH, ISWRITE, ISDMA)                \
-    do {                                                                \
-        std::vector<ref<Expr> > traceArgs;                              \
-        traceArgs.push_back(ADDRESS);                                   \
-        traceArgs.push_back(VALUE);                                     \
-        traceArgs.push_back(ConstantExpr::create(WIDTH, Expr::Int64));  \
-        traceArgs.push_back(ConstantExpr::create(ISWRITE, Expr::Int64)); \
-        if (!(ISDMA)) {                                                 \
-            S2EExecutor::handlerTraceMemoryAccess(g_s2e->getExecutor(), state, target, traceArgs); \
-        } else {                                                        \
-            S2EExecutor::handlerTraceDMAAccess(g_s2e->getExecutor(), state, target, traceArgs); \
-        }                                                               \
-    } while (0)
-    
 //This is an io_write_chkX_mmu function
 static void io_write_chk(S2EExecutionState *state,
                              target_phys_addr_t physaddr,
@@ -114,7 +100,7 @@ static void io_write_chk(S2EExecutionState *state,
         // MJR isWrite = 1
         // MJR isDMA = 1
         if (isDMASymb) { // MJR added this block
-            MJR_TRACE(symbAddress, val, width, 1, 1); // MJR
+            S2EExecutor::traceIOAccess(state, IOAccess::Dma, symbAddress, val, width, true); // MJR
         }
         uintptr_t pa = s2e_notdirty_mem_write(physaddr);
         state->writeMemory(pa, val, S2EExecutionState::HostAddress);
@@ -123,7 +109,7 @@ static void io_write_chk(S2EExecutionState *state,
     if (s2e_issymfunc(mr, addr)) { // MJR added this block
         // MJR isWrite = 1
         // MJR isDMA = 0
-        MJR_TRACE(symbAddress, val, width, 1, 0); // MJR
+        S2EExecutor::traceIOAccess(state, IOAccess::Mmio, symbAddress, val, width, true); // MJR
         return; // All done -- no need to "write" to symbolic memory ?? MJR maybe?
     }
 #endif
@@ -185,7 +171,7 @@ static ref<Expr> io_read_chk(S2EExecutionState *state,
             // MJR isWrite = 0
             // MJR isDMA = 1
             ref<Expr> symbolicResult = state->createSymbolicValue(ss.str(), width);
-            MJR_TRACE(symbAddress, symbolicResult, width, 0, 1); // MJR
+            S2EExecutor::traceIOAccess(state, IOAccess::Dma, symbAddress, symbolicResult, width, false); // MJR
             g_s2e->getCorePlugin()->establishIOMap (ss.str()); // MJR
             return symbolicResult;
         }
@@ -198,7 +184,7 @@ static ref<Expr> io_read_chk(S2EExecutionState *state,
         // MJR isWrite = 0
         // MJR isDMA = 0
         ref<Expr> symbolicResult = state->createSymbolicValue(ss.str(), width);
-        MJR_TRACE(symbAddress, symbolicResult, width, 0, 0); // MJR
+        S2EExecutor::traceIOAccess(state, IOAccess::Mmio, symbAddress, symbolicResult, width, false); // MJR
         g_s2e->getCorePlugin()->establishIOMap (ss.str()); // MJR
         return symbolicResult;
     }
@@ -54,7 +54,8 @@ void Plugin::initialize()
 
 PluginState *Plugin::getPluginState(S2EExecutionState *s, PluginStateFactory f) const
 {
-    if (m_CachedPluginS2EState == s) {
+    //The cached state may have been shared by a fork since it was cached
+    if (m_CachedPluginS2EState == s && m_CachedPluginState->m_refCount == 1) {
         return m_CachedPluginState;
     }
     m_CachedPluginState = s->getPluginState(const_cast<Plugin*>(this), f);
@@ -62,6 +63,17 @@ PluginState *Plugin::getPluginState(S2EExecutionState *s, PluginStateFactory f)
     return m_CachedPluginState;
 }
 
+const PluginState *Plugin::getConstPluginState(S2EExecutionState *s, PluginStateFactory f) const
+{
+    if (m_CachedPluginS2EState == s) {
+        return m_CachedPluginState;
+    }
+    m_CachedPluginState = const_cast<PluginState*>(
+            s->getConstPluginState(const_cast<Plugin*>(this), f));
+    m_CachedPluginS2EState = s;
+    return m_CachedPluginState;
+}
+
 PluginsFactory::PluginsFactory()
 {
     CompiledPlugin::CompiledPlugins *plugins = CompiledPlugin::getPlugins();
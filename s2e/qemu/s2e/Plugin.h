@@ -78,8 +78,13 @@ public:
     /** Return configuration key for this plugin */
     const std::string& getConfigKey() const;
 
+    /** Return the plugin state of s for writing. A copy-on-write plugin
+        state that is shared with other execution states is cloned first. */
     PluginState *getPluginState(S2EExecutionState *s, PluginState* (*f)(Plugin *, S2EExecutionState *)) const;
 
+    /** Return the plugin state of s for reading only, without cloning it */
+    const PluginState *getConstPluginState(S2EExecutionState *s, PluginState* (*f)(Plugin *, S2EExecutionState *)) const;
+
     void refresh() {
         m_CachedPluginS2EState = NULL;
         m_CachedPluginState = NULL;
@@ -95,17 +100,39 @@ public:
 #define DECLARE_PLUGINSTATE_N(c, name, execstate) \
     c *name = static_cast<c*>(getPluginState(execstate, &c::factory))
 
+#define DECLARE_PLUGINSTATE_PCONST(plg, c, execstate) \
+    const c *plgState = static_cast<const c*>(plg->getConstPluginState(execstate, &c::factory))
+
 #define DECLARE_PLUGINSTATE_CONST(c, execstate) \
-    const c *plgState = static_cast<c*>(getPluginState(execstate, &c::factory))
+    const c *plgState = static_cast<const c*>(getConstPluginState(execstate, &c::factory))
 
 #define DECLARE_PLUGINSTATE_NCONST(c, name, execstate) \
-    const c *name = static_cast<c*>(getPluginState(execstate, &c::factory))
+    const c *name = static_cast<const c*>(getConstPluginState(execstate, &c::factory))
 
 class PluginState
 {
+private:
+    friend class Plugin;
+    friend class S2EExecutionState;
+
+    /** Number of execution states sharing this plugin state */
+    unsigned m_refCount;
+
 public:
+    PluginState() : m_refCount(1) {}
+    PluginState(const PluginState&) : m_refCount(1) {}
+    PluginState& operator=(const PluginState&) { return *this; }
+
     virtual ~PluginState() {};
     virtual PluginState *clone() const = 0;
+
+    /** Copy-on-write plugin states are shared by the execution states
+        forked from each other instead of being cloned at every fork.
+        A shared state is cloned the first time it is accessed for
+        writing, so plugins must use the const variants of
+        DECLARE_PLUGINSTATE wherever they only read their state, and must
+        not keep pointers to it across forks. */
+    virtual bool isCopyOnWrite() const { return false; }
 };
 
 
@@ -160,6 +160,7 @@ static void s2e_tcg_instrument_code(S2E*, ExecutionSignal* signal, uint64_t pc,
     const int sizemask = 4;
     tcg_gen_movi_i32(TCGV_PTR_TO_NAT(t0), (tcg_target_ulong) signal);
 #endif
+    tcg_llvm_add_reloc(&tcg_ctx, (uintptr_t) signal);
 
     tcg_gen_movi_i64(t1, pc);
 
@@ -386,22 +387,11 @@ void s2e_trace_memory_access(
     if(/* isIO == 2 && */!g_s2e->getCorePlugin()->onIOMemoryAccess.empty()) {
 
         try {
-            // Parameters to onIOMemoryAccess.
-            // Address:
-            klee::ref<klee::Expr> eAddress = klee::ConstantExpr::create(vaddr, 64);
-
-            // Data / size:
             uint64_t value = 0;
             memcpy((void*) &value, buf, size);
-            klee::ref<klee::Expr> eValue = klee::ConstantExpr::create(value, size*8);
-            int accessType = 1; // MMIO
-            g_s2e->getCorePlugin()->onIOMemoryAccess.emit(
-                state,
-                accessType,
-                eAddress,
-                eValue,
-                size,
-                isWrite);
+
+            IOAccess access(IOAccess::Mmio, vaddr, value, size, isWrite);
+            g_s2e->getCorePlugin()->onIOMemoryAccess.emit(state, access);
             g_s2e->getMessagesStream() << "s2e_trace_memory_access: Finished I/O memory access\n";
         } catch(s2e::CpuExitException&) {
             g_s2e->getMessagesStream() << "s2e_trace_memory_access: Caught CPUExitException\n";
@@ -459,19 +449,8 @@ void s2e_trace_port_access(
     // SymDrive added this:
     if(!s2e->getCorePlugin()->onIOMemoryAccess.empty()) {
         try {
-            // We're ignoring host addr
-            // Parameters to onIOMemoryAccess:
-            int accessType = 0; // Port I/O
-            klee::ref<klee::Expr> eAddress = klee::ConstantExpr::create(port, 64);
-            klee::ref<klee::Expr> eValue = klee::ConstantExpr::create(value, 64);
-
-            s2e->getCorePlugin()->onIOMemoryAccess.emit(
-                state,
-                accessType,
-                eAddress, // vaddr
-                eValue,   // value
-                size,     // size in bytes
-                isWrite); // isWrite
+            IOAccess access(IOAccess::Port, port, value, size, isWrite);
+            s2e->getCorePlugin()->onIOMemoryAccess.emit(state, access);
             s2e->getMessagesStream() << "s2e_trace_port_access: Finished port access\n";
         } catch(s2e::CpuExitException&) {
             s2e->getMessagesStream() << "s2e_trace_port_access: Caught CPUExitException\n";
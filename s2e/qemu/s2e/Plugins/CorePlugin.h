@@ -67,6 +67,35 @@ typedef bool (*SYMB_PORT_CHECK)(uint16_t port, void *opaque);
 typedef bool (*SYMB_MMIO_CHECK)(uint64_t physaddress, uint64_t size, void *opaque);
 typedef bool (*ESTABLISH_IO_MAP_FN)(std::string origin, void *opaque); // SymDrive added
 
+/** Description of a traced port, MMIO or DMA access.
+  * It lives on the stack of the emitter, so tracing does not allocate
+  * anything. Concrete operands are passed as raw integers, the expression
+  * of an operand is only set when the operand is symbolic. */
+struct IOAccess {
+    enum Type {
+        Port = 0,
+        Mmio = 1,
+        Dma = 2
+    };
+
+    Type type;
+    uint64_t address;   /* port number or virtual address */
+    uint64_t value;     /* zero-extended to 64 bits */
+    unsigned size;      /* in bytes */
+    bool isWrite;
+
+    klee::ref<klee::Expr> symbolicAddress;
+    klee::ref<klee::Expr> symbolicValue;
+
+    IOAccess(Type _type, uint64_t _address, uint64_t _value,
+             unsigned _size, bool _isWrite)
+        : type(_type), address(_address), value(_value),
+          size(_size), isWrite(_isWrite) {}
+
+    bool isAddressSymbolic() const { return !symbolicAddress.isNull(); }
+    bool isValueSymbolic() const { return !symbolicValue.isNull(); }
+};
+
 class CorePlugin : public Plugin {
     S2E_PLUGIN
 
@@ -205,15 +234,9 @@ public:
                  bool /* isWrite */, bool /* isIO */>
             onDataMemoryAccess;
 
-    /** Signal that is emitted on each I/O memory access */
+    /** Signal that is emitted on each port, MMIO and DMA access */
     // SymDrive, added this:
-    sigc::signal<void,
-        S2EExecutionState*,     /* state */
-        int,                    /* access type */
-        klee::ref<klee::Expr>,  /* virtualAddress */
-        klee::ref<klee::Expr>,  /* value */
-        int,                    /* size in bytes */
-        bool>                   /* isWrite */
+    sigc::signal<void, S2EExecutionState*, const IOAccess&>
         onIOMemoryAccess;
 
     /** Signal that is emitted on each port access */
@@ -130,6 +130,7 @@ public:
     ~MemoryCheckerState() {}
 
     MemoryCheckerState *clone() const { return new MemoryCheckerState(*this); }
+    bool isCopyOnWrite() const { return true; }
     static PluginState *factory(Plugin*, S2EExecutionState*) {
         return new MemoryCheckerState();
     }
@@ -138,6 +139,10 @@ public:
         return m_memoryMap;
     }
 
+    const MemoryMap &getMemoryMap() const {
+        return m_memoryMap;
+    }
+
     void setMemoryMap(const MemoryMap& memoryMap) {
         m_memoryMap = memoryMap;
     }
@@ -146,6 +151,10 @@ public:
         return m_resourceMap;
     }
 
+    const ResourceHandleMap &getResourceMap() const {
+        return m_resourceMap;
+    }
+
     void setResourceMap(const ResourceHandleMap& resourceMap) {
         m_resourceMap = resourceMap;
     }
@@ -756,9 +765,9 @@ bool MemoryChecker::checkMemoryAccess(S2EExecutionState *state,
     if(!m_checkMemoryErrors)
         return true;
 
-    DECLARE_PLUGINSTATE(MemoryCheckerState, state);
+    DECLARE_PLUGINSTATE_CONST(MemoryCheckerState, state);
 
-    MemoryMap &memoryMap = plgState->getMemoryMap();
+    const MemoryMap &memoryMap = plgState->getMemoryMap();
 
     bool hasError = false;
 
@@ -814,7 +823,7 @@ bool MemoryChecker::findMemoryRegion(S2EExecutionState *state,
                                      uint64_t address,
                                      uint64_t *start, uint64_t *size) const
 {
-    DECLARE_PLUGINSTATE(MemoryCheckerState, state);
+    DECLARE_PLUGINSTATE_CONST(MemoryCheckerState, state);
 
     const MemoryMap &memoryMap = plgState->getMemoryMap();
 
@@ -838,9 +847,9 @@ bool MemoryChecker::checkResourceLeaks(S2EExecutionState *state)
     if(!m_checkResourceLeaks)
         return true;
 
-    DECLARE_PLUGINSTATE(MemoryCheckerState, state);
+    DECLARE_PLUGINSTATE_CONST(MemoryCheckerState, state);
 
-    ResourceHandleMap &resourceMap = plgState->getResourceMap();
+    const ResourceHandleMap &resourceMap = plgState->getResourceMap();
 
     s2e()->getDebugStream(state) << "MemoryChecker::checkResourceLeaks" << '\n';
 
@@ -877,9 +886,9 @@ bool MemoryChecker::checkMemoryLeaks(S2EExecutionState *state)
     if(!m_checkMemoryLeaks)
         return true;
 
-    DECLARE_PLUGINSTATE(MemoryCheckerState, state);
+    DECLARE_PLUGINSTATE_CONST(MemoryCheckerState, state);
 
-    MemoryMap &memoryMap = plgState->getMemoryMap();
+    const MemoryMap &memoryMap = plgState->getMemoryMap();
 
     s2e()->getDebugStream(state) << "MemoryChecker::checkMemoryLeaks" << '\n';
 
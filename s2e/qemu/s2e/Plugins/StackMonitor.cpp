@@ -281,6 +281,7 @@ public:
     StackMonitorState(bool debugMessages);
     virtual ~StackMonitorState();
     virtual StackMonitorState* clone() const;
+    virtual bool isCopyOnWrite() const { return true; }
     static PluginState *factory(Plugin *p, S2EExecutionState *s);
 
     friend class StackMonitor;
@@ -419,20 +420,20 @@ void StackMonitor::onModuleTransition(S2EExecutionState* state, const ModuleDesc
 
 bool StackMonitor::getFrameInfo(S2EExecutionState *state, uint64_t sp, bool &onTheStack, StackFrameInfo &info) const
 {
-    DECLARE_PLUGINSTATE(StackMonitorState, state);
+    DECLARE_PLUGINSTATE_CONST(StackMonitorState, state);
     return plgState->getFrameInfo(state, sp, onTheStack, info);
 }
 
 void StackMonitor::dump(S2EExecutionState *state)
 {
     //s2e()->getDebugStream() << "StackMonitor: ESP modif at " << hexval(pc) << "\n";
-    DECLARE_PLUGINSTATE(StackMonitorState, state);
+    DECLARE_PLUGINSTATE_CONST(StackMonitorState, state);
     plgState->dump(state);
 }
 
 bool StackMonitor::getCallStacks(S2EExecutionState *state, CallStacks &callStacks) const
 {
-    DECLARE_PLUGINSTATE(StackMonitorState, state);
+    DECLARE_PLUGINSTATE_CONST(StackMonitorState, state);
     return plgState->getCallStacks(state, callStacks);
 }
 
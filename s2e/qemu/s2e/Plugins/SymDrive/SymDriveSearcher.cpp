@@ -1619,12 +1619,9 @@ void SymDriveSearcher::helper_check_invariants(bool full_checks) {
     // Check for duplicates
     std::map<S2EExecutionState*, unsigned> counter1;
     std::map<unsigned, unsigned> counter2;
-    std::map<SymDriveSearcherState*, unsigned> counter3;
     foreach2(it1, m_states.begin(), m_states.end()) {
-        DECLARE_PLUGINSTATE_N(SymDriveSearcherState, it1_state, *it1);
         ++counter1[*it1];
         ++counter2[(*it1)->getID()];
-        ++counter3[it1_state];
     }
 
     foreach2(it1, counter1.begin(), counter1.end()) {
@@ -1641,12 +1638,6 @@ void SymDriveSearcher::helper_check_invariants(bool full_checks) {
         }
     }
 
-    foreach2(it1, counter3.begin(), counter3.end()) {
-        if (it1->second != 1) {
-            assert (false && "State found multiple times (error 3).\n");
-        }
-    }
-
     // Check ordering
     S2EExecutionState *es2 = NULL;
     SymDriveSorter sorter;
@@ -1655,8 +1646,8 @@ void SymDriveSearcher::helper_check_invariants(bool full_checks) {
         S2EExecutionState *es1 = *it1;
         if (es2 != NULL) {
             assert (es2 != es1);
-            DECLARE_PLUGINSTATE_N(SymDriveSearcherState, es1_state, es1);
-            DECLARE_PLUGINSTATE_N(SymDriveSearcherState, es2_state, es2);
+            DECLARE_PLUGINSTATE_NCONST(SymDriveSearcherState, es1_state, es1);
+            DECLARE_PLUGINSTATE_NCONST(SymDriveSearcherState, es2_state, es2);
             if (sorter (es2, es1) == false) {
                 WARNING()
                     << "es1_state: " << hexval((unsigned long) es1_state)
@@ -2183,33 +2174,29 @@ void SymDriveSearcher::helper_push_pop_trackperf(S2EExecutionState *state,
     // MESSAGE_S() << "m_TrackperfFnCnt: " << plgState->m_TrackperfFnCnt << "\n";
 }
 
-// accessType:
-//  0 = Port
-//  1 = MMIO
-//  2 = DMA
-// address: port or MMIO address
-// size: in bytes
-// value: value read/written
-// isWrite:
+// access.type:
+//  IOAccess::Port, IOAccess::Mmio or IOAccess::Dma
+// access.address: port or MMIO address
+// access.size: in bytes
+// access.value: value read/written
+// access.isWrite:
 //  true = we're doing an I/O write
 //  false = we're doing an I/O read
 void SymDriveSearcher::onIOMemoryAccess(S2EExecutionState *state,
-                                        int accessType,
-                                        klee::ref<klee::Expr> address, // or port
-                                        klee::ref<klee::Expr> value,
-                                        int sizeInBytes, // size in bytes
-                                        bool isWrite)
+                                        const IOAccess &access)
 {
     DECLARE_PLUGINSTATE(SymDriveSearcherState, state);
 
-    bool isAddrCste = isa<klee::ConstantExpr>(address);
-    bool isValCste = isa<klee::ConstantExpr>(value);
+    int accessType = access.type;
+    bool isWrite = access.isWrite;
+    bool isAddrCste = !access.isAddressSymbolic();
+    bool isValCste = !access.isValueSymbolic();
 
     uint64_t i_pc = state->getPc();
-    uint64_t i_virt_address = isAddrCste ? cast<klee::ConstantExpr>(address)->getZExtValue(64) : 0xDEADBEEF;
+    uint64_t i_virt_address = isAddrCste ? access.address : 0xDEADBEEF;
     uint64_t i_phys_address = 0xDEADBEEF;
-    uint64_t i_value = isValCste ? cast<klee::ConstantExpr>(value)->getZExtValue(64) : 0xDEADBEEF;
-    uint64_t i_sizeInBytes = sizeInBytes;
+    uint64_t i_value = isValCste ? access.value : 0xDEADBEEF;
+    uint64_t i_sizeInBytes = access.size;
 
     const char *str_accessType;
     switch (accessType) {
@@ -2521,7 +2508,7 @@ S2EExecutionState *SymDriveSearcher::selectStateMode1(int64_t target_metric) {
     if (target_metric == 0 || target_metric == 1) {
         if (m_states.size() > 0) {
             S2EExecutionState *es = dynamic_cast<S2EExecutionState*>(*m_states.begin());
-            DECLARE_PLUGINSTATE(SymDriveSearcherState, es);
+            DECLARE_PLUGINSTATE_CONST(SymDriveSearcherState, es);
             if (plgState->m_metricValid &&
                 plgState->m_metric < 2) {
                 state = es;
@@ -2536,7 +2523,7 @@ S2EExecutionState *SymDriveSearcher::selectStateMode1(int64_t target_metric) {
     if (target_metric >= 0 && target_metric < 100) {
         // Find ANY state we track with the target metric
         foreach2(it, m_states.begin(), m_states.end()) {
-            DECLARE_PLUGINSTATE(SymDriveSearcherState, *it);
+            DECLARE_PLUGINSTATE_CONST(SymDriveSearcherState, *it);
             if (plgState->m_metricValid &&
                 plgState->m_metric == target_metric) {
                 state = *it;
@@ -2547,7 +2534,7 @@ S2EExecutionState *SymDriveSearcher::selectStateMode1(int64_t target_metric) {
         int64_t max_metric = 0;
         // Find a state that has a really high metric
         foreach2(it, m_states.begin(), m_states.end()) {
-            DECLARE_PLUGINSTATE(SymDriveSearcherState, *it);
+            DECLARE_PLUGINSTATE_CONST(SymDriveSearcherState, *it);
             if (plgState->m_metricValid &&
                 plgState->m_metric > max_metric) {
                 state = *it;
@@ -2585,7 +2572,7 @@ S2EExecutionState *SymDriveSearcher::selectStateMode2a(void) {
 
     if (FunctionRare != "") {
         foreach2(it, m_states.begin(), m_states.end()) {
-            DECLARE_PLUGINSTATE(SymDriveSearcherState, *it);
+            DECLARE_PLUGINSTATE_CONST(SymDriveSearcherState, *it);
             foreach2(cur_fn_name,
                      plgState->m_functionCallStackFn.begin(),
                      plgState->m_functionCallStackFn.end()) {
@@ -2626,7 +2613,7 @@ S2EExecutionState *SymDriveSearcher::selectStateMode2b(void) {
     }
 
     foreach2(it, m_states.begin(), m_states.end()) {
-        DECLARE_PLUGINSTATE(SymDriveSearcherState, *it);
+        DECLARE_PLUGINSTATE_CONST(SymDriveSearcherState, *it);
         int64_t plgStateMetric;
         if (plgState->m_metricValid == false) {
             plgStateMetric = 0;
@@ -2681,7 +2668,7 @@ S2EExecutionState *SymDriveSearcher::selectStateMode3(void) {
     int best_primary_fn_count = 0;
 
     foreach2(it, m_states.begin(), m_states.end()) {
-        DECLARE_PLUGINSTATE(SymDriveSearcherState, *it);
+        DECLARE_PLUGINSTATE_CONST(SymDriveSearcherState, *it);
 
         int matched_count = 0;
         foreach2(cur_fn_name,
@@ -2710,7 +2697,7 @@ S2EExecutionState *SymDriveSearcher::selectStateMode4(bool greatest) {
     int longest_success = 0;
 
     foreach2(it, m_states.begin(), m_states.end()) {
-        DECLARE_PLUGINSTATE(SymDriveSearcherState, *it);
+        DECLARE_PLUGINSTATE_CONST(SymDriveSearcherState, *it);
         if (greatest) {
             // Find state with longest success path
             if (plgState->m_successPath > longest_success) {
@@ -2734,7 +2721,7 @@ S2EExecutionState *SymDriveSearcher::selectStateMode5(bool greatest) {
     int greatest_call_depth = 0;
 
     foreach2(it, m_states.begin(), m_states.end()) {
-        DECLARE_PLUGINSTATE(SymDriveSearcherState, *it);
+        DECLARE_PLUGINSTATE_CONST(SymDriveSearcherState, *it);
         if (greatest) {
             // Find state with deepest call stack.
             if (plgState->m_driverCallStack > greatest_call_depth) {
@@ -2986,23 +2973,16 @@ bool SymDriveSorter::operator()(const S2EExecutionState *s1, const S2EExecutionS
     // return true if s1 is higher priority
     // return false if s2 is higher priority
 
-    const SymDriveSearcherState *p1 = static_cast<SymDriveSearcherState*>
-        (p->getPluginState(const_cast<S2EExecutionState*>(s1), &SymDriveSearcherState::factory));
-    const SymDriveSearcherState *p2 = static_cast<SymDriveSearcherState*>
-        (p->getPluginState(const_cast<S2EExecutionState*>(s2), &SymDriveSearcherState::factory));
+    const SymDriveSearcherState *p1 = static_cast<const SymDriveSearcherState*>
+        (p->getConstPluginState(const_cast<S2EExecutionState*>(s1), &SymDriveSearcherState::factory));
+    const SymDriveSearcherState *p2 = static_cast<const SymDriveSearcherState*>
+        (p->getConstPluginState(const_cast<S2EExecutionState*>(s2), &SymDriveSearcherState::factory));
 
+    // States forked from each other share their plugin state until one
+    // of them writes it, so only the same state must have the same one.
     if (s1 == s2) {
         assert (p1 == p2);
     }
-    if (s1 != s2) {
-        assert (p1 != p2);
-    }
-    if (p1 == p2) {
-        assert (s1 == s2);
-    }
-    if (p1 != p2) {
-        assert (s1 != s2);
-    }
 
     if (p->m_favorSuccessful == true) {
         // ignore metric
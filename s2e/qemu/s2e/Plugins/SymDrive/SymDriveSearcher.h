@@ -139,6 +139,7 @@ class SymDriveSearcherState: public PluginState
     SymDriveSearcherState(S2EExecutionState *s, Plugin *p);
     virtual ~SymDriveSearcherState();
     virtual PluginState *clone() const;
+    virtual bool isCopyOnWrite() const { return true; }
     static PluginState *factory(Plugin *p, S2EExecutionState *s);
 
     friend class SymDriveSearcher;
@@ -266,11 +267,7 @@ class SymDriveSearcher : public Plugin, public klee::Searcher
 
     // Tracing
     void onIOMemoryAccess(S2EExecutionState *state,
-                          int accessType,
-                          klee::ref<klee::Expr> address,
-                          klee::ref<klee::Expr> value,
-                          int sizeInBytes,
-                          bool isWrite);
+                          const IOAccess &access);
 
     void onTraceTbEnd(S2EExecutionState* state, uint64_t pc);
     void onTraceTbStart(S2EExecutionState* state, uint64_t pc);
@@ -1104,160 +1104,16 @@ PluginState *SymbolicHardwareState::factory(Plugin *p, S2EExecutionState *s)
     return new SymbolicHardwareState();
 }
 
-//Unmaps a previously allocated range.
-//phybase must fall inside an existing range.
 bool SymbolicHardwareState::setMmioRange(uint64_t physbase, uint64_t size, bool b)
 {
-    uint64_t addr = physbase;
-    while(size > 0) {
-        MemoryRanges::iterator it = m_MmioMemory.find(addr & TARGET_PAGE_MASK);
-        if (it == m_MmioMemory.end()) {
-            if (!b) {
-                //No need to reset anything,
-                //Go to the next page
-                uint64_t leftover = TARGET_PAGE_SIZE - (addr & (TARGET_PAGE_SIZE-1));
-                addr += leftover;
-                size -= leftover > size ? size : leftover;
-                continue;
-            }else {
-                //Need to create a new page
-                m_MmioMemory[addr & TARGET_PAGE_MASK] = PageBitmap();
-                it = m_MmioMemory.find(addr & TARGET_PAGE_MASK);
-            }
-        }
-
-        uint32_t offset = addr & (TARGET_PAGE_SIZE-1);
-        uint32_t mysize = offset + size > TARGET_PAGE_SIZE ? TARGET_PAGE_SIZE - offset : size;
-
-        bool fc = (*it).second.set(offset, mysize, b);
-        if (fc) {
-            //The entire page is concrete, do not need to keep it in the map
-            m_MmioMemory.erase(addr & TARGET_PAGE_MASK);
-        }
-
-        size -= mysize;
-        addr += mysize;
+    if (b) {
+        m_MmioMemory.add(physbase, size);
+    } else {
+        m_MmioMemory.remove(physbase, size);
     }
     return true;
 }
 
-bool SymbolicHardwareState::isMmio(uint64_t physaddr, uint64_t size) const
-{
-    while (size > 0) {
-        MemoryRanges::const_iterator it = m_MmioMemory.find(physaddr & TARGET_PAGE_MASK);
-        if (it == m_MmioMemory.end()) {
-            uint64_t leftover = TARGET_PAGE_SIZE - (physaddr & (TARGET_PAGE_SIZE-1));
-            physaddr += leftover;
-            size -= leftover > size ? size : leftover;
-            continue;
-        }
-
-        if (((physaddr & (TARGET_PAGE_SIZE-1)) == 0) && size>=TARGET_PAGE_SIZE) {
-            if ((*it).second.hasSymbolic()) {
-                return true;
-            }
-            size-=TARGET_PAGE_SIZE;
-            physaddr+=TARGET_PAGE_SIZE;
-            continue;
-        }
-
-        bool b = (*it).second.get(physaddr & (TARGET_PAGE_SIZE-1));
-        if (b) {
-            return true;
-        }
-
-        size--;
-        physaddr++;
-    }
-    return false;
-}
-
-///////////////////////////////////////////////
-bool SymbolicHardwareState::PageBitmap::hasSymbolic() const
-{
-    return !isFullyConcrete();
-}
-
-void SymbolicHardwareState::PageBitmap::allocateBitmap(klee::BitArray *source) {
-    if (bitmap == NULL) { // SymDrive
-        if (source) {
-            bitmap = new klee::BitArray(*source, TARGET_PAGE_SIZE);
-        } else {
-            bitmap = new klee::BitArray(TARGET_PAGE_SIZE, false);
-        }
-    }
-}
-
-
-bool SymbolicHardwareState::PageBitmap::isFullySymbolic() const {
-    return fullySymbolic;
-}
-
-bool SymbolicHardwareState::PageBitmap::isFullyConcrete() const {
-    if (!fullySymbolic) {
-        if (!bitmap) {
-            return true;
-        }
-        return bitmap->isAllZeros(TARGET_PAGE_SIZE);
-    }
-    return false;
-}
-
-SymbolicHardwareState::PageBitmap::PageBitmap() {
-    fullySymbolic = false;
-    bitmap = NULL;
-}
-
-//Copy constructor when cloning the state
-SymbolicHardwareState::PageBitmap::PageBitmap(const PageBitmap &b1) {
-    fullySymbolic = b1.fullySymbolic;
-    bitmap = NULL;
-    if (b1.bitmap) {
-        allocateBitmap(b1.bitmap);
-    }
-}
-
-SymbolicHardwareState::PageBitmap::~PageBitmap() {
-    if (bitmap) {
-        delete bitmap;
-    }
-    bitmap = NULL; // SymDrive
-}
-
-//Returns true if the resulting range is fully concrete
-bool SymbolicHardwareState::PageBitmap::set(unsigned offset, unsigned length, bool b) {
-    assert(offset <= TARGET_PAGE_SIZE && offset + length <= TARGET_PAGE_SIZE);
-    allocateBitmap(NULL);
-
-    for (unsigned i=offset; i<offset + length; ++i) {
-        bitmap->set(i, b);
-    }
-
-    fullySymbolic = bitmap->isAllOnes(TARGET_PAGE_SIZE);
-    bool fc = false;
-    if (fullySymbolic || (fc = bitmap->isAllZeros(TARGET_PAGE_SIZE))) {
-        delete bitmap;
-        bitmap = NULL;
-        return fc;
-    }
-    return false;
-}
-
-bool SymbolicHardwareState::PageBitmap::get(unsigned offset) const {
-    assert(offset < TARGET_PAGE_SIZE);
-    if (isFullySymbolic()) {
-        return true;
-    }
-
-    if (isFullyConcrete()) {
-        return true;
-    }
-
-    assert(bitmap);
-
-    return bitmap->get(offset);
-}
-
 
 } // namespace plugins
 } // namespace s2e
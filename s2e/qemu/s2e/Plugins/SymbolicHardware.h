@@ -42,7 +42,7 @@
 #include <s2e/S2EExecutionState.h>
 #include <s2e/ConfigFile.h>
 
-#include "klee/util/BitArray.h"
+#include "klee/Internal/ADT/RangeIndex.h"
 
 #include <string>
 #include <set>
@@ -234,40 +234,24 @@ private:
 
 class SymbolicHardwareState : public PluginState
 {
-public:
-    class PageBitmap {
-    private:
-        bool fullySymbolic; //if false then bitmap must not be null
-        klee::BitArray *bitmap; //bit set means symbolic
-
-        void allocateBitmap(klee::BitArray *source);
-        bool isFullySymbolic() const;
-        bool isFullyConcrete() const;
-
-    public:
-        PageBitmap();
-        PageBitmap(const PageBitmap &b1);
-        ~PageBitmap();
-
-        bool set(unsigned offset, unsigned length, bool b);
-        bool get(unsigned offset) const;
-        bool hasSymbolic() const;
-    };
-
-    typedef std::map<uint64_t, PageBitmap> MemoryRanges;
 private:
-
-    MemoryRanges m_MmioMemory;
+    //Physical ranges whose accesses return symbolic values
+    klee::RangeIndex m_MmioMemory;
 
 public:
 
     SymbolicHardwareState();
     virtual ~SymbolicHardwareState();
     virtual SymbolicHardwareState* clone() const;
+    virtual bool isCopyOnWrite() const { return true; }
     static PluginState *factory(Plugin *p, S2EExecutionState *s);
 
     bool setMmioRange(uint64_t physbase, uint64_t size, bool b);
-    bool isMmio(uint64_t physaddr, uint64_t size) const;
+
+    //True if any byte of the range is symbolic
+    bool isMmio(uint64_t physaddr, uint64_t size) const {
+        return m_MmioMemory.intersects(physaddr, size);
+    }
 
     friend class SymbolicHardware;
 
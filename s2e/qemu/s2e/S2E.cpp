@@ -219,6 +219,7 @@ S2E::S2E(int argc, char** argv, TCGLLVMContext *tcgLLVMContext,
     m_maxProcesses = s2e_max_processes;
     m_currentProcessIndex = 0;
     m_currentProcessId = 0;
+    m_reservedProcessIndex = (unsigned) -1;
     S2EShared *shared = m_sync.acquire();
     shared->currentProcessCount = 1;
     shared->lastStateId = 0;
@@ -294,6 +295,7 @@ S2E::~S2E()
     assert(shared->processIds[m_currentProcessId] == m_currentProcessIndex);
     shared->processIds[m_currentProcessId] = (unsigned) -1;
     shared->processPids[m_currentProcessId] = (unsigned) -1;
+    shared->processStateCounts[m_currentProcessId] = 0;
     --shared->currentProcessCount;
 
     m_sync.release();
@@ -638,15 +640,21 @@ int S2E::fork()
     return -1;
 #else
 
+    unsigned newProcessIndex;
     S2EShared *shared = m_sync.acquire();
-    if (shared->currentProcessCount == m_maxProcesses) {
-        m_sync.release();
-        return -1;
-    }
+    if (m_reservedProcessIndex != (unsigned) -1) {
+        newProcessIndex = m_reservedProcessIndex;
+        m_reservedProcessIndex = (unsigned) -1;
+    } else {
+        if (shared->currentProcessCount == m_maxProcesses) {
+            m_sync.release();
+            return -1;
+        }
 
-    unsigned newProcessIndex = shared->lastFileId;
-    ++shared->lastFileId;
-    ++shared->currentProcessCount;
+        newProcessIndex = shared->lastFileId;
+        ++shared->lastFileId;
+        ++shared->currentProcessCount;
+    }
 
     m_sync.release();
 
@@ -671,6 +679,7 @@ int S2E::fork()
             if (shared->processIds[i] == (unsigned)-1) {
                 shared->processIds[i] = newProcessIndex;
                 shared->processPids[i] = getpid();
+                shared->processStateCounts[i] = 0;
                 m_currentProcessId = i;
                 break;
             }
@@ -764,6 +773,7 @@ bool S2E::checkDeadProcesses()
             //Process is dead, we have to decrement everyting
             shared->processIds[i] = (unsigned) -1;
             shared->processPids[i] = (unsigned) -1;
+            shared->processStateCounts[i] = 0;
             --shared->currentProcessCount;
             ret = true;
         }
@@ -773,6 +783,45 @@ bool S2E::checkDeadProcesses()
     return ret;
 }
 
+bool S2E::shouldShareStates(unsigned stateCount)
+{
+    S2EShared *shared = m_sync.acquire();
+    shared->processStateCounts[m_currentProcessId] = stateCount;
+
+    if (stateCount < 2 || shared->currentProcessCount >= m_maxProcesses) {
+        m_sync.release();
+        return false;
+    }
+
+    //Only the busiest instance gives work to the free slot.
+    //This avoids all instances forking at once and
+    //lets nearly idle instances terminate on their own.
+    //Ties go to the instance in the lowest slot.
+    unsigned busiest = m_currentProcessId;
+    for (unsigned i=0; i<m_maxProcesses; ++i) {
+        if (shared->processIds[i] == (unsigned)-1) {
+            continue;
+        }
+        unsigned count = shared->processStateCounts[i];
+        unsigned busiestCount = shared->processStateCounts[busiest];
+        if (count > busiestCount || (count == busiestCount && i < busiest)) {
+            busiest = i;
+        }
+    }
+
+    bool ret = busiest == m_currentProcessId;
+    if (ret) {
+        //Take the slot now, before the caller stops the VM, so that
+        //the other instances see it as used
+        m_reservedProcessIndex = shared->lastFileId;
+        ++shared->lastFileId;
+        ++shared->currentProcessCount;
+    }
+
+    m_sync.release();
+    return ret;
+}
+
 } // namespace s2e
 
 /******************************/
@@ -84,10 +84,17 @@ struct S2EShared {
     //the instance index.
     unsigned processIds[S2E_MAX_PROCESSES];
     unsigned processPids[S2E_MAX_PROCESSES];
+
+    //Number of states in the queue of each running instance.
+    //When an instance slot is free, the instance with the
+    //largest queue gives half of its states to a new instance.
+    unsigned processStateCounts[S2E_MAX_PROCESSES];
+
     S2EShared() {
         for (unsigned i=0; i<S2E_MAX_PROCESSES; ++i)    {
             processIds[i] = (unsigned)-1;
             processPids[i] = (unsigned)-1;
+            processStateCounts[i] = 0;
         }
     }
 };
@@ -125,6 +132,10 @@ protected:
     unsigned m_currentProcessIndex;
     unsigned m_currentProcessId;
 
+    /* Index of the process slot reserved for the next fork
+       by shouldShareStates, or -1 */
+    unsigned m_reservedProcessIndex;
+
     std::string m_outputDirectoryBase;
 
     /* The following members are late-initialized when
@@ -239,6 +250,11 @@ public:
 
     bool checkDeadProcesses();
 
+    /** Publishes the number of states of the current process and
+        returns true if this process should give work to an idle slot.
+        In that case, the slot is reserved for the next call to fork() */
+    bool shouldShareStates(unsigned stateCount);
+
     inline uint64_t getStartTime() const {
         return m_startTimeSeconds;
     }
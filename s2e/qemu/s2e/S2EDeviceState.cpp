@@ -46,6 +46,7 @@ void vm_start(void);
 #include "s2e_block.h"
 
 #include <iostream>
+#include <algorithm>
 #include <sstream>
 #include <s2e/Utils.h>
 #include <s2e/S2E.h>
@@ -70,7 +71,6 @@ namespace {
 using namespace s2e;
 using namespace std;
 
-unsigned int S2EDeviceState::s_preferedStateSize = 0x1000;
 std::vector<void *> S2EDeviceState::s_devices;
 bool S2EDeviceState::s_devicesInited=false;
 S2EDeviceState* S2EDeviceState::s_currentDeviceState = NULL;
@@ -104,55 +104,129 @@ S2EDeviceState::S2EDeviceState(const S2EDeviceState &)
 
 }
 
-//This is assumed to be called on fork.
-//At that time, we need to save the state of the VM to 
-//be later restored.
-//XXX: use reference counting to delete the device states
-void S2EDeviceState::clone(S2EDeviceState **state1, S2EDeviceState **state2)
+S2EDeviceState::S2EDeviceState()
 {
-    //We must make two copies
-
-    S2EDeviceState* copy1 = new S2EDeviceState();
-    copy1->m_parent = this;
-    copy1->m_state = 0;
-    copy1->m_stateSize = 0;
-    copy1->m_memFile = m_memFile;
-    *state1 = copy1;
-
-    S2EDeviceState* copy2 = new S2EDeviceState();
-    copy2->m_parent = this;
-    copy2->m_state = 0;
-    copy2->m_stateSize = 0;
-    copy2->m_memFile = m_memFile;
-
-    *state2 = copy2;
+    m_memFile = NULL;
+    m_stateSize = 0;
+    m_parent = NULL;
+    m_refCount = 0;
 }
 
-void S2EDeviceState::cloneDiskState()
+S2EDeviceState::~S2EDeviceState()
 {
+    assert(m_refCount == 0);
+    assert(s_currentDeviceState != this);
+
+    releaseChunks(0);
+
     foreach2(it, m_blockDevices.begin(), m_blockDevices.end()) {
         SectorMap &sm = (*it).second;
         foreach2(smit, sm.begin(), sm.end()) {
-            uint8_t *newSector = new uint8_t[512];
-            memcpy(newSector, (*smit).second, 512);
-            (*smit).second = newSector;
+            delete [] (*smit).second;
         }
     }
+
+    if (m_parent) {
+        m_parent->release();
+    }
 }
 
-S2EDeviceState::S2EDeviceState()
+//The child shares the device snapshot and reads
+//the disk through the layer of its parent
+S2EDeviceState *S2EDeviceState::createChild()
 {
-    m_parent = NULL;
+    S2EDeviceState *child = new S2EDeviceState();
+    child->m_parent = this;
+    child->m_memFile = m_memFile;
+    child->m_chunks = m_chunks;
+    child->m_stateSize = m_stateSize;
+
+    foreach2(it, m_chunks.begin(), m_chunks.end()) {
+        if (*it) {
+            ++(*it)->refCount;
+        }
+    }
+
+    ++m_refCount;
+    return child;
 }
 
-S2EDeviceState::~S2EDeviceState()
+void S2EDeviceState::release()
+{
+    assert(m_refCount > 0);
+    if (--m_refCount == 0) {
+        delete this;
+    }
+}
+
+void S2EDeviceState::releaseChunks(unsigned firstChunk)
+{
+    for (unsigned i = firstChunk; i < m_chunks.size(); ++i) {
+        SnapshotChunk *chunk = m_chunks[i];
+        if (chunk && --chunk->refCount == 0) {
+            delete chunk;
+        }
+    }
+
+    if (firstChunk < m_chunks.size()) {
+        m_chunks.resize(firstChunk);
+    }
+}
+
+//This is assumed to be called on fork.
+//At that time, we need to save the state of the VM to
+//be later restored.
+void S2EDeviceState::clone(S2EDeviceState **state1, S2EDeviceState **state2)
+{
+    compactDiskLayers();
+
+    *state1 = createChild();
+    *state2 = createChild();
+
+    //Only the disk layer of this object remains in use
+    releaseChunks(0);
+    m_stateSize = 0;
+}
+
+void S2EDeviceState::compactDiskLayers()
 {
-    /* TODO */
+    while (m_parent && m_parent->m_refCount == 1) {
+        S2EDeviceState *parent = m_parent;
+
+        foreach2(it, parent->m_blockDevices.begin(), parent->m_blockDevices.end()) {
+            SectorMap &mine = m_blockDevices[(*it).first];
+            SectorMap &theirs = (*it).second;
+
+            //Merge the smaller map into the larger one,
+            //sectors written by this state take precedence
+            bool swapped = theirs.size() > mine.size();
+            if (swapped) {
+                mine.swap(theirs);
+            }
+
+            foreach2(smit, theirs.begin(), theirs.end()) {
+                SectorMap::iterator mit = mine.find((*smit).first);
+                if (mit == mine.end()) {
+                    mine[(*smit).first] = (*smit).second;
+                } else if (swapped) {
+                    delete [] (*mit).second;
+                    (*mit).second = (*smit).second;
+                } else {
+                    delete [] (*smit).second;
+                }
+            }
+            theirs.clear();
+        }
+
+        m_parent = parent->m_parent;
+        parent->m_parent = NULL;
+        parent->m_refCount = 0;
+        delete parent;
+    }
 }
 
 void S2EDeviceState::initDeviceState()
 {
-    m_state = NULL;
     m_stateSize = 0;
     
     assert(!s_devicesInited);
@@ -210,6 +284,7 @@ int s2edev_dbg=0;
 void S2EDeviceState::saveDeviceState()
 {
     s_currentDeviceState = this;
+    m_stateSize = 0;
 
     qemu_make_readable(m_memFile);
 
@@ -223,13 +298,15 @@ void S2EDeviceState::saveDeviceState()
     }
     //DPRINTF("\n");
     qemu_fflush(m_memFile);
+
+    //Drop the chunks that are past the end of the new snapshot
+    releaseChunks((m_stateSize + SnapshotChunkSize - 1) / SnapshotChunkSize);
     s_currentDeviceState = NULL;
 }
 
 void S2EDeviceState::restoreDeviceState()
 {
     assert(m_stateSize);
-    assert(m_state);
 
     s_currentDeviceState = this;
 
@@ -249,36 +326,46 @@ void S2EDeviceState::restoreDeviceState()
 /*****************************************************************************/
 /*****************************************************************************/
 
-void S2EDeviceState::allocateBuffer(unsigned int Sz)
+int S2EDeviceState::putBuffer(const uint8_t *buf, int64_t pos, int size)
 {
-    if (!m_state) {
-        m_state = (unsigned char *)malloc(Sz);
-        if (!m_state) {
-            cerr << "Cannot allocate memory for device state snapshot" << endl;
-            exit(-1);
+    int written = 0;
+
+    while (written < size) {
+        unsigned index = pos / SnapshotChunkSize;
+        unsigned offset = pos % SnapshotChunkSize;
+        unsigned length = std::min((unsigned) (size - written), SnapshotChunkSize - offset);
+
+        if (index >= m_chunks.size()) {
+            m_chunks.resize(index + 1, NULL);
+        }
+
+        SnapshotChunk *&chunk = m_chunks[index];
+        if (!chunk) {
+            chunk = new SnapshotChunk;
+            chunk->refCount = 1;
+            memset(chunk->data, 0, SnapshotChunkSize);
         }
-        m_stateSize = Sz;
-        return;
-    }
 
-    if (Sz >= m_stateSize) {
-        /* Need to expand the buffer */
-        m_stateSize = Sz;
-        m_state = (unsigned char*)realloc(m_state, m_stateSize);
-        if (!m_state) {
-            cerr << "Cannot reallocate memory for device state snapshot" << endl;
-            exit(-1);
+        //Keep sharing the chunk as long as its content does not change
+        if (memcmp(&chunk->data[offset], buf, length)) {
+            if (chunk->refCount > 1) {
+                SnapshotChunk *copy = new SnapshotChunk;
+                copy->refCount = 1;
+                memcpy(copy->data, chunk->data, SnapshotChunkSize);
+                --chunk->refCount;
+                chunk = copy;
+            }
+            memcpy(&chunk->data[offset], buf, length);
         }
-        return;
+
+        buf += length;
+        pos += length;
+        written += length;
     }
-}
 
-int S2EDeviceState::putBuffer(const uint8_t *buf, int64_t pos, int size)
-{
-    if (pos + size > m_stateSize) {
-        allocateBuffer(pos + size);
+    if (pos > m_stateSize) {
+        m_stateSize = pos;
     }
-    memcpy(&m_state[pos], buf, size);
     return size;
 }
 
@@ -286,7 +373,19 @@ int S2EDeviceState::getBuffer(uint8_t *buf, int64_t pos, int size)
 {
     assert(pos <= m_stateSize);
     int toCopy = pos + size <= m_stateSize ? size : m_stateSize - pos;
-    memcpy(buf, &m_state[pos], toCopy);
+
+    for (int copied = 0; copied < toCopy; ) {
+        unsigned index = pos / SnapshotChunkSize;
+        unsigned offset = pos % SnapshotChunkSize;
+        unsigned length = std::min((unsigned) (toCopy - copied), SnapshotChunkSize - offset);
+
+        assert(index < m_chunks.size() && m_chunks[index]);
+        memcpy(buf, &m_chunks[index]->data[offset], length);
+
+        buf += length;
+        pos += length;
+        copied += length;
+    }
     return toCopy;
 }
 
@@ -297,6 +396,8 @@ int S2EDeviceState::getBuffer(uint8_t *buf, int64_t pos, int size)
 
 int S2EDeviceState::writeSector(struct BlockDriverState *bs, int64_t sector, const uint8_t *buf, int nb_sectors)
 {
+    compactDiskLayers();
+
     SectorMap &dev = m_blockDevices[bs];
  //   DPRINTF("writeSector %#"PRIx64" count=%d\n", sector, nb_sectors);
     for (int64_t i = sector; i<sector+nb_sectors; i++) {
@@ -322,6 +423,8 @@ int S2EDeviceState::readSector(struct BlockDriverState *bs, int64_t sector, uint
     bool hasRead = false;
     int readCount = 0;
 
+    compactDiskLayers();
+
   //  DPRINTF("readSector %#"PRIx64" count=%d\n", sector, nb_sectors);
     for (int64_t i = sector; i<sector+nb_sectors; i++) {
         for (S2EDeviceState *curState = this; curState; curState = curState->m_parent) {
@@ -58,22 +58,45 @@ private:
     typedef std::map<int64_t, uint8_t *> SectorMap;
     typedef std::map<BlockDriverState *, SectorMap> BlockDeviceToSectorMap;
 
+    /** Size of the pieces in which device snapshots are stored */
+    static const unsigned SnapshotChunkSize = 0x1000;
+
+    /**
+     * A piece of a device snapshot. Chunks are shared between the
+     * snapshots of forked states until one of them saves a different
+     * content into the chunk.
+     */
+    struct SnapshotChunk {
+        unsigned refCount;
+        uint8_t data[SnapshotChunkSize];
+    };
+
+    typedef std::vector<SnapshotChunk *> SnapshotChunks;
+
     static std::vector<void *> s_devices;
     static std::set<std::string> s_customDevices;
     static bool s_devicesInited;
 
     QEMUFile *m_memFile;
-    unsigned char *m_state;
+    SnapshotChunks m_chunks;
     unsigned int m_stateSize;
 
-    static unsigned int s_preferedStateSize;
-
+    /**
+     * Disk writes are stored in a tree of layers. Each state writes
+     * into its own layer and reads through its ancestors.
+     * A layer is kept alive as long as it has children.
+     */
     S2EDeviceState *m_parent;
+    unsigned m_refCount;
     BlockDeviceToSectorMap m_blockDevices;
-    
-    void allocateBuffer(unsigned int Sz);
 
-    void cloneDiskState();
+    S2EDeviceState *createChild();
+    void release();
+
+    void releaseChunks(unsigned firstChunk);
+
+    /** Absorbs the ancestors that are not shared with other states */
+    void compactDiskLayers();
 
     S2EDeviceState(const S2EDeviceState &);
 public:
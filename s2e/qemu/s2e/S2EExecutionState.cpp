@@ -119,13 +119,15 @@ S2EExecutionState::~S2EExecutionState()
     //print_stacktrace();
 
     for(it = m_PluginState.begin(); it != m_PluginState.end(); ++it) {
-        delete it->second;
+        if (--it->second->m_refCount == 0) {
+            delete it->second;
+        }
     }
 
     g_s2e->refreshPlugins();
 
-    //XXX: This cannot be done, as device states may refer to each other
-    //delete m_deviceState;
+    //Device states are reference-counted by their children
+    delete m_deviceState;
 
     delete m_timersState;
 }
@@ -262,8 +264,10 @@ void S2EExecutionState::addressSpaceChange(const klee::MemoryObject *mo,
     } else {
         ObjectPair op = m_memcache.get(mo->address);
         if (op.first) {
-            op.second = newState;
-            m_memcache.put(mo->address, op);
+            //A NULL state means that the object was unbound, e.g.,
+            //when swapping out the state
+            m_memcache.put(mo->address,
+                           newState ? ObjectPair(mo, newState) : ObjectPair());
         }
     }
 }
@@ -311,7 +315,13 @@ ExecutionState* S2EExecutionState::clone()
     PluginStateMap::iterator it;
     ret->m_PluginState.clear();
     for(it = m_PluginState.begin(); it != m_PluginState.end(); ++it) {
-        ret->m_PluginState.insert(std::make_pair((*it).first, (*it).second->clone()));
+        PluginState *pluginState = (*it).second;
+        if (pluginState->isCopyOnWrite()) {
+            ++pluginState->m_refCount;
+        } else {
+            pluginState = pluginState->clone();
+        }
+        ret->m_PluginState.insert(std::make_pair((*it).first, pluginState));
     }
 
     // This objects are not in TLB and won't cause any changes to it
@@ -334,6 +344,40 @@ ExecutionState* S2EExecutionState::clone()
     return ret;
 }
 
+const PluginState* S2EExecutionState::getConstPluginState(
+        Plugin *plugin, PluginStateFactory factory)
+{
+    PluginStateMap::iterator it = m_PluginState.find(plugin);
+    if (it == m_PluginState.end()) {
+        PluginState *ret = factory(plugin, this);
+        assert(ret);
+        m_PluginState[plugin] = ret;
+        return ret;
+    }
+    return (*it).second;
+}
+
+PluginState* S2EExecutionState::getPluginState(
+        Plugin *plugin, PluginStateFactory factory)
+{
+    PluginStateMap::iterator it = m_PluginState.find(plugin);
+    if (it == m_PluginState.end()) {
+        PluginState *ret = factory(plugin, this);
+        assert(ret);
+        m_PluginState[plugin] = ret;
+        return ret;
+    }
+
+    PluginState *ret = (*it).second;
+    if (ret->m_refCount > 1) {
+        //Copy on write: stop sharing the state with the other states
+        --ret->m_refCount;
+        ret = ret->clone();
+        (*it).second = ret;
+    }
+    return ret;
+}
+
 ref<Expr> S2EExecutionState::readCpuRegister(unsigned offset,
                                              Expr::Width width) const
 {
@@ -822,6 +866,7 @@ bool S2EExecutionState::writeMemory(uint64_t address,
 
         ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
         wos->write(hostAddress & ~S2E_RAM_OBJECT_MASK, value);
+        markSwitchDirty(op.first);
     } else {
         // Slowest case (TODO: could optimize it)
         unsigned numBytes = width / 8;
@@ -853,6 +898,7 @@ bool S2EExecutionState::writeMemory8(uint64_t address,
 
     ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
     wos->write(hostAddress & ~S2E_RAM_OBJECT_MASK, value);
+    markSwitchDirty(op.first);
     return true;
 }
 
@@ -878,6 +924,7 @@ bool S2EExecutionState::writeMemory(uint64_t address,
         ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
         for(uint64_t i = 0; i < width / 8; ++i)
             wos->write8(pageOffset + i, buf[i]);
+        markSwitchDirty(op.first);
 
     } else {
         /* Access spawns multiple MemoryObject's */
@@ -1023,6 +1070,7 @@ void S2EExecutionState::writeRamConcrete(uint64_t hostAddress, const uint8_t* bu
         for(uint64_t i=0; i<size; ++i) {
             wos->write8(page_offset+i, buf[i]);
         }
+        markSwitchDirty(op.first);
 
     } else {
         /* Access spans multiple MemoryObject's */
@@ -1414,6 +1462,30 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
         return false;
     }
 
+    // Guest RAM objects live in the radix table, only look at the parts
+    // that are not shared by the two states
+    std::vector<const MemoryObject*> fixedMutated;
+    if(!addressSpace.fixedObjects.diff(b.addressSpace.fixedObjects,
+                                       fixedMutated)) {
+        if(DebugLogStateMerge)
+            s << "merge failed: different fixed address maps" << '\n';
+        return false;
+    }
+    for(unsigned i = 0; i < fixedMutated.size(); ++i) {
+        const MemoryObject *mo = fixedMutated[i];
+        if(mo->isValueIgnored)
+            continue;
+        if(DebugLogStateMerge)
+            s << "\t\tmutated: " << mo->id << " (" << mo->name << ")\n";
+        if(mo->isSharedConcrete) {
+            if(DebugLogStateMerge)
+                s << "merge failed: different shared-concrete objects "
+                  << '\n';
+            return false;
+        }
+        mutated.insert(mo);
+    }
+
     // Create state predicates
     ref<Expr> inA = ConstantExpr::alloc(1, Expr::Bool);
     ref<Expr> inB = ConstantExpr::alloc(1, Expr::Bool);
@@ -1590,6 +1662,7 @@ void S2EExecutionState::dmaWrite(uint64_t hostAddress, uint8_t *buf, unsigned si
         if (op.first->isSharedConcrete) {
             concreteStore = (uint8_t*)op.first->address;
             memcpy(concreteStore + offset, buf, length);
+            markSwitchDirty(op.first);
         } else {
             concreteStore = os->getConcreteStore(true);
 
@@ -1707,6 +1780,13 @@ void S2EExecutionState::updateTlbEntry(CPUX86State* env,
 }
 
 
+void S2EExecutionState::markSwitchDirty(const MemoryObject *mo)
+{
+    if (mo->isSharedConcrete && m_active) {
+        g_s2e->getExecutor()->markSwitchDirty(this, mo);
+    }
+}
+
 uint8_t S2EExecutionState::readDirtyMask(uint64_t host_address)
 {
     uint8_t val=0;
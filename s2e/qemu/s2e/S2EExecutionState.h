@@ -92,6 +92,7 @@ class S2EExecutionState : public klee::ExecutionState
 {
 protected:
     friend class S2EExecutor;
+    friend class S2EStateSwapper;
 
     static unsigned s_lastSymbolicId;
 
@@ -200,16 +201,8 @@ public:
     uint64_t getTotalInstructionCount();
     /*************************************************/
 
-    PluginState* getPluginState(Plugin *plugin, PluginStateFactory factory) {
-        PluginStateMap::iterator it = m_PluginState.find(plugin);
-        if (it == m_PluginState.end()) {
-            PluginState *ret = factory(plugin, this);
-            assert(ret);
-            m_PluginState[plugin] = ret;
-            return ret;
-        }
-        return (*it).second;
-    }
+    const PluginState* getConstPluginState(Plugin *plugin, PluginStateFactory factory);
+    PluginState* getPluginState(Plugin *plugin, PluginStateFactory factory);
 
     /** Returns true is this is the active state */
     bool isActive() const { return m_active; }
@@ -386,6 +379,8 @@ public:
     void dmaWrite(uint64_t hostAddress, uint8_t *buf, unsigned size);
 
     /** Dirty mask management */
+    void markSwitchDirty(const klee::MemoryObject *mo);
+
     uint8_t readDirtyMask(uint64_t host_address);
     void writeDirtyMask(uint64_t host_address, uint8_t val);
     void registerDirtyMask(uint64_t host_address, uint64_t size);
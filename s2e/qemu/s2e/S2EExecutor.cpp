@@ -77,6 +77,7 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <s2e/S2EDeviceState.h>
 #include <s2e/SelectRemovalPass.h>
 #include <s2e/S2EStatsTracker.h>
+#include <s2e/S2EStateSwapper.h>
 
 //XXX: Remove this from executor
 #include <s2e/Plugins/ModuleExecutionDetector.h>
@@ -104,10 +105,15 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <klee/CoreStats.h>
 #include <klee/TimerStatIncrementer.h>
 #include <klee/Solver.h>
+#include <klee/util/Assignment.h>
+#include <klee/util/ExprUtil.h>
+#include <klee/Internal/System/Time.h>
+#include <klee/Internal/Module/KModule.h>
 
 #include <llvm/Support/TimeValue.h>
 
 #include <vector>
+#include <algorithm>
 
 #include <sstream>
 
@@ -167,6 +173,12 @@ namespace {
                      " disabling leads to faster but possibly incorrect execution"),
             cl::init(true));
 
+    cl::opt<bool>
+    IncrementalStateSwitch("incremental-state-switch",
+            cl::desc("Save and restore only the shared concrete memory pages"
+                     " that differ between states when switching states"),
+            cl::init(false));
+
     cl::opt<bool>
     KeepLLVMFunctions("keep-llvm-functions",
             cl::desc("Never delete generated LLVM functions"),
@@ -208,6 +220,42 @@ namespace {
     UseFastHelpers("use-fast-helpers",
                    cl::desc("Replaces LLVM bitcode with fast symbolic-aware equivalent native helpers"),  cl::init(false));
 
+    cl::opt<std::string>
+    TranslationCacheDir("translation-cache-dir",
+            cl::desc("Directory where the optimized LLVM code of translation blocks"
+                     " is stored and reused across runs (disabled if empty)"),
+            cl::init(""));
+
+    cl::opt<bool>
+    BackgroundTranslation("background-translation",
+            cl::desc("Translate TBs that are likely to run symbolically to LLVM"
+                     " in a separate thread"),
+            cl::init(false));
+
+    cl::opt<unsigned>
+    BackgroundTranslationQueueSize("background-translation-queue-size",
+            cl::desc("Maximum number of TBs waiting for background translation"),
+            cl::init(64));
+
+    cl::opt<unsigned>
+    BackgroundTranslationHotness("background-translation-hotness",
+            cl::desc("Number of concrete executions after which a TB that"
+                     " accesses registers that were symbolic is translated"
+                     " in the background"),
+            cl::init(16));
+
+    cl::opt<bool>
+    SwapStates("swap-states",
+            cl::desc("Swap the memory of inactive states to disk instead of"
+                     " killing states when exceeding --max-memory"),
+            cl::init(false));
+
+    cl::opt<std::string>
+    StateSwapDir("state-swap-dir",
+            cl::desc("Directory of the state swap file (default: the output"
+                     " directory)"),
+            cl::init(""));
+
 }
 
 //The logs may be flooded with messages when switching execution mode.
@@ -233,6 +281,7 @@ ConcolicMode("use-concolic-execution",
 
 
 extern cl::opt<bool> UseExprSimplifier;
+extern cl::opt<bool> ConcreteFastPath;
 
 extern "C" {
     int g_s2e_fork_on_symbolic_address = 0;
@@ -259,6 +308,24 @@ public:
     void removeFunction(llvm::Function *f);
 };
 
+/* Applies the passes of KLEE to the TBs translated in the background */
+class S2EBackgroundOptimizer: public TCGLLVMFunctionOptimizer
+{
+    klee::FunctionOptimizer m_optimizer;
+
+public:
+    S2EBackgroundOptimizer(llvm::Module *module): m_optimizer(module) {}
+
+    void optimize(llvm::Function *function) {
+        m_optimizer.run(function);
+    }
+};
+
+static TCGLLVMFunctionOptimizer* createBackgroundOptimizer(llvm::Module *module)
+{
+    return new S2EBackgroundOptimizer(module);
+}
+
 extern "C" {
 
 // FIXME: This is not reentrant.
@@ -390,45 +457,53 @@ void S2EHandler::processTestCase(const klee::ExecutionState &state,
     //Use onTestCaseGeneration event instead.
 }
 
+void S2EExecutor::traceIOAccess(S2EExecutionState *state, int accessType,
+                                const klee::ref<klee::Expr> &address,
+                                const klee::ref<klee::Expr> &value,
+                                unsigned sizeInBits, bool isWrite)
+{
+    CorePlugin *corePlugin = g_s2e->getCorePlugin();
+    if (corePlugin->onIOMemoryAccess.empty()) {
+        return;
+    }
+
+    IOAccess access((IOAccess::Type) accessType, 0, 0, sizeInBits / 8, isWrite);
+
+    if (klee::ConstantExpr *ce = dyn_cast<klee::ConstantExpr>(address)) {
+        access.address = ce->getZExtValue();
+    } else {
+        access.symbolicAddress = address;
+    }
+
+    if (klee::ConstantExpr *ce = dyn_cast<klee::ConstantExpr>(value)) {
+        access.value = ce->getZExtValue();
+        if (sizeInBits < 64) {
+            access.value &= (1ULL << sizeInBits) - 1;
+        }
+    } else if (value->getWidth() > sizeInBits) {
+        access.symbolicValue = klee::ExtractExpr::create(value, 0, sizeInBits);
+    } else {
+        access.symbolicValue = value;
+    }
+
+    corePlugin->onIOMemoryAccess.emit(state, access);
+}
+
 void S2EExecutor::handlerMJRCommon(Executor* executor,
                                    ExecutionState* state,
                                    klee::KInstruction* target,
                                    int accessType,
                                    std::vector<klee::ref<klee::Expr> > &args) {
-    assert(dynamic_cast<S2EExecutor*>(executor));
-    S2EExecutor* s2eExecutor = static_cast<S2EExecutor*>(executor);
-
     // MJR This call corresponds to tcg_llvm_trace_memory_access
     // tcg_llvm_trace_memory_access parameters are:
     // vaddr, value, sizeof(value), isWrite
-    // MJR Added for I/O memory tracing:
-    if(!s2eExecutor->m_s2e->getCorePlugin()->onIOMemoryAccess.empty()) {
-        assert(dynamic_cast<S2EExecutionState*>(state));
-        assert(args.size() == 4);
-
-        S2EExecutionState* s2eState = static_cast<S2EExecutionState*>(state);
-
-        // Argument index 0 is the address
-        klee::ref<klee::Expr> vaddr = args[0];
-
-        // Argument index 2 is size in bits:
-        Expr::Width sizeInBits = cast<klee::ConstantExpr>(args[2])->getZExtValue();
-        Expr::Width sizeInBytes = sizeInBits / 8;
-
-        // Argument index 1 is value:
-        klee::ref<Expr> value = klee::ExtractExpr::create(args[1], 0, sizeInBits);
-
-        // Argument index 3 is whether it's a write operation or not
-        bool isWrite = cast<klee::ConstantExpr>(args[3])->getZExtValue();
+    assert(dynamic_cast<S2EExecutionState*>(state));
+    assert(args.size() == 4);
 
-        s2eExecutor->m_s2e->getCorePlugin()->onIOMemoryAccess.emit(
-            s2eState,
-            accessType,
-            vaddr,            // address
-            value,            // value
-            sizeInBytes,      // size converted to bytes
-            isWrite);         // true = write, false = read
-    }
+    traceIOAccess(static_cast<S2EExecutionState*>(state), accessType,
+                  args[0], args[1],
+                  cast<klee::ConstantExpr>(args[2])->getZExtValue(),
+                  cast<klee::ConstantExpr>(args[3])->getZExtValue());
 }
 
 void S2EExecutor::handlerTraceMemoryAccess(Executor* executor,
@@ -436,7 +511,7 @@ void S2EExecutor::handlerTraceMemoryAccess(Executor* executor,
                                            klee::KInstruction* target,
                                            std::vector<klee::ref<klee::Expr> > &args)
 {
-    handlerMJRCommon(executor, state, target, 1, args);
+    handlerMJRCommon(executor, state, target, IOAccess::Mmio, args);
 }
 
 void S2EExecutor::handlerTracePortAccess(Executor* executor,
@@ -478,7 +553,7 @@ void S2EExecutor::handlerTracePortAccess(Executor* executor,
     //         isWrite);
     // }
 
-    handlerMJRCommon(executor, state, target, 0, args);
+    handlerMJRCommon(executor, state, target, IOAccess::Port, args);
 }
 
 void S2EExecutor::handlerTraceDMAAccess(Executor* executor,
@@ -486,7 +561,7 @@ void S2EExecutor::handlerTraceDMAAccess(Executor* executor,
                                         klee::KInstruction* target,
                                         std::vector<klee::ref<klee::Expr> > &args)
 {
-    handlerMJRCommon(executor, state, target, 2, args);
+    handlerMJRCommon(executor, state, target, IOAccess::Dma, args);
 }
 
 void S2EExecutor::handlerTraceInstruction(klee::Executor* executor,
@@ -707,7 +782,10 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
         : Executor(opts, ie, tcgLLVMContext->getExecutionEngine()),
           m_s2e(s2e), m_tcgLLVMContext(tcgLLVMContext),
           m_executeAlwaysKlee(false), m_forkProcTerminateCurrentState(false),
-          m_inLoadBalancing(false), yieldedState(NULL)
+          m_inLoadBalancing(false), m_switchTrackedState(NULL),
+          yieldedState(NULL), m_startTime(klee::util::getWallTime()),
+          m_firstForkReported(false), m_symbolicRegistersSeen(0),
+          m_stateSwapper(NULL)
 {
     delete externalDispatcher;
     externalDispatcher = new S2EExternalDispatcher(
@@ -935,10 +1013,27 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
         }
 
         m_tcgLLVMContext->initializeHelpers();
+
+        if (!TranslationCacheDir.empty()) {
+            char* filename =  qemu_find_file(QEMU_FILE_TYPE_LIB, "op_helper.bc");
+            assert(filename);
+            m_tcgLLVMContext->enableTranslationCache(TranslationCacheDir,
+                                                     filename);
+            g_free(filename);
+        }
+
+        if (BackgroundTranslation) {
+            m_tcgLLVMContext->enableBackgroundTranslation(
+                    createBackgroundOptimizer, BackgroundTranslationQueueSize);
+        }
     }
 
     initializeStatistics();
 
+    if (SwapStates && getMaxMemory()) {
+        m_stateSwapper = new S2EStateSwapper(StateSwapDir.empty() ?
+                m_s2e->getOutputDirectory() : StateSwapDir);
+    }
 
     searcher = constructUserSearcher(*this);
 
@@ -967,8 +1062,12 @@ void S2EExecutor::flushTb() {
 
 S2EExecutor::~S2EExecutor()
 {
+    m_tcgLLVMContext->disableBackgroundTranslation();
+
     if(statsTracker)
         statsTracker->done();
+
+    delete m_stateSwapper;
 }
 
 S2EExecutionState* S2EExecutor::createInitialState()
@@ -1125,6 +1224,10 @@ void S2EExecutor::registerRam(S2EExecutionState *initialState,
               << ", size = " << hexval(size) << ", hostAddr = " << hexval(hostAddress)
               << ", isSharedConcrete=" << isSharedConcrete << ", name=" << name << ")\n";
 
+    /* The objects of the block go to the radix table of the address space */
+    initialState->addressSpace.addFixedRange(hostAddress, size,
+                                             S2E_RAM_OBJECT_BITS);
+
     for(uint64_t addr = hostAddress; addr < hostAddress+size;
                  addr += S2E_RAM_OBJECT_SIZE) {
         std::stringstream ss;
@@ -1143,6 +1246,23 @@ void S2EExecutor::registerRam(S2EExecutionState *initialState,
         }
     }
 
+    if (isSharedConcrete && (saveOnContextSwitch || !StateSharedMemory)) {
+        SwitchRegion region;
+        ram_addr_t ramAddress;
+
+        region.hostAddress = hostAddress;
+        region.size = size;
+        region.firstObject = m_saveOnContextSwitch.size() - size / S2E_RAM_OBJECT_SIZE;
+
+        if (qemu_ram_addr_from_host((void*) hostAddress, &ramAddress) == 0) {
+            region.ramAddress = ramAddress;
+        } else {
+            region.ramAddress = (uint64_t) -1;
+        }
+
+        m_switchRegions.push_back(region);
+    }
+
     if(!isSharedConcrete) {
         /* XXX */
         /* XXX : use qemu_mprotect */
@@ -1181,6 +1301,56 @@ void S2EExecutor::registerDirtyMask(S2EExecutionState *initial_state, uint64_t h
 }
 
 
+void S2EExecutor::concretizeCpuRegisters(S2EExecutionState *state, const char *reason)
+{
+    ObjectState *wos = state->m_cpuRegistersObject;
+
+    std::vector<unsigned> offsets;
+    std::vector<ref<Expr> > bytes;
+    for (unsigned i = 0; i < wos->size; ++i) {
+        if (wos->isConcrete(i, Expr::Int8)) {
+            continue;
+        }
+        ref<Expr> e = state->constraints.simplifyExpr(wos->read8(i));
+        if (klee::ConstantExpr *ce = dyn_cast<klee::ConstantExpr>(e)) {
+            wos->write8(i, ce->getZExtValue(8));
+            continue;
+        }
+        offsets.push_back(i);
+        bytes.push_back(e);
+    }
+
+    if (bytes.empty()) {
+        return;
+    }
+
+    /* Get one solution for all the bytes with a single query */
+    std::vector<const Array*> objects;
+    findSymbolicObjects(bytes.begin(), bytes.end(), objects);
+
+    std::vector<std::vector<unsigned char> > values;
+    bool success = getSolver()->getInitialValues(
+            Query(state->constraints, klee::ConstantExpr::alloc(0, Expr::Bool)),
+            objects, values);
+    assert(success && "FIXME: Unhandled solver failure");
+    (void) success;
+
+    Assignment assignment(objects, values);
+    for (unsigned i = 0; i < bytes.size(); ++i) {
+        ref<klee::ConstantExpr> value =
+                cast<klee::ConstantExpr>(assignment.evaluate(bytes[i]));
+
+        if (PrintModeSwitch) {
+            m_s2e->getMessagesStream(state)
+                    << "Concretizing (reason: " << reason << ") register byte "
+                    << offsets[i] << ": " << bytes[i] << " to " << value << '\n';
+        }
+
+        addConstraint(*state, EqExpr::create(bytes[i], value));
+        wos->write8(offsets[i], value->getZExtValue(8));
+    }
+}
+
 void S2EExecutor::switchToConcrete(S2EExecutionState *state)
 {
     assert(!state->m_runningConcrete);
@@ -1199,15 +1369,7 @@ void S2EExecutor::switchToConcrete(S2EExecutionState *state)
             if(!wos->isAllConcrete()) {
                 /* The object contains symbolic values. We have to
                concretize it */
-
-                for(unsigned i = 0; i < wos->size; ++i) {
-                    ref<Expr> e = wos->read8(i);
-                    if(!isa<klee::ConstantExpr>(e)) {
-                        uint8_t ch = toConstant(*state, e,
-                                                "switching to concrete execution")->getZExtValue(8);
-                        wos->write8(i, ch);
-                    }
-                }
+                concretizeCpuRegisters(state, "switching to concrete execution");
             }
             // } // MJR
     }
@@ -1258,17 +1420,13 @@ bool S2EExecutor::copyInConcretes(klee::ExecutionState &state)
     return true;
 }
 
-void S2EExecutor::doLoadBalancing()
+static bool compareStateDepth(const ExecutionState *s1, const ExecutionState *s2)
 {
-    if (states.size() < 2) {
-        return;
-    }
-
-    //Don't bother copying stuff if it's obvious that it'll very likely fail
-    if (m_s2e->getCurrentProcessCount() == m_s2e->getMaxProcesses()) {
-        return;
-    }
+    return s1->depth < s2->depth;
+}
 
+void S2EExecutor::doLoadBalancing()
+{
     std::vector<ExecutionState*> allStates;
 
     foreach2(it, states.begin(), states.end()) {
@@ -1278,12 +1436,19 @@ void S2EExecutor::doLoadBalancing()
         }
     }
 
-    if (allStates.size() < 2) {
+    //Publish the queue size of this process to the other ones.
+    //When a process runs out of states and exits, the busiest
+    //remaining process forks to hand half of its queue to the free slot.
+    if (!m_s2e->shouldShareStates(allStates.size())) {
         return;
     }
 
     g_s2e->getDebugStream() << "LoadBalancing: starting\n";
 
+    //Interleave the states sorted by depth, so that both processes
+    //get a similar mix of shallow and deep states
+    std::stable_sort(allStates.begin(), allStates.end(), compareStateDepth);
+
     m_inLoadBalancing = true;
 
     vm_stop(RUN_STATE_SAVE_VM);
@@ -1299,16 +1464,16 @@ void S2EExecutor::doLoadBalancing()
         return;
     }
 
-    unsigned size = allStates.size();
-    unsigned n = size / 2;
-    unsigned lower = child ? 0 : n;
-    unsigned upper = child ? n : size;
-
     m_s2e->getCorePlugin()->onProcessFork.emit(false, child, parentId);
 
+    //Both processes keep reading the swapped states they inherited
+    if (m_stateSwapper) {
+        m_stateSwapper->seal();
+    }
+
     g_s2e->getDebugStream() << "LoadBalancing: terminating states\n";
 
-    for (unsigned i=lower; i<upper; ++i) {
+    for (unsigned i = child ? 0 : 1; i < allStates.size(); i += 2) {
         S2EExecutionState *s2estate = static_cast<S2EExecutionState*>(allStates[i]);
         terminateStateAtFork(*s2estate);
     }
@@ -1343,6 +1508,166 @@ void S2EExecutor::initializeStateSwitchTimer()
     qemu_mod_timer(m_stateSwitchTimer, qemu_get_clock_ms(rt_clock) + 100);
 }
 
+/**
+ * Copies the 64-byte chunks of src that differ from dst.
+ * Returns the number of bytes actually written.
+ */
+static uint64_t copyDifferingChunks(uint8_t *dst, const uint8_t *src, uint64_t size)
+{
+    static const uint64_t ChunkSize = 64;
+    uint64_t copied = 0;
+
+    for (uint64_t offset = 0; offset < size; offset += ChunkSize) {
+        uint64_t length = std::min(ChunkSize, size - offset);
+        if (memcmp(dst + offset, src + offset, length)) {
+            memcpy(dst + offset, src + offset, length);
+            copied += length;
+        }
+    }
+
+    return copied;
+}
+
+void S2EExecutor::getSwitchDirtyObjects(S2EExecutionState *state,
+                                        std::vector<bool> &dirtyObjects)
+{
+    dirtyObjects.clear();
+
+    //Without tracking, everything must be considered as dirty
+    if (!IncrementalStateSwitch || state != m_switchTrackedState) {
+        return;
+    }
+
+    dirtyObjects.resize(m_saveOnContextSwitch.size(), true);
+
+    const unsigned objectsPerPage = TARGET_PAGE_SIZE / S2E_RAM_OBJECT_SIZE;
+    uint64_t dirtyMaskAddress = S2EExecutionState::m_dirtyMask->address;
+
+    for (unsigned i = 0; i < m_switchRegions.size(); ++i) {
+        const SwitchRegion &region = m_switchRegions[i];
+        if (region.ramAddress == (uint64_t) -1) {
+            continue;
+        }
+
+        unsigned index = region.firstObject;
+        for (uint64_t offset = 0; offset < region.size; offset += TARGET_PAGE_SIZE) {
+            uint64_t page = (region.ramAddress + offset) >> TARGET_PAGE_BITS;
+            bool dirty = state->readDirtyMask(dirtyMaskAddress + page) & S2E_SWITCH_DIRTY_FLAG;
+            for (unsigned j = 0; j < objectsPerPage; ++j) {
+                dirtyObjects[index++] = dirty;
+            }
+        }
+    }
+}
+
+uint64_t S2EExecutor::saveSharedConcreteObjects(S2EExecutionState *state,
+                                                const std::vector<bool> &dirtyObjects)
+{
+    const MemoryObject *cpuMo = state->m_cpuSystemState;
+    uint64_t totalCopied = 0;
+
+    for (unsigned i = 0; i < m_saveOnContextSwitch.size(); ++i) {
+        MemoryObject *mo = m_saveOnContextSwitch[i];
+        if (mo == cpuMo || (!dirtyObjects.empty() && !dirtyObjects[i])) {
+            continue;
+        }
+
+        const ObjectState *os = state->addressSpace.findObject(mo);
+        if (IncrementalStateSwitch &&
+            !memcmp(os->getConcreteStore(), (uint8_t*) mo->address, mo->size)) {
+            //Avoid copy-on-write of objects that did not change
+            continue;
+        }
+
+        ObjectState *wos = state->addressSpace.getWriteable(mo, os);
+        uint8_t *store = wos->getConcreteStore();
+        assert(store);
+        memcpy(store, (uint8_t*) mo->address, mo->size);
+        totalCopied += mo->size;
+    }
+
+    return totalCopied;
+}
+
+uint64_t S2EExecutor::restoreSharedConcreteObjects(S2EExecutionState *oldState,
+                                                   S2EExecutionState *newState)
+{
+    const MemoryObject *cpuMo = newState->m_cpuSystemState;
+    uint64_t totalCopied = 0;
+
+    for (unsigned i = 0; i < m_saveOnContextSwitch.size(); ++i) {
+        MemoryObject *mo = m_saveOnContextSwitch[i];
+        if (mo == cpuMo) {
+            continue;
+        }
+
+        const ObjectState *newOS = newState->addressSpace.findObject(mo);
+        const uint8_t *newStore = newOS->getConcreteStore();
+        assert(newStore);
+
+        if (!oldState) {
+            memcpy((uint8_t*) mo->address, newStore, mo->size);
+            totalCopied += mo->size;
+            continue;
+        }
+
+        //The host location holds the up-to-date content of oldState.
+        //Objects shared by both states are already in place.
+        if (oldState->addressSpace.findObject(mo) == newOS) {
+            continue;
+        }
+
+        totalCopied += copyDifferingChunks((uint8_t*) mo->address, newStore, mo->size);
+    }
+
+    return totalCopied;
+}
+
+void S2EExecutor::markSwitchDirty(S2EExecutionState *state,
+                                  const MemoryObject *mo)
+{
+    if (state != m_switchTrackedState) {
+        return;
+    }
+
+    for (unsigned i = 0; i < m_switchRegions.size(); ++i) {
+        const SwitchRegion &region = m_switchRegions[i];
+        if (mo->address < region.hostAddress ||
+            mo->address >= region.hostAddress + region.size) {
+            continue;
+        }
+
+        //Regions without a RAM address are always considered dirty
+        if (region.ramAddress != (uint64_t) -1) {
+            uint64_t page = (region.ramAddress + mo->address - region.hostAddress)
+                            >> TARGET_PAGE_BITS;
+            uint64_t maskAddress = S2EExecutionState::m_dirtyMask->address + page;
+            state->writeDirtyMask(maskAddress,
+                    state->readDirtyMask(maskAddress) | S2E_SWITCH_DIRTY_FLAG);
+        }
+        return;
+    }
+}
+
+void S2EExecutor::resetSwitchDirtyTracking(S2EExecutionState *state)
+{
+    if (!IncrementalStateSwitch || !S2EExecutionState::m_dirtyMask) {
+        m_switchTrackedState = NULL;
+        return;
+    }
+
+    assert(g_s2e_state == state);
+
+    for (unsigned i = 0; i < m_switchRegions.size(); ++i) {
+        const SwitchRegion &region = m_switchRegions[i];
+        if (region.ramAddress != (uint64_t) -1) {
+            s2e_reset_switch_dirty(region.ramAddress, region.size);
+        }
+    }
+
+    m_switchTrackedState = state;
+}
+
 void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
                                 S2EExecutionState* newState)
 {
@@ -1370,6 +1695,8 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
     const MemoryObject* cpuMo = oldState ? oldState->m_cpuSystemState :
                                             newState->m_cpuSystemState;
 
+    uint64_t totalCopied = 0;
+
     if(oldState) {
         if(oldState->m_runningConcrete)
             switchToSymbolic(oldState);
@@ -1387,11 +1714,26 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
         *oldState->m_timersState = timers_state;
 
         uint8_t *oldStore = oldState->m_cpuSystemObject->getConcreteStore();
-        memcpy(oldStore, (uint8_t*) cpuMo->address, cpuMo->size);
+        if (IncrementalStateSwitch) {
+            totalCopied += copyDifferingChunks(oldStore, (uint8_t*) cpuMo->address, cpuMo->size);
+        } else {
+            memcpy(oldStore, (uint8_t*) cpuMo->address, cpuMo->size);
+            totalCopied += cpuMo->size;
+        }
+
+        //Must be done before newState overwrites the dirty mask
+        std::vector<bool> dirtyObjects;
+        getSwitchDirtyObjects(oldState, dirtyObjects);
+        totalCopied += saveSharedConcreteObjects(oldState, dirtyObjects);
+
+        //Idle states do not need their cached simplifications
+        oldState->constraints.clearSimplifyCache();
 
         oldState->m_active = false;
     }
 
+    m_switchTrackedState = NULL;
+
     if(newState) {
         timers_state = *newState->m_timersState;
         //qemu_icount = newState->m_qemuIcount;
@@ -1400,7 +1742,12 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
         memcpy(&jmp_env, &env->jmp_env, sizeof(jmp_buf));
 
         const uint8_t *newStore = newState->m_cpuSystemObject->getConcreteStore();
-        memcpy((uint8_t*) cpuMo->address, newStore, cpuMo->size);
+        if (IncrementalStateSwitch && oldState) {
+            totalCopied += copyDifferingChunks((uint8_t*) cpuMo->address, newStore, cpuMo->size);
+        } else {
+            memcpy((uint8_t*) cpuMo->address, newStore, cpuMo->size);
+            totalCopied += cpuMo->size;
+        }
 
         memcpy(&env->jmp_env, &jmp_env, sizeof(jmp_buf));
 
@@ -1410,36 +1757,19 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
         //after the state is activated
         //XXX: assigning g_s2e_state here is ugly but is required for restoreDeviceState...
         g_s2e_state = newState;
-        newState->getDeviceState()->restoreDeviceState();
-    }
 
-    uint64_t totalCopied = 0;
-    uint64_t objectsCopied = 0;
-    foreach(MemoryObject* mo, m_saveOnContextSwitch) {
-        if(mo == cpuMo)
-            continue;
+        totalCopied += restoreSharedConcreteObjects(
+                IncrementalStateSwitch ? oldState : NULL, newState);
+        resetSwitchDirtyTracking(newState);
 
-        if(oldState) {
-            const ObjectState *oldOS = oldState->addressSpace.findObject(mo);
-            ObjectState *oldWOS = oldState->addressSpace.getWriteable(mo, oldOS);
-            uint8_t *oldStore = oldWOS->getConcreteStore();
-            assert(oldStore);
-            memcpy(oldStore, (uint8_t*) mo->address, mo->size);
-        }
-
-        if(newState) {
-            const ObjectState *newOS = newState->addressSpace.findObject(mo);
-            const uint8_t *newStore = newOS->getConcreteStore();
-            assert(newStore);
-            memcpy((uint8_t*) mo->address, newStore, mo->size);
-        }
-
-        totalCopied += mo->size;
-        objectsCopied++;
+        newState->getDeviceState()->restoreDeviceState();
     }
 
+    ++stats::stateSwitches;
+    stats::stateSwitchBytesCopied += totalCopied;
+
     if (VerboseStateSwitching) {
-        s2e_debug_print("Copied %d (count=%d)\n", totalCopied, objectsCopied);
+        s2e_debug_print("Copied %" PRIu64 " bytes\n", totalCopied);
     }
 
     if(FlushTBsOnStateSwitch)
@@ -1455,7 +1785,12 @@ ExecutionState* S2EExecutor::selectNonSpeculativeState(S2EExecutionState *state)
     ExecutionState *newState;
     std::set<ExecutionState*> empty;
 
-    do {
+    //Take into account the speculative states resolved in the background
+    if (updateSpeculativeStates()) {
+        updateStates(state);
+    }
+
+    for (;;) {
         if (searcher->empty()) {
             newState = NULL;
             break;
@@ -1477,7 +1812,19 @@ ExecutionState* S2EExecutor::selectNonSpeculativeState(S2EExecutionState *state)
             //the status of the state.
             searcher->update(newState, empty, empty);
         }
-    } while(newState->isSpeculative());
+
+        if (m_stateSwapper) {
+            S2EExecutionState *s2eState = static_cast<S2EExecutionState*>(newState);
+            if (!m_stateSwapper->swapIn(s2eState)) {
+                terminateStateEarly(*newState, "could not swap in the state");
+                updateStates(state);
+                continue;
+            }
+            m_stateSwapper->touch(s2eState);
+        }
+
+        break;
+    }
 
     if (!newState) {
         m_s2e->getWarningsStream() << "All states were terminated" << '\n';
@@ -1566,7 +1913,16 @@ void S2EExecutor::prepareFunctionExecution(S2EExecutionState *state,
     } else {
 
         unsigned cIndex = kmodule->constants.size();
-        kf = kmodule->updateModuleWithFunction(function);
+        bool cached = m_tcgLLVMContext->isCachedFunction(function);
+        bool optimized = cached ||
+                         m_tcgLLVMContext->isBackgroundFunction(function);
+        kf = kmodule->updateModuleWithFunction(function, !optimized);
+
+        if (m_tcgLLVMContext->cacheFunction(function)) {
+            ++stats::translationCacheMisses;
+        } else if (cached) {
+            ++stats::translationCacheHits;
+        }
 
         for(unsigned i = 0; i < kf->numInstructions; ++i)
             bindInstructionConstants(kf->instructions[i]);
@@ -1634,7 +1990,12 @@ inline void S2EExecutor::executeOneInstruction(S2EExecutionState *state)
 
     bool shouldExitCpu = false;
     try {
-        executeInstruction(*state, ki);
+        /* Most instructions of a TB only compute on concrete data */
+        if (ConcreteFastPath && executeConcreteInstruction(*state, ki)) {
+            ++stats::concreteFastPathInstructions;
+        } else {
+            executeInstruction(*state, ki);
+        }
 
 #ifdef S2E_TRACE_EFLAGS
         ref<Expr> efl = state->readCpuRegister(offsetof(CPUState, cc_src), klee::Expr::Int32);
@@ -1655,17 +2016,34 @@ inline void S2EExecutor::executeOneInstruction(S2EExecutionState *state)
         // to pummel the freelist once we hit the memory cap.
         unsigned mbs = sys::Process::GetTotalMemoryUsage() >> 20;
 
+        if (mbs > getMaxMemory() && m_stateSwapper) {
+          //Make room by swapping out the coldest states first
+          uint64_t excess = (uint64_t) (mbs - getMaxMemory()) << 20;
+          if (m_stateSwapper->evict(states, state, excess)) {
+            mbs = sys::Process::GetTotalMemoryUsage() >> 20;
+          }
+        }
+
         if (mbs > getMaxMemory()) {
           if (mbs > getMaxMemory() + 100) {
+            // Swapped out states hold little memory and would have to be
+            // read back from the disk to generate their test cases
+            std::vector<ExecutionState*> arr;
+            for (std::set<ExecutionState*>::iterator it = states.begin();
+                 it != states.end(); ++it) {
+              if (!m_stateSwapper || !m_stateSwapper->isSwappedOut(
+                      static_cast<S2EExecutionState*>(*it)))
+                arr.push_back(*it);
+            }
+
             // just guess at how many to kill
-            unsigned numStates = states.size();
+            unsigned numStates = arr.size();
             unsigned toKill = std::max(1U, numStates - numStates*getMaxMemory()/mbs);
 
             if (getMaxMemoryInhibit())
               klee_warning("killing %d states (over memory cap)",
                            toKill);
 
-            std::vector<ExecutionState*> arr(states.begin(), states.end());
             for (unsigned i=0,N=arr.size(); N && i<toKill; ++i,--N) {
               unsigned idx = rand() % N;
 
@@ -1753,39 +2131,25 @@ void S2EExecutor::finalizeTranslationBlockExec(S2EExecutionState *state)
 
 }
 
-#ifdef _WIN32
-
-extern "C" volatile LONG g_signals_enabled;
-
-typedef int sigset_t;
-
-static void s2e_disable_signals(sigset_t *oldset)
-{
-    while(InterlockedCompareExchange(&g_signals_enabled, 0, 1) == 0)
-       ;
-}
-
-static void s2e_enable_signals(sigset_t *oldset)
-{
-    g_signals_enabled = 1;
-}
-
-#else
-
-static void s2e_disable_signals(sigset_t *oldset)
+/* The TB chains are also unlinked by cpu_unlink_tb() from signal handlers.
+   Instead of blocking the signals around each chain update, which costs
+   two syscalls per chained TB, the handler defers the unlinking while
+   s2e_tb_chain_busy is set. */
+static inline void s2e_begin_chain_update()
 {
-    sigset_t set;
-    sigfillset(&set);
-    sigprocmask(SIG_BLOCK, &set, oldset);
+    s2e_tb_chain_busy = 1;
+    asm volatile("" ::: "memory");
 }
 
-static void s2e_enable_signals(sigset_t *oldset)
+static inline void s2e_end_chain_update()
 {
-    sigprocmask(SIG_SETMASK, oldset, NULL);
+    s2e_tb_chain_busy = 0;
+    __sync_synchronize();
+    if (unlikely(s2e_tb_unlink_pending)) {
+        s2e_tb_run_pending_unlink(env);
+    }
 }
 
-#endif
-
 uintptr_t S2EExecutor::executeTranslationBlockKlee(
         S2EExecutionState* state,
         TranslationBlock* tb)
@@ -1815,6 +2179,21 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
         if(!tb->llvm_function) {
             cpu_gen_llvm(env, tb);
             assert(tb->llvm_function);
+
+            if (BackgroundTranslation) {
+                if (m_tcgLLVMContext->isBackgroundFunction(tb->llvm_function)) {
+                    ++stats::backgroundTranslationHits;
+                } else {
+                    ++stats::backgroundTranslationMisses;
+                }
+            }
+        }
+
+        /* The successors are likely to run symbolically as well,
+           translate them while KLEE executes this TB */
+        if (BackgroundTranslation) {
+            translateInBackground(tb->s2e_tb_next[0]);
+            translateInBackground(tb->s2e_tb_next[1]);
         }
 
         if(tb->s2e_tb != state->m_lastS2ETb) {
@@ -1841,16 +2220,8 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
             if(tcg_llvm_runtime.goto_tb != 0xff) {
                 assert(tcg_llvm_runtime.goto_tb < 2);
 
-                /* The next should be atomic with respect to signals */
-                /* XXX: what else should we block ? */
-#ifdef _WIN32
-                //Timers can run in different threads...
-                s2e_disable_signals(NULL);
-#else
-                sigset_t set, oldset;
-                sigfillset(&set);
-                sigprocmask(SIG_BLOCK, &set, &oldset);
-#endif
+                /* The next should be atomic with respect to unlinking */
+                s2e_begin_chain_update();
 
                 TranslationBlock* next_tb =
                         tb->s2e_tb_next[tcg_llvm_runtime.goto_tb];
@@ -1867,27 +2238,16 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
                     env->s2e_current_tb = tb;
                     //g_s2e_exec_ret_addr = tb->tc_ptr;
 
-                    /* assert that blocking works */
-#ifdef _WIN32
-                    assert(old_tb->s2e_tb_next[tcg_llvm_runtime.goto_tb] == tb);
-                    cleanupTranslationBlock(state, tb);
-                    s2e_enable_signals(NULL);
-                    break;
-#else
+                    /* assert that deferring the unlinking works */
                     assert(old_tb->s2e_tb_next[tcg_llvm_runtime.goto_tb] == tb);
                     cleanupTranslationBlock(state, tb);
-                    sigprocmask(SIG_SETMASK, &oldset, NULL);
+                    s2e_end_chain_update();
                     break;
-#endif
                 }
 
-                /* the block was unchained by signal handler */
+                /* the block is not chained, or was unchained by a signal handler */
                 tcg_llvm_runtime.goto_tb = 0xff;
-#ifdef _WIN32
-                s2e_enable_signals(NULL);
-#else
-                sigprocmask(SIG_SETMASK, &oldset, NULL);
-#endif
+                s2e_end_chain_update();
             }
 
         }
@@ -1935,6 +2295,13 @@ uintptr_t S2EExecutor::executeTranslationBlockConcrete(S2EExecutionState *state,
     return ret;
 }
 
+void S2EExecutor::translateInBackground(TranslationBlock *tb)
+{
+    if (tb && !tb->llvm_function && cpu_gen_llvm_background(env, tb) == 0) {
+        ++stats::backgroundTranslations;
+    }
+}
+
 static inline void s2e_tb_reset_jump(TranslationBlock *tb, unsigned int n)
 {
     TranslationBlock *tb1, *tb_next, **ptb;
@@ -1978,9 +2345,8 @@ static void s2e_tb_reset_jump_smask(TranslationBlock* tb, unsigned int n,
                                            uint64_t smask, int depth = 0)
 {
     TranslationBlock *tb1 = tb->s2e_tb_next[n];
-    sigset_t oldset;
     if (depth == 0) {
-        s2e_disable_signals(&oldset);
+        s2e_begin_chain_update();
     }
 
     if(tb1) {
@@ -1994,7 +2360,7 @@ static void s2e_tb_reset_jump_smask(TranslationBlock* tb, unsigned int n,
     }
 
     if (depth == 0) {
-        s2e_enable_signals(&oldset);
+        s2e_end_chain_update();
     }
 }
 
@@ -2035,6 +2401,7 @@ uintptr_t S2EExecutor::executeTranslationBlock(
                          || (tb->helper_accesses_mem & 4)) {
                     /* TB reads symbolic variables */
                     executeKlee = true;
+                    m_symbolicRegistersSeen |= smask;
 
                 } else {
                     s2e_tb_reset_jump_smask(tb, 0, smask);
@@ -2082,6 +2449,12 @@ uintptr_t S2EExecutor::executeTranslationBlock(
             TimerStatIncrementer t(stats::concreteModeTime);
         }
 
+        if (BackgroundTranslation &&
+                (m_symbolicRegistersSeen & (tb->reg_rmask | tb->reg_wmask)) &&
+                ++tb->s2e_tb->concreteExecutions == BackgroundTranslationHotness) {
+            translateInBackground(tb);
+        }
+
         return executeTranslationBlockConcrete(state, tb);
     }
 }
@@ -2172,12 +2545,24 @@ void S2EExecutor::doStateFork(S2EExecutionState *originalState,
     assert(originalState->m_active && !originalState->m_runningConcrete);
 
     llvm::raw_ostream& out = m_s2e->getMessagesStream(originalState);
+
+    if (!m_firstForkReported) {
+        m_firstForkReported = true;
+        out << "First symbolic branch after "
+            << (uint64_t) ((klee::util::getWallTime() - m_startTime) * 1000)
+            << " ms (translation cache: " << stats::translationCacheHits.getValue()
+            << " hits, " << stats::translationCacheMisses.getValue() << " misses)\n";
+    }
+
     out << "Forking state " << originalState->getID()
             << " at pc = " << hexval(originalState->getPc()) << '\n';
 
     qemu_aio_flush();
     bdrv_flush_all();
 
+    std::vector<bool> dirtyObjects;
+    getSwitchDirtyObjects(originalState, dirtyObjects);
+
     for(unsigned i = 0; i < newStates.size(); ++i) {
         S2EExecutionState* newState = newStates[i];
 
@@ -2203,18 +2588,14 @@ void S2EExecutor::doStateFork(S2EExecutionState *originalState,
             memcpy(cpuStore, (uint8_t*) cpuMo->address, cpuMo->size);
             newState->m_active = false;
 
-            /* Save all other objects */
-            foreach(MemoryObject* mo, m_saveOnContextSwitch) {
-                if(mo == cpuMo)
-                    continue;
-
-                const ObjectState *os = newState->addressSpace.findObject(mo);
-                ObjectState *wos = newState->addressSpace.getWriteable(mo, os);
-                uint8_t *store = wos->getConcreteStore();
+            /* Save all other objects. Objects not written since the
+               original state was activated are already up to date. */
+            saveSharedConcreteObjects(newState, dirtyObjects);
+        }
 
-                assert(store);
-                memcpy(store, (uint8_t*) mo->address, mo->size);
-            }
+        //New states are the most recently used ones
+        if (m_stateSwapper) {
+            m_stateSwapper->touch(newState);
         }
     }
 
@@ -2309,6 +2690,34 @@ bool S2EExecutor::merge(klee::ExecutionState &_base, klee::ExecutionState &_othe
     else if(other.m_active)
         doStateSwitch(&other, NULL);
 
+    /* Merging compares the memory of both states. A state that could not
+       be swapped in lost part of its memory and must not run anymore. */
+    if (m_stateSwapper) {
+        bool baseSwapped = m_stateSwapper->swapIn(&base);
+        bool otherSwapped = m_stateSwapper->swapIn(&other);
+
+        std::vector<S2EExecutionState*> failed;
+        if (!baseSwapped) {
+            failed.push_back(&base);
+        }
+        if (!otherSwapped) {
+            failed.push_back(&other);
+        }
+
+        //Terminating the current state exits the CPU loop, kill it last
+        if (failed.size() == 2 && failed[0] == g_s2e_state) {
+            std::swap(failed[0], failed[1]);
+        }
+
+        for (unsigned i = 0; i < failed.size(); ++i) {
+            terminateStateEarly(*failed[i], "could not swap in the state");
+        }
+
+        if (!failed.empty()) {
+            return false;
+        }
+    }
+
     if(base.merge(other)) {
         m_s2e->getMessagesStream(&base)
                 << "Merged with state " << other.getID() << '\n';
@@ -2323,6 +2732,12 @@ bool S2EExecutor::merge(klee::ExecutionState &_base, klee::ExecutionState &_othe
 void S2EExecutor::terminateStateEarly(klee::ExecutionState &state, const llvm::Twine &message)
 {
     S2EExecutionState  *s2estate = static_cast<S2EExecutionState*>(&state);
+
+    //Test case generators read the memory of the state
+    if (m_stateSwapper) {
+        m_stateSwapper->swapIn(s2estate);
+    }
+
     m_s2e->getMessagesStream(s2estate) << message << '\n';
     m_s2e->getCorePlugin()->onTestCaseGeneration.emit(s2estate, message.str());
     terminateState(state);
@@ -2331,6 +2746,12 @@ void S2EExecutor::terminateStateEarly(klee::ExecutionState &state, const llvm::T
 void S2EExecutor::terminateState(ExecutionState &s)
 {
     S2EExecutionState& state = static_cast<S2EExecutionState&>(s);
+
+    //Plugins may look at the memory of the killed state
+    if (m_stateSwapper) {
+        m_stateSwapper->swapIn(&state);
+    }
+
     m_s2e->getCorePlugin()->onStateKill.emit(&state);
 
     terminateStateAtFork(state);
@@ -2392,6 +2813,9 @@ void S2EExecutor::yieldState(ExecutionState &s)
 
 void S2EExecutor::terminateStateAtFork(S2EExecutionState &state)
 {
+    if (m_stateSwapper) {
+        m_stateSwapper->forget(&state);
+    }
     Executor::terminateState(state);
 }
 
@@ -2514,6 +2938,16 @@ void S2EExecutor::unrefS2ETb(S2ETranslationBlock* s2e_tb)
     }
 }
 
+unsigned S2EExecutor::getBackgroundTranslationQueueSize() const
+{
+    return m_tcgLLVMContext->getBackgroundQueueSize();
+}
+
+uint64_t S2EExecutor::getSwappedStatesCount() const
+{
+    return m_stateSwapper ? m_stateSwapper->getSwappedStatesCount() : 0;
+}
+
 void S2EExecutor::queueStateForMerge(S2EExecutionState *state)
 {
     if(dynamic_cast<MergingSearcher*>(searcher) == NULL) {
@@ -2698,6 +3132,7 @@ void s2e_tb_alloc(S2E*, TranslationBlock *tb)
     tb->s2e_tb = new S2ETranslationBlock;
     tb->s2e_tb->llvm_function = NULL;
     tb->s2e_tb->refCount = 1;
+    tb->s2e_tb->concreteExecutions = 0;
 
     /* Push one copy of a signal to use it as a cache */
     tb->s2e_tb->executionSignals.push_back(new s2e::ExecutionSignal);
@@ -2713,6 +3148,7 @@ void s2e_set_tb_function(S2E*, TranslationBlock *tb)
 
 void s2e_tb_free(S2E* s2e, TranslationBlock *tb)
 {
+    tcg_llvm_ctx->discardBackgroundCode(tb);
     s2e->getExecutor()->unrefS2ETb(tb->s2e_tb);
 }
 
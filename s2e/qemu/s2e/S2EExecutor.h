@@ -53,6 +53,7 @@ namespace s2e {
 
 class S2E;
 class S2EExecutionState;
+class S2EStateSwapper;
 struct S2ETranslationBlock;
 
 class CpuExitException
@@ -100,6 +101,24 @@ protected:
 
     std::vector<klee::MemoryObject*> m_saveOnContextSwitch;
 
+    /** Host RAM ranges whose objects are stored in m_saveOnContextSwitch.
+        Used by incremental state switching to map QEMU dirty pages
+        to memory objects. */
+    struct SwitchRegion {
+        uint64_t hostAddress;
+        uint64_t size;
+        /** Offset of the range in QEMU's RAM list, -1 if unknown */
+        uint64_t ramAddress;
+        /** Index of the first object of the range in m_saveOnContextSwitch */
+        unsigned firstObject;
+    };
+
+    std::vector<SwitchRegion> m_switchRegions;
+
+    /** The state whose writes to m_saveOnContextSwitch pages are tracked
+        in the dirty mask since its activation */
+    S2EExecutionState *m_switchTrackedState;
+
     std::vector<S2EExecutionState*> m_deletedStates;
 
     bool m_executeAlwaysKlee;
@@ -115,6 +134,17 @@ protected:
     /** Holds the yielded state, if any */
     S2EExecutionState* yieldedState;
 
+    /** Used to report the time to the first symbolic branch */
+    double m_startTime;
+    bool m_firstForkReported;
+
+    /** Registers that caused TBs to run in KLEE. Hot TBs that access
+        them are translated to LLVM in the background. */
+    uint64_t m_symbolicRegistersSeen;
+
+    /** Swaps inactive states to disk at the memory cap, or NULL */
+    S2EStateSwapper *m_stateSwapper;
+
     /** Moves yielded state back into list of schedulable states */
     void restoreYieldedState(void);
 
@@ -199,6 +229,12 @@ public:
 
     void unrefS2ETb(S2ETranslationBlock* s2e_tb);
 
+    /** Number of TBs waiting for background translation to LLVM */
+    unsigned getBackgroundTranslationQueueSize() const;
+
+    /** Number of states whose memory is swapped out */
+    uint64_t getSwappedStatesCount() const;
+
     void queueStateForMerge(S2EExecutionState *state);
 
     void initializeStatistics();
@@ -220,8 +256,21 @@ public:
         return yieldedState;
     }
 
+    /** Records in the dirty mask that the active state wrote to the given
+        shared concrete object outside of QEMU's memory access paths
+        (e.g., from a plugin), so that the next switch saves it */
+    void markSwitchDirty(S2EExecutionState *state, const klee::MemoryObject *mo);
+
 protected:
 public: // MJR
+    /** Emit CorePlugin::onIOMemoryAccess, unboxing the concrete operands.
+        accessType is an IOAccess::Type and sizeInBits is the width of the
+        access, the value is truncated to it. */
+    static void traceIOAccess(S2EExecutionState *state, int accessType,
+                              const klee::ref<klee::Expr> &address,
+                              const klee::ref<klee::Expr> &value,
+                              unsigned sizeInBits, bool isWrite);
+
     static void handlerMJRCommon(klee::Executor* executor,
                                  klee::ExecutionState* state,
                                  klee::KInstruction* target,
@@ -268,6 +317,8 @@ public: // MJR
     uintptr_t executeTranslationBlockConcrete(S2EExecutionState *state,
                                               TranslationBlock *tb);
 
+    void translateInBackground(TranslationBlock *tb);
+
     void deleteState(klee::ExecutionState *state);
 
     void doStateSwitch(S2EExecutionState* oldState,
@@ -279,6 +330,26 @@ public: // MJR
 
     void doLoadBalancing();
 
+    /** Computes which objects of m_saveOnContextSwitch may have been
+        modified by the active state since it was activated */
+    void getSwitchDirtyObjects(S2EExecutionState *state,
+                               std::vector<bool> &dirtyObjects);
+
+    /** Copies shared concrete objects from their host location into
+        the given state. Only objects marked in dirtyObjects are copied
+        when the vector is not empty. Returns the number of bytes copied. */
+    uint64_t saveSharedConcreteObjects(S2EExecutionState *state,
+                                       const std::vector<bool> &dirtyObjects);
+
+    /** Copies shared concrete objects of newState to their host location.
+        When oldState is given, skips objects that are known to be
+        identical in both states. Returns the number of bytes copied. */
+    uint64_t restoreSharedConcreteObjects(S2EExecutionState *oldState,
+                                          S2EExecutionState *newState);
+
+    /** Starts tracking writes of the newly activated state */
+    void resetSwitchDirtyTracking(S2EExecutionState *state);
+
     /** Copy concrete values to their proper location, concretizing
         if necessary (most importantly it will concretize CPU registers.
         Note: this is required only to execute generated code,
@@ -288,6 +359,10 @@ public: // MJR
     /** Copy concrete values to the execution state storage */
     void switchToSymbolic(S2EExecutionState *state);
 
+    /** Concretize the symbolic bytes of the CPU registers, getting
+        values for all of them with a single solver query */
+    void concretizeCpuRegisters(S2EExecutionState *state, const char *reason);
+
 
     /** Implementation that does nothing. We do not need to concretize
         when calling externals, because all of them access data only
@@ -401,6 +476,10 @@ struct S2ETranslationBlock
         when this translation block will be flushed.
         XXX: how could we avoid using void* here ? */
     std::vector<void*> executionSignals;
+
+    /** Number of concrete executions of the TB while it accesses
+        registers that were symbolic */
+    unsigned concreteExecutions;
 };
 
 } // namespace s2e
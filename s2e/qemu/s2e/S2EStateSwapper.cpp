@@ -0,0 +1,405 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#include "S2EStateSwapper.h"
+
+#include <s2e/S2E.h>
+#include <s2e/S2EExecutionState.h>
+#include <s2e/S2EStatsTracker.h>
+#include <s2e/Utils.h>
+#include <s2e/s2e_qemu.h>
+
+#include <klee/Memory.h>
+#include <klee/TimerStatIncrementer.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace klee;
+
+namespace {
+    /** Swapped objects are copied through buffers of about this size */
+    const uint64_t SwapBufferSize = 1 << 20;
+
+    bool writeAt(int fd, const uint8_t *buffer, size_t size, uint64_t offset)
+    {
+        while (size) {
+            ssize_t ret = pwrite(fd, buffer, size, offset);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+                return false;
+            buffer += ret;
+            size -= ret;
+            offset += ret;
+        }
+        return true;
+    }
+
+    bool readAt(int fd, uint8_t *buffer, size_t size, uint64_t offset)
+    {
+        while (size) {
+            ssize_t ret = pread(fd, buffer, size, offset);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+                return false;
+            buffer += ret;
+            size -= ret;
+            offset += ret;
+        }
+        return true;
+    }
+}
+
+namespace s2e {
+
+S2EStateSwapper::S2EStateSwapper(const std::string &directory)
+    : m_directory(directory), m_file(NULL), m_clock(0)
+{
+}
+
+S2EStateSwapper::~S2EStateSwapper()
+{
+    while (!m_swappedStates.empty()) {
+        release(m_swappedStates.begin());
+    }
+
+    if (m_file) {
+        releaseFile(m_file);
+    }
+}
+
+S2EStateSwapper::SwapFile *S2EStateSwapper::getFile()
+{
+    if (m_file) {
+        return m_file;
+    }
+
+    std::string path = m_directory + "/s2e-swap-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back(0);
+
+    int fd = mkstemp(&name[0]);
+    if (fd < 0) {
+        g_s2e->getWarningsStream() << "Could not create swap file " << path
+                                   << ": " << strerror(errno) << '\n';
+        return NULL;
+    }
+
+    //The space is reclaimed when the last process using the file exits
+    unlink(&name[0]);
+
+    m_file = new SwapFile();
+    m_file->fd = fd;
+    m_file->refCount = 1;
+    m_file->size = 0;
+    m_file->sealed = false;
+    return m_file;
+}
+
+void S2EStateSwapper::releaseFile(SwapFile *file)
+{
+    if (--file->refCount == 0) {
+        close(file->fd);
+        delete file;
+    }
+}
+
+uint64_t S2EStateSwapper::allocate(SwapFile *file, uint64_t size)
+{
+    assert(!file->sealed);
+
+    std::map<uint64_t, uint64_t>::iterator it;
+    for (it = file->freeExtents.begin(); it != file->freeExtents.end(); ++it) {
+        if (it->second >= size) {
+            uint64_t offset = it->first;
+            uint64_t rest = it->second - size;
+            file->freeExtents.erase(it);
+            if (rest) {
+                file->freeExtents[offset + size] = rest;
+            }
+            return offset;
+        }
+    }
+
+    uint64_t offset = file->size;
+    file->size += size;
+    return offset;
+}
+
+void S2EStateSwapper::deallocate(SwapFile *file, uint64_t offset, uint64_t size)
+{
+    if (file->sealed) {
+        return;
+    }
+
+    //Merge the extent with its free neighbors
+    std::map<uint64_t, uint64_t> &extents = file->freeExtents;
+    std::map<uint64_t, uint64_t>::iterator next = extents.lower_bound(offset);
+    if (next != extents.begin()) {
+        std::map<uint64_t, uint64_t>::iterator prev = next;
+        --prev;
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            extents.erase(prev);
+        }
+    }
+
+    if (next != extents.end() && offset + size == next->first) {
+        size += next->second;
+        extents.erase(next);
+    }
+
+    if (offset + size == file->size) {
+        //Give the end of the file back to the file system
+        file->size = offset;
+        if (ftruncate(file->fd, offset) < 0) {
+            g_s2e->getWarningsStream() << "Could not truncate swap file: "
+                                       << strerror(errno) << '\n';
+        }
+    } else {
+        extents[offset] = size;
+    }
+}
+
+void S2EStateSwapper::release(SwappedStates::iterator it)
+{
+    SwappedState &swapped = it->second;
+    deallocate(swapped.file, swapped.offset, swapped.size);
+    releaseFile(swapped.file);
+    m_swappedStates.erase(it);
+}
+
+uint64_t S2EStateSwapper::swapOut(S2EExecutionState *state)
+{
+    assert(!state->isActive());
+
+    if (isSwappedOut(state)) {
+        return 0;
+    }
+
+    TimerStatIncrementer timer(stats::stateSwapOutTime);
+
+    ResolutionList objects, swappable;
+    state->addressSpace.getPrivateConcreteObjects(objects);
+
+    SwappedState swapped;
+    swapped.size = 0;
+
+    foreach2(it, objects.begin(), objects.end()) {
+        const MemoryObject *mo = it->first;
+
+        //The state caches pointers to the CPU state objects,
+        //and its TLB entries point to the objects they map
+        if (mo == S2EExecutionState::m_cpuRegistersState ||
+            mo == S2EExecutionState::m_cpuSystemState ||
+            mo == S2EExecutionState::m_dirtyMask ||
+            state->m_tlbMap.count(const_cast<ObjectState*>(it->second))) {
+            continue;
+        }
+
+        swappable.push_back(*it);
+        swapped.size += mo->size;
+    }
+
+    if (swappable.empty()) {
+        return 0;
+    }
+
+    SwapFile *file = getFile();
+    if (!file) {
+        return 0;
+    }
+
+    swapped.file = file;
+    swapped.offset = allocate(file, swapped.size);
+
+    std::vector<uint8_t> buffer;
+    uint64_t offset = swapped.offset;
+
+    for (unsigned i = 0; i < swappable.size(); ++i) {
+        const ObjectState *os = swappable[i].second;
+        const uint8_t *store = os->getConcreteStore();
+        buffer.insert(buffer.end(), store, store + os->size);
+
+        if (buffer.size() < SwapBufferSize && i + 1 < swappable.size()) {
+            continue;
+        }
+
+        if (!writeAt(file->fd, &buffer[0], buffer.size(), offset)) {
+            g_s2e->getWarningsStream(state) << "Could not write to swap file: "
+                                            << strerror(errno) << '\n';
+            deallocate(file, swapped.offset, swapped.size);
+            return 0;
+        }
+
+        offset += buffer.size();
+        buffer.clear();
+    }
+
+    ++file->refCount;
+    swapped.objects.resize(swappable.size());
+
+    for (unsigned i = 0; i < swappable.size(); ++i) {
+        swapped.objects[i].mo = swappable[i].first;
+        swapped.objects[i].readOnly = swappable[i].second->readOnly;
+        state->addressSpace.unbindObject(swappable[i].first);
+    }
+
+    m_swappedStates[state] = swapped;
+
+    ++stats::stateSwapOuts;
+    stats::stateSwapOutBytes += swapped.size;
+
+    return swapped.size;
+}
+
+bool S2EStateSwapper::swapIn(S2EExecutionState *state)
+{
+    SwappedStates::iterator it = m_swappedStates.find(state);
+    if (it == m_swappedStates.end()) {
+        return true;
+    }
+
+    TimerStatIncrementer timer(stats::stateSwapInTime);
+
+    const SwappedState &swapped = it->second;
+    uint64_t next = swapped.offset, end = swapped.offset + swapped.size;
+
+    std::vector<uint8_t> buffer;
+    size_t position = 0;
+    bool success = true;
+
+    foreach2(oit, swapped.objects.begin(), swapped.objects.end()) {
+        const MemoryObject *mo = oit->mo;
+
+        if (buffer.size() - position < mo->size) {
+            buffer.erase(buffer.begin(), buffer.begin() + position);
+            position = 0;
+
+            size_t count = std::min(std::max(SwapBufferSize,
+                                             (uint64_t) mo->size),
+                                    end - next);
+            size_t filled = buffer.size();
+            buffer.resize(filled + count);
+
+            if (!readAt(swapped.file->fd, &buffer[filled], count, next)) {
+                g_s2e->getWarningsStream(state) << "Could not read from swap file: "
+                                                << strerror(errno) << '\n';
+                success = false;
+                break;
+            }
+            next += count;
+        }
+
+        ObjectState *os = new (mo->size) ObjectState(mo);
+        memcpy(os->getConcreteStore(), &buffer[position], mo->size);
+        position += mo->size;
+
+        os->setReadOnly(oit->readOnly);
+        state->addressSpace.bindObject(mo, os);
+    }
+
+    if (success) {
+        ++stats::stateSwapIns;
+        stats::stateSwapInBytes += swapped.size;
+    }
+
+    release(it);
+    return success;
+}
+
+void S2EStateSwapper::forget(const S2EExecutionState *state)
+{
+    m_lastUses.erase(state);
+
+    SwappedStates::iterator it = m_swappedStates.find(state);
+    if (it != m_swappedStates.end()) {
+        release(it);
+    }
+}
+
+void S2EStateSwapper::seal()
+{
+    foreach2(it, m_swappedStates.begin(), m_swappedStates.end()) {
+        it->second.file->sealed = true;
+        it->second.file->freeExtents.clear();
+    }
+
+    if (m_file) {
+        m_file->sealed = true;
+        m_file->freeExtents.clear();
+        releaseFile(m_file);
+        m_file = NULL;
+    }
+}
+
+uint64_t S2EStateSwapper::evict(const std::set<klee::ExecutionState*> &states,
+                                const S2EExecutionState *current, uint64_t bytes)
+{
+    std::vector<std::pair<uint64_t, S2EExecutionState*> > candidates;
+
+    foreach2(it, states.begin(), states.end()) {
+        S2EExecutionState *state = static_cast<S2EExecutionState*>(*it);
+        if (state == current || state->isActive() || state->isZombie() ||
+            isSwappedOut(state)) {
+            continue;
+        }
+
+        LastUses::const_iterator lit = m_lastUses.find(state);
+        uint64_t lastUse = lit != m_lastUses.end() ? lit->second : 0;
+        candidates.push_back(std::make_pair(lastUse, state));
+    }
+
+    //The states the searcher did not pick for the longest time go first
+    std::sort(candidates.begin(), candidates.end());
+
+    uint64_t swappedOut = 0;
+    for (unsigned i = 0; i < candidates.size() && swappedOut < bytes; ++i) {
+        swappedOut += swapOut(candidates[i].second);
+    }
+
+    return swappedOut;
+}
+
+}
@@ -0,0 +1,173 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_STATESWAPPER_H
+#define S2E_STATESWAPPER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace klee {
+    class ExecutionState;
+    class MemoryObject;
+}
+
+namespace s2e {
+
+class S2EExecutionState;
+
+/**
+ * Swaps the memory of inactive states out to a local file when
+ * S2E runs out of memory, and back in when they are scheduled.
+ *
+ * Only the objects that a state does not share with other states
+ * are swapped out, i.e., the memory it wrote since it was forked.
+ * These objects hold concrete bytes only and are recreated with
+ * the same contents on swap-in. Constraints are shared between
+ * forked states, plugin states have no serialized form and device
+ * snapshots are shared by chunks, so these stay in memory.
+ */
+class S2EStateSwapper
+{
+private:
+    /**
+     * A swap file, unlinked as soon as it is created. After a
+     * process fork, the parent and the child both read the extents
+     * of the states they inherited. The files opened before the fork
+     * are therefore sealed: their freed extents are never reused and
+     * they are closed once no swapped state uses them anymore.
+     */
+    struct SwapFile {
+        int fd;
+        /** Number of swapped states stored in the file */
+        unsigned refCount;
+        uint64_t size;
+        bool sealed;
+        /** Free extents, by offset */
+        std::map<uint64_t, uint64_t> freeExtents;
+    };
+
+    struct SwappedObject {
+        const klee::MemoryObject *mo;
+        bool readOnly;
+    };
+
+    /** The swapped objects of a state, stored contiguously */
+    struct SwappedState {
+        SwapFile *file;
+        uint64_t offset;
+        uint64_t size;
+        std::vector<SwappedObject> objects;
+    };
+
+    typedef std::map<const S2EExecutionState*, SwappedState> SwappedStates;
+    typedef std::map<const S2EExecutionState*, uint64_t> LastUses;
+
+    std::string m_directory;
+
+    /** The file new states are swapped to, opened lazily */
+    SwapFile *m_file;
+
+    SwappedStates m_swappedStates;
+
+    /** Clock of the last scheduling or fork of each state */
+    LastUses m_lastUses;
+    uint64_t m_clock;
+
+    SwapFile *getFile();
+    void releaseFile(SwapFile *file);
+
+    uint64_t allocate(SwapFile *file, uint64_t size);
+    void deallocate(SwapFile *file, uint64_t offset, uint64_t size);
+
+    void release(SwappedStates::iterator it);
+
+public:
+    /** Swap files are created in the given directory */
+    S2EStateSwapper(const std::string &directory);
+    ~S2EStateSwapper();
+
+    bool isSwappedOut(const S2EExecutionState *state) const {
+        return m_swappedStates.count(state);
+    }
+
+    /** Record that the state was just created or scheduled */
+    void touch(const S2EExecutionState *state) {
+        m_lastUses[state] = ++m_clock;
+    }
+
+    /**
+     * Write the private memory of an inactive state to the swap
+     * file and free it. Returns the number of bytes swapped out.
+     */
+    uint64_t swapOut(S2EExecutionState *state);
+
+    /**
+     * Restore the memory of a swapped-out state. Returns false if
+     * the swap file could not be read, in which case the state
+     * lost the swapped objects.
+     */
+    bool swapIn(S2EExecutionState *state);
+
+    /** Forget a terminated state, dropping its swapped memory */
+    void forget(const S2EExecutionState *state);
+
+    /**
+     * Seal the current swap files. Must be called by both processes
+     * after a process fork.
+     */
+    void seal();
+
+    /**
+     * Swap out the least recently scheduled states other than the
+     * current one until at least the given number of bytes are
+     * swapped out. Returns the number of bytes swapped out.
+     */
+    uint64_t evict(const std::set<klee::ExecutionState*> &states,
+                   const S2EExecutionState *current, uint64_t bytes);
+
+    uint64_t getSwappedStatesCount() const {
+        return m_swappedStates.size();
+    }
+};
+
+}
+
+#endif
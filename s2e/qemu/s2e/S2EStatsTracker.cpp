@@ -40,7 +40,9 @@
 #include <s2e/S2EExecutionState.h>
 
 #include <klee/CoreStats.h>
+#include <klee/Memory.h>
 #include <klee/SolverStats.h>
+#include <klee/util/ExprAllocator.h>
 #include <klee/Internal/System/Time.h>
 
 #include <llvm/Support/Process.h>
@@ -74,6 +76,25 @@ namespace stats {
 
     Statistic concreteModeTime("ConcreteModeTime", "ConcModeTime");
     Statistic symbolicModeTime("SymbolicModeTime", "SymbModeTime");
+
+    Statistic stateSwitches("StateSwitches", "Switches");
+    Statistic stateSwitchBytesCopied("StateSwitchBytesCopied", "SwitchBytes");
+
+    Statistic translationCacheHits("TranslationCacheHits", "TCacheHits");
+    Statistic translationCacheMisses("TranslationCacheMisses", "TCacheMisses");
+
+    Statistic backgroundTranslations("BackgroundTranslations", "BgTrans");
+    Statistic backgroundTranslationHits("BackgroundTranslationHits", "BgTransHits");
+    Statistic backgroundTranslationMisses("BackgroundTranslationMisses", "BgTransMisses");
+
+    Statistic concreteFastPathInstructions("ConcreteFastPathInstructions", "FastPathI");
+
+    Statistic stateSwapOuts("StateSwapOuts", "SwapOuts");
+    Statistic stateSwapOutBytes("StateSwapOutBytes", "SwapOutBytes");
+    Statistic stateSwapOutTime("StateSwapOutTime", "SwapOutTime");
+    Statistic stateSwapIns("StateSwapIns", "SwapIns");
+    Statistic stateSwapInBytes("StateSwapInBytes", "SwapInBytes");
+    Statistic stateSwapInTime("StateSwapInTime", "SwapInTime");
 } // namespace stats
 } // namespace klee
 
@@ -165,16 +186,62 @@ void S2EStatsTracker::writeStatsHeader() {
              << "'ForkTime',"
              << "'ResolveTime',"
              << "'MemoryUsage',"
+             << "'StateSwitches',"
+             << "'StateSwitchBytesCopied',"
+             << "'SharedQueryCacheHits',"
+             << "'SharedQueryCacheMisses',"
+             << "'SharedQueryCacheEvictions',"
+             << "'SharedCexCacheHits',"
+             << "'SharedCexCacheMisses',"
+             << "'PortfolioQueries',"
+             << "'PortfolioFailures',"
+             << "'PortfolioWinsSTP',"
+             << "'PortfolioWinsSTPSimple',"
+             << "'PortfolioWinsFastCex',"
+             << "'PortfolioWinsSMTLIB',"
+             << "'ExprLiveObjects',"
+             << "'ExprLiveBytes',"
+             << "'ExprLiveBytesPerState',"
+             << "'ExprSlabBytes',"
+             << "'AddressSpaceLookups',"
+             << "'AddressSpaceLookupTime',"
+             << "'ObjectStates',"
+             << "'ObjectStateBytes',"
+             << "'SymbolicObjectStates',"
+             << "'SymbolicObjectStateBytes',"
+             << "'TranslationCacheHits',"
+             << "'TranslationCacheMisses',"
+             << "'BackgroundTranslations',"
+             << "'BackgroundTranslationHits',"
+             << "'BackgroundTranslationMisses',"
+             << "'BackgroundTranslationQueue',"
+             << "'ConcreteFastPathInstructions',"
+             << "'SpeculativeStatesResolved',"
+             << "'SpeculativeStatesInfeasible',"
+             << "'SpeculativeStateWaits',"
+             << "'SwappedStates',"
+             << "'StateSwapOuts',"
+             << "'StateSwapOutBytes',"
+             << "'StateSwapOutTime',"
+             << "'StateSwapIns',"
+             << "'StateSwapInBytes',"
+             << "'StateSwapInTime',"
              << ")\n";
   statsFile->flush();
 }
 
 void S2EStatsTracker::writeStatsLine() {
+  ExprAllocator::Stats exprStats;
+  ExprAllocator::getStats(exprStats);
+  size_t statesCount = executor.getStatesCount();
+  const S2EExecutor &s2eExecutor = static_cast<const S2EExecutor&>(executor);
+  const ObjectState::Stats &osStats = ObjectState::getStats();
+
   *statsFile //<< "(" << stats::instructions
              //<< "," << fullBranches
              //<< "," << partialBranches
              //<< "," << numBranches
-             << "(" << executor.getStatesCount()
+             << "(" << statesCount
              << "," << stats::queries
              << "," << stats::queryConstructs
              << "," << 0 // was numObjects
@@ -196,6 +263,46 @@ void S2EStatsTracker::writeStatsLine() {
              << "," << stats::forkTime / 1000000.
              << "," << stats::resolveTime / 1000000.
              << "," << getProcessMemoryUsage() //sys::Process::GetTotalMemoryUsage()
+             << "," << stats::stateSwitches
+             << "," << stats::stateSwitchBytesCopied
+             << "," << stats::sharedQueryCacheHits
+             << "," << stats::sharedQueryCacheMisses
+             << "," << stats::sharedQueryCacheEvictions
+             << "," << stats::sharedCexCacheHits
+             << "," << stats::sharedCexCacheMisses
+             << "," << stats::portfolioQueries
+             << "," << stats::portfolioFailures
+             << "," << stats::portfolioWinsSTP
+             << "," << stats::portfolioWinsSTPSimple
+             << "," << stats::portfolioWinsFastCex
+             << "," << stats::portfolioWinsSMTLIB
+             << "," << exprStats.liveObjects
+             << "," << exprStats.liveBytes
+             << "," << (statesCount ? exprStats.liveBytes / statesCount : 0)
+             << "," << exprStats.slabBytes
+             << "," << stats::addressSpaceLookups
+             << "," << stats::addressSpaceLookupTime / 1000000000.
+             << "," << osStats.objects
+             << "," << osStats.bytes
+             << "," << osStats.symbolicObjects
+             << "," << osStats.symbolicBytes
+             << "," << stats::translationCacheHits
+             << "," << stats::translationCacheMisses
+             << "," << stats::backgroundTranslations
+             << "," << stats::backgroundTranslationHits
+             << "," << stats::backgroundTranslationMisses
+             << "," << s2eExecutor.getBackgroundTranslationQueueSize()
+             << "," << stats::concreteFastPathInstructions
+             << "," << stats::speculativeStatesResolved
+             << "," << stats::speculativeStatesInfeasible
+             << "," << stats::speculativeStateWaits
+             << "," << s2eExecutor.getSwappedStatesCount()
+             << "," << stats::stateSwapOuts
+             << "," << stats::stateSwapOutBytes
+             << "," << stats::stateSwapOutTime / 1000000.
+             << "," << stats::stateSwapIns
+             << "," << stats::stateSwapInBytes
+             << "," << stats::stateSwapInTime / 1000000.
              << ")\n";
   statsFile->flush();
 }
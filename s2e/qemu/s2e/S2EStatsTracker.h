@@ -52,6 +52,25 @@ namespace stats {
 
     extern klee::Statistic concreteModeTime;
     extern klee::Statistic symbolicModeTime;
+
+    extern klee::Statistic stateSwitches;
+    extern klee::Statistic stateSwitchBytesCopied;
+
+    extern klee::Statistic translationCacheHits;
+    extern klee::Statistic translationCacheMisses;
+
+    extern klee::Statistic backgroundTranslations;
+    extern klee::Statistic backgroundTranslationHits;
+    extern klee::Statistic backgroundTranslationMisses;
+
+    extern klee::Statistic concreteFastPathInstructions;
+
+    extern klee::Statistic stateSwapOuts;
+    extern klee::Statistic stateSwapOutBytes;
+    extern klee::Statistic stateSwapOutTime;
+    extern klee::Statistic stateSwapIns;
+    extern klee::Statistic stateSwapInBytes;
+    extern klee::Statistic stateSwapInTime;
 } // namespace stats
 } // namespace klee
 
@@ -205,6 +205,12 @@ void s2e_register_ram(struct S2E* s2e,
 
 uintptr_t s2e_get_host_address(uint64_t paddr);
 
+/** Dirty mask flag set by QEMU on the first write to a RAM page
+    after s2e_reset_switch_dirty() was called for that page */
+#define S2E_SWITCH_DIRTY_FLAG 0x10
+
+void s2e_reset_switch_dirty(uint64_t ram_addr, uint64_t size);
+
 int s2e_is_ram_registered(struct S2E* s2e,
                           struct S2EExecutionState *state,
                           uint64_t host_address);
@@ -343,6 +349,17 @@ int init_timer_alarm(int register_exit_handler);
 int s2e_is_load_balancing();
 int s2e_is_forking();
 
+/***************************/
+/* Functions from exec.c */
+
+/** Nonzero while S2E follows or edits the TB chains. cpu_unlink_tb() then
+    only sets s2e_tb_unlink_pending, and S2E unlinks the TBs by calling
+    s2e_tb_run_pending_unlink() when it is done. */
+extern volatile int s2e_tb_chain_busy;
+extern volatile int s2e_tb_unlink_pending;
+
+void s2e_tb_run_pending_unlink(struct CPUX86State *env);
+
 /******************************************************/
 /* Prototypes for special functions used in LLVM code */
 /* NOTE: this functions should never be defined. They */
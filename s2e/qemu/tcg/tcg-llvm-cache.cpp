@@ -0,0 +1,424 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#include "tcg-llvm-cache.h"
+
+#include <llvm/Constants.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Instructions.h>
+#include <llvm/LLVMContext.h>
+#include <llvm/Module.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/InstIterator.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/system_error.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#include <stdio.h>
+#include <unistd.h>
+
+using namespace llvm;
+
+/* Finalizer of MurmurHash3 */
+static inline uint64_t mix(uint64_t v)
+{
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    v *= 0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33;
+    return v;
+}
+
+static inline uint64_t rotl(uint64_t v, unsigned bits)
+{
+    return (v << bits) | (v >> (64 - bits));
+}
+
+TCGLLVMTranslationCache::KeyBuilder::KeyBuilder(uint64_t seed)
+    : m_h1(mix(seed)), m_h2(mix(~seed))
+{
+}
+
+void TCGLLVMTranslationCache::KeyBuilder::add(uint64_t value)
+{
+    m_h1 = rotl(m_h1 ^ mix(value), 31) * 0x9e3779b97f4a7c15ULL;
+    m_h2 = rotl(m_h2 + mix(value ^ 0x5bd1e9955bd1e995ULL), 27)
+            * 0x87c37b91114253d5ULL;
+}
+
+void TCGLLVMTranslationCache::KeyBuilder::get(uint64_t key[2]) const
+{
+    key[0] = mix(m_h1 ^ m_h2);
+    key[1] = mix(m_h2 + key[0]);
+}
+
+TCGLLVMTranslationCache::TCGLLVMTranslationCache(const std::string &directory)
+    : m_directory(directory)
+{
+    bool existed;
+    if (sys::fs::create_directories(directory, existed)) {
+        std::cerr << "Could not create translation cache directory "
+                  << directory << std::endl;
+    }
+}
+
+bool TCGLLVMTranslationCache::computeBuildId(
+        const std::vector<std::string> &files, uint64_t id[2])
+{
+    KeyBuilder builder(files.size());
+    for (unsigned i = 0; i < files.size(); ++i) {
+        OwningPtr<MemoryBuffer> buffer;
+        if (MemoryBuffer::getFile(files[i], buffer)) {
+            std::cerr << "Could not read " << files[i] << std::endl;
+            return false;
+        }
+
+        const unsigned char *data =
+                (const unsigned char*) buffer->getBufferStart();
+        size_t size = buffer->getBufferSize();
+        builder.add(size);
+
+        uint64_t word = 0;
+        for (size_t j = 0; j < size; ++j) {
+            word = (word << 8) | data[j];
+            if ((j & 7) == 7) {
+                builder.add(word);
+                word = 0;
+            }
+        }
+        builder.add(word);
+    }
+
+    builder.get(id);
+    return true;
+}
+
+std::string TCGLLVMTranslationCache::getPath(const Entry &entry) const
+{
+    std::ostringstream path;
+    path << m_directory << '/' << std::hex << std::setfill('0')
+         << std::setw(16) << entry.key[0]
+         << std::setw(16) << entry.key[1] << ".bc";
+    return path.str();
+}
+
+Module* TCGLLVMTranslationCache::load(LLVMContext &context,
+                                      const Entry &entry,
+                                      std::vector<uint64_t> &relocations)
+{
+    std::string path = getPath(entry);
+    OwningPtr<MemoryBuffer> buffer;
+    if (MemoryBuffer::getFile(path, buffer)) {
+        return NULL;
+    }
+
+    std::string error;
+    Module *module = parse(buffer.get(), context, entry.relocations.size(),
+                           relocations, error);
+    if (!module) {
+        std::cerr << "Ignoring invalid translation cache entry " << path
+                  << ": " << error << std::endl;
+    }
+
+    return module;
+}
+
+Module* TCGLLVMTranslationCache::parse(MemoryBuffer *buffer,
+                                       LLVMContext &context,
+                                       unsigned relocationCount,
+                                       std::vector<uint64_t> &relocations,
+                                       std::string &error)
+{
+    Module *module = ParseBitcodeFile(buffer, context, &error);
+    if (!module) {
+        return NULL;
+    }
+
+    Function *function = module->getFunction("tb");
+    GlobalVariable *table = module->getNamedGlobal("relocations");
+    ArrayType *tableType = table ?
+            dyn_cast<ArrayType>(table->getType()->getElementType()) : NULL;
+
+    if (!function || function->isDeclaration() ||
+            !tableType || !table->hasInitializer() ||
+            tableType->getNumElements() != relocationCount) {
+        error = "unexpected content";
+        delete module;
+        return NULL;
+    }
+
+    Constant *values = table->getInitializer();
+    relocations.clear();
+    for (unsigned i = 0; i < tableType->getNumElements(); ++i) {
+        ConstantInt *value = NULL;
+        if (!isa<ConstantAggregateZero>(values)) {
+            value = dyn_cast<ConstantInt>(values->getOperand(i));
+        }
+        relocations.push_back(value ? value->getZExtValue() : 0);
+    }
+
+    table->eraseFromParent();
+    return module;
+}
+
+static void collectGlobals(Value *value, std::set<GlobalValue*> &globals,
+                           std::set<Constant*> &visited)
+{
+    if (GlobalValue *global = dyn_cast<GlobalValue>(value)) {
+        globals.insert(global);
+        return;
+    }
+
+    Constant *constant = dyn_cast<Constant>(value);
+    if (!constant || !visited.insert(constant).second) {
+        return;
+    }
+
+    for (unsigned i = 0; i < constant->getNumOperands(); ++i) {
+        collectGlobals(constant->getOperand(i), globals, visited);
+    }
+}
+
+/* Returns the constant with its immediates relocated, or NULL if one
+   of them is nested in a constant that cannot be rebuilt */
+Constant* TCGLLVMTranslationCache::relocate(Constant *constant,
+        const std::map<uint64_t, uint64_t> &map, std::set<uint64_t> &found)
+{
+    if (ConstantInt *value = dyn_cast<ConstantInt>(constant)) {
+        if (value->getBitWidth() > 64) {
+            return constant;
+        }
+
+        std::map<uint64_t, uint64_t>::const_iterator it =
+                map.find(value->getZExtValue());
+        if (it == map.end()) {
+            return constant;
+        }
+
+        found.insert(it->first);
+        return ConstantInt::get(value->getType(), it->second);
+    }
+
+    if (isa<GlobalValue>(constant) || constant->getNumOperands() == 0) {
+        return constant;
+    }
+
+    /* Pointers are usually wrapped in casts and address computations */
+    bool changed = false;
+    std::vector<Constant*> operands;
+    for (unsigned i = 0; i < constant->getNumOperands(); ++i) {
+        Constant *operand = dyn_cast<Constant>(constant->getOperand(i));
+        if (!operand) {
+            /* Block addresses */
+            return constant;
+        }
+
+        Constant *relocated = relocate(operand, map, found);
+        if (!relocated) {
+            return NULL;
+        }
+        changed |= relocated != operand;
+        operands.push_back(relocated);
+    }
+
+    if (!changed) {
+        return constant;
+    }
+
+    ConstantExpr *expr = dyn_cast<ConstantExpr>(constant);
+    return expr ? expr->getWithOperands(operands) : NULL;
+}
+
+bool TCGLLVMTranslationCache::relocate(Function *function,
+                                       const std::vector<uint64_t> &from,
+                                       const std::vector<uint64_t> &to)
+{
+    /* Identical immediates are kept in the map, to check that every
+       immediate of the run that generated the function can be found */
+    std::map<uint64_t, uint64_t> map;
+    for (unsigned i = 0; i < from.size(); ++i) {
+        std::pair<std::map<uint64_t, uint64_t>::iterator, bool> it =
+                map.insert(std::make_pair(from[i], to[i]));
+        if (it.first->second != to[i]) {
+            return false;
+        }
+    }
+
+    std::set<uint64_t> found;
+    for (inst_iterator it = inst_begin(function), ie = inst_end(function);
+         it != ie; ++it) {
+        for (unsigned i = 0; i < it->getNumOperands(); ++i) {
+            Constant *operand = dyn_cast<Constant>(it->getOperand(i));
+            if (!operand) {
+                continue;
+            }
+
+            Constant *relocated = relocate(operand, map, found);
+            if (!relocated) {
+                return false;
+            }
+            if (relocated != operand) {
+                it->setOperand(i, relocated);
+            }
+        }
+    }
+
+    return found.size() == map.size();
+}
+
+Module* TCGLLVMTranslationCache::extract(Function *function,
+        const std::vector<uint64_t> &relocations)
+{
+    /* Relocating to the same immediates leaves the function unchanged */
+    if (!relocate(function, relocations, relocations)) {
+        return NULL;
+    }
+
+    std::set<GlobalValue*> globals;
+    std::set<Constant*> visited;
+    for (inst_iterator it = inst_begin(function), ie = inst_end(function);
+         it != ie; ++it) {
+        for (unsigned i = 0; i < it->getNumOperands(); ++i) {
+            collectGlobals(it->getOperand(i), globals, visited);
+        }
+    }
+
+    LLVMContext &context = function->getContext();
+    OwningPtr<Module> module(new Module("tcg-llvm-cache", context));
+    module->setDataLayout(function->getParent()->getDataLayout());
+    module->setTargetTriple(function->getParent()->getTargetTriple());
+
+    /* Referenced globals become declarations, which are resolved by name
+       when loading the entry */
+    ValueToValueMapTy vmap;
+    for (std::set<GlobalValue*>::iterator it = globals.begin();
+         it != globals.end(); ++it) {
+        if (!(*it)->hasName()) {
+            return NULL;
+        }
+
+        if (Function *f = dyn_cast<Function>(*it)) {
+            Function *decl = Function::Create(f->getFunctionType(),
+                    GlobalValue::ExternalLinkage, f->getName(), module.get());
+            decl->setAttributes(f->getAttributes());
+            vmap[f] = decl;
+        } else if (GlobalVariable *v = dyn_cast<GlobalVariable>(*it)) {
+            vmap[v] = new GlobalVariable(*module,
+                    v->getType()->getElementType(), v->isConstant(),
+                    GlobalValue::ExternalLinkage, NULL, v->getName(), NULL,
+                    v->isThreadLocal(), v->getType()->getAddressSpace());
+        } else {
+            return NULL;
+        }
+    }
+
+    Function *tb = Function::Create(function->getFunctionType(),
+            GlobalValue::ExternalLinkage, "tb", module.get());
+
+    Function::arg_iterator dst = tb->arg_begin();
+    for (Function::arg_iterator src = function->arg_begin();
+         src != function->arg_end(); ++src, ++dst) {
+        vmap[src] = dst;
+    }
+
+    SmallVector<ReturnInst*, 4> returns;
+    CloneFunctionInto(tb, function, vmap, true, returns);
+
+    Type *int64Type = Type::getInt64Ty(context);
+    std::vector<Constant*> values;
+    for (unsigned i = 0; i < relocations.size(); ++i) {
+        values.push_back(ConstantInt::get(int64Type, relocations[i]));
+    }
+
+    ArrayType *tableType = ArrayType::get(int64Type, values.size());
+    new GlobalVariable(*module, tableType, true, GlobalValue::ExternalLinkage,
+                       ConstantArray::get(tableType, values), "relocations");
+
+    return module.take();
+}
+
+bool TCGLLVMTranslationCache::store(Function *function, const Entry &entry)
+{
+    OwningPtr<Module> module(extract(function, entry.relocations));
+    if (!module) {
+        return true;
+    }
+
+    /* Write to a private file first, other processes may be reading
+       or writing the same entry */
+    std::string path = getPath(entry);
+    std::stringstream tmpPath;
+    tmpPath << path << ".tmp" << getpid();
+
+    std::string error;
+    raw_fd_ostream out(tmpPath.str().c_str(), error, raw_fd_ostream::F_Binary);
+    if (!error.empty()) {
+        std::cerr << "Could not write translation cache entry "
+                  << tmpPath.str() << ": " << error << std::endl;
+        return false;
+    }
+
+    WriteBitcodeToFile(module.get(), out);
+    out.close();
+
+    if (out.has_error()) {
+        out.clear_error();
+        std::cerr << "Could not write translation cache entry "
+                  << tmpPath.str() << std::endl;
+        unlink(tmpPath.str().c_str());
+        return false;
+    }
+
+    if (rename(tmpPath.str().c_str(), path.c_str())) {
+        std::cerr << "Could not write translation cache entry "
+                  << path << std::endl;
+        unlink(tmpPath.str().c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,139 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef TCG_LLVM_CACHE_H
+#define TCG_LLVM_CACHE_H
+
+#include <inttypes.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class Constant;
+    class Function;
+    class LLVMContext;
+    class MemoryBuffer;
+    class Module;
+}
+
+/**
+ * On-disk cache of the optimized LLVM code of translation blocks.
+ *
+ * Each entry is a bitcode file holding one function, named after the key
+ * of the TB, so that runs sharing the directory reuse each other's code
+ * and files are only read when a TB with the same key is translated.
+ * Entries are written to a temporary file and renamed, which lets several
+ * S2E processes share the directory.
+ */
+class TCGLLVMTranslationCache
+{
+public:
+    struct Entry {
+        uint64_t key[2];
+
+        /* Run-specific immediates of the TB (instrumentation data,
+           TB pointers), in the order of the TCG operations */
+        std::vector<uint64_t> relocations;
+    };
+
+    /* Computes the 128-bit key of an entry from a sequence of words */
+    class KeyBuilder {
+        uint64_t m_h1, m_h2;
+    public:
+        KeyBuilder(uint64_t seed = 0);
+        void add(uint64_t value);
+        void get(uint64_t key[2]) const;
+    };
+
+private:
+    std::string m_directory;
+
+    std::string getPath(const Entry &entry) const;
+
+    static llvm::Constant* relocate(llvm::Constant *constant,
+                                    const std::map<uint64_t, uint64_t> &map,
+                                    std::set<uint64_t> &found);
+
+public:
+    TCGLLVMTranslationCache(const std::string &directory);
+
+    /** Reads the entry from the disk. Returns a module with the cached
+        function, named "tb", or NULL if there is no valid entry.
+        On success, relocations holds the immediates of the run
+        that stored the entry, in the order of entry.relocations. */
+    llvm::Module* load(llvm::LLVMContext &context, const Entry &entry,
+                       std::vector<uint64_t> &relocations);
+
+    /** Writes the function to the disk. Returns false on I/O errors.
+        Functions that reference values that cannot be resolved by name
+        are silently skipped. */
+    bool store(llvm::Function *function, const Entry &entry);
+
+    /** Hashes the contents of the files into a build id, which keys
+        the entries together with the TB. Entries embed host addresses
+        and the code of the helpers, and are only valid for the binary
+        and helper bitcode that generated them. Returns false if one of
+        the files cannot be read. */
+    static bool computeBuildId(const std::vector<std::string> &files,
+                               uint64_t id[2]);
+
+    /** Replaces the run-specific immediates from[i] of the function by
+        to[i], including those wrapped in constant expressions. Returns
+        false if one of the immediates does not appear in the function,
+        e.g. because the optimizer folded it into another value: such a
+        function cannot be relocated. */
+    static bool relocate(llvm::Function *function,
+                         const std::vector<uint64_t> &from,
+                         const std::vector<uint64_t> &to);
+
+    /** Copies the function, as "tb", to a new module along with its
+        relocations and declarations of the values it references.
+        Returns NULL if these values cannot be resolved by name, or if
+        the function cannot be relocated. */
+    static llvm::Module* extract(llvm::Function *function,
+                                 const std::vector<uint64_t> &relocations);
+
+    /** Parses the bitcode of a module created by extract() */
+    static llvm::Module* parse(llvm::MemoryBuffer *buffer,
+                               llvm::LLVMContext &context,
+                               unsigned relocationCount,
+                               std::vector<uint64_t> &relocations,
+                               std::string &error);
+};
+
+#endif
@@ -39,10 +39,12 @@ extern "C" {
 }
 
 #include "tcg-llvm.h"
+#include "tcg-llvm-cache.h"
 
 extern "C" {
 #include "config.h"
 #include "qemu-common.h"
+#include "qemu-thread.h"
 #include "disas.h"
 
 #if defined(CONFIG_SOFTMMU)
@@ -84,13 +86,26 @@ static void *qemu_st_helpers[5] = {
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Support/IRBuilder.h>
 #include <llvm/Support/Threading.h>
+#include <llvm/Support/InstIterator.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
 #include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Bitcode/ReaderWriter.h>
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
+#include <list>
+#include <map>
 #include <sstream>
 
+/* Bump when changing the generated code or its optimization,
+   to invalidate the translation caches */
+#define TCG_LLVM_CACHE_VERSION 1
+
 //#undef NDEBUG
 
 extern "C" {
@@ -112,6 +127,8 @@ extern "C" {
 using namespace llvm;
 
 class TJITMemoryManager;
+struct TCGLLVMBackgroundJob;
+class TCGLLVMBackgroundTranslator;
 
 struct TCGLLVMContextPrivate {
     LLVMContext& m_context;
@@ -139,11 +156,32 @@ struct TCGLLVMContextPrivate {
     /* Count of generated translation blocks */
     int m_tbCount;
 
+    /* On-disk cache of optimized translation blocks, NULL if disabled */
+    TCGLLVMTranslationCache *m_translationCache;
+
+    /* Hash of the binary and of the helper bitcode, part of the keys */
+    uint64_t m_cacheBuildId[2];
+
+    /* Translator of TBs likely to run symbolically, NULL if disabled */
+    TCGLLVMBackgroundTranslator *m_background;
+
+    /* Last generated function, until it is optimized and can be cached */
+    Function *m_lastFunction;
+    enum {
+        GeneratedFunction, CachedFunction, BackgroundFunction
+    } m_lastFunctionOrigin;
+    bool m_lastFunctionCacheable;
+    TCGLLVMTranslationCache::Entry m_lastCacheEntry;
+
     /* XXX: The following members are "local" to generateCode method */
 
     /* TCGContext for current translation block */
     TCGContext* m_tcgContext;
 
+    /* TCG operations of current translation block */
+    const uint16_t *m_opcBuf;
+    const TCGArg *m_opparamBuf;
+
     /* Function for current translation block */
     Function *m_tbFunction;
 
@@ -161,6 +199,7 @@ struct TCGLLVMContextPrivate {
 
 public:
     TCGLLVMContextPrivate();
+    TCGLLVMContextPrivate(LLVMContext &context, Module *module);
     ~TCGLLVMContextPrivate();
 
     void deleteExecutionEngine() {
@@ -174,6 +213,34 @@ public:
         return m_functionPassManager;
     }
 
+    void enableTranslationCache(const std::string &directory,
+                                const std::string &helperBitcode) {
+        delete m_translationCache;
+        m_translationCache = NULL;
+
+        std::vector<std::string> files;
+        files.push_back("/proc/self/exe");
+        files.push_back(helperBitcode);
+        if(!TCGLLVMTranslationCache::computeBuildId(files, m_cacheBuildId)) {
+            std::cerr << "Disabling the translation cache" << std::endl;
+            return;
+        }
+
+        m_translationCache = new TCGLLVMTranslationCache(directory);
+    }
+
+    bool isCachedFunction(Function *function) const {
+        return function == m_lastFunction &&
+               m_lastFunctionOrigin == CachedFunction;
+    }
+
+    bool isBackgroundFunction(Function *function) const {
+        return function == m_lastFunction &&
+               m_lastFunctionOrigin == BackgroundFunction;
+    }
+
+    bool cacheFunction(Function *function);
+
     /* Shortcuts */
     Type* intType(int w) { return IntegerType::get(m_context, w); }
     Type* intPtrType(int w) { return PointerType::get(intType(w), 0); }
@@ -248,13 +315,41 @@ public:
     void startNewBasicBlock(BasicBlock *bb = NULL);
 
     /* Code generation */
+    Function* getHelperFunction(const std::string &helperName,
+                                FunctionType *type, void *address);
+
     Value* generateQemuMemOp(bool ld, Value *value, Value *addr,
                              int mem_index, int bits);
 
     void generateTraceCall(uintptr_t pc);
     int generateOperation(int opc, const TCGArg *args);
 
+    void generateFunction(uint64_t pc, const std::string &name);
     void generateCode(TCGContext *s, TranslationBlock *tb);
+    void translateFunction(TranslationBlock *tb, TCGLLVMBackgroundJob *job);
+
+    /* Translation cache */
+    bool computeCacheEntry(TranslationBlock *tb,
+                           TCGLLVMTranslationCache::Entry &entry);
+    Function* resolveCachedDeclaration(Function *declaration);
+    Function* importFunction(Module *cached, const std::string &name);
+    Function* loadCachedFunction(const TCGLLVMTranslationCache::Entry &entry,
+                                 const std::string &name);
+
+#ifdef CONFIG_S2E
+    /* Background translation */
+    void enableBackgroundTranslation(
+            TCGLLVMFunctionOptimizer* (*createOptimizer)(Module*),
+            unsigned maxQueueSize);
+    void disableBackgroundTranslation();
+    unsigned getBackgroundQueueSize() const;
+    void discardBackgroundCode(TranslationBlock *tb);
+    bool canGenerateCodeInBackground(TranslationBlock *tb) const;
+    void generateCodeInBackground(TCGContext *s, TranslationBlock *tb);
+    bool generateCodeFromBackground(TCGContext *s, TranslationBlock *tb);
+    Function* loadBackgroundFunction(TCGLLVMBackgroundJob *job,
+                                     const std::string &name);
+#endif
 };
 
 /* Custom JITMemoryManager in order to capture the size of
@@ -334,7 +429,10 @@ public:
 
 TCGLLVMContextPrivate::TCGLLVMContextPrivate()
     : m_context(getGlobalContext()), m_builder(m_context), m_tbCount(0),
-      m_tcgContext(NULL), m_tbFunction(NULL)
+      m_translationCache(NULL), m_background(NULL), m_lastFunction(NULL),
+      m_lastFunctionOrigin(GeneratedFunction), m_lastFunctionCacheable(false),
+      m_tcgContext(NULL), m_opcBuf(NULL), m_opparamBuf(NULL),
+      m_tbFunction(NULL)
 {
     std::memset(m_values, 0, sizeof(m_values));
     std::memset(m_memValuesPtr, 0, sizeof(m_memValuesPtr));
@@ -372,8 +470,34 @@ TCGLLVMContextPrivate::TCGLLVMContextPrivate()
     m_functionPassManager->doInitialization();
 }
 
+/* Code generator without execution engine, for the background thread.
+   The module must already declare the functions used by initializeHelpers. */
+TCGLLVMContextPrivate::TCGLLVMContextPrivate(LLVMContext &context,
+                                             Module *module)
+    : m_context(context), m_builder(m_context), m_module(module),
+      m_jitMemoryManager(NULL), m_executionEngine(NULL),
+      m_functionPassManager(NULL), m_tbCount(0),
+      m_translationCache(NULL), m_background(NULL), m_lastFunction(NULL),
+      m_lastFunctionOrigin(GeneratedFunction), m_lastFunctionCacheable(false),
+      m_tcgContext(NULL), m_opcBuf(NULL), m_opparamBuf(NULL),
+      m_tbFunction(NULL)
+{
+    std::memset(m_values, 0, sizeof(m_values));
+    std::memset(m_memValuesPtr, 0, sizeof(m_memValuesPtr));
+    std::memset(m_globalsIdx, 0, sizeof(m_globalsIdx));
+    std::memset(m_labels, 0, sizeof(m_labels));
+
+#ifdef CONFIG_S2E
+    initializeHelpers();
+#endif
+}
+
 TCGLLVMContextPrivate::~TCGLLVMContextPrivate()
 {
+#ifdef CONFIG_S2E
+    disableBackgroundTranslation();
+#endif
+    delete m_translationCache;
     delete m_functionPassManager;
 
     // the following line will also delete
@@ -704,6 +828,26 @@ inline Value* TCGLLVMContextPrivate::generateQemuMemOp(bool ld,
 #endif // CONFIG_SOFTMMU
 }
 
+Function* TCGLLVMContextPrivate::getHelperFunction(
+        const std::string &helperName, FunctionType *type, void *address)
+{
+    std::string funcName = "helper_" + helperName;
+    Function* helperFunc = m_module->getFunction(funcName);
+    if(!helperFunc) {
+        helperFunc = Function::Create(type,
+                Function::PrivateLinkage, funcName, m_module);
+
+        /* Code generated in the background is not executed from
+           its own module */
+        if(m_executionEngine) {
+            m_executionEngine->addGlobalMapping(helperFunc, address);
+            /* XXX: Why do we need this ? */
+            sys::DynamicLibrary::AddSymbol(funcName, address);
+        }
+    }
+    return helperFunc;
+}
+
 void TCGLLVMContextPrivate::generateTraceCall(uintptr_t pc)
 {
 #ifdef CONFIG_S2E
@@ -779,17 +923,9 @@ int TCGLLVMContextPrivate::generateOperation(int opc, const TCGArg *args)
                                                              (void*) helperAddrC);
                 assert(helperName);
 
-                std::string funcName = std::string("helper_") + helperName;
-                Function* helperFunc = m_module->getFunction(funcName);
-                if(!helperFunc) {
-                    helperFunc = Function::Create(
-                            FunctionType::get(retType, argTypes, false),
-                            Function::PrivateLinkage, funcName, m_module);
-                    m_executionEngine->addGlobalMapping(helperFunc,
-                                                        (void*) helperAddrC);
-                    /* XXX: Why do we need this ? */
-                    sys::DynamicLibrary::AddSymbol(funcName, (void*) helperAddrC);
-                }
+                Function* helperFunc = getHelperFunction(helperName,
+                        FunctionType::get(retType, argTypes, false),
+                        (void*) helperAddrC);
 
                 result = m_builder.CreateCall(helperFunc,
                                               ArrayRef<Value*>(argValues));
@@ -1227,13 +1363,9 @@ int TCGLLVMContextPrivate::generateOperation(int opc, const TCGArg *args)
     return nb_args;
 }
 
-void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
+void TCGLLVMContextPrivate::generateFunction(uint64_t pc,
+                                             const std::string &name)
 {
-    /* Create new function for current translation block */
-    /* TODO: compute the checksum of the tb to see if we can reuse some code */
-    std::ostringstream fName;
-    fName << "tcg-llvm-tb-" << (m_tbCount++) << "-" << std::hex << tb->pc;
-
     /*
     if(m_tbFunction)
         m_tbFunction->eraseFromParent();
@@ -1243,20 +1375,18 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
             wordType(),
             std::vector<Type*>(1, intPtrType(64)), false);
     m_tbFunction = Function::Create(tbFunctionType,
-            Function::PrivateLinkage, fName.str(), m_module);
+            Function::PrivateLinkage, name, m_module);
     BasicBlock *basicBlock = BasicBlock::Create(m_context,
             "entry", m_tbFunction);
     m_builder.SetInsertPoint(basicBlock);
 
-    m_tcgContext = s;
-
     /* Prepare globals and temps information */
     initGlobalsAndLocalTemps();
 
     /* Generate code for each opc */
-    const TCGArg *args = gen_opparam_buf;
+    const TCGArg *args = m_opparamBuf;
     for(int opc_index=0; ;++opc_index) {
-        int opc = gen_opc_buf[opc_index];
+        int opc = m_opcBuf[opc_index];
 
         if(opc == INDEX_op_end)
             break;
@@ -1280,7 +1410,7 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
 #endif
         }
 
-        generateTraceCall(tb->pc);
+        generateTraceCall(pc);
         args += generateOperation(opc, args);
         //llvm::errs() << *m_tbFunction << "\n";
     }
@@ -1306,7 +1436,50 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
 
     //KLEE will optimize the function later
     //m_functionPassManager->run(*m_tbFunction);
+}
 
+void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
+{
+    m_tcgContext = s;
+    m_opcBuf = gen_opc_buf;
+    m_opparamBuf = gen_opparam_buf;
+
+    m_lastFunctionCacheable = m_translationCache &&
+                              computeCacheEntry(tb, m_lastCacheEntry);
+    translateFunction(tb, NULL);
+}
+
+/* Creates the function of the TB from the current TCG operations,
+   or from the result of its background translation if any */
+void TCGLLVMContextPrivate::translateFunction(TranslationBlock *tb,
+                                              TCGLLVMBackgroundJob *job)
+{
+    /* Create new function for current translation block */
+    std::ostringstream fName;
+    fName << "tcg-llvm-tb-" << (m_tbCount++) << "-" << std::hex << tb->pc;
+
+    m_tbFunction = NULL;
+    m_lastFunctionOrigin = GeneratedFunction;
+
+#ifdef CONFIG_S2E
+    if(job) {
+        m_tbFunction = loadBackgroundFunction(job, fName.str());
+        if(m_tbFunction)
+            m_lastFunctionOrigin = BackgroundFunction;
+    }
+#endif
+
+    /* Reuse the optimized code of a previous run if possible */
+    if(!m_tbFunction && m_lastFunctionCacheable) {
+        m_tbFunction = loadCachedFunction(m_lastCacheEntry, fName.str());
+        if(m_tbFunction)
+            m_lastFunctionOrigin = CachedFunction;
+    }
+
+    if(!m_tbFunction)
+        generateFunction(tb->pc, fName.str());
+
+    m_lastFunction = m_tbFunction;
     tb->llvm_function = m_tbFunction;
 
     if(execute_llvm || qemu_loglevel_mask(CPU_LOG_LLVM_ASM)) {
@@ -1330,6 +1503,618 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
     }
 }
 
+/* Returns the number of arguments of a TCG operation */
+static int getOperationArgCount(int opc, const TCGArg *args)
+{
+    const TCGOpDef &def = tcg_op_defs[opc];
+    if(opc == INDEX_op_call)
+        return (args[0] >> 16) + (args[0] & 0xffff) + def.nb_cargs + 1;
+    if(opc == INDEX_op_nopn)
+        return args[0];
+    return def.nb_args;
+}
+
+/* The code generated for a TB only depends on the TCG operations and temps,
+   except for a few run-specific immediates: the TB pointers returned to
+   cpu_exec for chaining and the data registered with tcg_llvm_add_reloc.
+   These are replaced in the key by the index of their first occurrence. */
+bool TCGLLVMContextPrivate::computeCacheEntry(TranslationBlock *tb,
+        TCGLLVMTranslationCache::Entry &entry)
+{
+    TCGContext *s = m_tcgContext;
+    if(s->nb_llvm_relocs > TCG_MAX_LLVM_RELOCS)
+        return false;
+
+    TCGLLVMTranslationCache::KeyBuilder key(TCG_LLVM_CACHE_VERSION);
+
+    /* The generated code embeds host addresses of the runtime and
+       inlined helpers, which change with every build */
+    key.add((uintptr_t) &tcg_llvm_runtime);
+    key.add(m_cacheBuildId[0]);
+    key.add(m_cacheBuildId[1]);
+
+    key.add(tb->pc);
+    key.add(tb->cs_base);
+    key.add(tb->flags);
+    key.add(tb->size);
+
+    key.add(s->nb_globals);
+    key.add(s->nb_temps);
+    for(int i=0; i<s->nb_temps; ++i) {
+        const TCGTemp &temp = s->temps[i];
+        key.add(temp.type);
+        key.add(temp.temp_local);
+        if(i < s->nb_globals) {
+            key.add(temp.fixed_reg);
+            if(temp.fixed_reg) {
+                key.add(temp.reg);
+            } else {
+                key.add(temp.mem_reg);
+                key.add(temp.mem_offset);
+            }
+        }
+    }
+
+    entry.relocations.clear();
+    const TCGArg *args = m_opparamBuf;
+    for(const uint16_t *opc = m_opcBuf; *opc != INDEX_op_end; ++opc) {
+        int nb_args = getOperationArgCount(*opc, args);
+        key.add(*opc);
+
+        for(int i=0; i<nb_args; ++i) {
+            uint64_t value = args[i];
+            bool isReloc;
+
+            if(*opc == INDEX_op_exit_tb) {
+                /* (tb | n) */
+                isReloc = value - (uintptr_t) tb < 4;
+            } else if((*opc == INDEX_op_movi_i32 ||
+                       *opc == INDEX_op_movi_i64) && i == 1) {
+                isReloc = std::find(s->llvm_relocs,
+                                    s->llvm_relocs + s->nb_llvm_relocs,
+                                    value) != s->llvm_relocs + s->nb_llvm_relocs;
+            } else {
+                key.add(value);
+                continue;
+            }
+
+            key.add(isReloc);
+            if(isReloc) {
+                unsigned index = std::find(entry.relocations.begin(),
+                        entry.relocations.end(), value) -
+                        entry.relocations.begin();
+                if(index == entry.relocations.size())
+                    entry.relocations.push_back(value);
+                key.add(index);
+            } else {
+                key.add(value);
+            }
+        }
+
+        args += nb_args;
+    }
+
+    key.get(entry.key);
+    return true;
+}
+
+/* Maps a declaration of a cached module to the current module */
+Function* TCGLLVMContextPrivate::resolveCachedDeclaration(Function *declaration)
+{
+    FunctionType *type = declaration->getFunctionType();
+    std::string name = declaration->getName();
+
+    Function *function = m_module->getFunction(name);
+    if(!function) {
+        if(declaration->getIntrinsicID()) {
+            function = Function::Create(type, Function::ExternalLinkage,
+                                        name, m_module);
+        } else if(name.compare(0, 7, "helper_") == 0) {
+            /* Helpers are only declared once generated code calls them */
+            TCGContext *s = m_tcgContext;
+            for(int i=0; i<s->nb_helpers; ++i) {
+                if(name.compare(7, std::string::npos, s->helpers[i].name) == 0) {
+                    function = getHelperFunction(s->helpers[i].name, type,
+                                                 (void*) s->helpers[i].func);
+                    break;
+                }
+            }
+        }
+    }
+
+    return function && function->getFunctionType() == type ? function : NULL;
+}
+
+/* Clones the function "tb" of a module created by the translation cache
+   into the current module. Takes ownership of the module. */
+Function* TCGLLVMContextPrivate::importFunction(Module *cached,
+                                                const std::string &name)
+{
+    Function *cachedFunction = cached->getFunction("tb");
+    ValueToValueMapTy vmap;
+    bool resolved = true;
+
+    for(Module::iterator it = cached->begin();
+            resolved && it != cached->end(); ++it) {
+        Function *f = it;
+        if(f != cachedFunction) {
+            vmap[f] = resolveCachedDeclaration(f);
+            resolved = vmap[f] != NULL;
+        }
+    }
+
+    for(Module::global_iterator it = cached->global_begin();
+            resolved && it != cached->global_end(); ++it) {
+        GlobalVariable *v = m_module->getNamedGlobal(it->getName());
+        vmap[it] = v;
+        resolved = v && v->getType() == it->getType();
+    }
+
+    if(!resolved) {
+        delete cached;
+        return NULL;
+    }
+
+    Function *function = Function::Create(cachedFunction->getFunctionType(),
+            Function::PrivateLinkage, name, m_module);
+
+    Function::arg_iterator dst = function->arg_begin();
+    for(Function::arg_iterator src = cachedFunction->arg_begin();
+            src != cachedFunction->arg_end(); ++src, ++dst)
+        vmap[src] = dst;
+
+    SmallVector<ReturnInst*, 4> returns;
+    CloneFunctionInto(function, cachedFunction, vmap, true, returns);
+    delete cached;
+
+#ifndef NDEBUG
+    verifyFunction(*function);
+#endif
+
+    return function;
+}
+
+Function* TCGLLVMContextPrivate::loadCachedFunction(
+        const TCGLLVMTranslationCache::Entry &entry, const std::string &name)
+{
+    std::vector<uint64_t> relocations;
+    Module *cached = m_translationCache->load(m_context, entry, relocations);
+    if(!cached)
+        return NULL;
+
+    Function *function = importFunction(cached, name);
+    if(function && !TCGLLVMTranslationCache::relocate(
+                function, relocations, entry.relocations)) {
+        /* Only functions that can be relocated are stored, but another
+           binary may have written the entry */
+        std::cerr << "Ignoring translation cache entry that cannot be "
+                     "relocated" << std::endl;
+        function->eraseFromParent();
+        return NULL;
+    }
+
+    return function;
+}
+
+bool TCGLLVMContextPrivate::cacheFunction(Function *function)
+{
+    if(function != m_lastFunction)
+        return false;
+
+    m_lastFunction = NULL;
+    if(!m_translationCache || m_lastFunctionOrigin == CachedFunction ||
+            !m_lastFunctionCacheable)
+        return false;
+
+    if(!m_translationCache->store(function, m_lastCacheEntry)) {
+        std::cerr << "Disabling the translation cache" << std::endl;
+        delete m_translationCache;
+        m_translationCache = NULL;
+    }
+
+    return true;
+}
+
+#ifdef CONFIG_S2E
+
+/****************************/
+/* Background translation */
+
+/* A TB queued for background translation. The TCG operations and temps
+   are copied when queuing it, the translation only reads this copy. */
+struct TCGLLVMBackgroundJob {
+    TranslationBlock *tb;
+    uint64_t pc;
+
+    /* Temps of the TB. The helpers of context point to helpers. */
+    TCGContext context;
+    std::vector<TCGHelperInfo> helpers;
+
+    std::vector<uint16_t> opcs;
+    std::vector<TCGArg> params;
+
+    bool cacheable;
+    TCGLLVMTranslationCache::Entry cacheEntry;
+
+    enum { Queued, Running, Done } status;
+
+    /* The TB was freed while the job was running */
+    bool discarded;
+
+    /* Position in the list of finished jobs */
+    std::list<TCGLLVMBackgroundJob*>::iterator finishedPos;
+
+    /* Bitcode of the optimized function, as written by the
+       translation cache, or empty if it could not be generated */
+    std::string bitcode;
+};
+
+/* Generates and optimizes the code of queued TBs in a thread of its own.
+   The thread has its own LLVMContext, the results are passed back as
+   bitcode and imported by the main thread when the TB first runs
+   symbolically. Finished jobs are kept until then, or until the TB is
+   freed, and the oldest ones are dropped to bound memory usage. */
+class TCGLLVMBackgroundTranslator {
+    LLVMContext m_context;
+    TCGLLVMContextPrivate *m_generator;
+    TCGLLVMFunctionOptimizer *m_optimizer;
+
+    QemuThread m_thread;
+    mutable QemuMutex m_mutex;
+    QemuCond m_queueCond;
+    QemuCond m_doneCond;
+    bool m_exit;
+
+    unsigned m_maxQueueSize;
+    std::deque<TCGLLVMBackgroundJob*> m_queue;
+    std::list<TCGLLVMBackgroundJob*> m_finished;
+    std::map<TranslationBlock*, TCGLLVMBackgroundJob*> m_jobs;
+
+    static void* threadMain(void *opaque);
+    void run();
+    void translate(TCGLLVMBackgroundJob *job);
+    void remove(TCGLLVMBackgroundJob *job);
+
+public:
+    TCGLLVMBackgroundTranslator(const std::string &declarations,
+            TCGLLVMFunctionOptimizer* (*createOptimizer)(Module*),
+            unsigned maxQueueSize);
+    ~TCGLLVMBackgroundTranslator();
+
+    unsigned getQueueSize() const;
+    bool canQueue(TranslationBlock *tb) const;
+    void queue(TCGLLVMBackgroundJob *job);
+    TCGLLVMBackgroundJob* take(TranslationBlock *tb);
+    void discard(TranslationBlock *tb);
+};
+
+/* The declarations module is parsed in the context of the thread,
+   as LLVM values cannot be shared between contexts */
+TCGLLVMBackgroundTranslator::TCGLLVMBackgroundTranslator(
+        const std::string &declarations,
+        TCGLLVMFunctionOptimizer* (*createOptimizer)(Module*),
+        unsigned maxQueueSize)
+    : m_exit(false), m_maxQueueSize(maxQueueSize)
+{
+    OwningPtr<MemoryBuffer> buffer(MemoryBuffer::getMemBuffer(
+            declarations, "tcg-llvm-background", false));
+
+    std::string error;
+    Module *module = ParseBitcodeFile(buffer.get(), m_context, &error);
+    if(!module) {
+        std::cerr << "Could not create background translation module: "
+                  << error << std::endl;
+        exit(1);
+    }
+
+    m_generator = new TCGLLVMContextPrivate(m_context, module);
+    m_optimizer = createOptimizer(module);
+
+    qemu_mutex_init(&m_mutex);
+    qemu_cond_init(&m_queueCond);
+    qemu_cond_init(&m_doneCond);
+    qemu_thread_create(&m_thread, threadMain, this, QEMU_THREAD_JOINABLE);
+}
+
+TCGLLVMBackgroundTranslator::~TCGLLVMBackgroundTranslator()
+{
+    qemu_mutex_lock(&m_mutex);
+    m_exit = true;
+    qemu_cond_signal(&m_queueCond);
+    qemu_mutex_unlock(&m_mutex);
+    qemu_thread_join(&m_thread);
+
+    for(std::map<TranslationBlock*, TCGLLVMBackgroundJob*>::iterator
+            it = m_jobs.begin(); it != m_jobs.end(); ++it)
+        delete it->second;
+
+    qemu_cond_destroy(&m_doneCond);
+    qemu_cond_destroy(&m_queueCond);
+    qemu_mutex_destroy(&m_mutex);
+
+    Module *module = m_generator->m_module;
+    delete m_optimizer;
+    delete m_generator;
+    delete module;
+}
+
+void* TCGLLVMBackgroundTranslator::threadMain(void *opaque)
+{
+    static_cast<TCGLLVMBackgroundTranslator*>(opaque)->run();
+    return NULL;
+}
+
+void TCGLLVMBackgroundTranslator::run()
+{
+    qemu_mutex_lock(&m_mutex);
+    while(!m_exit) {
+        if(m_queue.empty()) {
+            qemu_cond_wait(&m_queueCond, &m_mutex);
+            continue;
+        }
+
+        TCGLLVMBackgroundJob *job = m_queue.front();
+        m_queue.pop_front();
+        job->status = TCGLLVMBackgroundJob::Running;
+        qemu_mutex_unlock(&m_mutex);
+
+        translate(job);
+
+        qemu_mutex_lock(&m_mutex);
+        job->status = TCGLLVMBackgroundJob::Done;
+        if(job->discarded) {
+            delete job;
+        } else {
+            job->finishedPos = m_finished.insert(m_finished.end(), job);
+        }
+        qemu_cond_broadcast(&m_doneCond);
+    }
+    qemu_mutex_unlock(&m_mutex);
+}
+
+void TCGLLVMBackgroundTranslator::translate(TCGLLVMBackgroundJob *job)
+{
+    m_generator->m_tcgContext = &job->context;
+    m_generator->m_opcBuf = &job->opcs[0];
+    m_generator->m_opparamBuf = job->params.empty() ? NULL : &job->params[0];
+    m_generator->generateFunction(job->pc, "tb");
+
+    Function *function = m_generator->m_tbFunction;
+    m_optimizer->optimize(function);
+
+    OwningPtr<Module> module(TCGLLVMTranslationCache::extract(
+            function, job->cacheEntry.relocations));
+    if(module) {
+        raw_string_ostream out(job->bitcode);
+        WriteBitcodeToFile(module.get(), out);
+        out.flush();
+    }
+
+    function->eraseFromParent();
+    m_generator->m_tbFunction = NULL;
+}
+
+unsigned TCGLLVMBackgroundTranslator::getQueueSize() const
+{
+    qemu_mutex_lock(&m_mutex);
+    unsigned size = m_queue.size();
+    qemu_mutex_unlock(&m_mutex);
+    return size;
+}
+
+bool TCGLLVMBackgroundTranslator::canQueue(TranslationBlock *tb) const
+{
+    qemu_mutex_lock(&m_mutex);
+    bool result = m_queue.size() < m_maxQueueSize &&
+                  m_jobs.find(tb) == m_jobs.end();
+    qemu_mutex_unlock(&m_mutex);
+    return result;
+}
+
+/* Must be called with the mutex held, the job must not be running */
+void TCGLLVMBackgroundTranslator::remove(TCGLLVMBackgroundJob *job)
+{
+    m_jobs.erase(job->tb);
+    if(job->status == TCGLLVMBackgroundJob::Queued) {
+        m_queue.erase(std::find(m_queue.begin(), m_queue.end(), job));
+    } else {
+        assert(job->status == TCGLLVMBackgroundJob::Done);
+        m_finished.erase(job->finishedPos);
+    }
+}
+
+void TCGLLVMBackgroundTranslator::queue(TCGLLVMBackgroundJob *job)
+{
+    qemu_mutex_lock(&m_mutex);
+    assert(m_jobs.find(job->tb) == m_jobs.end());
+
+    /* Keep as many finished jobs as queued ones at most */
+    while(m_finished.size() >= m_maxQueueSize) {
+        TCGLLVMBackgroundJob *oldest = m_finished.front();
+        remove(oldest);
+        delete oldest;
+    }
+
+    job->status = TCGLLVMBackgroundJob::Queued;
+    job->discarded = false;
+    m_jobs[job->tb] = job;
+    m_queue.push_back(job);
+    qemu_cond_signal(&m_queueCond);
+    qemu_mutex_unlock(&m_mutex);
+}
+
+/* Returns the job of the TB, waiting for it if it is running */
+TCGLLVMBackgroundJob* TCGLLVMBackgroundTranslator::take(TranslationBlock *tb)
+{
+    qemu_mutex_lock(&m_mutex);
+    std::map<TranslationBlock*, TCGLLVMBackgroundJob*>::iterator it =
+            m_jobs.find(tb);
+    if(it == m_jobs.end()) {
+        qemu_mutex_unlock(&m_mutex);
+        return NULL;
+    }
+
+    TCGLLVMBackgroundJob *job = it->second;
+    while(job->status == TCGLLVMBackgroundJob::Running)
+        qemu_cond_wait(&m_doneCond, &m_mutex);
+
+    remove(job);
+    qemu_mutex_unlock(&m_mutex);
+    return job;
+}
+
+void TCGLLVMBackgroundTranslator::discard(TranslationBlock *tb)
+{
+    qemu_mutex_lock(&m_mutex);
+    std::map<TranslationBlock*, TCGLLVMBackgroundJob*>::iterator it =
+            m_jobs.find(tb);
+    if(it != m_jobs.end()) {
+        TCGLLVMBackgroundJob *job = it->second;
+        if(job->status == TCGLLVMBackgroundJob::Running) {
+            /* The thread deletes it when done */
+            m_jobs.erase(it);
+            job->discarded = true;
+        } else {
+            remove(job);
+            delete job;
+        }
+    }
+    qemu_mutex_unlock(&m_mutex);
+}
+
+void TCGLLVMContextPrivate::enableBackgroundTranslation(
+        TCGLLVMFunctionOptimizer* (*createOptimizer)(Module*),
+        unsigned maxQueueSize)
+{
+    disableBackgroundTranslation();
+
+    /* Declarations of the functions that generated code can call
+       without going through tcg_helper_get_name */
+    static const char *functions[] = {
+        "tcg_llvm_trace_instruction", "tcg_llvm_fork_and_concretize",
+        "__ldb_mmu", "__ldw_mmu", "__ldl_mmu", "__ldq_mmu",
+        "__stb_mmu", "__stw_mmu", "__stl_mmu", "__stq_mmu"
+    };
+
+    Module declarations("tcg-llvm-background", m_context);
+    declarations.setDataLayout(m_module->getDataLayout());
+    declarations.setTargetTriple(m_module->getTargetTriple());
+    for(unsigned i = 0; i < sizeof(functions) / sizeof(functions[0]); ++i) {
+        Function *f = m_module->getFunction(functions[i]);
+        if(f) {
+            Function::Create(f->getFunctionType(), Function::ExternalLinkage,
+                             f->getName(), &declarations);
+        }
+    }
+
+    std::string bitcode;
+    raw_string_ostream out(bitcode);
+    WriteBitcodeToFile(&declarations, out);
+    out.flush();
+
+    m_background = new TCGLLVMBackgroundTranslator(bitcode, createOptimizer,
+                                                   maxQueueSize);
+}
+
+void TCGLLVMContextPrivate::disableBackgroundTranslation()
+{
+    delete m_background;
+    m_background = NULL;
+}
+
+unsigned TCGLLVMContextPrivate::getBackgroundQueueSize() const
+{
+    return m_background ? m_background->getQueueSize() : 0;
+}
+
+void TCGLLVMContextPrivate::discardBackgroundCode(TranslationBlock *tb)
+{
+    if(m_background)
+        m_background->discard(tb);
+}
+
+bool TCGLLVMContextPrivate::canGenerateCodeInBackground(
+        TranslationBlock *tb) const
+{
+    return m_background && m_background->canQueue(tb);
+}
+
+void TCGLLVMContextPrivate::generateCodeInBackground(TCGContext *s,
+                                                     TranslationBlock *tb)
+{
+    TCGLLVMBackgroundJob *job = new TCGLLVMBackgroundJob;
+    job->tb = tb;
+    job->pc = tb->pc;
+
+    std::memcpy(&job->context, s, sizeof(*s));
+    job->context.temps = job->context.static_temps;
+    job->helpers.assign(s->helpers, s->helpers + s->nb_helpers);
+    job->context.helpers = job->helpers.empty() ? NULL : &job->helpers[0];
+    job->context.allocated_helpers = job->helpers.size();
+
+    const uint16_t *opcEnd = gen_opc_buf;
+    while(*opcEnd != INDEX_op_end)
+        ++opcEnd;
+    job->opcs.assign(gen_opc_buf, opcEnd + 1);
+    job->params.assign(gen_opparam_buf, gen_opparam_ptr);
+
+    m_tcgContext = s;
+    m_opcBuf = gen_opc_buf;
+    m_opparamBuf = gen_opparam_buf;
+    job->cacheable = m_translationCache &&
+                     computeCacheEntry(tb, job->cacheEntry);
+
+    m_background->queue(job);
+}
+
+bool TCGLLVMContextPrivate::generateCodeFromBackground(TCGContext *s,
+                                                       TranslationBlock *tb)
+{
+    TCGLLVMBackgroundJob *job = m_background ? m_background->take(tb) : NULL;
+    if(!job)
+        return false;
+
+    /* If the job did not run, translate its copy of the TCG operations */
+    m_tcgContext = &job->context;
+    m_opcBuf = &job->opcs[0];
+    m_opparamBuf = job->params.empty() ? NULL : &job->params[0];
+    m_lastFunctionCacheable = job->cacheable;
+    m_lastCacheEntry = job->cacheEntry;
+
+    translateFunction(tb, job);
+
+    m_tcgContext = s;
+    m_opcBuf = NULL;
+    m_opparamBuf = NULL;
+    delete job;
+    return true;
+}
+
+Function* TCGLLVMContextPrivate::loadBackgroundFunction(
+        TCGLLVMBackgroundJob *job, const std::string &name)
+{
+    if(job->bitcode.empty())
+        return NULL;
+
+    OwningPtr<MemoryBuffer> buffer(MemoryBuffer::getMemBuffer(
+            job->bitcode, "tcg-llvm-background", false));
+
+    std::vector<uint64_t> relocations;
+    std::string error;
+    Module *module = TCGLLVMTranslationCache::parse(buffer.get(), m_context,
+            job->cacheEntry.relocations.size(), relocations, error);
+    if(!module) {
+        std::cerr << "Ignoring background translation of TB at 0x"
+                  << std::hex << job->pc << std::dec << ": "
+                  << error << std::endl;
+        return NULL;
+    }
+
+    return importFunction(module, name);
+}
+
+#endif
+
 /***********************************/
 /* External interface for C++ code */
 
@@ -1368,6 +2153,22 @@ ExecutionEngine* TCGLLVMContext::getExecutionEngine()
     return m_private->m_executionEngine;
 }
 
+void TCGLLVMContext::enableTranslationCache(const std::string &directory,
+                                            const std::string &helperBitcode)
+{
+    m_private->enableTranslationCache(directory, helperBitcode);
+}
+
+bool TCGLLVMContext::isCachedFunction(llvm::Function *function) const
+{
+    return m_private->isCachedFunction(function);
+}
+
+bool TCGLLVMContext::cacheFunction(llvm::Function *function)
+{
+    return m_private->cacheFunction(function);
+}
+
 #ifdef CONFIG_S2E
 void TCGLLVMContext::initializeHelpers()
 {
@@ -1375,6 +2176,59 @@ void TCGLLVMContext::initializeHelpers()
 }
 #endif
 
+#ifdef CONFIG_S2E
+void TCGLLVMContext::enableBackgroundTranslation(
+        TCGLLVMFunctionOptimizer* (*createOptimizer)(llvm::Module*),
+        unsigned maxQueueSize)
+{
+    m_private->enableBackgroundTranslation(createOptimizer, maxQueueSize);
+}
+
+void TCGLLVMContext::disableBackgroundTranslation()
+{
+    m_private->disableBackgroundTranslation();
+}
+
+bool TCGLLVMContext::isBackgroundFunction(llvm::Function *function) const
+{
+    return m_private->isBackgroundFunction(function);
+}
+
+unsigned TCGLLVMContext::getBackgroundQueueSize() const
+{
+    return m_private->getBackgroundQueueSize();
+}
+
+void TCGLLVMContext::discardBackgroundCode(TranslationBlock *tb)
+{
+    m_private->discardBackgroundCode(tb);
+}
+
+bool TCGLLVMContext::canGenerateCodeInBackground(TranslationBlock *tb) const
+{
+    return m_private->canGenerateCodeInBackground(tb);
+}
+
+void TCGLLVMContext::generateCodeInBackground(TCGContext *s,
+                                              TranslationBlock *tb)
+{
+    m_private->generateCodeInBackground(s, tb);
+}
+
+bool TCGLLVMContext::generateCodeFromBackground(TCGContext *s,
+                                                TranslationBlock *tb)
+{
+    assert(tb->tcg_llvm_context == NULL);
+    assert(tb->llvm_function == NULL);
+
+    if(!m_private->generateCodeFromBackground(s, tb))
+        return false;
+
+    tb->tcg_llvm_context = this;
+    return true;
+}
+#endif
+
 void TCGLLVMContext::generateCode(TCGContext *s, TranslationBlock *tb)
 {
     assert(tb->tcg_llvm_context == NULL);
@@ -1406,6 +2260,25 @@ void tcg_llvm_gen_code(TCGLLVMContext *l, TCGContext *s, TranslationBlock *tb)
     l->generateCode(s, tb);
 }
 
+#ifdef CONFIG_S2E
+int tcg_llvm_can_gen_code_background(TCGLLVMContext *l, TranslationBlock *tb)
+{
+    return l->canGenerateCodeInBackground(tb);
+}
+
+void tcg_llvm_gen_code_background(TCGLLVMContext *l, TCGContext *s,
+                                  TranslationBlock *tb)
+{
+    l->generateCodeInBackground(s, tb);
+}
+
+int tcg_llvm_gen_code_from_background(TCGLLVMContext *l, TCGContext *s,
+                                      TranslationBlock *tb)
+{
+    return l->generateCodeFromBackground(s, tb);
+}
+#endif
+
 void tcg_llvm_tb_alloc(TranslationBlock *tb)
 {
     tb->tcg_llvm_context = NULL;
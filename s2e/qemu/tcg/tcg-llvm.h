@@ -90,12 +90,27 @@ uintptr_t tcg_llvm_qemu_tb_exec(void *env, TranslationBlock *tb);
 int tcg_llvm_search_last_pc(struct TranslationBlock *tb, uintptr_t searched_pc);
 #endif
 
+#ifdef CONFIG_S2E
+/* Generation of LLVM code in a background thread, see
+   TCGLLVMContext::enableBackgroundTranslation */
+int tcg_llvm_can_gen_code_background(struct TCGLLVMContext *l,
+                                     struct TranslationBlock *tb);
+void tcg_llvm_gen_code_background(struct TCGLLVMContext *l,
+                                  struct TCGContext *s,
+                                  struct TranslationBlock *tb);
+int tcg_llvm_gen_code_from_background(struct TCGLLVMContext *l,
+                                      struct TCGContext *s,
+                                      struct TranslationBlock *tb);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
 
 #ifdef __cplusplus
 
+#include <string>
+
 /***********************************/
 /* External interface for C++ code */
 
@@ -108,6 +123,14 @@ namespace llvm {
     class FunctionPassManager;
 }
 
+/** Optimizes the functions of one module */
+class TCGLLVMFunctionOptimizer
+{
+public:
+    virtual ~TCGLLVMFunctionOptimizer() {}
+    virtual void optimize(llvm::Function *function) = 0;
+};
+
 class TCGLLVMContextPrivate;
 class TCGLLVMContext
 {
@@ -128,9 +151,50 @@ public:
     void deleteExecutionEngine();
     llvm::FunctionPassManager* getFunctionPassManager() const;
 
+    /** Reuses the optimized code of translation blocks stored in the
+        given directory and stores the code of new ones there. Entries
+        are only shared with runs of the same binary and helper bitcode. */
+    void enableTranslationCache(const std::string &directory,
+                                const std::string &helperBitcode);
+
+    /** Returns true if the last generated function was loaded from
+        the translation cache, i.e., is already optimized */
+    bool isCachedFunction(llvm::Function *function) const;
+
+    /** Stores the last generated function in the translation cache once
+        it is optimized. Returns false if it was not a cache miss. */
+    bool cacheFunction(llvm::Function *function);
+
 #ifdef CONFIG_S2E
     /** Called after linking all helper libraries */
     void initializeHelpers();
+
+    /** Generates and optimizes the code of the TBs passed to
+        tcg_llvm_gen_code_background() in a separate thread and LLVM
+        context. createOptimizer is called once with the module of that
+        context. At most maxQueueSize TBs wait for translation. */
+    void enableBackgroundTranslation(
+            TCGLLVMFunctionOptimizer* (*createOptimizer)(llvm::Module*),
+            unsigned maxQueueSize);
+
+    /** Stops the background thread, dropping the queued TBs */
+    void disableBackgroundTranslation();
+
+    /** Returns true if the last generated function was translated
+        in the background, i.e., is already optimized */
+    bool isBackgroundFunction(llvm::Function *function) const;
+
+    /** Number of TBs waiting for background translation */
+    unsigned getBackgroundQueueSize() const;
+
+    /** Drops the background translation of a TB that is freed */
+    void discardBackgroundCode(struct TranslationBlock *tb);
+
+    bool canGenerateCodeInBackground(struct TranslationBlock *tb) const;
+    void generateCodeInBackground(struct TCGContext *s,
+                                  struct TranslationBlock *tb);
+    bool generateCodeFromBackground(struct TCGContext *s,
+                                    struct TranslationBlock *tb);
 #endif
 
     void generateCode(struct TCGContext *s,
@@ -287,6 +287,9 @@ void tcg_func_start(TCGContext *s)
     s->labels = tcg_malloc(sizeof(TCGLabel) * TCG_MAX_LABELS);
     s->nb_labels = 0;
     s->current_frame_offset = s->frame_start;
+#ifdef CONFIG_LLVM
+    s->nb_llvm_relocs = 0;
+#endif
 
     gen_opc_ptr = gen_opc_buf;
     gen_opparam_ptr = gen_opparam_buf;
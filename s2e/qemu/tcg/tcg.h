@@ -159,6 +159,10 @@ typedef struct TCGPool {
 
 #define TCG_MAX_TEMPS 512
 
+#ifdef CONFIG_LLVM
+#define TCG_MAX_LLVM_RELOCS 256
+#endif
+
 /* when the size of the arguments of a called function is smaller than
    this value, they are statically allocated in the TB stack frame */
 #define TCG_STATIC_CALL_ARGS_SIZE 128
@@ -385,6 +389,12 @@ struct TCGContext {
     int allocated_helpers;
     int helpers_sorted;
 
+#ifdef CONFIG_LLVM
+    /* Immediates of the current TB that are only valid in this run */
+    uint64_t llvm_relocs[TCG_MAX_LLVM_RELOCS];
+    int nb_llvm_relocs;
+#endif
+
 #ifdef CONFIG_PROFILER
     /* profiling info */
     int64_t tb_count1;
@@ -439,6 +449,18 @@ void tcg_context_init(TCGContext *s);
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
 
+#ifdef CONFIG_LLVM
+/* Marks an immediate of the TB being translated as only valid in this run
+   (e.g., a pointer to instrumentation data). The LLVM translation cache
+   does not key on such immediates and patches them in the code it reuses. */
+static inline void tcg_llvm_add_reloc(TCGContext *s, uint64_t value)
+{
+    if (s->nb_llvm_relocs < TCG_MAX_LLVM_RELOCS)
+        s->llvm_relocs[s->nb_llvm_relocs] = value;
+    s->nb_llvm_relocs++;
+}
+#endif
+
 int tcg_gen_code(TCGContext *s, uint8_t *gen_code_buf);
 int tcg_gen_code_search_pc(TCGContext *s, uint8_t *gen_code_buf, long offset);
 
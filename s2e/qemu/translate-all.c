@@ -235,9 +235,12 @@ int cpu_gen_llvm(CPUArchState *env, TranslationBlock *tb)
     TCGContext *s = &tcg_ctx;
     assert(tb->llvm_function == NULL);
 
-    tcg_func_start(s);
-    gen_intermediate_code_pc(env, tb);
-    tcg_llvm_gen_code(tcg_llvm_ctx, s, tb);
+    /* Reuse the TCG operations of a background translation if any */
+    if (!tcg_llvm_gen_code_from_background(tcg_llvm_ctx, s, tb)) {
+        tcg_func_start(s);
+        gen_intermediate_code_pc(env, tb);
+        tcg_llvm_gen_code(tcg_llvm_ctx, s, tb);
+    }
     s2e_set_tb_function(g_s2e, tb);
 
     if(qemu_loglevel_mask(CPU_LOG_LLVM_ASM) && tb->llvm_tc_ptr) {
@@ -252,4 +255,24 @@ int cpu_gen_llvm(CPUArchState *env, TranslationBlock *tb)
     return 0;
 }
 
+/** Queues an already translated TB for LLVM code generation in the
+    background. Returns -1 if the TB was not queued. */
+int cpu_gen_llvm_background(CPUArchState *env, TranslationBlock *tb)
+{
+    TCGContext *s = &tcg_ctx;
+
+    /* Translating the TB again must not fault */
+    if (tb->llvm_function ||
+        !tcg_llvm_can_gen_code_background(tcg_llvm_ctx, tb) ||
+        !tb_code_in_tlb(env, tb)) {
+        return -1;
+    }
+
+    tcg_func_start(s);
+    gen_intermediate_code_pc(env, tb);
+    tcg_llvm_gen_code_background(tcg_llvm_ctx, s, tb);
+
+    return 0;
+}
+
 #endif